@@ -13,8 +13,16 @@
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <cairo/cairo-svg.h>
 
+#if defined(__GNUC__) && defined(__x86_64__)
+	#define PX_HAVE_X86 1
+	#include <immintrin.h>
+#else
+	#define PX_HAVE_X86 0
+#endif
+
 #define DRAW_WITH_XLIB 1
 
 #if DRAW_WITH_XLIB
@@ -153,15 +161,186 @@ typedef struct legend_t {
 	box_size_t size;
 } legend_t;
 
+/* Level-of-detail pyramid of min/max summaries for a trace.
+ * Level 0 buckets summarize LOD_BASE consecutive ring-buffer slots, and
+ * each higher level summarizes LOD_FANOUT buckets of the level below.
+ * Buckets are indexed by physical slot, so a write only affects the
+ * buckets above that slot.  Writes just extend the dirty slot range;
+ * lod_sync() folds it into the pyramid before anybody reads it.
+ */
+#define LOD_BASE          32
+#define LOD_FANOUT        8
+#define LOD_MAX_LEVELS    12
+#define LOD_MIN_CAPACITY  4096
+
+typedef struct lod_bucket_t {
+	double x_min;
+	double x_max;
+	double y_min;
+	double y_max;
+	double y_first;
+	double y_last;
+} lod_bucket_t;
+
+typedef struct lod_t {
+	int num_levels;
+	int bucket_size[LOD_MAX_LEVELS];
+	int num_buckets[LOD_MAX_LEVELS];
+	lod_bucket_t *buckets[LOD_MAX_LEVELS];
+	int dirty_start;
+	int dirty_count;
+} lod_t;
+
+/* Running extrema of a trace.  Traces that own their data keep a
+ * monotonic deque of ring-buffer slots per axis and direction, so the
+ * extremes of the current window are updated in O(1) amortized time as
+ * samples are appended and evicted.  Traces using external data just
+ * remember the extremes found by jbplot_trace_set_data().
+ */
+typedef enum {
+	EXTREMA_SCAN,
+	EXTREMA_SNAPSHOT,
+	EXTREMA_DEQUE
+} extrema_mode_t;
+
+enum {
+	EXT_X_MIN,
+	EXT_X_MAX,
+	EXT_Y_MIN,
+	EXT_Y_MAX,
+	EXT_NUM_DEQUES
+};
+
+typedef struct mono_deque_t {
+	int *slots;
+	int size;
+	int head;
+	int count;
+} mono_deque_t;
+
+typedef struct extrema_t {
+	extrema_mode_t mode;
+	mono_deque_t dq[EXT_NUM_DEQUES];
+	double x_min;
+	double x_max;
+	double y_min;
+	double y_max;
+} extrema_t;
+
+/* Storage for one axis of a trace.  Sample n lives stride bytes after
+ * sample n-1, so a column can view one field of an interleaved record
+ * buffer.  Values read back as gain * raw + offset; for the integer types
+ * the most negative value stands for a missing (NaN) sample.  Double
+ * columns are never scaled. */
+typedef struct sample_col_t {
+	void *data;
+	sample_type_t type;
+	int stride;
+	double gain;
+	double offset;
+} sample_col_t;
+
+/* Single-producer/single-consumer staging ring between an acquisition
+ * thread and the GTK thread.  head and tail are free-running counters,
+ * and size a power of two so that they stay in step with the slots
+ * (& (size - 1)) when they wrap; the producer publishes head with a
+ * release store after writing the samples, the consumer publishes tail
+ * the same way after reading them. */
+typedef struct trace_feed_t {
+	double *x;
+	double *y;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+} trace_feed_t;
+
+/* Uniform pixel-space grid over the samples of a trace, used to find the
+ * sample nearest the pointer.  Built lazily and kept until the data or
+ * the data-to-pixel transform changes. */
+#define SNAP_CELL_PX 16
+#define SNAP_MIN_SAMPLES 4096
+typedef struct snap_grid_t {
+	unsigned int data_gen;
+	double x_m, x_b, y_m, y_b;
+	double left, top;
+	int cols;
+	int rows;
+	int *cell_start;  // cols * rows + 1 offsets into slots
+	int *slots;
+} snap_grid_t;
+
+/* Per-pixel sample counts of a trace drawn in density mode, binned over
+ * a box of pixels with the transform of the frame.  They are kept and
+ * topped up with appended samples until the transform, the box or the
+ * data (other than by appending) changes. */
+typedef struct density_t {
+	int mode; // density_mode_t
+	char valid;
+	guint32 *counts;
+	int size;
+	int left, top, width, height;
+	double x_m, x_b, y_m, y_b;
+	unsigned int edit_gen;
+	long long first_seq; // oldest sample held when they were binned
+	long long end_seq;   // one past the newest sample binned
+	unsigned int counts_gen; // bumped whenever the counts change
+	/* the counts shaded in the marker color, for the cairo renderer */
+	cairo_surface_t *image;
+	unsigned int image_gen;
+	int image_mode;
+	rgb_color_t image_color;
+#if DRAW_WITH_XLIB
+	XPoint *points;
+	int num_points;
+#endif
+} density_t;
+
+/* A trace's marker rendered once for stamping into image surfaces:
+ * premultiplied ARGB images of it centered at SPRITE_PHASES x
+ * SPRITE_PHASES sub-pixel offsets.  They are kept until the marker
+ * props or the antialias mode change.  For Xlib, the runs of pixels a
+ * circle marker covers. */
+#define SPRITE_PHASES 4
+#define SPRITE_MAX_SIZE 32
+typedef struct sprite_t {
+	char valid;
+	int type;
+	double size;
+	rgb_color_t color;
+	char antialias;
+	int width;  // of each image, which is square
+	int center; // pixel of each image the marker is centered in
+	guint32 *pixels;
+#if DRAW_WITH_XLIB
+	char spans_valid;
+	double span_size;
+	XRectangle *spans; // relative to the marker's center pixel
+	int num_spans;
+#endif
+} sprite_t;
+
 #define MAX_TRACE_NAME_LENGTH 255
 typedef struct trace_t {
-  double *x_data;
-  double *y_data;
+	sample_col_t x_col;
+	sample_col_t y_col;
   int capacity;
   int length;
   int start_index;
   int end_index;
   int is_data_owner;
+	char x_monotonic;
+	char x_uniform;    // x is x0 + k * dx for the k-th sample ever added; no x_col data
+	double x0;
+	double dx;
+	long long first_seq; // k of the oldest sample held
+	unsigned int data_gen; // bumped whenever the samples change
+	unsigned int edit_gen; // bumped when they change other than by appending, or the style changes
+	trace_feed_t *feed;
+	snap_grid_t *snap;
+	density_t *density;
+	sprite_t *sprite;
+	lod_t lod;
+	extrema_t ext;
 	double line_width;
 	int line_type;
 	rgb_color_t line_color;
@@ -173,6 +352,133 @@ typedef struct trace_t {
 	int lossless_decimation;
 } trace_t;
 
+/* One column of a trace envelope in pixel coordinates.  A raw sample
+ * has lo == hi == first == last; a pyramid bucket spans [lo, hi]. */
+typedef struct env_pt_t {
+	double x_first;
+	double x_last;
+	double y_first;
+	double y_last;
+	double y_lo;
+	double y_hi;
+	char gap;
+} env_pt_t;
+
+#define RENDER_CHUNK 256
+#define MARKER_BATCH 1024 // markers added to the path before it's painted
+
+/* interactive drafts, see jbplot_set_interactive_quality() */
+#define DRAFT_LOD_COARSEN 4         // pyramid buckets per draft column, in pixels
+#define DRAFT_SAMPLES     250000    // raw samples a draft starts out allowed
+#define DRAFT_MIN_SAMPLES 20000
+#define DRAFT_MAX_SAMPLES 20000000
+#define DRAFT_BUDGET_MS   16        // when the frame scheduler has no budget
+#define DRAFT_SETTLE_MS   200
+
+/* progressive rendering, see jbplot_set_progressive() */
+#define PROGRESS_FRAMES   4   // frames over this many drafts' worth of samples are refined
+#define PROGRESS_JOBS     16  // pieces the refinement is cut into
+#define PROGRESS_SLICE_MS 8
+
+/* the render worker, see jbplot_set_render_worker() */
+#define SNAPSHOT_MAX_BYTES (128 << 20) // bigger refinements stay on the GTK thread
+#define WORKER_POLL_MS     5           // how often the GTK thread looks for a finished frame
+
+/* the frame cache, see jbplot_set_frame_cache() */
+#define FRAME_CACHE_ENTRIES 16
+#define FRAME_CACHE_BYTES   (32 << 20)
+
+/* pan tiles, see jbplot_set_pan_tiles() */
+#define TILE_SIZE 256 // pixels on a side
+#define TILE_MAX  96  // tiles kept at once
+
+/* classes of a point in pixel coordinates */
+#define PX_IN  0
+#define PX_OUT 1
+#define PX_NAN 2
+#define PX_DUP 3 // dropped by px_dedup(): drawing it wouldn't change a pixel
+
+/* what px_dedup() drops */
+#define DEDUP_NONE    0
+#define DEDUP_MARKERS 1
+#define DEDUP_RUNS    2
+#define DEDUP_MAX_CELLS (1 << 26)
+
+#if DRAW_WITH_XLIB
+/* Xlib primitives collected by the trace renderer so they go out in as few
+ * requests as the server allows.  Segments are clipped to the box as they
+ * are added, which also keeps them within the 16-bit protocol coordinates.
+ */
+typedef struct xbatch_t {
+	Display *display;
+	Drawable d;
+	GC gc;
+	double clip_x0, clip_y0, clip_x1, clip_y1;
+	XSegment *segs;
+	int num_segs;
+	int max_segs;
+	XPoint *pts;
+	int num_pts;
+	int max_pts;
+	XArc *arcs;
+	int num_arcs;
+	int max_arcs;
+	XRectangle *rects;
+	int num_rects;
+	int max_rects;
+} xbatch_t;
+#endif
+
+/* scratch buffers reused from frame to frame by the trace renderer */
+typedef struct render_scratch_t {
+	env_pt_t *env;
+	int env_size;
+	int env_length;
+	double x_px[RENDER_CHUNK];
+	double y_px[RENDER_CHUNK];
+	unsigned char cls[RENDER_CHUNK]; // PX_IN, PX_OUT, PX_NAN or PX_DUP
+	double bounds[4];                // x min, x max, y min, y max for cls
+	/* deduplication of the converted samples, see px_dedup() */
+	int dedup;                       // DEDUP_NONE, DEDUP_MARKERS or DEDUP_RUNS
+	double dedup_q, dedup_off;       // cells are floor(px * q + off)
+	double dedup_box[4];             // runs are only collapsed inside
+	int dedup_col0, dedup_row0, dedup_cols, dedup_rows;
+	guint32 *occupied;               // a bit per cell
+	int occupied_size;
+#if DRAW_WITH_XLIB
+	xbatch_t xb;
+#endif
+} render_scratch_t;
+
+/* Direct view of the pixels of an ARGB32 image surface, used when
+ * antialiasing is off to write 1-px solid lines and point/square markers
+ * straight into the buffer instead of going through cairo's rasteriser.
+ * Coordinates are user space, which may be offset from the surface by a
+ * whole-pixel translation.  The clip box is in whole pixels, inclusive;
+ * lines are cut to the guard box before they are walked.
+ */
+typedef struct raster_t {
+	cairo_surface_t *surface;
+	guint32 *data;
+	int stride; // in pixels
+	int width;
+	int height;
+	int ox, oy; // surface pixel = user pixel + (ox, oy)
+	int origin; // index in data of user pixel (0, 0)
+	int x0, y0, x1, y1;
+	double gx0, gy0, gx1, gy1;
+	guint32 color;
+} raster_t;
+
+/* Where the trace renderer's lines go: the cairo path, or straight into
+ * the pixels if r is set */
+typedef struct pen_t {
+	cairo_t *cr;
+	raster_t *r;
+	double x;
+	double y;
+} pen_t;
+
 typedef struct cursor_t {
 	int type;
 	rgb_color_t color;
@@ -200,6 +506,335 @@ typedef struct plot_t {
 	cursor_t cursor;
 } plot_t;
 
+/* What the chrome draws of an axis: its range, the tics in use, what's
+ * shown and how it looks.  The tic values past num_tics stay zero. */
+typedef struct chrome_axis_key_t {
+	double min_val;
+	double max_val;
+	int num_tics;
+	double tic_values[MAX_NUM_MAJOR_TICS];
+	char do_show_axis_label;
+	char do_show_tic_labels;
+	char do_show_major_gridlines;
+	char do_show_minor_gridlines;
+	char do_manual_tics;
+	char log_scale;
+	int num_minor_tics_per_major;
+	double axis_label_font_size;
+	double tic_label_font_size;
+	double major_gridline_width;
+	rgb_color_t major_gridline_color;
+	int major_gridline_type;
+} chrome_axis_key_t;
+
+/* Everything the chrome (background, title, legend, tic labels, gridlines,
+ * axis labels and border) is drawn from, as plain values so that keys
+ * can be compared with memcmp().  The text is folded in as a hash.
+ */
+typedef struct chrome_key_t {
+	double width;
+	double height;
+	char antialias;
+	rgb_color_t bg_color;
+	/* the plot area; the edges and ideal margins are the layout */
+	double left_edge;
+	double right_edge;
+	double top_edge;
+	double bottom_edge;
+	double ideal_left_margin;
+	double ideal_right_margin;
+	int LR_margin_mode;
+	double lmargin;
+	double rmargin;
+	char do_show_bounding_box;
+	double bounding_box_width;
+	rgb_color_t plot_bg_color;
+	rgb_color_t border_color;
+	/* the legend; its size is the layout */
+	int legend_position;
+	double legend_font_size;
+	char legend_do_show_bounding_box;
+	double legend_bounding_box_width;
+	rgb_color_t legend_bg_color;
+	rgb_color_t legend_border_color;
+	double legend_width;
+	double legend_height;
+	chrome_axis_key_t x_axis;
+	chrome_axis_key_t y_axis;
+	char do_show_plot_title;
+	double plot_title_font_size;
+	guint64 text_hash;
+} chrome_key_t;
+
+/* The traces a frame was drawn from, down to the last edit */
+typedef struct frame_traces_t {
+	int num_traces;
+	trace_t *traces[MAX_NUM_TRACES];
+	unsigned int data_gen[MAX_NUM_TRACES];
+	unsigned int edit_gen[MAX_NUM_TRACES];
+} frame_traces_t;
+
+/* Everything a frame is drawn from: the chrome key, less the layout the
+ * chrome works out, and the traces */
+typedef struct frame_key_t {
+	chrome_key_t chrome;
+	frame_traces_t traces;
+} frame_key_t;
+
+/* What drawing the chrome of a frame leaves in priv */
+typedef struct frame_layout_t {
+	plot_area_t plot_area;
+	double x_m, x_b, y_m, y_b;
+} frame_layout_t;
+
+typedef struct frame_entry_t {
+	frame_key_t key;
+	frame_layout_t layout;
+	double width, height;
+	size_t bytes;
+	guint64 last_used;
+#if DRAW_WITH_XLIB
+	Pixmap pixmap;
+#else
+	cairo_surface_t *buffer;
+#endif
+} frame_entry_t;
+
+/* Full quality frames of views shown before, so going back to one (undo,
+ * zoom all, flipping between views) is a copy.  A frame goes in when the
+ * view moves away from it, as long as the traces haven't changed since;
+ * entries are dropped least recently used first to stay within max_bytes,
+ * and as soon as the traces change.
+ */
+typedef struct frame_cache_t {
+	frame_entry_t entries[FRAME_CACHE_ENTRIES];
+	int num_entries;
+	size_t bytes;
+	size_t max_bytes;
+	guint64 clock;
+	frame_key_t shown_key;       // the frame in the widget's buffer
+	frame_layout_t shown_layout;
+	gboolean shown_valid;        // it's there, at full quality
+} frame_cache_t;
+
+typedef struct tile_t {
+	int col, row;
+	guint64 last_used;
+#if DRAW_WITH_XLIB
+	Pixmap pixmap;
+	Pixmap mask;
+#else
+	cairo_surface_t *buffer;
+#endif
+} tile_t;
+
+/* The data layer cut into squares while a pan goes on.  Tile (col, row)
+ * covers pixels [col, col + 1) * TILE_SIZE by [row, row + 1) * TILE_SIZE
+ * of the transform the tiles were started at (x_b, y_b); a pan frame is
+ * the tiles in view laid over the chrome, moved by whole pixels.  Tiles
+ * around the view are drawn ahead from idle callbacks, those the view is
+ * heading for first.  A change of scale or of any trace drops them all.
+ */
+typedef struct tile_cache_t {
+	char valid;
+	double x_m, x_b, y_m, y_b;
+	char antialias;
+	frame_traces_t traces;
+	tile_t tiles[TILE_MAX];
+	int num_tiles;
+	guint64 clock;               // counts pan frames
+	int shift_x, shift_y;        // of the last pan frame from x_b, y_b
+	int col0, col1, row0, row1;  // the tiles it showed
+	int dir_x, dir_y;            // which way the view was going
+	guint idle;                  // prefetch callback
+} tile_cache_t;
+
+/* The data layer of the frame shown when a burst of wheel notches began,
+ * stretched to each new view until the exact frame, refined in the
+ * background, takes its place.  Pixels the frame
+ * has in common with the chrome layer it was drawn on are left out, so a
+ * preview is the new chrome with the old data scaled over it.
+ */
+typedef struct wheel_preview_t {
+	char active;
+	double x_m, x_b, y_m, y_b;       // the transform the copy was drawn with
+	int left, top, width, height;    // the part of the frame it was taken from
+#if DRAW_WITH_XLIB
+	XImage *image;
+	char *mask;                      // 1 where the image has data
+#else
+	cairo_surface_t *buffer;         // transparent where there's no data
+#endif
+	guint timer;                     // runs out settle_ms after the last notch
+} wheel_preview_t;
+
+/* What one pass of the trace renderer covers: samples with x in
+ * [x_lo, x_hi] drawn with the given data-to-pixel transform, the lines
+ * clipped to the plot area rows and to columns [clip_left, clip_right].
+ */
+typedef struct trace_pass_t {
+	double x_lo;
+	double x_hi;
+	double x_m, x_b, y_m, y_b;
+	double clip_left;
+	double clip_right;
+	char clip_markers; // clip the markers to columns [mark_left, mark_right]
+	double mark_left;
+	double mark_right;
+	char raw;          // draw every sample; the caller ruled out the pyramid
+	char mono;         // Xlib mask pass: leave the foreground alone
+	char draft;        // interactive preview: coarse, see pass_pick_level()
+	int draft_samples; // and at most about this many raw samples per trace
+} trace_pass_t;
+
+/* The data layer used in scroll mode, and what it was drawn from.  Its
+ * x_b is snapped so that the layer only ever moves by whole pixels; the
+ * per-trace records say how far into each trace it has been drawn.
+ */
+typedef struct scroll_layer_t {
+	char valid;
+	int width;
+	int height;
+	double left, right, top, bottom;
+	double x_m, x_b, y_m, y_b;
+	int num_traces;
+	struct trace_t *traces[MAX_NUM_TRACES];
+	unsigned int edit_gen[MAX_NUM_TRACES];
+	double first_x[MAX_NUM_TRACES];
+	double last_x[MAX_NUM_TRACES];
+} scroll_layer_t;
+
+/* State of the frame scheduler behind jbplot_refresh() */
+typedef struct frame_sched_t {
+	double max_fps;     // 0 draws on every refresh
+	double budget_ms;
+	char pending;       // a refresh is waiting for its frame
+	guint timer;        // source that will start the frame, or 0
+	GTimeVal start;     // when the last frame started
+	GTimeVal next_due;  // the earliest the next one may start
+	jbplot_frame_stats_t stats;
+} frame_sched_t;
+
+#define MAX_RENDER_THREADS 32
+#define MAX_RENDER_JOBS    64
+
+/* What the trace renderers read of the plot.  It normally points
+ * into the widget, but a render off the GTK thread gets a copy whose
+ * traces hold their own samples (see render_snapshot_t).
+ */
+typedef struct render_view_t {
+	trace_t **traces;
+	plot_area_t pa;
+	double x_min, x_max; // the axis ranges
+	double y_min, y_max;
+	char antialias;
+	env_pt_t **env;   // if not NULL, the envelopes the traces' lines are
+	int *env_length;  // drawn from, where one is given
+} render_view_t;
+
+/* what draw_trace_range() draws */
+#define DRAW_LINES   1
+#define DRAW_MARKERS 2
+
+/* A share of the traces for the parallel renderer: traces [i0, i1), or
+ * the columns of one big trace covered by tp.  Each job draws into its
+ * own layer spanning columns [left, right) of the target.
+ */
+typedef struct render_job_t {
+	trace_pass_t tp;
+	int i0, i1;
+	int left, right;
+	char lines;   // something to draw in the DRAW_LINES phase
+	char markers; // something to draw in the DRAW_MARKERS phase
+} render_job_t;
+
+/* A frame being drawn progressively: the full quality traces are drawn,
+ * job by job, into a copy of the frame's chrome from idle callbacks, and
+ * the copy replaces the coarse frame on screen once all jobs are done.
+ * It's abandoned if a new frame is drawn or the traces change, except
+ * that frames asked for when samples were only appended wait for it.
+ */
+typedef struct progress_t {
+	guint idle;        // the idle source while refining, else 0
+	int slice_ms;      // how long each idle callback may draw for
+	trace_pass_t tp;   // the pass being refined
+	render_job_t jobs[MAX_RENDER_JOBS];
+	int num_jobs;
+	int phase;         // DRAW_LINES, then DRAW_MARKERS
+	int next_job;
+	int width, height; // of the buffer it's drawn into
+	int num_traces;    // the traces as they were when it started
+	trace_t *traces[MAX_NUM_TRACES];
+	unsigned int data_gen[MAX_NUM_TRACES];
+	unsigned int edit_gen[MAX_NUM_TRACES];
+	char deferred;     // a frame was put off until it's done
+	guint owed;        // idle source drawing that frame after it, else 0
+	char follow;       // the next frame is that one, see progress_follow()
+} progress_t;
+
+/* A refinement handed to the render worker.  The traces are copies whose
+ * samples are their own copy of the window the pass reads; lines drawn
+ * from a pyramid come as the envelope, and sprites and density images are
+ * copied too.  Nothing in it points into the widget, so the GTK thread
+ * can go on changing the traces while it's drawn.
+ */
+typedef struct render_snapshot_t {
+	unsigned int gen;         // request number, see async_worker_t
+	render_view_t view;
+	render_job_t jobs[MAX_RENDER_JOBS];
+	int num_jobs;
+	trace_t traces[MAX_NUM_TRACES];
+	trace_t *trace_list[MAX_NUM_TRACES];
+	void *x_data[MAX_NUM_TRACES];
+	void *y_data[MAX_NUM_TRACES];
+	env_pt_t *env[MAX_NUM_TRACES];
+	int env_length[MAX_NUM_TRACES];
+	sprite_t sprites[MAX_NUM_TRACES];
+	density_t densities[MAX_NUM_TRACES];
+	size_t bytes;             // held by the copies
+	cairo_surface_t *buffer;  // the chrome, with the traces drawn over it
+} render_snapshot_t;
+
+/* A thread drawing refinements off the GTK thread.  Every request bumps
+ * gen; the worker gives up on a snapshot as soon as its number is no
+ * longer the latest, so only the newest frame is ever finished.
+ */
+typedef struct async_worker_t {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	unsigned int gen;           // the newest request
+	render_snapshot_t *pending; // waiting to be drawn
+	render_snapshot_t *done;    // drawn, waiting for the GTK thread
+	int quit;
+	render_scratch_t scratch;
+} async_worker_t;
+
+/* Worker threads for the parallel renderer.  A batch of jobs is handed
+ * out through next_job; the thread that posted the batch takes jobs too
+ * and returns once jobs_left drops to zero.
+ */
+typedef struct render_worker_t {
+	struct render_pool_t *pool;
+	pthread_t thread;
+	render_scratch_t scratch;
+} render_worker_t;
+
+typedef struct render_pool_t {
+	int num_workers;
+	render_worker_t workers[MAX_RENDER_THREADS];
+	pthread_mutex_t lock;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	unsigned int batch;
+	int num_jobs;
+	int next_job;
+	int jobs_left;
+	int quit;
+	void (*run)(void *ctx, int job, render_scratch_t *rs);
+	void *ctx;
+} render_pool_t;
+
 
 /* private (static) plotting utility functions */
 #if DRAW_WITH_XLIB
@@ -222,8 +857,71 @@ static data_range get_y_range_within_x_range(trace_t **traces, int num_traces, d
 static data_range get_x_range(trace_t **traces, int num_traces);
 static data_range get_x_range_within_y_range(trace_t **traces, int num_traces, data_range yr);
 
+/* private (static) trace indexing functions */
+static void lod_init(lod_t *lod);
+static void lod_free(lod_t *lod);
+static int lod_alloc(trace_t *t);
+static void lod_reset(lod_t *lod);
+static void lod_mark_dirty(trace_t *t, int n);
+static void lod_sync(trace_t *t);
+static int lod_pick_level(trace_t *t, int count, double width_px);
+static int pass_pick_level(trace_t *t, trace_pass_t *tp, int span, double width_px);
+static int pass_stride(trace_t *t, trace_pass_t *tp, int span);
+static int lod_build_envelope(trace_t *t, int j0, int j1, int level, double x_m, double x_b, double y_m, double y_b, render_scratch_t *rs);
+static int trace_get_visible_span(trace_t *t, double x_min, double x_max, int *j0, int *j1);
+static int trace_slot(trace_t *t, int j);
+static double trace_x(trace_t *t, int n);
+static double trace_y(trace_t *t, int n);
+static trace_t *create_trace(int capacity, sample_type_t x_type, sample_type_t y_type, int x_uniform, double x0, double dx);
+static void trace_feed_free(trace_t *t);
+static void snap_grid_free(trace_t *t);
+static void density_free(trace_t *t);
+static void sprite_free(trace_t *t);
+static void sprite_invalidate(trace_t *t);
+static int trace_to_px(trace_t *t, int j, int j1, int step, double x_m, double x_b, double y_m, double y_b, render_scratch_t *rs);
+static void px_kernels_init(void);
+static int px_dedup_markers(render_scratch_t *rs, double q, double off, int samples);
+static void px_dedup_runs(render_scratch_t *rs, double left, double top, double right, double bottom);
+static void px_dedup_off(render_scratch_t *rs);
+static void px_dedup(render_scratch_t *rs, int n);
+static void extrema_init(extrema_t *e);
+static void extrema_free(extrema_t *e);
+static void extrema_rebuild(trace_t *t);
+static void extrema_evict(trace_t *t, int n);
+static void extrema_push(trace_t *t, int n);
+static void extrema_snapshot(trace_t *t);
+static void trace_get_extrema(trace_t *t, data_range *xr, data_range *yr);
+static void trace_get_range_within(trace_t *t, int by_x, data_range key, data_range *r);
+
 
 typedef struct _jbplotPrivate jbplotPrivate;
+static trace_t *find_closest_point(jbplotPrivate *priv, double x, double y, int *slot);
+static void render_view_init(jbplotPrivate *priv, render_view_t *view);
+static void update_axis_ranges(plot_t *p);
+static void interaction_tick(GtkWidget *plot);
+static int progress_plan(jbplotPrivate *priv, trace_pass_t *tp, int width);
+static int progress_begin(GtkWidget *plot, int width, int height, int over_chrome);
+static void progress_cancel(jbplotPrivate *priv);
+static int progress_defer(jbplotPrivate *priv, double width, double height);
+static int progress_follow(GtkWidget *plot, double width, double height);
+static void frame_pass_init(jbplotPrivate *priv, trace_pass_t *tp, double width);
+#if !DRAW_WITH_XLIB
+static void async_cancel(async_worker_t *w);
+static void async_worker_destroy(async_worker_t *w);
+#endif
+static int sample_size(sample_type_t type);
+static void get_chrome_key(jbplotPrivate *priv, double width, double height, chrome_key_t *k);
+static int chrome_is_current(jbplotPrivate *priv, double width, double height);
+static void frame_cache_flush(jbplotPrivate *priv);
+static void frame_shown(jbplotPrivate *priv);
+static void tile_cache_reset(jbplotPrivate *priv);
+static void remove_callbacks(jbplotPrivate *priv);
+static int draw_pan_tiles(GtkWidget *plot, trace_pass_t *tp);
+static void wheel_preview_reset(jbplotPrivate *priv);
+static int wheel_preview_tick(GtkWidget *plot);
+static int wheel_preview_show(GtkWidget *plot, trace_pass_t *tp, int width, int height);
+static int scroll_layer_plan(jbplotPrivate *priv, trace_pass_t *tp, int *shift);
+static void scroll_layer_commit(jbplotPrivate *priv, trace_pass_t *tp);
 
 struct _jbplotPrivate
 {
@@ -261,17 +959,84 @@ struct _jbplotPrivate
 	double y_m;
 	double y_b;
 
+	/* scratch space for the trace renderer */
+	render_scratch_t scratch;
+
 	/* image buffers used for non real-time mode */
 	cairo_surface_t *legend_buffer;
 	cairo_t *legend_context;
 	cairo_surface_t *plot_buffer;
 	cairo_t *plot_context;
 
+	/* cached chrome layer; only redrawn when chrome_key changes */
+	cairo_surface_t *chrome_buffer;
+	cairo_t *chrome_context;
+	chrome_key_t chrome_key;
+	gboolean chrome_valid;
+
+	/* scroll mode: the data gets its own layer, which is shifted rather
+	 * than redrawn when the x range only translates */
+	gboolean scroll_mode;
+	scroll_layer_t scroll;
+	cairo_surface_t *data_buffer;
+	cairo_t *data_context;
+
+	/* parallel trace rendering: the jobs of the current frame and a layer
+	 * for each; only used by the cairo renderer */
+	int render_threads;
+	render_pool_t *render_pool;
+	render_job_t render_jobs[MAX_RENDER_JOBS];
+	int num_render_jobs;
+	cairo_surface_t *render_layers[MAX_RENDER_JOBS];
+
+	/* per-thread counts for binning big density traces on the pool */
+	guint32 *density_parts[MAX_RENDER_THREADS];
+	int density_parts_size;
+
+	/* paces the redraws asked for by jbplot_refresh() */
+	frame_sched_t sched;
+
+	/* interactive quality: while a pan or wheel zoom goes on, frames are
+	 * drafts until it has been still for settle_ms */
+	gboolean draft_quality;
+	int settle_ms;
+	gboolean interacting;
+	guint settle_timer;
+	double draft_samples; // raw samples per frame, tuned to the frame budget
+	gboolean drew_draft;
+
+	/* progressive rendering of frames too big to draw in one go */
+	gboolean progressive;
+	gboolean exposing; // draw_plot() is drawing for the screen, not a capture
+	progress_t progress;
+	cairo_surface_t *progress_buffer;
+	cairo_t *progress_context;
+
+	/* refinements drawn on a thread of their own; cairo renderer only */
+	gboolean render_worker;
+	async_worker_t *async;
+
+	/* frames of views shown before */
+	frame_cache_t frames;
+
+	/* middle-button pans drawn from tiles */
+	gboolean pan_tiles;
+	tile_cache_t tiles;
+
+	/* wheel zooms previewed from the frame before */
+	gboolean wheel_preview;
+	wheel_preview_t wheel;
+
 #if DRAW_WITH_XLIB
 	Display *xdisp;
 	Window xwin;
 	Pixmap plot_pixmap;
 	Pixmap legend_pixmap;
+	Pixmap chrome_pixmap;
+	Pixmap data_pixmap;
+	Pixmap data_mask;
+	GC mask_gc;
+	Pixmap progress_pixmap;
 #endif
 
 	zoom_hist_t zoom_hist;	
@@ -570,10 +1335,16 @@ static gboolean jbplot_scroll(GtkWidget *w, GdkEventScroll *event) {
 			printf("got unexpected scroll direction!!\n");
 			return FALSE;
 		}
-		xmin = xs - alpha/2 * (priv->plot.x_axis.max_val - priv->plot.x_axis.min_val);
-		xmax = xs + alpha/2 * (priv->plot.x_axis.max_val - priv->plot.x_axis.min_val);
-		ymin = ys - alpha/2 * (priv->plot.y_axis.max_val - priv->plot.y_axis.min_val);
-		ymax = ys + alpha/2 * (priv->plot.y_axis.max_val - priv->plot.y_axis.min_val);
+		// the point under the pointer stays there
+		xmin = xs - alpha * (xs - priv->plot.x_axis.min_val);
+		xmax = xs + alpha * (priv->plot.x_axis.max_val - xs);
+		ymin = ys - alpha * (ys - priv->plot.y_axis.min_val);
+		ymax = ys + alpha * (priv->plot.y_axis.max_val - ys);
+		// each notch shows the frame the burst began at, scaled, while the
+		// exact one is drawn in the background
+		if(wheel_preview_tick(w) < 0) {
+			interaction_tick(w);
+		}
 		jbplot_set_xy_range((jbplot *)w, xmin, xmax, ymin, ymax, 1);
 		priv->needs_redraw = TRUE;
 		g_signal_emit_by_name((gpointer *)w, "zoom-in", xmin, xmax, ymin, ymax);
@@ -699,6 +1470,11 @@ static gboolean jbplot_button_release(GtkWidget *w, GdkEventButton *event) {
 	else if(event->button == 2) {
 		if(priv->panning) {
 			priv->panning = FALSE;
+			// tiles are only drawn ahead while the pan goes on
+			if(priv->tiles.idle != 0) {
+				g_source_remove(priv->tiles.idle);
+				priv->tiles.idle = 0;
+			}
 			priv->needs_redraw = TRUE;
 			gtk_widget_queue_draw(w);
 		}
@@ -720,7 +1496,9 @@ static gboolean jbplot_motion_notify(GtkWidget *w, GdkEventMotion *event) {
 	jbplotPrivate *priv = JBPLOT_GET_PRIVATE((jbplot*)w);
 	GTimeVal t_now;
 	g_get_current_time(&t_now);
-	if((t_now.tv_sec-priv->last_mouse_motion.tv_sec) + 1.e-6*(t_now.tv_usec-priv->last_mouse_motion.tv_usec) < 60.e-3) {
+	// pan frames from tiles are cheap enough to keep up with the mouse
+	if((t_now.tv_sec-priv->last_mouse_motion.tv_sec) + 1.e-6*(t_now.tv_usec-priv->last_mouse_motion.tv_usec) < 60.e-3 &&
+	   !(priv->panning && priv->pan_tiles)) {
 		return FALSE;
 	}
 	priv->last_mouse_motion = t_now;
@@ -743,6 +1521,7 @@ static gboolean jbplot_motion_notify(GtkWidget *w, GdkEventMotion *event) {
 		xmax = priv->pan_start_x_range.max - (event->x - priv->pan_start_x)/priv->x_m;
 		ymin = priv->pan_start_y_range.min - (event->y - priv->pan_start_y)/priv->y_m;
 		ymax = priv->pan_start_y_range.max - (event->y - priv->pan_start_y)/priv->y_m;
+		interaction_tick(w);
 		jbplot_set_x_axis_range((jbplot *)w, xmin, xmax, 0);
 		jbplot_set_y_axis_range((jbplot *)w, ymin, ymax, 0);
 		priv->needs_redraw = TRUE;
@@ -772,13 +1551,27 @@ static void zoom_all (jbplot *plot) {
 }
 
 
+/* The widget is going away: nothing may call back into it after this.
+ * GTK may run it more than once. */
+static void jbplot_object_destroy(GtkObject *object) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(object);
+	remove_callbacks(priv);
+	GTK_OBJECT_CLASS(jbplot_parent_class)->destroy(object);
+}
+
 static void jbplot_class_init (jbplotClass *class) {
 	GObjectClass *obj_class;
+	GtkObjectClass *gtk_obj_class;
 	GtkWidgetClass *widget_class;
 
+	px_kernels_init();
+
 	obj_class = G_OBJECT_CLASS (class);
+	gtk_obj_class = GTK_OBJECT_CLASS (class);
 	widget_class = GTK_WIDGET_CLASS (class);
 
+	gtk_obj_class->destroy = jbplot_object_destroy;
+
 	/* GtkWidget signals */
 	widget_class->expose_event = jbplot_expose;
 	widget_class->configure_event = jbplot_configure;
@@ -932,6 +1725,7 @@ static void jbplot_init (jbplot *plot) {
 			GDK_BUTTON_PRESS_MASK | GDK_BUTTON_RELEASE_MASK |
 			GDK_POINTER_MOTION_MASK | GDK_LEAVE_NOTIFY_MASK | GDK_SCROLL_MASK);
 
+	int i;
 	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
 
 	priv->zooming = FALSE;
@@ -962,12 +1756,85 @@ static void jbplot_init (jbplot *plot) {
 	priv->legend_buffer = NULL;
 	priv->plot_context = NULL;
 	priv->plot_buffer = NULL;
+	priv->chrome_context = NULL;
+	priv->chrome_buffer = NULL;
+	priv->chrome_valid = FALSE;
+	priv->scroll_mode = FALSE;
+	priv->scroll.valid = 0;
+	priv->data_context = NULL;
+	priv->data_buffer = NULL;
+	priv->render_threads = 0;
+	priv->render_pool = NULL;
+	priv->num_render_jobs = 0;
+	for(i = 0; i < MAX_RENDER_JOBS; i++) {
+		priv->render_layers[i] = NULL;
+	}
+	for(i = 0; i < MAX_RENDER_THREADS; i++) {
+		priv->density_parts[i] = NULL;
+	}
+	priv->density_parts_size = 0;
+
+	memset(&(priv->sched), 0, sizeof(frame_sched_t));
+	priv->sched.max_fps = 60;
+	priv->sched.budget_ms = 16;
+
+	priv->draft_quality = TRUE;
+	priv->settle_ms = DRAFT_SETTLE_MS;
+	priv->interacting = FALSE;
+	priv->settle_timer = 0;
+	priv->draft_samples = DRAFT_SAMPLES;
+	priv->drew_draft = FALSE;
+
+	priv->progressive = TRUE;
+	priv->exposing = FALSE;
+	memset(&(priv->progress), 0, sizeof(progress_t));
+	priv->progress.slice_ms = PROGRESS_SLICE_MS;
+	priv->progress_buffer = NULL;
+	priv->progress_context = NULL;
+	priv->render_worker = FALSE;
+	priv->async = NULL;
+	priv->frames.num_entries = 0;
+	priv->frames.bytes = 0;
+	priv->frames.max_bytes = FRAME_CACHE_BYTES;
+	priv->frames.clock = 0;
+	priv->frames.shown_valid = FALSE;
+	priv->pan_tiles = TRUE;
+	priv->tiles.valid = 0;
+	priv->tiles.num_tiles = 0;
+	priv->tiles.idle = 0;
+	priv->wheel_preview = TRUE;
+	priv->wheel.active = 0;
+#if DRAW_WITH_XLIB
+	priv->wheel.image = NULL;
+	priv->wheel.mask = NULL;
+#else
+	priv->wheel.buffer = NULL;
+#endif
+	priv->wheel.timer = 0;
+
+	priv->scratch.env = NULL;
+	priv->scratch.env_size = 0;
+	priv->scratch.env_length = 0;
+	priv->scratch.dedup = DEDUP_NONE;
+	priv->scratch.occupied = NULL;
+	priv->scratch.occupied_size = 0;
+#if DRAW_WITH_XLIB
+	priv->scratch.xb.segs = NULL;
+	priv->scratch.xb.pts = NULL;
+	priv->scratch.xb.arcs = NULL;
+	priv->scratch.xb.rects = NULL;
+#endif
 
 #if DRAW_WITH_XLIB
 	priv->xdisp = NULL;
 	priv->xwin = 0;
 	priv->plot_pixmap = 0;
 	priv->legend_pixmap = 0;
+	priv->chrome_pixmap = 0;
+	priv->data_pixmap = 0;
+	priv->data_mask = 0;
+	priv->mask_gc = 0;
+	priv->progress_pixmap = 0;
 #endif
 
 	zoom_hist_init(&(priv->zoom_hist));	
@@ -1164,111 +2031,833 @@ static int draw_horiz_text_at_point(void *cr, char *text, double x, double y, an
 	return 0;
 }
 
+/* Clips the line from (*x1,*y1) to (*x2,*y2) to the box [x0, x1] by
+ * [y0, y1] (Liang-Barsky).  Returns -1 if an end is NaN or none of the
+ * line is inside. */
+static int clip_line(double box_x0, double box_y0, double box_x1, double box_y1, double *x1, double *y1, double *x2, double *y2) {
+	double t0 = 0, t1 = 1;
+	double dx = *x2 - *x1;
+	double dy = *y2 - *y1;
+	double p[4] = {-dx, dx, -dy, dy};
+	double q[4] = {*x1 - box_x0, box_x1 - *x1, *y1 - box_y0, box_y1 - *y1};
+	int i;
+	if(isnan(*x1) || isnan(*y1) || isnan(*x2) || isnan(*y2)) {
+		return -1;
+	}
+	for(i = 0; i < 4; i++) {
+		if(p[i] == 0) {
+			if(q[i] < 0) {
+				return -1;
+			}
+		}
+		else {
+			double r = q[i] / p[i];
+			if(p[i] < 0) {
+				if(r > t1) return -1;
+				if(r > t0) t0 = r;
+			}
+			else {
+				if(r < t0) return -1;
+				if(r < t1) t1 = r;
+			}
+		}
+	}
+	if(t1 < 1) {
+		*x2 = *x1 + t1 * dx;
+		*y2 = *y1 + t1 * dy;
+	}
+	if(t0 > 0) {
+		*x1 = *x1 + t0 * dx;
+		*y1 = *y1 + t0 * dy;
+	}
+	return 0;
+}
+
 #if DRAW_WITH_XLIB
 void draw_marker_x(Display *display, Drawable d, GC gc, int type, double size, double x, double y) {
 	if(type == MARKER_POINT) {
 		XDrawPoint(display, d, gc, x, y);
 	}
 	else if(type == MARKER_CIRCLE) {
-		XFillArc(display, d, gc, x, y, size, size, 0, 23040);
+		XFillArc(display, d, gc, x-size/2, y-size/2, size, size, 0, 23040);
 	}
 	else if(type == MARKER_SQUARE) {
 		XFillRectangle(display, d, gc, x-size/2, y-size/2, size, size);
 	}
+	else if(type == MARKER_X) {
+		XDrawLine(display, d, gc, x-size/2, y-size/2, x+size/2, y+size/2);
+		XDrawLine(display, d, gc, x+size/2, y-size/2, x-size/2, y+size/2);
+	}
+	return;
+}
+
+static void xbatch_free(xbatch_t *b) {
+	free(b->segs);
+	free(b->pts);
+	free(b->arcs);
+	free(b->rects);
+	b->segs = NULL;
+	b->pts = NULL;
+	b->arcs = NULL;
+	b->rects = NULL;
+	return;
+}
+
+/* Starts a batch drawing to d with gc.  Segments are clipped to the box
+ * (x0, y0) - (x1, y1).  Returns -1 if the buffers can't be allocated. */
+static int xbatch_begin(xbatch_t *b, Display *display, Drawable d, GC gc, double x0, double y0, double x1, double y1) {
+	if(b->segs == NULL) {
+		// size the buffers to the largest request the server takes:
+		// 2 units per segment or rectangle, 1 per point, 3 per arc
+		long units = XMaxRequestSize(display) - 3;
+		b->max_segs = units / 2;
+		b->max_pts = units;
+		b->max_arcs = units / 3;
+		b->max_rects = units / 2;
+		b->segs = malloc(b->max_segs * sizeof(XSegment));
+		b->pts = malloc(b->max_pts * sizeof(XPoint));
+		b->arcs = malloc(b->max_arcs * sizeof(XArc));
+		b->rects = malloc(b->max_rects * sizeof(XRectangle));
+		if(b->segs == NULL || b->pts == NULL || b->arcs == NULL || b->rects == NULL) {
+			printf("Error allocating Xlib batch buffers\n");
+			xbatch_free(b);
+			return -1;
+		}
+	}
+	b->display = display;
+	b->d = d;
+	b->gc = gc;
+	b->clip_x0 = fmax(x0, -32000);
+	b->clip_y0 = fmax(y0, -32000);
+	b->clip_x1 = fmin(x1, 32000);
+	b->clip_y1 = fmin(y1, 32000);
+	b->num_segs = 0;
+	b->num_pts = 0;
+	b->num_arcs = 0;
+	b->num_rects = 0;
+	return 0;
+}
+
+/* sends whatever has been collected */
+static void xbatch_flush(xbatch_t *b) {
+	if(b->num_segs > 0) {
+		XDrawSegments(b->display, b->d, b->gc, b->segs, b->num_segs);
+		b->num_segs = 0;
+	}
+	if(b->num_pts > 0) {
+		XDrawPoints(b->display, b->d, b->gc, b->pts, b->num_pts, CoordModeOrigin);
+		b->num_pts = 0;
+	}
+	if(b->num_arcs > 0) {
+		XFillArcs(b->display, b->d, b->gc, b->arcs, b->num_arcs);
+		b->num_arcs = 0;
+	}
+	if(b->num_rects > 0) {
+		XFillRectangles(b->display, b->d, b->gc, b->rects, b->num_rects);
+		b->num_rects = 0;
+	}
+	return;
+}
+
+/* adds a line from (x1,y1) to (x2,y2) as is */
+static void xbatch_seg(xbatch_t *b, double x1, double y1, double x2, double y2) {
+	if(b->num_segs == b->max_segs) {
+		XDrawSegments(b->display, b->d, b->gc, b->segs, b->num_segs);
+		b->num_segs = 0;
+	}
+	XSegment *s = &(b->segs[b->num_segs++]);
+	s->x1 = (int)x1;
+	s->y1 = (int)y1;
+	s->x2 = (int)x2;
+	s->y2 = (int)y2;
+	return;
+}
+
+/* adds a line from (x1,y1) to (x2,y2), clipped to the batch's box; lines
+ * with a NaN end or entirely outside are dropped */
+static void xbatch_line(xbatch_t *b, double x1, double y1, double x2, double y2) {
+	if(clip_line(b->clip_x0, b->clip_y0, b->clip_x1, b->clip_y1, &x1, &y1, &x2, &y2) == 0) {
+		xbatch_seg(b, x1, y1, x2, y2);
+	}
+	return;
+}
+
+/* adds a marker at (x, y), drawn the same way draw_marker_x() would */
+static void xbatch_marker(xbatch_t *b, int type, double size, double x, double y) {
+	if(type == MARKER_POINT) {
+		if(b->num_pts == b->max_pts) {
+			XDrawPoints(b->display, b->d, b->gc, b->pts, b->num_pts, CoordModeOrigin);
+			b->num_pts = 0;
+		}
+		XPoint *pt = &(b->pts[b->num_pts++]);
+		pt->x = (int)x;
+		pt->y = (int)y;
+	}
+	else if(type == MARKER_CIRCLE) {
+		if(b->num_arcs == b->max_arcs) {
+			XFillArcs(b->display, b->d, b->gc, b->arcs, b->num_arcs);
+			b->num_arcs = 0;
+		}
+		XArc *a = &(b->arcs[b->num_arcs++]);
+		a->x = (int)(x - size/2);
+		a->y = (int)(y - size/2);
+		a->width = (unsigned int)size;
+		a->height = (unsigned int)size;
+		a->angle1 = 0;
+		a->angle2 = 23040;
+	}
+	else if(type == MARKER_SQUARE) {
+		if(b->num_rects == b->max_rects) {
+			XFillRectangles(b->display, b->d, b->gc, b->rects, b->num_rects);
+			b->num_rects = 0;
+		}
+		XRectangle *r = &(b->rects[b->num_rects++]);
+		r->x = (int)(x - size/2);
+		r->y = (int)(y - size/2);
+		r->width = (unsigned int)size;
+		r->height = (unsigned int)size;
+	}
+	else if(type == MARKER_X) {
+		int x0 = (int)(x - size/2);
+		int y0 = (int)(y - size/2);
+		int n = (int)size;
+		xbatch_seg(b, x0, y0, x0 + n, y0 + n);
+		xbatch_seg(b, x0 + n, y0, x0, y0 + n);
+	}
+	return;
+}
+
+/* adds a marker made of the given runs of pixels, relative to the pixel
+ * at (x, y) */
+static void xbatch_spans(xbatch_t *b, XRectangle *spans, int n, double x, double y) {
+	int ix = (int)x;
+	int iy = (int)y;
+	int k;
+	for(k = 0; k < n; k++) {
+		if(b->num_rects == b->max_rects) {
+			XFillRectangles(b->display, b->d, b->gc, b->rects, b->num_rects);
+			b->num_rects = 0;
+		}
+		XRectangle *r = &(b->rects[b->num_rects++]);
+		r->x = ix + spans[k].x;
+		r->y = iy + spans[k].y;
+		r->width = spans[k].width;
+		r->height = spans[k].height;
+	}
 	return;
 }
 #endif
 
 
-void draw_marker(cairo_t *cr, int type, double size) {
-	double x, y;
-	cairo_get_current_point(cr, &x, &y);
+/* adds a marker centered at (x, y) to the path; many can be added and
+ * then painted at once with marker_paint() */
+static void marker_path(cairo_t *cr, int type, double size, double x, double y) {
 	if(type == MARKER_POINT) {
 		cairo_move_to(cr, x, y);
 		cairo_close_path(cr);
-		cairo_stroke(cr);
 	}
 	else if(type == MARKER_CIRCLE) {
+		cairo_new_sub_path(cr);
 		cairo_arc(cr, x, y, size/2.0, 0, 2*M_PI);
-		cairo_fill(cr);
 	}
 	else if(type == MARKER_SQUARE) {
 		cairo_rectangle(cr, x-size/2.0, y-size/2.0, size, size);
-		cairo_fill(cr);
+	}
+	else if(type == MARKER_X) {
+		cairo_move_to(cr, x-size/2.0, y-size/2.0);
+		cairo_line_to(cr, x+size/2.0, y+size/2.0);
+		cairo_move_to(cr, x+size/2.0, y-size/2.0);
+		cairo_line_to(cr, x-size/2.0, y+size/2.0);
 	}
 	return;
 }
 
-int calc_legend_dims(plot_t *plot, cairo_t *cr, double *width, double *height, double *spacing) {
-	double max_width = 10.;
-	double h_sum = 10.;
-	int i;
-		double w;
-		double h;
-	for(i=0; i < plot->num_traces; i++) {
-		w = get_text_width(cr, plot->traces[i]->name, plot->legend.font_size);
-		h = get_text_height(cr, plot->traces[i]->name, plot->legend.font_size);
-		if(w > max_width) {
-			max_width = w;
-		}
-		h_sum = h_sum + h + 10;
+/* points and x's are stroked with the current line width, the others filled */
+static void marker_paint(cairo_t *cr, int type) {
+	if(type == MARKER_POINT || type == MARKER_X) {
+		cairo_stroke(cr);
 	}
-	*width = max_width + 15 + 10;
-	*height = h_sum;
-	*spacing = h + 10;
-	return 0;
+	else {
+		cairo_fill(cr);
+	}
+	return;
+}
+
+void draw_marker(cairo_t *cr, int type, double size) {
+	double x, y;
+	cairo_get_current_point(cr, &x, &y);
+	marker_path(cr, type, size, x, y);
+	marker_paint(cr, type);
+	return;
 }
 
 #if DRAW_WITH_XLIB
-static int draw_legend_x(jbplot *plot) {
-	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
-	plot_t *p = &(priv->plot);
-	legend_t *l = &(p->legend);
-	double border_margin = 3.;
-	double line_length = 15;
-	double text_to_line_gap = 5;
+/* draws a trace envelope as one connected line: first -> lo -> hi -> last */
+static void draw_envelope_x(xbatch_t *xb, env_pt_t *e, int n) {
+	int k;
+	int pen_down = 0;
+	double last_x = 0, last_y = 0;
+	for(k = 0; k < n; k++) {
+		if(e[k].gap) {
+			pen_down = 0;
+			continue;
+		}
+		if(pen_down) {
+			xbatch_line(xb, last_x, last_y, e[k].x_first, e[k].y_first);
+		}
+		if(e[k].y_lo != e[k].y_hi) {
+			xbatch_line(xb, e[k].x_first, e[k].y_lo, e[k].x_first, e[k].y_hi);
+		}
+		if(e[k].x_last != e[k].x_first || e[k].y_last != e[k].y_first) {
+			xbatch_line(xb, e[k].x_first, e[k].y_first, e[k].x_last, e[k].y_last);
+		}
+		last_x = e[k].x_last;
+		last_y = e[k].y_last;
+		pen_down = 1;
+	}
+	return;
+}
+#endif
 
-	if(!l->needs_redraw) {
-		return 0;
+/* Sets r up to write into the target of cr.  Returns -1 if the target
+ * isn't an ARGB32 image surface drawn with an identity transform or a
+ * translation by whole pixels.  Each stretch of writes goes between
+ * raster_acquire() and raster_release(). */
+static int raster_begin(raster_t *r, cairo_t *cr) {
+	cairo_matrix_t m;
+	cairo_surface_t *s = cairo_get_target(cr);
+	if(cairo_surface_get_type(s) != CAIRO_SURFACE_TYPE_IMAGE ||
+	   cairo_image_surface_get_format(s) != CAIRO_FORMAT_ARGB32) {
+		return -1;
 	}
-	l->needs_redraw = 0;
+	cairo_get_matrix(cr, &m);
+	if(m.xx != 1 || m.yy != 1 || m.xy != 0 || m.yx != 0 || 
+	   m.x0 != floor(m.x0) || m.y0 != floor(m.y0)) {
+		return -1;
+	}
+	r->data = (guint32 *)cairo_image_surface_get_data(s);
+	if(r->data == NULL) {
+		return -1;
+	}
+	r->surface = s;
+	r->stride = cairo_image_surface_get_stride(s) / 4;
+	r->width = cairo_image_surface_get_width(s);
+	r->height = cairo_image_surface_get_height(s);
+	r->ox = (int)m.x0;
+	r->oy = (int)m.y0;
+	r->origin = r->oy * r->stride + r->ox;
+	r->x0 = -r->ox;
+	r->y0 = -r->oy;
+	r->x1 = r->width - 1 - r->ox;
+	r->y1 = r->height - 1 - r->oy;
+	r->gx0 = r->x0 - 1;
+	r->gy0 = r->y0 - 1;
+	r->gx1 = r->x1 + 2;
+	r->gy1 = r->y1 + 2;
+	r->color = 0xff000000;
+	return 0;
+}
 
+/* lets cairo finish what it has drawn before the pixels are written */
+static void raster_acquire(raster_t *r) {
+	cairo_surface_flush(r->surface);
+	return;
+}
 
-	// create graphics context
-	// TODO: GC gc = XCreateGC(display, d, unsignedlong valuemask, XGCValues *values);
-	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+/* tells cairo the pixels were changed behind its back */
+static void raster_release(raster_t *r) {
+	cairo_surface_mark_dirty(r->surface);
+	return;
+}
 
-	// set up a couple colors
-	int blackColor = BlackPixel(priv->xdisp, DefaultScreen(priv->xdisp));
-	int whiteColor = WhitePixel(priv->xdisp, DefaultScreen(priv->xdisp));
+/* clips to the pixels whose centers are inside the given rectangle */
+static void raster_set_clip(raster_t *r, double left, double top, double right, double bottom) {
+	r->x0 = (int)ceil(left - 0.5);
+	r->y0 = (int)ceil(top - 0.5);
+	r->x1 = (int)ceil(right - 0.5) - 1;
+	r->y1 = (int)ceil(bottom - 0.5) - 1;
+	if(r->x0 < -r->ox) r->x0 = -r->ox;
+	if(r->y0 < -r->oy) r->y0 = -r->oy;
+	if(r->x1 > r->width - 1 - r->ox) r->x1 = r->width - 1 - r->ox;
+	if(r->y1 > r->height - 1 - r->oy) r->y1 = r->height - 1 - r->oy;
+	return;
+}
 
-	// set some default values in graphics context
-	XSetLineAttributes(
-		priv->xdisp, gc, 
-		1,         // lineWidth
-		LineSolid, // lineStyle
-		CapRound,  //cap_style
-		JoinMiter  // jointStyle
-	);
-	XSetFillStyle(priv->xdisp, gc, FillSolid);
+/* Sets the box lines are cut to before they are walked, just outside the
+ * pixels of the given rectangle.  Where a line is cut moves the pixels it
+ * lands on, so passes that are to match pixel for pixel have to share
+ * the guard box even if their clip boxes differ. */
+static void raster_set_guard(raster_t *r, double left, double top, double right, double bottom) {
+	r->gx0 = ceil(left - 0.5) - 1;
+	r->gy0 = ceil(top - 0.5) - 1;
+	r->gx1 = ceil(right - 0.5) + 1;
+	r->gy1 = ceil(bottom - 0.5) + 1;
+	return;
+}
 
-	//First fill the background
-	XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(p->bg_color)));
-	XFillRectangle(priv->xdisp, priv->legend_pixmap, gc, 0, 0, 2000, 2000);
+/* opaque, in the same 8-bit rounding cairo uses */
+static void raster_set_color(raster_t *r, rgb_color_t *c) {
+	double v[3] = {c->red, c->green, c->blue};
+	guint32 px = 0xff000000;
+	int i;
+	for(i = 0; i < 3; i++) {
+		double f = v[i] < 0 ? 0 : (v[i] > 1 ? 1 : v[i]);
+		px |= (((guint32)(f * 65535.0 + 0.5)) >> 8) << (16 - 8 * i);
+	}
+	r->color = px;
+	return;
+}
 
-	if(l->position == LEGEND_POS_RIGHT) {
-		// first calculate the widest trace name
-		double max_width = 10.;
-		int i;
-		double w;
-		for(i=0; i < p->num_traces; i++) {
-			/* skip traces with empty names */
-			if(strlen(p->traces[i]->name) == 0) {
-				continue;
+/* 1-px line from the pixel containing (x1,y1) to the one containing
+ * (x2,y2), Bresenham.  The ends are first clipped to the guard box so
+ * far-off points don't cost a long walk. */
+static void raster_line(raster_t *r, double x1, double y1, double x2, double y2) {
+	double t0 = 0, t1 = 1;
+	double dx = x2 - x1;
+	double dy = y2 - y1;
+	double p[4] = {-dx, dx, -dy, dy};
+	double q[4] = {x1 - r->gx0, r->gx1 - x1, y1 - r->gy0, r->gy1 - y1};
+	int i;
+	if(isnan(x1) || isnan(y1) || isnan(x2) || isnan(y2)) {
+		return;
+	}
+	for(i = 0; i < 4; i++) {
+		if(p[i] == 0) {
+			if(q[i] < 0) {
+				return;
 			}
-			w = get_text_width_x(priv->xdisp, gc, p->traces[i]->name);
-			if(w > max_width) {
-				max_width = w;
+		}
+		else {
+			double t = q[i] / p[i];
+			if(p[i] < 0) {
+				if(t > t1) return;
+				if(t > t0) t0 = t;
+			}
+			else {
+				if(t < t0) return;
+				if(t < t1) t1 = t;
+			}
+		}
+	}
+	int xa = (int)floor(x1 + t0 * dx);
+	int ya = (int)floor(y1 + t0 * dy);
+	int xb = (int)floor(x1 + t1 * dx);
+	int yb = (int)floor(y1 + t1 * dy);
+
+	int sx = xa < xb ? 1 : -1;
+	int sy = ya < yb ? 1 : -1;
+	int ex = abs(xb - xa);
+	int ey = -abs(yb - ya);
+	int err = ex + ey;
+	for(;;) {
+		if(xa >= r->x0 && xa <= r->x1 && ya >= r->y0 && ya <= r->y1) {
+			r->data[r->origin + ya * r->stride + xa] = r->color;
+		}
+		if(xa == xb && ya == yb) {
+			break;
+		}
+		int e2 = 2 * err;
+		if(e2 >= ey) {
+			err += ey;
+			xa += sx;
+		}
+		if(e2 <= ex) {
+			err += ex;
+			ya += sy;
+		}
+	}
+	return;
+}
+
+/* fills the pixels from (xa, ya) to (xb, yb) inclusive, clipped */
+static void raster_fill_box(raster_t *r, int xa, int ya, int xb, int yb) {
+	int i, j;
+	if(xa < r->x0) xa = r->x0;
+	if(ya < r->y0) ya = r->y0;
+	if(xb > r->x1) xb = r->x1;
+	if(yb > r->y1) yb = r->y1;
+	for(j = ya; j <= yb; j++) {
+		guint32 *px = r->data + (r->origin + j * r->stride + xa);
+		for(i = xa; i <= xb; i++) {
+			*px++ = r->color;
+		}
+	}
+	return;
+}
+
+/* solid square covering the pixels whose centers are inside it */
+static void raster_fill_rect(raster_t *r, double x, double y, double w, double h) {
+	raster_fill_box(r, (int)ceil(x - 0.5), (int)ceil(y - 0.5),
+	                (int)ceil(x + w - 0.5) - 1, (int)ceil(y + h - 0.5) - 1);
+	return;
+}
+
+/* Returns 1 if the raster path can draw this marker type */
+static int raster_marker_ok(int type) {
+	return type == MARKER_POINT || type == MARKER_SQUARE;
+}
+
+/* For MARKER_POINT size is the diameter of the dot, which cairo draws as
+ * a round-capped stroke of the line width. */
+static void raster_marker(raster_t *r, int type, double size, double x, double y) {
+	if(type == MARKER_POINT) {
+		int xa = (int)floor(x);
+		int ya = (int)floor(y);
+		if(size <= 1.0) {
+			if(xa >= r->x0 && xa <= r->x1 && ya >= r->y0 && ya <= r->y1) {
+				r->data[r->origin + ya * r->stride + xa] = r->color;
+			}
+		}
+		else {
+			// the pixels whose centers are inside the dot, centred on the
+			// pixel the point falls in so that px_dedup() can go by the
+			// pixel alone
+			int i, j;
+			int n = (int)ceil(size / 2.0);
+			double rr = size * size / 4.0;
+			for(j = -n; j <= n; j++) {
+				int i_max = -1;
+				for(i = 0; i <= n; i++) {
+					if(i * i + j * j <= rr) {
+						i_max = i;
+					}
+				}
+				if(i_max >= 0) {
+					raster_fill_box(r, xa - i_max, ya + j, xa + i_max, ya + j);
+				}
+			}
+		}
+	}
+	else if(type == MARKER_SQUARE) {
+		if(size == floor(size)) {
+			// whole-pixel squares go by their corner alone, which
+			// px_dedup() relies on
+			double c = size/2.0 + 0.5;
+			int xa = (int)ceil(x - c);
+			int ya = (int)ceil(y - c);
+			raster_fill_box(r, xa, ya, xa + (int)size - 1, ya + (int)size - 1);
+		}
+		else {
+			raster_fill_rect(r, x - size/2.0, y - size/2.0, size, size);
+		}
+	}
+	return;
+}
+
+static void sprite_free(trace_t *t) {
+	sprite_t *s = t->sprite;
+	if(s != NULL) {
+		free(s->pixels);
+#if DRAW_WITH_XLIB
+		free(s->spans);
+#endif
+		free(s);
+		t->sprite = NULL;
+	}
+}
+
+static void sprite_invalidate(trace_t *t) {
+	if(t->sprite != NULL) {
+		t->sprite->valid = 0;
+#if DRAW_WITH_XLIB
+		t->sprite->spans_valid = 0;
+#endif
+	}
+}
+
+static int sprite_ok(trace_t *t) {
+	return (t->marker_type == MARKER_CIRCLE || t->marker_type == MARKER_SQUARE ||
+	        t->marker_type == MARKER_X) &&
+	       t->marker_size > 0 && t->marker_size <= SPRITE_MAX_SIZE;
+}
+
+/* Returns the trace's sprite if it matches its markers and the antialias
+ * mode, else NULL */
+static sprite_t *trace_sprite(trace_t *t, int antialias) {
+	sprite_t *s = t->sprite;
+	if(s == NULL || !s->valid || s->antialias != antialias ||
+	   s->type != t->marker_type || s->size != t->marker_size ||
+	   s->color.red != t->marker_color.red || s->color.green != t->marker_color.green ||
+	   s->color.blue != t->marker_color.blue) {
+		return NULL;
+	}
+	return s;
+}
+
+/* Renders the trace's marker into its sprite unless it is up to date.
+ * Returns -1 if the marker can't be drawn from a sprite. */
+static int sprite_update(trace_t *t, int antialias) {
+	sprite_t *s;
+	int center, width, n, i, j;
+	if(!sprite_ok(t)) {
+		return -1;
+	}
+	if(trace_sprite(t, antialias) != NULL) {
+		return 0;
+	}
+	if(t->sprite == NULL) {
+		t->sprite = calloc(1, sizeof(sprite_t));
+		if(t->sprite == NULL) {
+			printf("Error allocating marker sprite\n");
+			return -1;
+		}
+	}
+	s = t->sprite;
+	s->valid = 0;
+	center = (int)ceil(t->marker_size / 2.0) + 2;
+	width = 2 * center + 1;
+	guint32 *pixels = realloc(s->pixels, (size_t)width * width * SPRITE_PHASES * SPRITE_PHASES * sizeof(guint32));
+	if(pixels == NULL) {
+		printf("Error allocating marker sprite\n");
+		return -1;
+	}
+	s->pixels = pixels;
+	cairo_surface_t *img = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, width);
+	if(cairo_surface_status(img) != CAIRO_STATUS_SUCCESS) {
+		cairo_surface_destroy(img);
+		return -1;
+	}
+	for(n = 0; n < SPRITE_PHASES * SPRITE_PHASES; n++) {
+		cairo_t *cr = cairo_create(img);
+		cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+		cairo_paint(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+		cairo_set_antialias(cr, antialias ? CAIRO_ANTIALIAS_DEFAULT : CAIRO_ANTIALIAS_NONE);
+		cairo_set_line_width(cr, 1.0);
+		cairo_set_source_rgb(cr, t->marker_color.red, t->marker_color.green, t->marker_color.blue);
+		// the middle of the n-th sub-pixel cell
+		cairo_move_to(cr, center + (n % SPRITE_PHASES + 0.5) / SPRITE_PHASES,
+		                  center + (n / SPRITE_PHASES + 0.5) / SPRITE_PHASES);
+		draw_marker(cr, t->marker_type, t->marker_size);
+		cairo_destroy(cr);
+		cairo_surface_flush(img);
+		unsigned char *data = cairo_image_surface_get_data(img);
+		int stride = cairo_image_surface_get_stride(img);
+		for(j = 0; j < width; j++) {
+			guint32 *row = (guint32 *)(data + j * stride);
+			for(i = 0; i < width; i++) {
+				pixels[(n * width + j) * width + i] = row[i];
+			}
+		}
+	}
+	cairo_surface_destroy(img);
+	s->type = t->marker_type;
+	s->size = t->marker_size;
+	s->color = t->marker_color;
+	s->antialias = antialias;
+	s->width = width;
+	s->center = center;
+	s->valid = 1;
+	return 0;
+}
+
+#if DRAW_WITH_XLIB
+/* Works out the runs of pixels a circle marker of the trace covers: those
+ * whose centers are within it when it is centered on a pixel's center.
+ * Returns -1 if the trace has no such markers. */
+static int sprite_update_spans(trace_t *t) {
+	sprite_t *s;
+	int r, j;
+	if(t->marker_type != MARKER_CIRCLE || !sprite_ok(t)) {
+		return -1;
+	}
+	if(t->sprite == NULL) {
+		t->sprite = calloc(1, sizeof(sprite_t));
+		if(t->sprite == NULL) {
+			printf("Error allocating marker sprite\n");
+			return -1;
+		}
+	}
+	s = t->sprite;
+	if(s->spans_valid && s->span_size == t->marker_size) {
+		return 0;
+	}
+	r = (int)floor(t->marker_size / 2.0);
+	XRectangle *spans = realloc(s->spans, (2 * r + 1) * sizeof(XRectangle));
+	if(spans == NULL) {
+		printf("Error allocating marker sprite\n");
+		s->spans_valid = 0;
+		return -1;
+	}
+	s->spans = spans;
+	double rr = t->marker_size * t->marker_size / 4.0;
+	for(j = -r; j <= r; j++) {
+		int half = (int)floor(sqrt(rr - j * j));
+		spans[j + r].x = -half;
+		spans[j + r].y = j;
+		spans[j + r].width = 2 * half + 1;
+		spans[j + r].height = 1;
+	}
+	s->num_spans = 2 * r + 1;
+	s->span_size = t->marker_size;
+	s->spans_valid = 1;
+	return 0;
+}
+#endif
+
+/* premultiplied src over dst */
+static guint32 blend_over(guint32 src, guint32 dst) {
+	guint32 ia = 255 - (src >> 24);
+	guint32 rb = (dst & 0x00ff00ff) * ia + 0x00800080;
+	guint32 ag = ((dst >> 8) & 0x00ff00ff) * ia + 0x00800080;
+	rb = ((rb + ((rb >> 8) & 0x00ff00ff)) >> 8) & 0x00ff00ff;
+	ag = (ag + ((ag >> 8) & 0x00ff00ff)) & 0xff00ff00;
+	return src + rb + ag;
+}
+
+/* stamps the sprite's marker centered at (x, y), to the nearest quarter
+ * pixel, over the pixels inside the clip */
+static void raster_sprite(raster_t *r, sprite_t *s, double x, double y) {
+	// by the quarter-pixel cell alone, which px_dedup() relies on
+	int cx = (int)floor(x * SPRITE_PHASES);
+	int cy = (int)floor(y * SPRITE_PHASES);
+	int px = cx & (SPRITE_PHASES - 1);
+	int py = cy & (SPRITE_PHASES - 1);
+	int w = s->width;
+	int i, j;
+	guint32 *img = s->pixels + (size_t)(py * SPRITE_PHASES + px) * w * w;
+	int left = (cx - px) / SPRITE_PHASES - s->center;
+	int top = (cy - py) / SPRITE_PHASES - s->center;
+	int i0 = (r->x0 > left) ? r->x0 - left : 0;
+	int i1 = (r->x1 < left + w - 1) ? r->x1 - left : w - 1;
+	int j0 = (r->y0 > top) ? r->y0 - top : 0;
+	int j1 = (r->y1 < top + w - 1) ? r->y1 - top : w - 1;
+	for(j = j0; j <= j1; j++) {
+		guint32 *src = img + j * w;
+		guint32 *dst = r->data + (r->origin + (top + j) * r->stride + left + i0);
+		for(i = i0; i <= i1; i++, dst++) {
+			guint32 c = src[i];
+			if(c >= 0xff000000) {
+				*dst = c;
+			}
+			else if(c != 0) {
+				*dst = blend_over(c, *dst);
+			}
+		}
+	}
+	return;
+}
+
+static void pen_move_to(pen_t *pen, double x, double y) {
+	if(pen->r != NULL) {
+		pen->x = x;
+		pen->y = y;
+	}
+	else {
+		cairo_move_to(pen->cr, x, y);
+	}
+	return;
+}
+
+static void pen_line_to(pen_t *pen, double x, double y) {
+	if(pen->r != NULL) {
+		raster_line(pen->r, pen->x, pen->y, x, y);
+		pen->x = x;
+		pen->y = y;
+	}
+	else {
+		cairo_line_to(pen->cr, x, y);
+	}
+	return;
+}
+
+/* draws a trace envelope as one connected path: first -> lo -> hi -> last */
+static void draw_envelope(pen_t *pen, env_pt_t *e, int n) {
+	int k;
+	int pen_down = 0;
+	for(k = 0; k < n; k++) {
+		if(e[k].gap) {
+			pen_down = 0;
+			continue;
+		}
+		if(pen_down) {
+			pen_line_to(pen, e[k].x_first, e[k].y_first);
+		}
+		else {
+			pen_move_to(pen, e[k].x_first, e[k].y_first);
+		}
+		if(e[k].y_lo != e[k].y_hi) {
+			pen_line_to(pen, e[k].x_first, e[k].y_lo);
+			pen_line_to(pen, e[k].x_first, e[k].y_hi);
+		}
+		if(e[k].x_last != e[k].x_first || e[k].y_last != e[k].y_first) {
+			pen_line_to(pen, e[k].x_last, e[k].y_last);
+		}
+		pen_down = 1;
+	}
+	return;
+}
+
+int calc_legend_dims(plot_t *plot, cairo_t *cr, double *width, double *height, double *spacing) {
+	double max_width = 10.;
+	double h_sum = 10.;
+	int i;
+		double w;
+		double h;
+	for(i=0; i < plot->num_traces; i++) {
+		w = get_text_width(cr, plot->traces[i]->name, plot->legend.font_size);
+		h = get_text_height(cr, plot->traces[i]->name, plot->legend.font_size);
+		if(w > max_width) {
+			max_width = w;
+		}
+		h_sum = h_sum + h + 10;
+	}
+	*width = max_width + 15 + 10;
+	*height = h_sum;
+	*spacing = h + 10;
+	return 0;
+}
+
+#if DRAW_WITH_XLIB
+static int draw_legend_x(jbplot *plot) {
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	legend_t *l = &(p->legend);
+	double border_margin = 3.;
+	double line_length = 15;
+	double text_to_line_gap = 5;
+
+	if(!l->needs_redraw) {
+		return 0;
+	}
+	l->needs_redraw = 0;
+
+
+	// create graphics context
+	// TODO: GC gc = XCreateGC(display, d, unsignedlong valuemask, XGCValues *values);
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+
+	// set up a couple colors
+	int blackColor = BlackPixel(priv->xdisp, DefaultScreen(priv->xdisp));
+	int whiteColor = WhitePixel(priv->xdisp, DefaultScreen(priv->xdisp));
+
+	// set some default values in graphics context
+	XSetLineAttributes(
+		priv->xdisp, gc, 
+		1,         // lineWidth
+		LineSolid, // lineStyle
+		CapRound,  //cap_style
+		JoinMiter  // jointStyle
+	);
+	XSetFillStyle(priv->xdisp, gc, FillSolid);
+
+	//First fill the background
+	XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(p->bg_color)));
+	XFillRectangle(priv->xdisp, priv->legend_pixmap, gc, 0, 0, 2000, 2000);
+
+	if(l->position == LEGEND_POS_RIGHT) {
+		// first calculate the widest trace name
+		double max_width = 10.;
+		int i;
+		double w;
+		for(i=0; i < p->num_traces; i++) {
+			/* skip traces with empty names */
+			if(strlen(p->traces[i]->name) == 0) {
+				continue;
+			}
+			w = get_text_width_x(priv->xdisp, gc, p->traces[i]->name);
+			if(w > max_width) {
+				max_width = w;
 			}
 		}
 
@@ -1320,7 +2909,8 @@ static int draw_legend_x(jbplot *plot) {
 			}
 			if(p->traces[i]->marker_type != MARKER_NONE) {
 				XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(p->traces[i]->marker_color)) );
-				XSetLineAttributes(priv->xdisp, gc, p->traces[i]->line_width,LineSolid,CapRound,JoinMiter);
+				// x markers are 1 px wide, as on the plot
+				XSetLineAttributes(priv->xdisp, gc, (p->traces[i]->marker_type == MARKER_X) ? 1 : p->traces[i]->line_width,LineSolid,CapRound,JoinMiter);
 				double h = border_margin + entry_spacing * j + 0.5 * get_text_height_x(priv->xdisp, gc, p->traces[i]->name);
 				draw_marker_x (
 					priv->xdisp, priv->legend_pixmap, gc,
@@ -1403,7 +2993,7 @@ static int draw_legend_x(jbplot *plot) {
 				}
 				if(p->traces[i]->marker_type != MARKER_NONE) {
 					XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(p->traces[i]->marker_color)) );
-					XSetLineAttributes(priv->xdisp, gc, p->traces[i]->line_width,LineSolid,CapRound,JoinMiter);
+					XSetLineAttributes(priv->xdisp, gc, (p->traces[i]->marker_type == MARKER_X) ? 1 : p->traces[i]->line_width,LineSolid,CapRound,JoinMiter);
 					double h = border_margin + 0.5 * get_text_height_x(priv->xdisp, gc, p->traces[i]->name);
 					draw_marker_x (
 						priv->xdisp, priv->legend_pixmap, gc,
@@ -1525,7 +3115,8 @@ static int draw_legend(jbplot *plot) {
 				                     p->traces[i]->marker_color.green,
 				                     p->traces[i]->marker_color.blue
 				);
-				cairo_set_line_width(cr, p->traces[i]->line_width);
+				// x markers are 1 px wide, as on the plot
+				cairo_set_line_width(cr, (p->traces[i]->marker_type == MARKER_X) ? 1.0 : p->traces[i]->line_width);
 				double h = border_margin + entry_spacing * j + 0.5 * get_text_height(cr, p->traces[i]->name, p->legend.font_size);
 				cairo_move_to(cr, x_start + line_length/2., h);
 				draw_marker(cr, p->traces[i]->marker_type, p->traces[i]->marker_size);
@@ -1615,7 +3206,7 @@ static int draw_legend(jbplot *plot) {
 															 p->traces[i]->marker_color.green,
 															 p->traces[i]->marker_color.blue
 					);
-					cairo_set_line_width(cr, p->traces[i]->line_width);
+					cairo_set_line_width(cr, (p->traces[i]->marker_type == MARKER_X) ? 1.0 : p->traces[i]->line_width);
 					double h = border_margin + 0.5 * get_text_height(cr, p->traces[i]->name, p->legend.font_size);
 					cairo_move_to(cr, x + line_length/2., h);
 					draw_marker(cr, p->traces[i]->marker_type, p->traces[i]->marker_size);
@@ -1640,622 +3231,941 @@ static int draw_legend(jbplot *plot) {
 	return 0;
 }
 
-#if DRAW_WITH_XLIB
-// ------ start X11 draw
-static gboolean draw_plot_x(GtkWidget *plot, Drawable d, double width, double height) {
-	int i, j;
-	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
-	plot_t *p = &(priv->plot);
+/* Works out the axis ranges (autoscaling if asked to) and the tic values
+ * and labels for them.
+ */
+static void update_axis_ranges(plot_t *p) {
 	axis_t *x_axis = &(p->x_axis);
 	axis_t *y_axis = &(p->y_axis);
-	plot_area_t *pa = &(p->plot_area);
-	legend_t *l = &(p->legend);
 
-	if(!priv->needs_redraw) {
-		return FALSE;
+	data_range x_range, y_range;
+	if(x_axis->do_autoscale) {
+		if(y_axis->do_autoscale) {
+	  	x_range = get_x_range(p->traces, p->num_traces);
+		}
+		else {
+			data_range yr;
+			yr.min = y_axis->min_val;
+			yr.max = y_axis->max_val;
+			x_range = get_x_range_within_y_range(p->traces, p->num_traces, yr);
+		}
+	}
+	else {
+		x_range.min = x_axis->min_val;
+		x_range.max = x_axis->max_val;
+	}
+	if(y_axis->do_autoscale) {
+		if(x_axis->do_autoscale) {
+			y_range = get_y_range(p->traces, p->num_traces);
+		}
+		else {
+			data_range xr;
+			xr.min = x_axis->min_val;
+			xr.max = x_axis->max_val;
+			y_range = get_y_range_within_x_range(p->traces, p->num_traces, xr);
+		}
+	}
+	else {
+		y_range.min = y_axis->min_val;
+		y_range.max = y_axis->max_val;
 	}
-	priv->needs_redraw = FALSE;
-
-	// create graphics context
-	// TODO: GC gc = XCreateGC(priv->xdisp, d, unsignedlong valuemask, XGCValues *values);
-	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
 
-	// set up a couple colors
-	int blackColor = BlackPixel(priv->xdisp, DefaultScreen(priv->xdisp));
-	int whiteColor = WhitePixel(priv->xdisp, DefaultScreen(priv->xdisp));
+	set_major_tic_values(x_axis, x_range.min, x_range.max);
+	set_major_tic_values(y_axis, y_range.min, y_range.max);
 
-	// set some default values in cairo context
-	///cairo_set_line_width(cr, 1.0);
-	XSetLineAttributes(
-		priv->xdisp, gc, 
-		1,         // lineWidth
-		LineSolid, // lineStyle
-		CapRound,  //cap_style
-		JoinMiter  // jointStyle
-	);
-	XSetFillStyle(priv->xdisp, gc, FillSolid);
-
-	//First fill the background
-	XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(p->bg_color)));
-	XFillRectangle(priv->xdisp, d, gc, 0, 0, width, height);
+	if(!x_axis->do_manual_tics) {
+		set_major_tic_labels(x_axis);
+	}
+	if(!y_axis->do_manual_tics) {
+		set_major_tic_labels(y_axis);
+	}
+	return;
+}
 
-	// now do the layout calcs
-  double title_top_edge = 0.01 * height;
-	double title_bottom_edge;
-	if(p->do_show_plot_title) {
-	  title_bottom_edge = title_top_edge + get_text_height_x(priv->xdisp, gc, p->plot_title);
+static guint64 hash_text(guint64 h, const char *text) {
+	if(text == NULL) {
+		return h * 1099511628211ULL;
 	}
-	else {
-		title_bottom_edge = title_top_edge;
+	while(*text) {
+		h = (h ^ (unsigned char)*text++) * 1099511628211ULL;
 	}
-  double x_label_bottom_edge = height - 0.01*height;
-  double x_label_top_edge = x_label_bottom_edge - 
-                             get_text_height_x(priv->xdisp, gc, x_axis->axis_label);
+	return (h ^ 0xff) * 1099511628211ULL;
+}
 
-	double legend_width, legend_height;
-	double legend_top_edge, legend_left_edge;
+/* Fills in k, which must be zeroed, from axis a */
+static void get_chrome_axis_key(axis_t *a, chrome_axis_key_t *k) {
+	int i;
+	k->min_val = a->min_val;
+	k->max_val = a->max_val;
+	k->num_tics = a->num_actual_major_tics;
+	for(i = 0; i < a->num_actual_major_tics; i++) {
+		k->tic_values[i] = a->major_tic_values[i];
+	}
+	k->do_show_axis_label = a->do_show_axis_label;
+	k->do_show_tic_labels = a->do_show_tic_labels;
+	k->do_show_major_gridlines = a->do_show_major_gridlines;
+	k->do_show_minor_gridlines = a->do_show_minor_gridlines;
+	k->do_manual_tics = a->do_manual_tics;
+	k->log_scale = a->log_scale;
+	k->num_minor_tics_per_major = a->num_minor_tics_per_major;
+	k->axis_label_font_size = a->axis_label_font_size;
+	k->tic_label_font_size = a->tic_label_font_size;
+	k->major_gridline_width = a->major_gridline_width;
+	k->major_gridline_color = a->major_gridline_color;
+	k->major_gridline_type = a->major_gridline_type;
+	return;
+}
 
+static void get_chrome_key(jbplotPrivate *priv, double width, double height, chrome_key_t *k) {
+	int i;
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
+	legend_t *l = &(p->legend);
+	// zeroed first so that the padding compares equal too
+	memset(k, 0, sizeof(chrome_key_t));
+	k->width = width;
+	k->height = height;
+	k->antialias = priv->antialias;
+	k->bg_color = p->bg_color;
+
+	k->left_edge = pa->left_edge;
+	k->right_edge = pa->right_edge;
+	k->top_edge = pa->top_edge;
+	k->bottom_edge = pa->bottom_edge;
+	k->ideal_left_margin = pa->ideal_left_margin;
+	k->ideal_right_margin = pa->ideal_right_margin;
+	k->LR_margin_mode = pa->LR_margin_mode;
+	k->lmargin = pa->lmargin;
+	k->rmargin = pa->rmargin;
+	k->do_show_bounding_box = pa->do_show_bounding_box;
+	k->bounding_box_width = pa->bounding_box_width;
+	k->plot_bg_color = pa->bg_color;
+	k->border_color = pa->border_color;
+
+	k->legend_position = l->position;
+	k->legend_font_size = l->font_size;
+	k->legend_do_show_bounding_box = l->do_show_bounding_box;
+	k->legend_bounding_box_width = l->bounding_box_width;
+	k->legend_bg_color = l->bg_color;
+	k->legend_border_color = l->border_color;
+	k->legend_width = l->size.width;
+	k->legend_height = l->size.height;
+
+	get_chrome_axis_key(&(p->x_axis), &(k->x_axis));
+	get_chrome_axis_key(&(p->y_axis), &(k->y_axis));
+	k->do_show_plot_title = p->do_show_plot_title;
+	k->plot_title_font_size = p->plot_title_font_size;
+
+	guint64 h = 14695981039346656037ULL;
+	h = hash_text(h, p->plot_title);
+	h = hash_text(h, p->x_axis.axis_label);
+	h = hash_text(h, p->y_axis.axis_label);
+	for(i = 0; i < p->x_axis.num_actual_major_tics; i++) {
+		h = hash_text(h, p->x_axis.major_tic_labels[i]);
+	}
+	for(i = 0; i < p->y_axis.num_actual_major_tics; i++) {
+		h = hash_text(h, p->y_axis.major_tic_labels[i]);
+	}
+	k->text_hash = h;
+	return;
+}
 
-	// draw the plot title if desired	
-	XSetForeground(priv->xdisp, gc, BLACK);
-  if(p->do_show_plot_title) {
-		draw_horiz_text_at_point_x(priv->xdisp, d, gc, p->plot_title, 0.5*width, title_top_edge, ANCHOR_TOP_MIDDLE);
-  }
+/* Returns 1 if the cached chrome layer can be reused as is */
+static int chrome_is_current(jbplotPrivate *priv, double width, double height) {
+	chrome_key_t k;
+	if(!priv->chrome_valid || priv->get_ideal_lr ||
+	   priv->needs_h_zoom_signal || priv->needs_v_zoom_signal ||
+	   priv->plot.legend.needs_redraw) {
+		return 0;
+	}
+	get_chrome_key(priv, width, height, &k);
+	return memcmp(&k, &(priv->chrome_key), sizeof(chrome_key_t)) == 0;
+}
 
-#if 1
+static void get_frame_traces(jbplotPrivate *priv, frame_traces_t *ft) {
+	int i;
+	plot_t *p = &(priv->plot);
+	memset(ft, 0, sizeof(frame_traces_t));
+	ft->num_traces = p->num_traces;
+	for(i = 0; i < p->num_traces; i++) {
+		ft->traces[i] = p->traces[i];
+		ft->data_gen[i] = p->traces[i]->data_gen;
+		ft->edit_gen[i] = p->traces[i]->edit_gen;
+	}
+	return;
+}
 
-	/********** Draw the legend ***********************/
-	/* Draw the legend to the legend image buffer */
-	draw_legend_x((jbplot *)plot);
+/* The key of the frame about to be drawn; called once the axis ranges are
+ * settled, before the chrome is drawn */
+static void get_frame_key(jbplotPrivate *priv, double width, double height, frame_key_t *k) {
+	get_chrome_key(priv, width, height, &(k->chrome));
+	// the layout is worked out from the rest
+	chrome_key_t *c = &(k->chrome);
+	c->left_edge = c->right_edge = c->top_edge = c->bottom_edge = 0;
+	c->ideal_left_margin = c->ideal_right_margin = 0;
+	c->legend_width = c->legend_height = 0;
+	get_frame_traces(priv, &(k->traces));
+	return;
+}
 
-	legend_width = l->size.width;
-	legend_height = l->size.height;
+static void get_frame_layout(jbplotPrivate *priv, frame_layout_t *l) {
+	l->plot_area = priv->plot.plot_area;
+	l->x_m = priv->x_m;
+	l->x_b = priv->x_b;
+	l->y_m = priv->y_m;
+	l->y_b = priv->y_b;
+	return;
+}
 
-	/* Then paint the legend image buffer to the plot surface */
-	if(l->position != LEGEND_POS_NONE) {
-		if(l->position == LEGEND_POS_RIGHT) {
-			legend_left_edge = width - legend_width - 10;
-			legend_top_edge = title_bottom_edge + 0.01 * height;
-		}
-		else if(l->position == LEGEND_POS_TOP) {
-			legend_left_edge = (width - legend_width)/2.;
-			legend_top_edge = title_bottom_edge + 10;
+static void frame_cache_evict(jbplotPrivate *priv, int i) {
+	frame_cache_t *fc = &(priv->frames);
+	frame_entry_t *e = &(fc->entries[i]);
+#if DRAW_WITH_XLIB
+	XFreePixmap(priv->xdisp, e->pixmap);
+#else
+	cairo_surface_destroy(e->buffer);
+#endif
+	fc->bytes -= e->bytes;
+	fc->num_entries--;
+	if(i != fc->num_entries) {
+		*e = fc->entries[fc->num_entries];
+	}
+	return;
+}
+
+static void frame_cache_evict_lru(jbplotPrivate *priv) {
+	int i;
+	int lru = 0;
+	frame_cache_t *fc = &(priv->frames);
+	for(i = 1; i < fc->num_entries; i++) {
+		if(fc->entries[i].last_used < fc->entries[lru].last_used) {
+			lru = i;
 		}
-		
-		XCopyArea(priv->xdisp, priv->legend_pixmap, priv->plot_pixmap, gc, 0, 0, l->size.width, l->size.height, legend_left_edge, legend_top_edge);
 	}
-	
+	frame_cache_evict(priv, lru);
+	return;
+}
+
+static void frame_cache_flush(jbplotPrivate *priv) {
+	while(priv->frames.num_entries > 0) {
+		frame_cache_evict(priv, priv->frames.num_entries - 1);
+	}
+	return;
+}
+
+/* The frame just drawn to the widget's buffer is complete */
+static void frame_shown(jbplotPrivate *priv) {
+	get_frame_layout(priv, &(priv->frames.shown_layout));
+	priv->frames.shown_valid = TRUE;
+	return;
+}
+
+/* Keeps a copy of the frame in the widget's buffer */
+static void frame_cache_store(GtkWidget *plot, double width, double height) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	frame_cache_t *fc = &(priv->frames);
+	size_t bytes = (size_t)width * height * 4;
+	if(bytes > fc->max_bytes) {
+		return;
+	}
+	while(fc->num_entries == FRAME_CACHE_ENTRIES || fc->bytes + bytes > fc->max_bytes) {
+		frame_cache_evict_lru(priv);
+	}
+
+	frame_entry_t *e = &(fc->entries[fc->num_entries]);
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	e->pixmap = XCreatePixmap(priv->xdisp, priv->xwin, width, height, XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp)));
+	XCopyArea(priv->xdisp, priv->plot_pixmap, e->pixmap, gc, 0, 0, width, height, 0, 0);
+#else
+	e->buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(e->buffer) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating frame cache buffer: %s\n", cairo_status_to_string(cairo_surface_status(e->buffer)));
+		cairo_surface_destroy(e->buffer);
+		return;
+	}
+	cairo_surface_flush(priv->plot_buffer);
+	cairo_t *cr = cairo_create(e->buffer);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, priv->plot_buffer, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
 #endif
+	e->key = fc->shown_key;
+	e->layout = fc->shown_layout;
+	e->width = width;
+	e->height = height;
+	e->bytes = bytes;
+	e->last_used = ++fc->clock;
+	fc->bytes += bytes;
+	fc->num_entries++;
+	return;
+}
 
-	// calculate data ranges and tic labels
-	data_range x_range, y_range;
-	if(x_axis->do_autoscale) {
-		if(y_axis->do_autoscale) {
-	  	x_range = get_x_range(p->traces, p->num_traces);
+/* Called by the draw functions once the axis ranges are settled.  Puts
+ * the frame on screen in the cache if the view is moving away from it,
+ * then looks for the new one: if it's there, it's copied to the widget's
+ * buffer and the layout restored, and 1 is returned. */
+static int frame_cache_reuse(GtkWidget *plot, double width, double height) {
+	int i;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	frame_cache_t *fc = &(priv->frames);
+	frame_key_t k;
+
+	get_frame_key(priv, width, height, &k);
+	// frames of older traces can't come back
+	for(i = fc->num_entries - 1; i >= 0; i--) {
+		if(memcmp(&(fc->entries[i].key.traces), &(k.traces), sizeof(frame_traces_t)) != 0) {
+			frame_cache_evict(priv, i);
+		}
+	}
+	if(fc->shown_valid && fc->max_bytes > 0 &&
+	   memcmp(&(fc->shown_key.traces), &(k.traces), sizeof(frame_traces_t)) == 0 &&
+	   memcmp(&(fc->shown_key), &k, sizeof(frame_key_t)) != 0) {
+		for(i = 0; i < fc->num_entries; i++) {
+			if(memcmp(&(fc->entries[i].key), &(fc->shown_key), sizeof(frame_key_t)) == 0) {
+				break;
+			}
 		}
-		else {
-			data_range yr;
-			yr.min = y_axis->min_val;
-			yr.max = y_axis->max_val;
-			x_range = get_x_range_within_y_range(p->traces, p->num_traces, yr);
+		if(i == fc->num_entries) {
+			frame_cache_store(plot, width, height);
 		}
 	}
-	else {
-		x_range.min = x_axis->min_val;
-		x_range.max = x_axis->max_val;
+	fc->shown_key = k;
+	fc->shown_valid = FALSE;
+
+	// the chrome has to be drawn for these
+	if(priv->get_ideal_lr || priv->needs_h_zoom_signal || priv->needs_v_zoom_signal) {
+		return 0;
 	}
-	if(y_axis->do_autoscale) {
-		if(x_axis->do_autoscale) {
-			y_range = get_y_range(p->traces, p->num_traces);
-		}
-		else {
-			data_range xr;
-			xr.min = x_axis->min_val;
-			xr.max = x_axis->max_val;
-			y_range = get_y_range_within_x_range(p->traces, p->num_traces, xr);
+	for(i = 0; i < fc->num_entries; i++) {
+		frame_entry_t *e = &(fc->entries[i]);
+		if(memcmp(&(e->key), &k, sizeof(frame_key_t)) != 0) {
+			continue;
 		}
+#if DRAW_WITH_XLIB
+		GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+		XCopyArea(priv->xdisp, e->pixmap, priv->plot_pixmap, gc, 0, 0, width, height, 0, 0);
+#else
+		cairo_save(priv->plot_context);
+		cairo_set_operator(priv->plot_context, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface(priv->plot_context, e->buffer, 0, 0);
+		cairo_paint(priv->plot_context);
+		cairo_restore(priv->plot_context);
+#endif
+		priv->plot.plot_area = e->layout.plot_area;
+		priv->x_m = e->layout.x_m;
+		priv->x_b = e->layout.x_b;
+		priv->y_m = e->layout.y_m;
+		priv->y_b = e->layout.y_b;
+		e->last_used = ++fc->clock;
+		fc->shown_layout = e->layout;
+		fc->shown_valid = TRUE;
+		priv->sched.stats.cached++;
+		return 1;
 	}
-	else {
-		y_range.min = y_axis->min_val;
-		y_range.max = y_axis->max_val;
-	}
+	return 0;
+}
 
-	set_major_tic_values(x_axis, x_range.min, x_range.max);
-	set_major_tic_values(y_axis, y_range.min, y_range.max);
+/* Decides how much of the scroll layer has to be redrawn.  If the layout,
+ * the y transform and the x scale are unchanged, no trace was edited other
+ * than by appending, and the x range only moved right, the layer can be
+ * shifted left by *shift pixels and tp is narrowed to the columns exposed
+ * on the right plus whatever was appended since the last frame.  Returns
+ * 1 in that case and 0 if the whole layer has to be redrawn.
+ */
+static int scroll_layer_plan(jbplotPrivate *priv, trace_pass_t *tp, int *shift) {
+	int i;
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
+	scroll_layer_t *sl = &(priv->scroll);
+	*shift = 0;
 
-	if(!x_axis->do_manual_tics) {
-		set_major_tic_labels(x_axis);
+	if(!sl->valid ||
+	   sl->left != pa->left_edge || sl->right != pa->right_edge ||
+	   sl->top != pa->top_edge || sl->bottom != pa->bottom_edge ||
+	   sl->num_traces != p->num_traces) {
+		return 0;
 	}
-	if(!y_axis->do_manual_tics) {
-		set_major_tic_labels(y_axis);
+	// transforms have to agree to well under a pixel across the plot area
+	double dy = p->y_axis.max_val - p->y_axis.min_val;
+	if(fabs((tp->x_m - sl->x_m) * (tp->x_hi - tp->x_lo)) > 1e-3 ||
+	   fabs((tp->y_m - sl->y_m) * dy) > 1e-3 ||
+	   fabs((tp->y_m * p->y_axis.min_val + tp->y_b) - (sl->y_m * p->y_axis.min_val + sl->y_b)) > 1e-3) {
+		return 0;
 	}
-
-	double max_y_label_width = get_widest_label_width_x(y_axis, priv->xdisp, gc);
-	double y_tic_labels_left_edge;
-	double y_tic_labels_right_edge;
-	double plot_area_left_edge;
-	double plot_area_right_edge;
-	double y_label_left_edge;
-	double y_label_right_edge; 
-
-	// fire a zoom signal if needed
-	if((priv->needs_h_zoom_signal || priv->needs_v_zoom_signal) && !priv->get_ideal_lr) {
-		g_signal_emit_by_name((gpointer *)plot, "zoom-in", x_axis->min_val, x_axis->max_val, y_axis->min_val, y_axis->max_val);
-		priv->needs_h_zoom_signal = FALSE;
-		priv->needs_v_zoom_signal = FALSE;
+	double d = floor(sl->x_b - tp->x_b + 0.5);
+	if(d < 0 || d >= sl->right - sl->left) {
+		return 0;
 	}
-
-	if(priv->plot.plot_area.LR_margin_mode == MARGIN_AUTO || priv->get_ideal_lr) {
-		y_label_left_edge = MED_GAP;
-		y_label_right_edge = y_label_left_edge + 
-			get_text_height_x(priv->xdisp, gc, y_axis->axis_label);
-		if(y_axis->do_show_axis_label) {
-			y_tic_labels_left_edge = y_label_right_edge + MED_GAP;
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		if(t != sl->traces[i] || t->edit_gen != sl->edit_gen[i] ||
+		   !t->x_monotonic || t->decimate_divisor != 1 || t->length <= 0) {
+			return 0;
 		}
-		else {
-			y_tic_labels_left_edge = MED_GAP;
+		// samples dropped off the front must all be out of view by now
+		double first_x = trace_x(t, trace_slot(t, 0));
+		if(first_x != sl->first_x[i] && first_x > tp->x_lo) {
+			return 0;
 		}
+	}
 
-		y_tic_labels_right_edge = y_tic_labels_left_edge + max_y_label_width;
-		plot_area_left_edge = y_tic_labels_right_edge + MED_GAP;
+	*shift = d;
+	tp->x_m = sl->x_m;
+	tp->x_b = sl->x_b - d;
+	tp->y_m = sl->y_m;
+	tp->y_b = sl->y_b;
 
-		if(l->position == LEGEND_POS_RIGHT) {
-			plot_area_right_edge = legend_left_edge - 10;
-		}
-		else {
-			plot_area_right_edge = width - 0.06 * width;
+	// redraw from the first exposed column, or from the last sample drawn
+	// if that's further left
+	double col = floor(sl->right) - d;
+	for(i = 0; i < p->num_traces; i++) {
+		if(isnan(sl->last_x[i])) {
+			continue;
 		}
-
-		double right_side_x_tic_label_width = 
-			get_text_width_x(priv->xdisp, gc, 
-			x_axis->major_tic_labels[x_axis->num_actual_major_tics-1]);
-		if(0.5*right_side_x_tic_label_width > (width - plot_area_right_edge)) {
-			plot_area_right_edge = width - right_side_x_tic_label_width;
+		double px = floor(tp->x_m * sl->last_x[i] + tp->x_b);
+		if(px < col) {
+			col = px;
 		}
-		priv->plot.plot_area.left_edge = plot_area_left_edge;
-		priv->plot.plot_area.ideal_left_margin = plot_area_left_edge;
-		priv->plot.plot_area.right_edge = plot_area_right_edge;
-		priv->plot.plot_area.ideal_right_margin = width - plot_area_right_edge;
 	}
-	if(priv->get_ideal_lr) {
-		return FALSE;
+	if(col < floor(pa->left_edge)) {
+		col = floor(pa->left_edge);
 	}
-	if(priv->plot.plot_area.LR_margin_mode != MARGIN_AUTO) {
-		if(priv->plot.plot_area.LR_margin_mode == MARGIN_PERCENT) {
-			plot_area_left_edge = priv->plot.plot_area.lmargin * width;
-			plot_area_right_edge = width - priv->plot.plot_area.rmargin * width;
+	tp->clip_left = col;
+	tp->clip_markers = 1;
+	tp->mark_left = col;
+	tp->mark_right = tp->clip_right;
+	tp->x_lo = (col - tp->x_b) / tp->x_m;
+	return 1;
+}
+
+/* Records what the scroll layer now holds */
+static void scroll_layer_commit(jbplotPrivate *priv, trace_pass_t *tp) {
+	int i;
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
+	scroll_layer_t *sl = &(priv->scroll);
+	sl->left = pa->left_edge;
+	sl->right = pa->right_edge;
+	sl->top = pa->top_edge;
+	sl->bottom = pa->bottom_edge;
+	sl->x_m = tp->x_m;
+	sl->x_b = tp->x_b;
+	sl->y_m = tp->y_m;
+	sl->y_b = tp->y_b;
+	sl->num_traces = p->num_traces;
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		sl->traces[i] = t;
+		sl->edit_gen[i] = t->edit_gen;
+		if(t->length > 0) {
+			sl->first_x[i] = trace_x(t, trace_slot(t, 0));
+			sl->last_x[i] = trace_x(t, trace_slot(t, t->length - 1));
 		}
-		else { // pixels
-			plot_area_left_edge = priv->plot.plot_area.lmargin;
-			plot_area_right_edge = width - priv->plot.plot_area.rmargin;
+		else {
+			sl->first_x[i] = NAN;
+			sl->last_x[i] = NAN;
 		}
-		priv->plot.plot_area.left_edge = plot_area_left_edge;
-		priv->plot.plot_area.right_edge = plot_area_right_edge;
-		y_tic_labels_right_edge = plot_area_left_edge - MED_GAP;
-		y_tic_labels_left_edge = y_tic_labels_right_edge - max_y_label_width;
-		y_label_right_edge = y_tic_labels_left_edge - MED_GAP;
-		y_label_left_edge = y_label_right_edge - 
-			get_text_height_x(priv->xdisp, gc, y_axis->axis_label);
 	}
+	sl->valid = 1;
+	return;
+}
 
-	double plot_area_top_edge;
-	if(l->position == LEGEND_POS_TOP) {
-		plot_area_top_edge = legend_top_edge + legend_height + 2*MED_GAP;
+static void *render_worker_main(void *arg) {
+	render_worker_t *w = arg;
+	render_pool_t *pool = w->pool;
+	unsigned int seen = 0;
+	pthread_mutex_lock(&(pool->lock));
+	for(;;) {
+		while(!pool->quit && pool->batch == seen) {
+			pthread_cond_wait(&(pool->wake), &(pool->lock));
+		}
+		if(pool->quit) {
+			break;
+		}
+		seen = pool->batch;
+		while(pool->next_job < pool->num_jobs) {
+			int job = pool->next_job++;
+			pthread_mutex_unlock(&(pool->lock));
+			pool->run(pool->ctx, job, &(w->scratch));
+			pthread_mutex_lock(&(pool->lock));
+			if(--pool->jobs_left == 0) {
+				pthread_cond_signal(&(pool->done));
+			}
+		}
 	}
-	else {
-		plot_area_top_edge = title_bottom_edge + 2*MED_GAP;
+	pthread_mutex_unlock(&(pool->lock));
+	return NULL;
+}
+
+static void render_pool_destroy(render_pool_t *pool) {
+	int i;
+	if(pool == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&(pool->lock));
+	pool->quit = 1;
+	pthread_cond_broadcast(&(pool->wake));
+	pthread_mutex_unlock(&(pool->lock));
+	for(i = 0; i < pool->num_workers; i++) {
+		pthread_join(pool->workers[i].thread, NULL);
+		free(pool->workers[i].scratch.env);
+		free(pool->workers[i].scratch.occupied);
+	}
+	pthread_mutex_destroy(&(pool->lock));
+	pthread_cond_destroy(&(pool->wake));
+	pthread_cond_destroy(&(pool->done));
+	free(pool);
+	return;
+}
+
+/* Starts num_workers threads; returns NULL if not even one would start */
+static render_pool_t *render_pool_create(int num_workers) {
+	int i;
+	render_pool_t *pool = calloc(1, sizeof(render_pool_t));
+	if(pool == NULL) {
+		printf("Error allocating render pool\n");
+		return NULL;
 	}
-	priv->plot.plot_area.top_edge = plot_area_top_edge;
-  double x_tic_labels_bottom_edge;
-	if(x_axis->do_show_axis_label) {
-		x_tic_labels_bottom_edge = x_label_top_edge - MED_GAP;
+	pthread_mutex_init(&(pool->lock), NULL);
+	pthread_cond_init(&(pool->wake), NULL);
+	pthread_cond_init(&(pool->done), NULL);
+	for(i = 0; i < num_workers && i < MAX_RENDER_THREADS; i++) {
+		pool->workers[i].pool = pool;
+		if(pthread_create(&(pool->workers[i].thread), NULL, render_worker_main, &(pool->workers[i])) != 0) {
+			break;
+		}
+		pool->num_workers++;
 	}
-	else {
-		x_tic_labels_bottom_edge = height - MED_GAP;
+	if(pool->num_workers == 0) {
+		printf("Error starting render threads\n");
+		render_pool_destroy(pool);
+		return NULL;
 	}
+	return pool;
+}
 
-  double x_tic_labels_height = get_text_height_x(priv->xdisp, gc, x_axis->major_tic_labels[0]);
-  double x_tic_labels_top_edge = x_tic_labels_bottom_edge - x_tic_labels_height;
-  double plot_area_bottom_edge = x_tic_labels_top_edge - MED_GAP;
-	priv->plot.plot_area.bottom_edge = plot_area_bottom_edge;
-  double plot_area_height = plot_area_bottom_edge - plot_area_top_edge;
-  double plot_area_width = plot_area_right_edge - plot_area_left_edge;
-  double y_label_middle_y = plot_area_top_edge + plot_area_height/2;
-  double y_label_bottom_edge = y_label_middle_y + 0.5*get_text_width_x(priv->xdisp, gc, y_axis->axis_label);
-  double x_label_middle_x = plot_area_left_edge + plot_area_width/2;
+/* Runs jobs [0, num_jobs) on the pool and the calling thread, which uses
+ * rs for its share.  Returns once they have all finished. */
+static void render_pool_run(render_pool_t *pool, void (*run)(void *, int, render_scratch_t *), void *ctx, int num_jobs, render_scratch_t *rs) {
+	pthread_mutex_lock(&(pool->lock));
+	pool->run = run;
+	pool->ctx = ctx;
+	pool->num_jobs = num_jobs;
+	pool->next_job = 0;
+	pool->jobs_left = num_jobs;
+	pool->batch++;
+	pthread_cond_broadcast(&(pool->wake));
+	while(pool->next_job < pool->num_jobs) {
+		int job = pool->next_job++;
+		pthread_mutex_unlock(&(pool->lock));
+		run(ctx, job, rs);
+		pthread_mutex_lock(&(pool->lock));
+		pool->jobs_left--;
+	}
+	while(pool->jobs_left > 0) {
+		pthread_cond_wait(&(pool->done), &(pool->lock));
+	}
+	pthread_mutex_unlock(&(pool->lock));
+	return;
+}
 
-	// these params can be used to transform from data coordinates to pixel coords
-	// for x-direction, use: x_pixel = x_m * x_data + x_b
-	// for y-direction, use: y_pixel = y_m * y_data + y_b	
-	double x_m = (plot_area_right_edge - plot_area_left_edge) / (x_axis->max_val - x_axis->min_val);	
-	double x_b = plot_area_left_edge - x_m * x_axis->min_val;	
-	double y_m = (plot_area_top_edge - plot_area_bottom_edge) / (y_axis->max_val - y_axis->min_val);	
-	double y_b = plot_area_bottom_edge - y_m * y_axis->min_val;
-	priv->x_m = x_m;	
-	priv->y_m = y_m;	
-	priv->x_b = x_b;	
-	priv->y_b = y_b;	
-	
-	// fill the plot area (we'll stroke the border later)
-	XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(pa->bg_color)) );
-	XFillRectangle(priv->xdisp, d, gc, 
-		plot_area_left_edge, 
-		plot_area_top_edge,
-		(plot_area_right_edge-plot_area_left_edge),
-		(plot_area_bottom_edge-plot_area_top_edge)
-	);
+/* Starts the render pool the first time it's wanted; NULL if threading
+ * is off or the threads won't start */
+static render_pool_t *get_render_pool(jbplotPrivate *priv) {
+	if(priv->render_threads < 2) {
+		return NULL;
+	}
+	if(priv->render_pool == NULL) {
+		priv->render_pool = render_pool_create(priv->render_threads - 1);
+	}
+	return priv->render_pool;
+}
 
-	// draw the y tic labels
-	XSetForeground(priv->xdisp, gc, BLACK);
-	///cairo_set_font_size(cr, y_axis->tic_label_font_size);
-	if(y_axis->do_manual_tics) {
-		for(i=0; i<y_axis->num_actual_major_tics; i++) {
-			double val = y_axis->major_tic_values[i];
-			if(val <= y_axis->max_val && val >= y_axis->min_val) {
-				draw_horiz_text_at_point_x(
-					priv->xdisp, d, gc, 
-					y_axis->major_tic_labels[i], 
-					y_tic_labels_right_edge, 
-					y_m * y_axis->major_tic_values[i] + y_b, 
-					ANCHOR_MIDDLE_RIGHT
-				);
-			}
+#define DENSITY_MIN_SHADE 48          // shade of a pixel holding one sample
+#define DENSITY_PARALLEL_MIN 262144   // samples worth binning on the pool
+
+static int trace_is_density(trace_t *t) {
+	return t->density != NULL && t->density->mode != DENSITY_NONE;
+}
+
+static void density_free(trace_t *t) {
+	density_t *d = t->density;
+	if(d != NULL) {
+		free(d->counts);
+		if(d->image != NULL) {
+			cairo_surface_destroy(d->image);
 		}
+#if DRAW_WITH_XLIB
+		free(d->points);
+#endif
+		free(d);
+		t->density = NULL;
 	}
-	else {
-		for(i=0; i<y_axis->num_actual_major_tics; i++) {
-			draw_horiz_text_at_point_x(
-				priv->xdisp, d, gc, 
-				y_axis->major_tic_labels[i], 
-				y_tic_labels_right_edge, 
-				y_m * y_axis->major_tic_values[i] + y_b, 
-				ANCHOR_MIDDLE_RIGHT
-			);
-		}
+}
+
+static void density_parts_free(jbplotPrivate *priv) {
+	int i;
+	for(i = 0; i < MAX_RENDER_THREADS; i++) {
+		free(priv->density_parts[i]);
+		priv->density_parts[i] = NULL;
 	}
+	priv->density_parts_size = 0;
+	return;
+}
 
-	// draw the y major gridlines
-	if(y_axis->do_show_major_gridlines && y_axis->major_gridline_type != LINETYPE_NONE) {
-		if(y_axis->major_gridline_type == LINETYPE_SOLID) {
-			XSetLineAttributes(
-				priv->xdisp, gc, 
-				y_axis->major_gridline_width,  // lineWidth
-				LineSolid, // lineStyle
-				CapRound,  //cap_style
-				JoinMiter  // jointStyle
-			);
-		}	
-		else if(y_axis->major_gridline_type == LINETYPE_DASHED) {
-			XSetLineAttributes(
-				priv->xdisp, gc, 
-				y_axis->major_gridline_width,  // lineWidth
-				LineOnOffDash, // lineStyle
-				CapRound,  //cap_style
-				JoinMiter  // jointStyle
-			);
-		}	
-		else if(y_axis->major_gridline_type == LINETYPE_DOTTED) {
-			XSetLineAttributes(
-				priv->xdisp, gc, 
-				y_axis->major_gridline_width,  // lineWidth
-				LineOnOffDash, // lineStyle
-				CapRound,  //cap_style
-				JoinMiter  // jointStyle
-			);
-		}	
-		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(y_axis->major_gridline_color)) );
-		if(y_axis->do_manual_tics) {
-			for(i=0; i<y_axis->num_actual_major_tics; i++) {
-				double val = y_axis->major_tic_values[i];
-				if(val <= y_axis->max_val && val >= y_axis->min_val) {
-					double y = y_m * y_axis->major_tic_values[i] + y_b;
-					XDrawLine(priv->xdisp, d, gc, plot_area_left_edge, y , plot_area_right_edge, y);
+/* Adds logical samples [j0, j1) into counts, a w x h box of pixels whose
+ * top left corner is at (left, top) */
+static void density_bin(trace_t *t, int j0, int j1, trace_pass_t *tp, int left, int top, int w, int h, guint32 *counts, render_scratch_t *rs) {
+	int j, k, n;
+	rs->bounds[0] = left;
+	rs->bounds[1] = left + w;
+	rs->bounds[2] = top;
+	rs->bounds[3] = top + h;
+	for(j = j0; j < j1; j += n) {
+		n = trace_to_px(t, j, j1 - 1, 1, tp->x_m, tp->x_b, tp->y_m, tp->y_b, rs);
+		for(k = 0; k < n; k++) {
+			if(rs->cls[k] == PX_IN) {
+				// in the box, so the truncation is a floor
+				int ix = (int)(rs->x_px[k] - left);
+				int iy = (int)(rs->y_px[k] - top);
+				if(ix < w && iy < h) {
+					counts[iy * w + ix]++;
 				}
 			}
-		}	
-		else {
-			for(i=0; i<y_axis->num_actual_major_tics; i++) {
-				double y = y_m * y_axis->major_tic_values[i] + y_b;
-				XDrawLine(priv->xdisp, d, gc, plot_area_left_edge, y , plot_area_right_edge, y);
-			}
 		}
 	}
+	return;
+}
 
-	// draw the x tic labels
-	XSetForeground(priv->xdisp, gc, BLACK);
-	///cairo_set_font_size(cr, x_axis->tic_label_font_size);
-	if(x_axis->do_manual_tics) {
-		for(i=0; i<x_axis->num_actual_major_tics; i++) {
-			double val = x_axis->major_tic_values[i];
-			if(val <= x_axis->max_val && val >= x_axis->min_val) {
-				draw_horiz_text_at_point_x(
-					priv->xdisp, d, gc, 
-					x_axis->major_tic_labels[i], 
-					x_m * val + x_b, 
-					x_tic_labels_top_edge, 
-					ANCHOR_TOP_MIDDLE
-				);
-			}
+/* Binning split over the render pool: job k bins its share of the
+ * samples into parts[k], then the parts are summed a band of rows per
+ * job.  Part 0 is the counts themselves. */
+typedef struct density_batch_t {
+	trace_t *t;
+	trace_pass_t *tp;
+	int j0, j1;
+	int num_parts;
+	guint32 *parts[MAX_RENDER_THREADS + 1];
+} density_batch_t;
+
+static void run_density_bin(void *ctx, int k, render_scratch_t *rs) {
+	density_batch_t *b = ctx;
+	density_t *d = b->t->density;
+	int a = b->j0 + (int)((long long)(b->j1 - b->j0) * k / b->num_parts);
+	int c = b->j0 + (int)((long long)(b->j1 - b->j0) * (k + 1) / b->num_parts);
+	if(k > 0) {
+		memset(b->parts[k], 0, d->width * d->height * sizeof(guint32));
+	}
+	density_bin(b->t, a, c, b->tp, d->left, d->top, d->width, d->height, b->parts[k], rs);
+	return;
+}
+
+static void run_density_merge(void *ctx, int k, render_scratch_t *rs) {
+	density_batch_t *b = ctx;
+	density_t *d = b->t->density;
+	int i, p;
+	int a = (int)((long long)d->width * d->height * k / b->num_parts);
+	int c = (int)((long long)d->width * d->height * (k + 1) / b->num_parts);
+	for(p = 1; p < b->num_parts; p++) {
+		guint32 *part = b->parts[p];
+		for(i = a; i < c; i++) {
+			d->counts[i] += part[i];
 		}
 	}
-	else {
-		for(i=0; i<x_axis->num_actual_major_tics; i++) {
-			draw_horiz_text_at_point_x(
-				priv->xdisp, d, gc, 
-				x_axis->major_tic_labels[i], 
-				x_m * x_axis->major_tic_values[i] + x_b, 
-				x_tic_labels_top_edge, 
-				ANCHOR_TOP_MIDDLE
-			);
-		}
+	return;
+}
+
+/* Brings the counts of the density traces up to date for pass tp,
+ * binning over the plot area */
+static void density_update(jbplotPrivate *priv, trace_pass_t *tp) {
+	int i, k;
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
+	int left = floor(pa->left_edge);
+	int top = floor(pa->top_edge);
+	int w = (int)ceil(pa->right_edge) - left;
+	int h = (int)ceil(pa->bottom_edge) - top;
+	if(w < 1 || h < 1) {
+		return;
 	}
-	
-	// draw the x major gridlines
-	if(x_axis->do_show_major_gridlines && x_axis->major_gridline_type != LINETYPE_NONE) {
-		if(x_axis->major_gridline_type == LINETYPE_SOLID) {
-			XSetLineAttributes(
-				priv->xdisp, gc, 
-				y_axis->major_gridline_width,  // lineWidth
-				LineSolid, // lineStyle
-				CapRound,  //cap_style
-				JoinMiter  // jointStyle
-			);
-		}	
-		else if(x_axis->major_gridline_type == LINETYPE_DASHED) {
-			XSetLineAttributes(
-				priv->xdisp, gc, 
-				y_axis->major_gridline_width,  // lineWidth
-				LineOnOffDash, // lineStyle
-				CapRound,  //cap_style
-				JoinMiter  // jointStyle
-			);
-		}	
-		else if(x_axis->major_gridline_type == LINETYPE_DOTTED) {
-			XSetLineAttributes(
-				priv->xdisp, gc, 
-				y_axis->major_gridline_width,  // lineWidth
-				LineOnOffDash, // lineStyle
-				CapRound,  //cap_style
-				JoinMiter  // jointStyle
-			);
-		}	
-		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(x_axis->major_gridline_color)) );
-		if(x_axis->do_manual_tics) {
-			for(i=0; i<x_axis->num_actual_major_tics; i++) {
-				double val = x_axis->major_tic_values[i];
-				if(val <= x_axis->max_val && val >= x_axis->min_val) {
-					double x = x_m * val + x_b;		
-					XDrawLine(priv->xdisp, d, gc, x, plot_area_top_edge, x, plot_area_bottom_edge);
-				}
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		density_t *d = t->density;
+		int j0 = 0;
+		if(!trace_is_density(t)) {
+			continue;
+		}
+		if(d->valid && d->left == left && d->top == top && d->width == w && d->height == h &&
+		   d->x_m == tp->x_m && d->x_b == tp->x_b && d->y_m == tp->y_m && d->y_b == tp->y_b &&
+		   d->edit_gen == t->edit_gen && d->first_seq == t->first_seq &&
+		   d->end_seq <= t->first_seq + t->length) {
+			// only samples appended since the last frame are new
+			j0 = d->end_seq - t->first_seq;
+			if(j0 == t->length) {
+				continue;
 			}
 		}
 		else {
-			for(i=0; i<x_axis->num_actual_major_tics; i++) {
-				double x = x_m * x_axis->major_tic_values[i] + x_b;		
-				XDrawLine(priv->xdisp, d, gc, x, plot_area_top_edge, x, plot_area_bottom_edge);
+			if(d->size < w * h) {
+				guint32 *c = realloc(d->counts, w * h * sizeof(guint32));
+				if(c == NULL) {
+					printf("Error allocating density counts\n");
+					d->valid = 0;
+					continue;
+				}
+				d->counts = c;
+				d->size = w * h;
+			}
+			memset(d->counts, 0, w * h * sizeof(guint32));
+			d->left = left;
+			d->top = top;
+			d->width = w;
+			d->height = h;
+			d->x_m = tp->x_m;
+			d->x_b = tp->x_b;
+			d->y_m = tp->y_m;
+			d->y_b = tp->y_b;
+			d->edit_gen = t->edit_gen;
+			d->first_seq = t->first_seq;
+		}
+
+		render_pool_t *pool = NULL;
+		if(t->length - j0 >= DENSITY_PARALLEL_MIN) {
+			pool = get_render_pool(priv);
+		}
+		if(pool != NULL && priv->density_parts_size < w * h) {
+			density_parts_free(priv);
+			for(k = 0; k < pool->num_workers; k++) {
+				priv->density_parts[k] = malloc(w * h * sizeof(guint32));
+				if(priv->density_parts[k] == NULL) {
+					printf("Error allocating density counts\n");
+					density_parts_free(priv);
+					pool = NULL;
+					break;
+				}
+			}
+			if(pool != NULL) {
+				priv->density_parts_size = w * h;
+			}
+		}
+		if(pool != NULL) {
+			density_batch_t b;
+			b.t = t;
+			b.tp = tp;
+			b.j0 = j0;
+			b.j1 = t->length;
+			b.num_parts = pool->num_workers + 1;
+			b.parts[0] = d->counts;
+			for(k = 1; k < b.num_parts; k++) {
+				b.parts[k] = priv->density_parts[k - 1];
 			}
+			render_pool_run(pool, run_density_bin, &b, b.num_parts, &(priv->scratch));
+			render_pool_run(pool, run_density_merge, &b, b.num_parts, &(priv->scratch));
 		}
+		else {
+			density_bin(t, j0, t->length, tp, left, top, w, h, d->counts, &(priv->scratch));
+		}
+		d->end_seq = t->first_seq + t->length;
+		d->valid = 1;
+		d->counts_gen++;
 	}
+	return;
+}
 
-#if 0
-	// draw the y-axis label if desired
-	cairo_set_source_rgb (cr, 0, 0, 0);
-	if(y_axis->do_show_axis_label) {
-		draw_vert_text_at_point(	plot,
-															cr, 
-															y_axis->axis_label, 
-															y_label_left_edge, 
-															y_label_bottom_edge, 
-															ANCHOR_BOTTOM_LEFT
-														);
+/* Maps counts to shades 0-255: 0 for none, DENSITY_MIN_SHADE for a single
+ * sample and full for the fullest pixel, linear or logarithmic between.
+ * Counts below 256 are looked up. */
+typedef struct density_scale_t {
+	int mode;
+	guint32 max_count;
+	double log_max;
+	unsigned char small[256];
+} density_scale_t;
+
+static int density_shade_of(density_scale_t *s, guint32 c) {
+	double f;
+	if(c == 0) {
+		return 0;
 	}
-#endif
-	
-	// draw the x-axis label if desired
-	XSetForeground(priv->xdisp, gc, BLACK);
-	if(x_axis->do_show_axis_label) {
-		draw_horiz_text_at_point_x(
-			priv->xdisp, d, gc, 
-			x_axis->axis_label, 
-			x_label_middle_x, 
-			x_label_top_edge, 
-			ANCHOR_TOP_MIDDLE
-		);
+	if(s->max_count <= 1) {
+		f = 1;
 	}
+	else if(s->mode == DENSITY_LOG) {
+		f = log((double)c) / s->log_max;
+	}
+	else {
+		f = (double)(c - 1) / (s->max_count - 1);
+	}
+	return DENSITY_MIN_SHADE + (int)((255 - DENSITY_MIN_SHADE) * f + 0.5);
+}
 
-	/*********** draw the plot area border ******************/
-	if(pa->do_show_bounding_box) {
-		//cairo_set_source_rgb (cr, pa->border_color.red, pa->border_color.green, pa->border_color.blue);
-		XSetForeground(priv->xdisp, gc, BLACK);
-		XSetLineAttributes(
-			priv->xdisp, gc, 
-			y_axis->major_gridline_width,  // lineWidth
-			LineSolid, // lineStyle
-			CapRound,  //cap_style
-			JoinMiter  // jointStyle
-		);
-
-		XDrawRectangle(
-			priv->xdisp, d, gc, 
-			plot_area_left_edge - pa->bounding_box_width, 
-			plot_area_top_edge - pa->bounding_box_width,
-			plot_area_right_edge - plot_area_left_edge + 2*pa->bounding_box_width,
-			plot_area_bottom_edge - plot_area_top_edge + 2*pa->bounding_box_width
-		);
+static void density_scale_init(density_scale_t *s, density_t *d) {
+	int i;
+	int n = d->width * d->height;
+	s->mode = d->mode;
+	s->max_count = 0;
+	for(i = 0; i < n; i++) {
+		if(d->counts[i] > s->max_count) {
+			s->max_count = d->counts[i];
+		}
+	}
+	s->log_max = log((double)s->max_count);
+	for(i = 0; i < 256; i++) {
+		s->small[i] = density_shade_of(s, i);
 	}
+	return;
+}
 
-	/*************** Draw the data ******************/
-
-	// set the clip region to the plot area
-	XRectangle clip_rect;
-	clip_rect.x = plot_area_left_edge;
-	clip_rect.y = plot_area_top_edge;
-	clip_rect.width = (plot_area_right_edge-plot_area_left_edge);
-	clip_rect.height = (plot_area_bottom_edge-plot_area_top_edge);
-	XSetClipRectangles(
-		priv->xdisp, gc, 
-		0, 0,          // clip origin (x,y) 
-		&clip_rect, 1, // clipping rectangle
-		Unsorted       // ordering
-	);
-
-	// now draw the trace lines (if requested)
-	for(i = 0; i < p->num_traces; i++) {
-		char first_pt = 1;
-		char last_was_NAN = 0;
-		char last_was_out = 0;
-		trace_t *t = p->traces[i];
-		if(t->line_type == LINETYPE_NONE) {
-			continue;
-		}
-		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(t->line_color)) );
+static inline int density_shade(density_scale_t *s, guint32 c) {
+	return (c < 256) ? s->small[c] : density_shade_of(s, c);
+}
 
-		if(t->line_type == LINETYPE_SOLID) {
-			XSetLineAttributes(priv->xdisp, gc, t->line_width, LineSolid,CapRound,JoinMiter);
-		}	
-		else if(t->line_type == LINETYPE_DASHED) {
-			XSetLineAttributes(priv->xdisp, gc, t->line_width, LineOnOffDash, CapRound, JoinMiter);
-		}	
-		else if(t->line_type == LINETYPE_DOTTED) {
-			XSetLineAttributes(priv->xdisp, gc, t->line_width, LineDoubleDash, CapRound, JoinMiter);
-		}	
-		if(t->length <= 0) continue;
-		int dd = t->decimate_divisor;
-		if(t->lossless_decimation) {
-			for(j = 0; j < t->length; j += dd) {
-				int last_x_px, last_y_px;
-				double min_y, max_y;
-				int n = t->start_index + j;
-				if(n >= t->capacity) {
-					n -= t->capacity;
-				}
-				double x_px = x_m * t->x_data[n] + x_b;
-				double y_px = y_m * t->y_data[n] + y_b;
-				if(first_pt) {
-					/// Why is this next line needed!!??
-					/// cairo_move_to(cr,	x_px,	y_px);
-					first_pt = 0;
-					min_y = max_y = y_px;
-				}
-				else {
-					if(x_px != last_x_px) {
-						/* first draw vertical line spanning min to max for previous x-pixel */
-						XDrawLine(priv->xdisp, d, gc, last_x_px, min_y, last_x_px, max_y);
-						/* then draw a line connecting last point to this point */
-						XDrawLine(priv->xdisp, d, gc, last_x_px, last_y_px, x_px, y_px);
-						min_y = max_y = y_px;
-					}
-					else {
-						if(y_px > max_y) 
-							max_y = y_px;
-						if(y_px < min_y) 
-							min_y = y_px;
-					}
-				}
-				last_x_px = x_px;
-				last_y_px = y_px;
-			}
-		}
-		else {
-			double line_start_x, line_start_y;
-			for(j = 0; j < t->length; j += dd) {
-				int n = t->start_index + j;
-				if(n >= t->capacity) {
-					n -= t->capacity;
-				}
-				if(isnan(t->y_data[n])) {
-					last_was_NAN = 1;
-					continue;
-				}
-				char this_is_out = 0;
-				if(t->x_data[n] < x_axis->min_val ||
-					 t->x_data[n] > x_axis->max_val ||
-					 t->y_data[n] < y_axis->min_val || 
-					 t->y_data[n] > y_axis->max_val
-				) {
-					this_is_out = 1;
-				}
-				double x_px = x_m * t->x_data[n] + x_b;
-				double y_px = y_m * t->y_data[n] + y_b;
-				if(first_pt) {
-					line_start_x = x_px;
-					line_start_y = y_px;
-					first_pt = 0;
-				}
-				else if(!this_is_out && last_was_NAN) {
-					line_start_x = x_px;
-					line_start_y = y_px;
-				}
-				else if(!this_is_out && last_was_out) {
-					XDrawLine(priv->xdisp, d, gc, line_start_x, line_start_y, x_px, y_px);
-					line_start_x = x_px;
-					line_start_y = y_px;
-				}
-				else if(this_is_out && !last_was_out) {
-					XDrawLine(priv->xdisp, d, gc, line_start_x, line_start_y, x_px, y_px);
-					line_start_x = x_px;
-					line_start_y = y_px;
-				}
-				else if(this_is_out && last_was_out) {
-					line_start_x = x_px;
-					line_start_y = y_px;
-				}
-				else {
-					XDrawLine(priv->xdisp, d, gc, line_start_x, line_start_y, x_px, y_px);
-					line_start_x = x_px;
-					line_start_y = y_px;
-				}
-				last_was_NAN = 0;
-				last_was_out = this_is_out;
-			}
+/* Shades the counts into d->image: the marker color with the shade as
+ * its alpha.  Returns -1 if the image can't be had. */
+static int density_image_update(trace_t *t) {
+	int i, j;
+	density_t *d = t->density;
+	rgb_color_t *c = &(t->marker_color);
+	if(d->image != NULL && (cairo_image_surface_get_width(d->image) != d->width || 
+	                        cairo_image_surface_get_height(d->image) != d->height)) {
+		cairo_surface_destroy(d->image);
+		d->image = NULL;
+	}
+	if(d->image == NULL) {
+		d->image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, d->width, d->height);
+		if(cairo_surface_status(d->image) != CAIRO_STATUS_SUCCESS) {
+			printf("Error creating density image: %s\n", cairo_status_to_string(cairo_surface_status(d->image)));
+			cairo_surface_destroy(d->image);
+			d->image = NULL;
+			return -1;
 		}
 	}
+	else if(d->image_gen == d->counts_gen && d->image_mode == d->mode &&
+	        !memcmp(&(d->image_color), c, sizeof(rgb_color_t))) {
+		return 0;
+	}
 
-	// unset the clip region
-	XSetClipMask(priv->xdisp, gc, None);
+	// premultiplied color for every shade
+	guint32 lut[256];
+	double v[3] = {c->red, c->green, c->blue};
+	for(i = 0; i < 256; i++) {
+		guint32 px = (guint32)i << 24;
+		for(j = 0; j < 3; j++) {
+			double f = v[j] < 0 ? 0 : (v[j] > 1 ? 1 : v[j]);
+			px |= ((guint32)(f * i + 0.5)) << (16 - 8 * j);
+		}
+		lut[i] = px;
+	}
+	density_scale_t s;
+	density_scale_init(&s, d);
+	cairo_surface_flush(d->image);
+	unsigned char *data = cairo_image_surface_get_data(d->image);
+	int stride = cairo_image_surface_get_stride(d->image);
+	for(j = 0; j < d->height; j++) {
+		guint32 *row = (guint32 *)(data + j * stride);
+		guint32 *counts = d->counts + j * d->width;
+		for(i = 0; i < d->width; i++) {
+			row[i] = lut[density_shade(&s, counts[i])];
+		}
+	}
+	cairo_surface_mark_dirty(d->image);
+	d->image_gen = d->counts_gen;
+	d->image_mode = d->mode;
+	d->image_color = *c;
+	return 0;
+}
 
-	// now draw the trace markers (if requested)
-	for(i = 0; i < p->num_traces; i++) {
-		trace_t *t = p->traces[i];
-		if(t->marker_type == MARKER_NONE) {
-			continue;
-		}
-		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(t->marker_color)) );
-		if(t->length <= 0) continue;
-		int dd = t->decimate_divisor;
-		for(j = 0; j < t->length; j += dd) {
-			int n;
-			n = t->start_index + j;
-			if(n >= t->capacity) {
-				n -= t->capacity;
-			}
-			if(isnan(t->y_data[n])) {
-				continue;
-			}
-			if(t->x_data[n] < x_axis->min_val ||
-			   t->x_data[n] > x_axis->max_val ||
-			   t->y_data[n] < y_axis->min_val || 
-			   t->y_data[n] > y_axis->max_val
-			) {
-				continue;
-			}
-			draw_marker_x (
-				priv->xdisp, d, gc,
-				t->marker_type, 
-				t->marker_size, 
-				x_m * t->x_data[n] + x_b, 
-				y_m * t->y_data[n] + y_b
-			);
-		}
+/* Lays the shaded counts of t over cr, within the columns of the pass */
+static void draw_density(cairo_t *cr, trace_t *t, trace_pass_t *tp, plot_area_t *pa) {
+	density_t *d = t->density;
+	if(!d->valid || density_image_update(t) < 0) {
+		return;
 	}
-	
-	return FALSE;
+	cairo_save(cr);
+	cairo_rectangle(cr, tp->clip_left, pa->top_edge, tp->clip_right - tp->clip_left, pa->bottom_edge - pa->top_edge);
+	cairo_clip(cr);
+	cairo_set_source_surface(cr, d->image, d->left, d->top);
+	cairo_paint(cr);
+	cairo_restore(cr);
+	return;
+}
+
+#if DRAW_WITH_XLIB
+/* Xlib has no alpha, so each shade is drawn as the marker color blended
+ * with the plot area color, one XDrawPoints run per shade. */
+static void draw_density_x(jbplotPrivate *priv, Drawable dr, GC gc, trace_t *t, trace_pass_t *tp) {
+	int i, n;
+	density_t *d = t->density;
+	rgb_color_t *c = &(t->marker_color);
+	rgb_color_t *bg = &(priv->plot.plot_area.bg_color);
+	int start[257];
+	int num = d->width * d->height;
+	if(!d->valid) {
+		return;
+	}
+	density_scale_t s;
+	density_scale_init(&s, d);
+
+	// sort the pixels by shade
+	memset(start, 0, sizeof(start));
+	for(i = 0; i < num; i++) {
+		if(d->counts[i]) {
+			start[density_shade(&s, d->counts[i]) + 1]++;
+		}
+	}
+	for(i = 1; i <= 256; i++) {
+		start[i] += start[i-1];
+	}
+	if(start[256] > d->num_points) {
+		XPoint *pts = realloc(d->points, start[256] * sizeof(XPoint));
+		if(pts == NULL) {
+			printf("Error allocating density points\n");
+			return;
+		}
+		d->points = pts;
+		d->num_points = start[256];
+	}
+	for(i = 0; i < num; i++) {
+		if(d->counts[i]) {
+			XPoint *pt = &(d->points[start[density_shade(&s, d->counts[i])]++]);
+			pt->x = d->left + i % d->width;
+			pt->y = d->top + i / d->width;
+		}
+	}
+
+	// start[k] now is where shade k + 1 begins
+	long max_pts = XMaxRequestSize(priv->xdisp) - 3;
+	int first = start[0];
+	for(i = 1; i < 256; i++) {
+		int count = start[i] - first;
+		if(count > 0 && !tp->mono) {
+			double a = i / 255.0;
+			rgb_color_t mix;
+			mix.red = a * c->red + (1 - a) * bg->red;
+			mix.green = a * c->green + (1 - a) * bg->green;
+			mix.blue = a * c->blue + (1 - a) * bg->blue;
+			XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&mix));
+		}
+		for(n = 0; n < count; n += max_pts) {
+			int m = (count - n < max_pts) ? count - n : max_pts;
+			XDrawPoints(priv->xdisp, dr, gc, d->points + first + n, m, CoordModeOrigin);
+		}
+		first = start[i];
+	}
+	return;
 }
-//---------- End X11 draw
 #endif
 
-static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double height) {
-	int i, j;
+#if DRAW_WITH_XLIB
+// ------ start X11 draw
+/* Draws everything but the data and leaves the layout (plot area edges
+ * and the data-to-pixel transform) in priv.  Returns -1 if only the ideal
+ * margins were wanted.
+ */
+static int draw_plot_chrome_x(GtkWidget *plot, Drawable d, double width, double height) {
+	int i;
 	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
 	plot_t *p = &(priv->plot);
 	axis_t *x_axis = &(p->x_axis);
@@ -2263,47 +4173,58 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 	plot_area_t *pa = &(p->plot_area);
 	legend_t *l = &(p->legend);
 
-	if(!priv->needs_redraw) {
-		return FALSE;
-	}
-	priv->needs_redraw = FALSE;
+	// create graphics context
+	// TODO: GC gc = XCreateGC(priv->xdisp, d, unsignedlong valuemask, XGCValues *values);
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+
+	// set up a couple colors
+	int blackColor = BlackPixel(priv->xdisp, DefaultScreen(priv->xdisp));
+	int whiteColor = WhitePixel(priv->xdisp, DefaultScreen(priv->xdisp));
 
 	// set some default values in cairo context
-	cairo_set_line_width(cr, 1.0);
+	///cairo_set_line_width(cr, 1.0);
+	XSetLineAttributes(
+		priv->xdisp, gc, 
+		1,         // lineWidth
+		LineSolid, // lineStyle
+		CapRound,  //cap_style
+		JoinMiter  // jointStyle
+	);
+	XSetFillStyle(priv->xdisp, gc, FillSolid);
 
 	//First fill the background
-	cairo_rectangle(cr, 0., 0., width, height);
-	cairo_set_source_rgb (cr, p->bg_color.red, p->bg_color.green, p->bg_color.blue);
-	cairo_fill(cr);
+	XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(p->bg_color)));
+	XFillRectangle(priv->xdisp, d, gc, 0, 0, width, height);
 
 	// now do the layout calcs
   double title_top_edge = 0.01 * height;
 	double title_bottom_edge;
 	if(p->do_show_plot_title) {
-	  title_bottom_edge = title_top_edge + get_text_height(cr, p->plot_title, p->plot_title_font_size);
+	  title_bottom_edge = title_top_edge + get_text_height_x(priv->xdisp, gc, p->plot_title);
 	}
 	else {
 		title_bottom_edge = title_top_edge;
 	}
   double x_label_bottom_edge = height - 0.01*height;
   double x_label_top_edge = x_label_bottom_edge - 
-                             get_text_height(cr, x_axis->axis_label , x_axis->axis_label_font_size);
+                             get_text_height_x(priv->xdisp, gc, x_axis->axis_label);
 
-  // draw the plot title if desired	
-	cairo_set_source_rgb (cr, 0., 0., 0.);
+	double legend_width, legend_height;
+	double legend_top_edge, legend_left_edge;
+
+
+	// draw the plot title if desired	
+	XSetForeground(priv->xdisp, gc, BLACK);
   if(p->do_show_plot_title) {
-		cairo_save(cr);
-		cairo_set_font_size(cr, p->plot_title_font_size);
-		draw_horiz_text_at_point(cr, p->plot_title, 0.5*width, title_top_edge, ANCHOR_TOP_MIDDLE);
-		cairo_restore(cr);
+		draw_horiz_text_at_point_x(priv->xdisp, d, gc, p->plot_title, 0.5*width, title_top_edge, ANCHOR_TOP_MIDDLE);
   }
 
+#if 1
+
 	/********** Draw the legend ***********************/
 	/* Draw the legend to the legend image buffer */
-	draw_legend((jbplot *)plot);
+	draw_legend_x((jbplot *)plot);
 
-	double legend_width, legend_height;
-	double legend_top_edge, legend_left_edge;
 	legend_width = l->size.width;
 	legend_height = l->size.height;
 
@@ -2318,62 +4239,16 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 			legend_top_edge = title_bottom_edge + 10;
 		}
 		
-		cairo_save(cr);
-		cairo_set_source_surface(cr, priv->legend_buffer, legend_left_edge, legend_top_edge);
-		cairo_rectangle(cr, legend_left_edge, legend_top_edge, l->size.width, l->size.height);
-		cairo_clip(cr);
-		cairo_paint(cr);
-		cairo_restore(cr);
+		XCopyArea(priv->xdisp, priv->legend_pixmap, d, gc, 0, 0, l->size.width, l->size.height, legend_left_edge, legend_top_edge);
 	}
 	
-	// calculate data ranges and tic labels
-  data_range x_range, y_range;
-	if(x_axis->do_autoscale) {
-		if(y_axis->do_autoscale) {
-	  	x_range = get_x_range(p->traces, p->num_traces);
-		}
-		else {
-			data_range yr;
-			yr.min = y_axis->min_val;
-			yr.max = y_axis->max_val;
-			x_range = get_x_range_within_y_range(p->traces, p->num_traces, yr);
-		}
-	}
-	else {
-		x_range.min = x_axis->min_val;
-		x_range.max = x_axis->max_val;
-	}
-	if(y_axis->do_autoscale) {
-		if(x_axis->do_autoscale) {
-			y_range = get_y_range(p->traces, p->num_traces);
-		}
-		else {
-			data_range xr;
-			xr.min = x_axis->min_val;
-			xr.max = x_axis->max_val;
-			y_range = get_y_range_within_x_range(p->traces, p->num_traces, xr);
-		}
-	}
-	else {
-		y_range.min = y_axis->min_val;
-		y_range.max = y_axis->max_val;
-	}
-
-	set_major_tic_values(x_axis, x_range.min, x_range.max);
-	set_major_tic_values(y_axis, y_range.min, y_range.max);
-
-	if(!x_axis->do_manual_tics) {
-		set_major_tic_labels(x_axis);
-	}
-	if(!y_axis->do_manual_tics) {
-		set_major_tic_labels(y_axis);
-	}
+#endif
 
-  double max_y_label_width = get_widest_label_width(y_axis, cr);
-  double y_tic_labels_left_edge;
-  double y_tic_labels_right_edge;
-  double plot_area_left_edge;
-  double plot_area_right_edge;
+	double max_y_label_width = get_widest_label_width_x(y_axis, priv->xdisp, gc);
+	double y_tic_labels_left_edge;
+	double y_tic_labels_right_edge;
+	double plot_area_left_edge;
+	double plot_area_right_edge;
 	double y_label_left_edge;
 	double y_label_right_edge; 
 
@@ -2384,11 +4259,10 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 		priv->needs_v_zoom_signal = FALSE;
 	}
 
-
 	if(priv->plot.plot_area.LR_margin_mode == MARGIN_AUTO || priv->get_ideal_lr) {
 		y_label_left_edge = MED_GAP;
 		y_label_right_edge = y_label_left_edge + 
-    	get_text_height(cr, y_axis->axis_label, y_axis->axis_label_font_size);
+			get_text_height_x(priv->xdisp, gc, y_axis->axis_label);
 		if(y_axis->do_show_axis_label) {
 			y_tic_labels_left_edge = y_label_right_edge + MED_GAP;
 		}
@@ -2407,9 +4281,8 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 		}
 
 		double right_side_x_tic_label_width = 
-			get_text_width(cr, 
-			x_axis->major_tic_labels[x_axis->num_actual_major_tics-1], 
-			x_axis->tic_label_font_size);
+			get_text_width_x(priv->xdisp, gc, 
+			x_axis->major_tic_labels[x_axis->num_actual_major_tics-1]);
 		if(0.5*right_side_x_tic_label_width > (width - plot_area_right_edge)) {
 			plot_area_right_edge = width - right_side_x_tic_label_width;
 		}
@@ -2419,7 +4292,7 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 		priv->plot.plot_area.ideal_right_margin = width - plot_area_right_edge;
 	}
 	if(priv->get_ideal_lr) {
-		return FALSE;
+		return -1;
 	}
 	if(priv->plot.plot_area.LR_margin_mode != MARGIN_AUTO) {
 		if(priv->plot.plot_area.LR_margin_mode == MARGIN_PERCENT) {
@@ -2436,7 +4309,7 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 		y_tic_labels_left_edge = y_tic_labels_right_edge - max_y_label_width;
 		y_label_right_edge = y_tic_labels_left_edge - MED_GAP;
 		y_label_left_edge = y_label_right_edge - 
-			get_text_height(cr, y_axis->axis_label, y_axis->axis_label_font_size);
+			get_text_height_x(priv->xdisp, gc, y_axis->axis_label);
 	}
 
 	double plot_area_top_edge;
@@ -2455,14 +4328,14 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 		x_tic_labels_bottom_edge = height - MED_GAP;
 	}
 
-  double x_tic_labels_height = get_text_height(cr, x_axis->major_tic_labels[0], x_axis->tic_label_font_size);
+  double x_tic_labels_height = get_text_height_x(priv->xdisp, gc, x_axis->major_tic_labels[0]);
   double x_tic_labels_top_edge = x_tic_labels_bottom_edge - x_tic_labels_height;
   double plot_area_bottom_edge = x_tic_labels_top_edge - MED_GAP;
 	priv->plot.plot_area.bottom_edge = plot_area_bottom_edge;
   double plot_area_height = plot_area_bottom_edge - plot_area_top_edge;
   double plot_area_width = plot_area_right_edge - plot_area_left_edge;
   double y_label_middle_y = plot_area_top_edge + plot_area_height/2;
-  double y_label_bottom_edge = y_label_middle_y + 0.5*get_text_width(cr, y_axis->axis_label, y_axis->axis_label_font_size);
+  double y_label_bottom_edge = y_label_middle_y + 0.5*get_text_width_x(priv->xdisp, gc, y_axis->axis_label);
   double x_label_middle_x = plot_area_left_edge + plot_area_width/2;
 
 	// these params can be used to transform from data coordinates to pixel coords
@@ -2478,153 +4351,167 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 	priv->y_b = y_b;	
 	
 	// fill the plot area (we'll stroke the border later)
-	cairo_set_source_rgb (cr, pa->bg_color.red, pa->bg_color.green, pa->bg_color.blue);
-	cairo_rectangle(	cr, 
-										plot_area_left_edge,
-										plot_area_top_edge,
-										(plot_area_right_edge-plot_area_left_edge),
-										(plot_area_bottom_edge-plot_area_top_edge)
-									);
-	cairo_fill(cr);
+	XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(pa->bg_color)) );
+	XFillRectangle(priv->xdisp, d, gc, 
+		plot_area_left_edge, 
+		plot_area_top_edge,
+		(plot_area_right_edge-plot_area_left_edge),
+		(plot_area_bottom_edge-plot_area_top_edge)
+	);
 
 	// draw the y tic labels
-	cairo_set_source_rgb (cr, 0., 0., 0.);
-	cairo_save(cr);
-	cairo_set_font_size(cr, y_axis->tic_label_font_size);
+	XSetForeground(priv->xdisp, gc, BLACK);
+	///cairo_set_font_size(cr, y_axis->tic_label_font_size);
 	if(y_axis->do_manual_tics) {
 		for(i=0; i<y_axis->num_actual_major_tics; i++) {
 			double val = y_axis->major_tic_values[i];
 			if(val <= y_axis->max_val && val >= y_axis->min_val) {
-				draw_horiz_text_at_point(	cr, 
-																	y_axis->major_tic_labels[i], 
-																	y_tic_labels_right_edge, 
-																	y_m * y_axis->major_tic_values[i] + y_b, 
-																	ANCHOR_MIDDLE_RIGHT
-																);
+				draw_horiz_text_at_point_x(
+					priv->xdisp, d, gc, 
+					y_axis->major_tic_labels[i], 
+					y_tic_labels_right_edge, 
+					y_m * y_axis->major_tic_values[i] + y_b, 
+					ANCHOR_MIDDLE_RIGHT
+				);
 			}
 		}
 	}
 	else {
 		for(i=0; i<y_axis->num_actual_major_tics; i++) {
-			draw_horiz_text_at_point(	cr, 
-																y_axis->major_tic_labels[i], 
-																y_tic_labels_right_edge, 
-																y_m * y_axis->major_tic_values[i] + y_b, 
-																ANCHOR_MIDDLE_RIGHT
-															);
+			draw_horiz_text_at_point_x(
+				priv->xdisp, d, gc, 
+				y_axis->major_tic_labels[i], 
+				y_tic_labels_right_edge, 
+				y_m * y_axis->major_tic_values[i] + y_b, 
+				ANCHOR_MIDDLE_RIGHT
+			);
 		}
 	}
-	cairo_restore(cr);
 
 	// draw the y major gridlines
 	if(y_axis->do_show_major_gridlines && y_axis->major_gridline_type != LINETYPE_NONE) {
-		cairo_save(cr);
 		if(y_axis->major_gridline_type == LINETYPE_SOLID) {
-			cairo_set_dash(cr, dash_pattern, 0, 0);
+			XSetLineAttributes(
+				priv->xdisp, gc, 
+				y_axis->major_gridline_width,  // lineWidth
+				LineSolid, // lineStyle
+				CapRound,  //cap_style
+				JoinMiter  // jointStyle
+			);
 		}	
 		else if(y_axis->major_gridline_type == LINETYPE_DASHED) {
-			cairo_set_dash(cr, dash_pattern, 2, 0);
+			XSetLineAttributes(
+				priv->xdisp, gc, 
+				y_axis->major_gridline_width,  // lineWidth
+				LineOnOffDash, // lineStyle
+				CapRound,  //cap_style
+				JoinMiter  // jointStyle
+			);
 		}	
 		else if(y_axis->major_gridline_type == LINETYPE_DOTTED) {
-			cairo_set_dash(cr, dot_pattern, 2, 0);
+			XSetLineAttributes(
+				priv->xdisp, gc, 
+				y_axis->major_gridline_width,  // lineWidth
+				LineOnOffDash, // lineStyle
+				CapRound,  //cap_style
+				JoinMiter  // jointStyle
+			);
 		}	
-		cairo_set_source_rgb(cr, 
-		                     y_axis->major_gridline_color.red, 
-		                     y_axis->major_gridline_color.green, 
-		                     y_axis->major_gridline_color.blue
-		);
-		cairo_set_line_width(cr, y_axis->major_gridline_width);
+		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(y_axis->major_gridline_color)) );
 		if(y_axis->do_manual_tics) {
 			for(i=0; i<y_axis->num_actual_major_tics; i++) {
 				double val = y_axis->major_tic_values[i];
 				if(val <= y_axis->max_val && val >= y_axis->min_val) {
 					double y = y_m * y_axis->major_tic_values[i] + y_b;
-					cairo_move_to(cr, plot_area_left_edge, y);
-					cairo_line_to(cr, plot_area_right_edge, y);
-					cairo_stroke(cr);
+					XDrawLine(priv->xdisp, d, gc, plot_area_left_edge, y , plot_area_right_edge, y);
 				}
 			}
 		}	
 		else {
 			for(i=0; i<y_axis->num_actual_major_tics; i++) {
 				double y = y_m * y_axis->major_tic_values[i] + y_b;
-				cairo_move_to(cr, plot_area_left_edge, y);
-				cairo_line_to(cr, plot_area_right_edge, y);
-				cairo_stroke(cr);
+				XDrawLine(priv->xdisp, d, gc, plot_area_left_edge, y , plot_area_right_edge, y);
 			}
 		}
-		cairo_restore(cr);
 	}
-	
+
 	// draw the x tic labels
-	cairo_set_source_rgb (cr, 0., 0., 0.);
-	cairo_save(cr);
-	cairo_set_font_size(cr, x_axis->tic_label_font_size);
+	XSetForeground(priv->xdisp, gc, BLACK);
+	///cairo_set_font_size(cr, x_axis->tic_label_font_size);
 	if(x_axis->do_manual_tics) {
 		for(i=0; i<x_axis->num_actual_major_tics; i++) {
 			double val = x_axis->major_tic_values[i];
 			if(val <= x_axis->max_val && val >= x_axis->min_val) {
-				draw_horiz_text_at_point(	cr, 
-																	x_axis->major_tic_labels[i], 
-																	x_m * val + x_b, 
-																	x_tic_labels_top_edge, 
-																	ANCHOR_TOP_MIDDLE
-																);
+				draw_horiz_text_at_point_x(
+					priv->xdisp, d, gc, 
+					x_axis->major_tic_labels[i], 
+					x_m * val + x_b, 
+					x_tic_labels_top_edge, 
+					ANCHOR_TOP_MIDDLE
+				);
 			}
 		}
 	}
 	else {
 		for(i=0; i<x_axis->num_actual_major_tics; i++) {
-			draw_horiz_text_at_point(	cr, 
-																x_axis->major_tic_labels[i], 
-																x_m * x_axis->major_tic_values[i] + x_b, 
-																x_tic_labels_top_edge, 
-																ANCHOR_TOP_MIDDLE
-															);
+			draw_horiz_text_at_point_x(
+				priv->xdisp, d, gc, 
+				x_axis->major_tic_labels[i], 
+				x_m * x_axis->major_tic_values[i] + x_b, 
+				x_tic_labels_top_edge, 
+				ANCHOR_TOP_MIDDLE
+			);
 		}
 	}
-	cairo_restore(cr);
-
+	
 	// draw the x major gridlines
 	if(x_axis->do_show_major_gridlines && x_axis->major_gridline_type != LINETYPE_NONE) {
-		cairo_save(cr);
 		if(x_axis->major_gridline_type == LINETYPE_SOLID) {
-			cairo_set_dash(cr, dash_pattern, 0, 0);
+			XSetLineAttributes(
+				priv->xdisp, gc, 
+				y_axis->major_gridline_width,  // lineWidth
+				LineSolid, // lineStyle
+				CapRound,  //cap_style
+				JoinMiter  // jointStyle
+			);
 		}	
 		else if(x_axis->major_gridline_type == LINETYPE_DASHED) {
-			cairo_set_dash(cr, dash_pattern, 2, 0);
+			XSetLineAttributes(
+				priv->xdisp, gc, 
+				y_axis->major_gridline_width,  // lineWidth
+				LineOnOffDash, // lineStyle
+				CapRound,  //cap_style
+				JoinMiter  // jointStyle
+			);
 		}	
 		else if(x_axis->major_gridline_type == LINETYPE_DOTTED) {
-			cairo_set_dash(cr, dot_pattern, 2, 0);
+			XSetLineAttributes(
+				priv->xdisp, gc, 
+				y_axis->major_gridline_width,  // lineWidth
+				LineOnOffDash, // lineStyle
+				CapRound,  //cap_style
+				JoinMiter  // jointStyle
+			);
 		}	
-		cairo_set_source_rgb(cr, 
-		                     x_axis->major_gridline_color.red, 
-		                     x_axis->major_gridline_color.green, 
-		                     x_axis->major_gridline_color.blue
-		);
-		cairo_set_line_width(cr, x_axis->major_gridline_width);
+		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(x_axis->major_gridline_color)) );
 		if(x_axis->do_manual_tics) {
 			for(i=0; i<x_axis->num_actual_major_tics; i++) {
 				double val = x_axis->major_tic_values[i];
 				if(val <= x_axis->max_val && val >= x_axis->min_val) {
 					double x = x_m * val + x_b;		
-					cairo_move_to(cr, x, plot_area_bottom_edge);
-					cairo_line_to(cr, x, plot_area_top_edge);
-					cairo_stroke(cr);
+					XDrawLine(priv->xdisp, d, gc, x, plot_area_top_edge, x, plot_area_bottom_edge);
 				}
 			}
 		}
 		else {
 			for(i=0; i<x_axis->num_actual_major_tics; i++) {
 				double x = x_m * x_axis->major_tic_values[i] + x_b;		
-				cairo_move_to(cr, x, plot_area_bottom_edge);
-				cairo_line_to(cr, x, plot_area_top_edge);
-				cairo_stroke(cr);
+				XDrawLine(priv->xdisp, d, gc, x, plot_area_top_edge, x, plot_area_bottom_edge);
 			}
 		}
-		cairo_restore(cr);
 	}
-			
+
+#if 0
 	// draw the y-axis label if desired
 	cairo_set_source_rgb (cr, 0, 0, 0);
 	if(y_axis->do_show_axis_label) {
@@ -2636,91 +4523,144 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 															ANCHOR_BOTTOM_LEFT
 														);
 	}
+#endif
 	
 	// draw the x-axis label if desired
-	cairo_set_source_rgb (cr, 0, 0, 0);
+	XSetForeground(priv->xdisp, gc, BLACK);
 	if(x_axis->do_show_axis_label) {
-		draw_horiz_text_at_point(	cr, 
-															x_axis->axis_label, 
-															x_label_middle_x, 
-															x_label_top_edge, 
-															ANCHOR_TOP_MIDDLE
-														);
+		draw_horiz_text_at_point_x(
+			priv->xdisp, d, gc, 
+			x_axis->axis_label, 
+			x_label_middle_x, 
+			x_label_top_edge, 
+			ANCHOR_TOP_MIDDLE
+		);
 	}
-	
 
 	/*********** draw the plot area border ******************/
 	if(pa->do_show_bounding_box) {
-		cairo_set_source_rgb (cr, pa->border_color.red, pa->border_color.green, pa->border_color.blue);
-		cairo_set_line_width(cr, pa->bounding_box_width);
-		cairo_rectangle(
-			cr, 
+		//cairo_set_source_rgb (cr, pa->border_color.red, pa->border_color.green, pa->border_color.blue);
+		XSetForeground(priv->xdisp, gc, BLACK);
+		XSetLineAttributes(
+			priv->xdisp, gc, 
+			y_axis->major_gridline_width,  // lineWidth
+			LineSolid, // lineStyle
+			CapRound,  //cap_style
+			JoinMiter  // jointStyle
+		);
+
+		XDrawRectangle(
+			priv->xdisp, d, gc, 
 			plot_area_left_edge - pa->bounding_box_width, 
 			plot_area_top_edge - pa->bounding_box_width,
 			plot_area_right_edge - plot_area_left_edge + 2*pa->bounding_box_width,
 			plot_area_bottom_edge - plot_area_top_edge + 2*pa->bounding_box_width
 		);
-		cairo_stroke(cr);	
 	}
 
+	return 0;
+}
 
-	/*************** Draw the data ******************/
-
-	// first set the clipping region
-	cairo_save(cr);
-	cairo_rectangle(	cr, 
-										plot_area_left_edge,
-										plot_area_top_edge,
-										(plot_area_right_edge-plot_area_left_edge),
-										(plot_area_bottom_edge-plot_area_top_edge)
-									);
-	cairo_clip(cr);
+/* Draws traces [i0, i1) of view for one pass of the renderer (see
+ * trace_pass_t): the lines, the markers or both, as given by what.  The
+ * density counts must already be up to date for tp.
+ */
+static void draw_trace_range_x(GtkWidget *plot, render_view_t *view, Drawable d, GC gc, trace_pass_t *tp, int i0, int i1, int what) {
+	int i, j;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_area_t *pa = &(view->pa);
+	double x_m = tp->x_m;
+	double x_b = tp->x_b;
+	double y_m = tp->y_m;
+	double y_b = tp->y_b;
+
+	// pixel extents of the axes; samples beyond them are out of range
+	render_scratch_t *rs = &(priv->scratch);
+	xbatch_t *xb = &(rs->xb);
+	double x_px_min = fmin(x_m * view->x_min + x_b, x_m * view->x_max + x_b);
+	double x_px_max = fmax(x_m * view->x_min + x_b, x_m * view->x_max + x_b);
+	double y_px_min = fmin(y_m * view->y_min + y_b, y_m * view->y_max + y_b);
+	double y_px_max = fmax(y_m * view->y_min + y_b, y_m * view->y_max + y_b);
+	int k;
+	rs->bounds[0] = x_px_min;
+	rs->bounds[1] = x_px_max;
+	rs->bounds[2] = y_px_min;
+	rs->bounds[3] = y_px_max;
+
+	// clip to the plot area rows and the columns of this pass
+	XRectangle clip_rect;
+	clip_rect.x = tp->clip_left;
+	clip_rect.y = pa->top_edge;
+	clip_rect.width = (tp->clip_right - tp->clip_left);
+	clip_rect.height = (pa->bottom_edge - pa->top_edge);
+	XSetClipRectangles(
+		priv->xdisp, gc, 
+		0, 0,          // clip origin (x,y) 
+		&clip_rect, 1, // clipping rectangle
+		Unsorted       // ordering
+	);
 
 	// now draw the trace lines (if requested)
-	for(i = 0; i < p->num_traces; i++) {
+	for(i = i0; i < i1 && (what & DRAW_LINES); i++) {
 		char first_pt = 1;
 		char last_was_NAN = 0;
 		char last_was_out = 0;
-		trace_t *t = p->traces[i];
+		trace_t *t = view->traces[i];
 		if(t->line_type == LINETYPE_NONE) {
 			continue;
 		}
-		cairo_set_source_rgb (cr, t->line_color.red, t->line_color.green, t->line_color.blue);
-		cairo_set_line_width(cr, t->line_width);
+		if(!tp->mono) {
+			XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(t->line_color)) );
+		}
+
 		if(t->line_type == LINETYPE_SOLID) {
-			cairo_set_dash(cr, dash_pattern, 0, 0);
+			XSetLineAttributes(priv->xdisp, gc, t->line_width, LineSolid,CapRound,JoinMiter);
 		}	
 		else if(t->line_type == LINETYPE_DASHED) {
-			cairo_set_dash(cr, dash_pattern, 2, 0);
+			XSetLineAttributes(priv->xdisp, gc, t->line_width, LineOnOffDash, CapRound, JoinMiter);
 		}	
 		else if(t->line_type == LINETYPE_DOTTED) {
-			cairo_set_dash(cr, dot_pattern, 2, 0);
+			XSetLineAttributes(priv->xdisp, gc, t->line_width, LineDoubleDash, CapRound, JoinMiter);
 		}	
 		if(t->length <= 0) continue;
-		int dd = t->decimate_divisor;
-		if(t->lossless_decimation) {
-			for(j = 0; j < t->length; j += dd) {
+		// lines reaching past the clip box by more than their width can
+		// be cut short without changing what ends up on screen
+		double margin = t->line_width + 2;
+		if(xbatch_begin(xb, priv->xdisp, d, gc, 
+		                tp->clip_left - margin, pa->top_edge - margin, 
+		                tp->clip_right + margin, pa->bottom_edge + margin) < 0) {
+			continue;
+		}
+		int j0, j1;
+		int span = trace_get_visible_span(t, tp->x_lo, tp->x_hi, &j0, &j1);
+		int level = pass_pick_level(t, tp, span, fabs(x_m) * (tp->x_hi - tp->x_lo));
+		int dd = pass_stride(t, tp, span);
+		j0 -= j0 % dd;
+		if(level >= 0 && lod_build_envelope(t, j0, j1, level, x_m, x_b, y_m, y_b, &(priv->scratch)) >= 0) {
+			draw_envelope_x(xb, priv->scratch.env, priv->scratch.env_length);
+		}
+		else if(t->lossless_decimation) {
+			for(j = j0, k = RENDER_CHUNK; j <= j1; j += dd, k++) {
 				int last_x_px, last_y_px;
 				double min_y, max_y;
-				int n = t->start_index + j;
-				if(n >= t->capacity) {
-					n -= t->capacity;
+				if(k == RENDER_CHUNK) {
+					trace_to_px(t, j, j1, dd, x_m, x_b, y_m, y_b, rs);
+					k = 0;
 				}
-				double x_px = x_m * t->x_data[n] + x_b;
-				double y_px = y_m * t->y_data[n] + y_b;
+				double x_px = rs->x_px[k];
+				double y_px = rs->y_px[k];
 				if(first_pt) {
-					cairo_move_to(cr,	x_px,	y_px);
+					/// Why is this next line needed!!??
+					/// cairo_move_to(cr,	x_px,	y_px);
 					first_pt = 0;
 					min_y = max_y = y_px;
 				}
 				else {
 					if(x_px != last_x_px) {
 						/* first draw vertical line spanning min to max for previous x-pixel */
-						cairo_move_to(cr,	last_x_px,	min_y);
-						cairo_line_to(cr,	last_x_px,	max_y);
+						xbatch_line(xb, last_x_px, min_y, last_x_px, max_y);
 						/* then draw a line connecting last point to this point */
-						cairo_move_to(cr,	last_x_px,	last_y_px);
-						cairo_line_to(cr,	x_px,	y_px);
+						xbatch_line(xb, last_x_px, last_y_px, x_px, y_px);
 						min_y = max_y = y_px;
 					}
 					else {
@@ -2735,1127 +4675,5398 @@ static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double hei
 			}
 		}
 		else {
-			for(j = 0; j < t->length; j += dd) {
-				int n = t->start_index + j;
-				if(n >= t->capacity) {
-					n -= t->capacity;
+			double line_start_x, line_start_y;
+			// dashes restart with every segment, so only solid lines lose runs
+			if(t->line_type == LINETYPE_SOLID) {
+				px_dedup_runs(rs, xb->clip_x0, xb->clip_y0, xb->clip_x1, xb->clip_y1);
+			}
+			for(j = j0, k = RENDER_CHUNK; j <= j1; j += dd, k++) {
+				if(k == RENDER_CHUNK) {
+					px_dedup(rs, trace_to_px(t, j, j1, dd, x_m, x_b, y_m, y_b, rs));
+					k = 0;
 				}
-				if(isnan(t->y_data[n])) {
-					last_was_NAN = 1;
+				double x_px = rs->x_px[k];
+				double y_px = rs->y_px[k];
+				if(rs->cls[k] == PX_DUP) {
 					continue;
 				}
-				char this_is_out = 0;
-				if(t->x_data[n] < x_axis->min_val ||
-					 t->x_data[n] > x_axis->max_val ||
-					 t->y_data[n] < y_axis->min_val || 
-					 t->y_data[n] > y_axis->max_val
-				) {
-					this_is_out = 1;
+				if(rs->cls[k] == PX_NAN) {
+					last_was_NAN = 1;
+					continue;
 				}
-				double x_px = x_m * t->x_data[n] + x_b;
-				double y_px = y_m * t->y_data[n] + y_b;
+				char this_is_out = (rs->cls[k] == PX_OUT);
 				if(first_pt) {
-					cairo_move_to(cr,	x_px,	y_px);
+					line_start_x = x_px;
+					line_start_y = y_px;
 					first_pt = 0;
 				}
-				else if(!this_is_out && last_was_NAN) {
-					cairo_move_to(cr,	x_px,	y_px);
+				else if(last_was_NAN) {
+					line_start_x = x_px;
+					line_start_y = y_px;
 				}
 				else if(!this_is_out && last_was_out) {
-					cairo_line_to(cr,	x_px,	y_px);
+					xbatch_line(xb, line_start_x, line_start_y, x_px, y_px);
+					line_start_x = x_px;
+					line_start_y = y_px;
 				}
 				else if(this_is_out && !last_was_out) {
-					cairo_line_to(cr,	x_px,	y_px);
+					xbatch_line(xb, line_start_x, line_start_y, x_px, y_px);
+					line_start_x = x_px;
+					line_start_y = y_px;
 				}
 				else if(this_is_out && last_was_out) {
-					cairo_move_to(cr,	x_px,	y_px);
+					// both ends out of range, but the line may still cross
+					// the box; xbatch_line() drops it if it doesn't
+					xbatch_line(xb, line_start_x, line_start_y, x_px, y_px);
+					line_start_x = x_px;
+					line_start_y = y_px;
 				}
 				else {
-					cairo_line_to(cr,	x_px,	y_px);
+					xbatch_line(xb, line_start_x, line_start_y, x_px, y_px);
+					line_start_x = x_px;
+					line_start_y = y_px;
 				}
 				last_was_NAN = 0;
 				last_was_out = this_is_out;
 			}
+			px_dedup_off(rs);
 		}
-		cairo_stroke(cr);
+		xbatch_flush(xb);
+	}
+
+	// unset the clip region unless the markers should be clipped too
+	if(tp->clip_markers) {
+		clip_rect.x = tp->mark_left;
+		clip_rect.y = 0;
+		clip_rect.width = (tp->mark_right - tp->mark_left);
+		clip_rect.height = 32767;
+		XSetClipRectangles(priv->xdisp, gc, 0, 0, &clip_rect, 1, Unsorted);
+	}
+	else {
+		XSetClipMask(priv->xdisp, gc, None);
 	}
-	cairo_restore(cr);
 
 	// now draw the trace markers (if requested)
-	for(i = 0; i < p->num_traces; i++) {
-		cairo_save(cr);
-		trace_t *t = p->traces[i];
+	for(i = i0; i < i1 && (what & DRAW_MARKERS); i++) {
+		trace_t *t = view->traces[i];
+		if(trace_is_density(t)) {
+			draw_density_x(priv, d, gc, t, tp);
+			continue;
+		}
 		if(t->marker_type == MARKER_NONE) {
 			continue;
 		}
-		cairo_set_source_rgb (cr, t->marker_color.red, t->marker_color.green, t->marker_color.blue);
-		if(t->marker_type == MARKER_POINT) {
-			cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+		if(!tp->mono) {
+			XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(t->marker_color)) );
 		}
 		if(t->length <= 0) continue;
-		int dd = t->decimate_divisor;
-		for(j = 0; j < t->length; j += dd) {
-			int n;
-			n = t->start_index + j;
-			if(n >= t->capacity) {
-				n -= t->capacity;
-			}
-			if(t->x_data[n] < x_axis->min_val ||
-			   t->x_data[n] > x_axis->max_val ||
-			   t->y_data[n] < y_axis->min_val || 
-			   t->y_data[n] > y_axis->max_val
-			) {
+		// a draft leaves the markers to traces that have no lines
+		if(tp->draft && t->line_type != LINETYPE_NONE) {
+			continue;
+		}
+		if(xbatch_begin(xb, priv->xdisp, d, gc, 
+		                tp->clip_left, pa->top_edge, tp->clip_right, pa->bottom_edge) < 0) {
+			continue;
+		}
+		// circles go as runs of pixels, which X fills far faster than arcs
+		XRectangle *spans = NULL;
+		int num_spans = 0;
+		if(sprite_update_spans(t) == 0) {
+			spans = t->sprite->spans;
+			num_spans = t->sprite->num_spans;
+		}
+		if(t->marker_type == MARKER_X) {
+			XSetLineAttributes(priv->xdisp, gc, 0, LineSolid, CapButt, JoinMiter);
+		}
+		// markers reach past the pass by up to their size
+		int j0, j1;
+		double pad = (x_m != 0) ? (t->marker_size / 2.0 + 1.0) / fabs(x_m) : 0;
+		int span = trace_get_visible_span(t, tp->x_lo - pad, tp->x_hi + pad, &j0, &j1);
+		int dd = pass_stride(t, tp, span);
+		j0 -= j0 % dd;
+		// markers are placed by the whole pixel their corner (or for points
+		// and runs, their center) falls in, so one per pixel is enough
+		px_dedup_markers(rs, 1, (t->marker_type == MARKER_POINT || spans != NULL) ? 0 : -t->marker_size / 2.0,
+		                 (j1 - j0) / dd + 1);
+		for(j = j0, k = RENDER_CHUNK; j <= j1; j += dd, k++) {
+			if(k == RENDER_CHUNK) {
+				px_dedup(rs, trace_to_px(t, j, j1, dd, x_m, x_b, y_m, y_b, rs));
+				k = 0;
+			}
+			double x_px = rs->x_px[k];
+			double y_px = rs->y_px[k];
+			if(rs->cls[k] != PX_IN) {
 				continue;
 			}
-			cairo_move_to(cr, x_m * t->x_data[n] + x_b,	y_m * t->y_data[n] + y_b);
-			draw_marker(cr, t->marker_type, t->marker_size);
+			if(spans != NULL) {
+				xbatch_spans(xb, spans, num_spans, x_px, y_px);
+			}
+			else {
+				xbatch_marker(xb, t->marker_type, t->marker_size, x_px, y_px);
+			}
 		}
-		cairo_restore(cr);
+		px_dedup_off(rs);
+		xbatch_flush(xb);
 	}
+	XSetClipMask(priv->xdisp, gc, None);
+	return;
+}
 
+/* Draws the traces for one pass of the renderer (see trace_pass_t) */
+static void draw_traces_x(GtkWidget *plot, Drawable d, GC gc, trace_pass_t *tp) {
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	render_view_t view;
+	render_view_init(priv, &view);
+	density_update(priv, tp);
+	draw_trace_range_x(plot, &view, d, gc, tp, 0, priv->plot.num_traces, DRAW_LINES | DRAW_MARKERS);
+	return;
+}
 
-/*
-	// DEBUG!!!!!
-	// Draw the legend image
-	cairo_save(cr);
-	cairo_set_source_surface(cr, legend_buffer, 50, 50);
-	cairo_rectangle(cr, 50, 50, 30, 100);
-	cairo_clip(cr);
-	cairo_paint(cr);
-	cairo_restore(cr);
-*/
-		
-	return FALSE;
+/* (Re)allocates the scroll layer pixmaps if the widget size changed */
+static int scroll_layer_alloc_x(GtkWidget *plot, int width, int height) {
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	scroll_layer_t *sl = &(priv->scroll);
+	if(priv->data_pixmap && sl->width == width && sl->height == height) {
+		return 0;
+	}
+	if(priv->data_pixmap) {
+		XFreePixmap(priv->xdisp, priv->data_pixmap);
+		XFreePixmap(priv->xdisp, priv->data_mask);
+	}
+	priv->data_pixmap = XCreatePixmap(
+		priv->xdisp, priv->xwin, 
+		width, height, 
+		XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
+	);
+	priv->data_mask = XCreatePixmap(priv->xdisp, priv->xwin, width, height, 1);
+	if(!priv->mask_gc) {
+		priv->mask_gc = XCreateGC(priv->xdisp, priv->data_mask, 0, NULL);
+		XSetBackground(priv->xdisp, priv->mask_gc, 0);
+	}
+	sl->width = width;
+	sl->height = height;
+	sl->valid = 0;
+	return 0;
 }
 
-/* This get's called by GtkMain when the widget is resized. 
- * We'll use it to resize (reallocate) our plot image buffer
+/* Brings the scroll layer up to date: shifts what is still good left by
+ * whole pixels and draws only what was exposed or added.  The layer is a
+ * pixmap plus a 1-bit mask of the pixels the traces cover, so it can be
+ * laid over the chrome.
  */
-static gboolean jbplot_configure (GtkWidget *plot, GdkEventConfigure *event) {
-	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+static void draw_scroll_layer_x(GtkWidget *plot, trace_pass_t *tp) {
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_area_t *pa = &(priv->plot.plot_area);
+	scroll_layer_t *sl = &(priv->scroll);
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	int shift;
+	int left = floor(pa->left_edge);
+	int right = ceil(pa->right_edge);
+	int top = floor(pa->top_edge);
+	int bottom = ceil(pa->bottom_edge);
+
+	XSetForeground(priv->xdisp, priv->mask_gc, 0);
+	if(scroll_layer_plan(priv, tp, &shift)) {
+		if(shift > 0) {
+			XCopyArea(priv->xdisp, priv->data_pixmap, priv->data_pixmap, gc, 
+				left + shift, top, right - left - shift, bottom - top, left, top);
+			XCopyArea(priv->xdisp, priv->data_mask, priv->data_mask, priv->mask_gc, 
+				left + shift, top, right - left - shift, bottom - top, left, top);
+		}
+		XFillRectangle(priv->xdisp, priv->data_mask, priv->mask_gc, 
+			tp->clip_left, 0, sl->width - tp->clip_left, sl->height);
+	}
+	else {
+		XFillRectangle(priv->xdisp, priv->data_mask, priv->mask_gc, 0, 0, sl->width, sl->height);
+	}
+	XSetForeground(priv->xdisp, priv->mask_gc, 1);
 
-	double width = plot->allocation.width;
-	double height = plot->allocation.height;
+	draw_traces_x(plot, priv->data_pixmap, gc, tp);
+	tp->mono = 1;
+	draw_traces_x(plot, priv->data_mask, priv->mask_gc, tp);
+	tp->mono = 0;
+	scroll_layer_commit(priv, tp);
+	return;
+}
 
-#if DRAW_WITH_XLIB
-	// handle X initialization stuff here
-	if(priv->xdisp == NULL) {
-		priv->xdisp = gdk_x11_drawable_get_xdisplay(plot->window);
-		priv->xwin =gdk_x11_drawable_get_xid(plot->window);
+static gboolean draw_plot_x(GtkWidget *plot, Drawable d, double width, double height) {
+	int i;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
 
-		// just allocate a big, fixed-size pixmap for the legend
-		priv->legend_pixmap = XCreatePixmap(
-			priv->xdisp, priv->xwin, 
-			2000, 2000, 
-			XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
-		);
+	if(!priv->needs_redraw) {
+		return FALSE;
 	}
+	priv->needs_redraw = FALSE;
 
-	// load font and font information use for text metrics
+	// take in whatever the acquisition threads have published
+	for(i = 0; i < p->num_traces; i++) {
+		jbplot_trace_drain_feed(p->traces[i]);
+	}
 
-	// free the current plot pixmap, and allocate a new one of the new size
-	if(priv->plot_pixmap) {
-		XFreePixmap(priv->xdisp, priv->plot_pixmap);
+	update_axis_ranges(p);
+
+	if(priv->exposing && (progress_defer(priv, width, height) || progress_follow(plot, width, height))) {
+		return FALSE;
 	}
-	Pixmap pm = XCreatePixmap(
-		priv->xdisp, priv->xwin, 
-		width, height, 
-		XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
-	);
-	priv->plot_pixmap = pm;
-#endif
+	progress_cancel(priv);
 
+	if(d == priv->plot_pixmap && frame_cache_reuse(plot, width, height)) {
+		return FALSE;
+	}
 
-	if(priv->plot_context != NULL) {
-		cairo_destroy(priv->plot_context);
+	// the chrome lives in its own pixmap and is only redrawn when something
+	// it depends on changes; otherwise it's just copied in under the data
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	if(!priv->chrome_pixmap) {
+		if(draw_plot_chrome_x(plot, d, width, height) < 0) {
+			return FALSE;
+		}
 	}
-	if(priv->plot_buffer != NULL) {
-		cairo_surface_destroy(priv->plot_buffer);
+	else {
+		if(!chrome_is_current(priv, width, height)) {
+			priv->chrome_valid = FALSE;
+			if(draw_plot_chrome_x(plot, priv->chrome_pixmap, width, height) < 0) {
+				return FALSE;
+			}
+			get_chrome_key(priv, width, height, &(priv->chrome_key));
+			priv->chrome_valid = TRUE;
+		}
+		XCopyArea(priv->xdisp, priv->chrome_pixmap, d, gc, 0, 0, width, height, 0, 0);
 	}
-	priv->plot_buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
-	cairo_status_t stat = cairo_surface_status(priv->plot_buffer);
-	if(stat != CAIRO_STATUS_SUCCESS) {
-		printf("Error creating cairo image surface: %s\n", cairo_status_to_string(stat));
+	XSetLineAttributes(priv->xdisp, gc, 1, LineSolid, CapRound, JoinMiter);
+
+	/*************** Draw the data ******************/
+	trace_pass_t tp;
+	frame_pass_init(priv, &tp, width);
+	tp.draft = priv->interacting;
+
+	// a middle-button pan is laid out from tiles at the scale it started at
+	if(priv->panning && d == priv->plot_pixmap && draw_pan_tiles(plot, &tp) == 0) {
+		return FALSE;
 	}
-	priv->plot_context = cairo_create(priv->plot_buffer);
-	cairo_status_t cr_stat = cairo_status(priv->plot_context);
-	if(cr_stat != CAIRO_STATUS_SUCCESS) {
-		printf("Error creating cairo image context: %s\n", cairo_status_to_string(cr_stat));
+	if(priv->wheel.active && !priv->panning && d == priv->plot_pixmap && wheel_preview_show(plot, &tp, width, height) == 0) {
 		return FALSE;
 	}
-	priv->needs_redraw = TRUE;
-	priv->plot.legend.needs_redraw = 1;
+
+	// drafts don't go into the scroll layer, which has to be redrawn after
+	if(tp.draft) {
+		priv->drew_draft = TRUE;
+		priv->scroll.valid = 0;
+	}
+	if(priv->scroll_mode && !tp.draft && scroll_layer_alloc_x(plot, width, height) == 0) {
+		draw_scroll_layer_x(plot, &tp);
+		XSetClipMask(priv->xdisp, gc, priv->data_mask);
+		XSetClipOrigin(priv->xdisp, gc, 0, 0);
+		XCopyArea(
+			priv->xdisp, priv->data_pixmap, d, gc, 
+			pa->left_edge, pa->top_edge, 
+			pa->right_edge - pa->left_edge, pa->bottom_edge - pa->top_edge, 
+			pa->left_edge, pa->top_edge
+		);
+		XSetClipMask(priv->xdisp, gc, None);
+	}
+	else if(progress_plan(priv, &tp, width) == 0 && progress_begin(plot, width, height, 0) == 0) {
+		// a coarse pass for now; the idle callbacks draw the rest
+		tp.draft = 1;
+		priv->drew_draft = TRUE;
+		draw_traces_x(plot, d, gc, &tp);
+	}
+	else {
+		draw_traces_x(plot, d, gc, &tp);
+	}
+	if(d == priv->plot_pixmap && !tp.draft) {
+		frame_shown(priv);
+	}
 	return FALSE;
 }
+//---------- End X11 draw
+#endif
 
-static gboolean jbplot_expose (GtkWidget *plot, GdkEventExpose *event) {
-	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
-
-	/* change the mouse cursor to show we're busy */
-	GdkCursor *cursor = gdk_cursor_new(GDK_WATCH);
-	gdk_window_set_cursor(plot->window, cursor);
-	
-
+/* Draws everything but the data and leaves the layout (plot area edges
+ * and the data-to-pixel transform) in priv.  Returns -1 if only the ideal
+ * margins were wanted.
+ */
+static int draw_plot_chrome(GtkWidget *plot, cairo_t *cr, double width, double height) {
+	int i;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
 	plot_t *p = &(priv->plot);
 	axis_t *x_axis = &(p->x_axis);
 	axis_t *y_axis = &(p->y_axis);
 	plot_area_t *pa = &(p->plot_area);
 	legend_t *l = &(p->legend);
-	
-	double x_m = priv->x_m;	
-	double y_m = priv->y_m;	
-	double x_b = priv->x_b;	
-	double y_b = priv->y_b;	
 
-#if DRAW_WITH_XLIB
-	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	// set some default values in cairo context
+	cairo_set_line_width(cr, 1.0);
 
-	Window root_win;
-	int x,y;
-	unsigned int w, h;
-	unsigned int bord_w, depth;
-	XGetGeometry(priv->xdisp, priv->plot_pixmap, &root_win, &x, &y, &w, &h, &bord_w, &depth);
-	draw_plot_x(plot, priv->plot_pixmap, w, h);
-	XCopyArea(priv->xdisp, priv->plot_pixmap, priv->xwin, gc, 0, 0, w, h, 0, 0);
+	//First fill the background
+	cairo_rectangle(cr, 0., 0., width, height);
+	cairo_set_source_rgb (cr, p->bg_color.red, p->bg_color.green, p->bg_color.blue);
+	cairo_fill(cr);
 
-	/********************** draw the cursor (if needed) *************************/
-	if(p->cursor.type != CURSOR_NONE) {
-		cursor_t *c = &(p->cursor);
-		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(c->color)) );
-		int lineStyle = LineSolid;
-		if(c->line_type == LINETYPE_SOLID) {
-			lineStyle = LineSolid;
-		}	
-		else if(c->line_type == LINETYPE_DASHED) {
-			lineStyle = LineOnOffDash;
-		}	
-		else if(c->line_type == LINETYPE_DOTTED) {
-			lineStyle = LineDoubleDash;
-		}
-		XSetLineAttributes(
-			priv->xdisp, gc, 
-			c->line_width,  // lineWidth
-			lineStyle, // lineStyle
-			CapRound,  //cap_style
-			JoinMiter  // jointStyle
-		);
-		double x_px = x_m * c->x + x_b;	
-		double y_px = y_m * c->y + y_b;	
-		if(c->type == CURSOR_VERT || c->type == CURSOR_CROSS) {
-			if(x_px >= p->plot_area.left_edge && x_px <= p->plot_area.right_edge) {
-				XDrawLine(
-					priv->xdisp, priv->xwin, gc, 
-					x_px, p->plot_area.top_edge, 
-					x_px, p->plot_area.bottom_edge
-				);
-			}
-		}
-		if(c->type == CURSOR_HORIZ || c->type == CURSOR_CROSS) {
-			if(y_px >= p->plot_area.top_edge && y_px <= p->plot_area.bottom_edge) {
-				XDrawLine(
-					priv->xdisp, priv->xwin, gc, 
-					p->plot_area.left_edge, y_px,
-					p->plot_area.right_edge, y_px
-				);
-			}
-		}
+	// now do the layout calcs
+  double title_top_edge = 0.01 * height;
+	double title_bottom_edge;
+	if(p->do_show_plot_title) {
+	  title_bottom_edge = title_top_edge + get_text_height(cr, p->plot_title, p->plot_title_font_size);
+	}
+	else {
+		title_bottom_edge = title_top_edge;
 	}
+  double x_label_bottom_edge = height - 0.01*height;
+  double x_label_top_edge = x_label_bottom_edge - 
+                             get_text_height(cr, x_axis->axis_label , x_axis->axis_label_font_size);
 
-	/************* draw the zoom box if zooming is active *****************/
-	if(priv->zooming) {
-		double dashes[] = {8.0,4.0};
-		XSetForeground(priv->xdisp, gc, 0x6CA5C8);
-		//XSetLineAttributes(priv->xdisp, gc, 1, LineOnOffDash,	CapRound, JoinMiter);
-		XSetLineAttributes(priv->xdisp, gc, 1, LineSolid,	CapRound, JoinMiter);
-		double x_e = priv->drag_end_x;
-		double y_e = priv->drag_end_y;
-		double x_s = priv->drag_start_x;
-		double y_s = priv->drag_start_y;
-		if(priv->drag_end_x < priv->plot.plot_area.left_edge) {
-			x_e = priv->plot.plot_area.left_edge;
-		}
-		else if(priv->drag_end_x > priv->plot.plot_area.right_edge) {
-			x_e = priv->plot.plot_area.right_edge;
-		}
-		if(priv->drag_end_y < priv->plot.plot_area.top_edge) {
-			y_e = priv->plot.plot_area.top_edge;
+  // draw the plot title if desired	
+	cairo_set_source_rgb (cr, 0., 0., 0.);
+  if(p->do_show_plot_title) {
+		cairo_save(cr);
+		cairo_set_font_size(cr, p->plot_title_font_size);
+		draw_horiz_text_at_point(cr, p->plot_title, 0.5*width, title_top_edge, ANCHOR_TOP_MIDDLE);
+		cairo_restore(cr);
+  }
+
+	/********** Draw the legend ***********************/
+	/* Draw the legend to the legend image buffer */
+	draw_legend((jbplot *)plot);
+
+	double legend_width, legend_height;
+	double legend_top_edge, legend_left_edge;
+	legend_width = l->size.width;
+	legend_height = l->size.height;
+
+	/* Then paint the legend image buffer to the plot surface */
+	if(l->position != LEGEND_POS_NONE) {
+		if(l->position == LEGEND_POS_RIGHT) {
+			legend_left_edge = width - legend_width - 10;
+			legend_top_edge = title_bottom_edge + 0.01 * height;
 		}
-		else if(priv->drag_end_y > priv->plot.plot_area.bottom_edge) {
-			y_e = priv->plot.plot_area.bottom_edge;
+		else if(l->position == LEGEND_POS_TOP) {
+			legend_left_edge = (width - legend_width)/2.;
+			legend_top_edge = title_bottom_edge + 10;
 		}
-		if(priv->h_zoom) {
-			y_s = priv->plot.plot_area.top_edge;
+		
+		cairo_save(cr);
+		cairo_set_source_surface(cr, priv->legend_buffer, legend_left_edge, legend_top_edge);
+		cairo_rectangle(cr, legend_left_edge, legend_top_edge, l->size.width, l->size.height);
+		cairo_clip(cr);
+		cairo_paint(cr);
+		cairo_restore(cr);
+	}
+	
+  double max_y_label_width = get_widest_label_width(y_axis, cr);
+  double y_tic_labels_left_edge;
+  double y_tic_labels_right_edge;
+  double plot_area_left_edge;
+  double plot_area_right_edge;
+	double y_label_left_edge;
+	double y_label_right_edge; 
+
+	// fire a zoom signal if needed
+	if((priv->needs_h_zoom_signal || priv->needs_v_zoom_signal) && !priv->get_ideal_lr) {
+		g_signal_emit_by_name((gpointer *)plot, "zoom-in", x_axis->min_val, x_axis->max_val, y_axis->min_val, y_axis->max_val);
+		priv->needs_h_zoom_signal = FALSE;
+		priv->needs_v_zoom_signal = FALSE;
+	}
+
+
+	if(priv->plot.plot_area.LR_margin_mode == MARGIN_AUTO || priv->get_ideal_lr) {
+		y_label_left_edge = MED_GAP;
+		y_label_right_edge = y_label_left_edge + 
+    	get_text_height(cr, y_axis->axis_label, y_axis->axis_label_font_size);
+		if(y_axis->do_show_axis_label) {
+			y_tic_labels_left_edge = y_label_right_edge + MED_GAP;
+		}
+		else {
+			y_tic_labels_left_edge = MED_GAP;
+		}
+
+		y_tic_labels_right_edge = y_tic_labels_left_edge + max_y_label_width;
+		plot_area_left_edge = y_tic_labels_right_edge + MED_GAP;
+
+		if(l->position == LEGEND_POS_RIGHT) {
+			plot_area_right_edge = legend_left_edge - 10;
+		}
+		else {
+			plot_area_right_edge = width - 0.06 * width;
+		}
+
+		double right_side_x_tic_label_width = 
+			get_text_width(cr, 
+			x_axis->major_tic_labels[x_axis->num_actual_major_tics-1], 
+			x_axis->tic_label_font_size);
+		if(0.5*right_side_x_tic_label_width > (width - plot_area_right_edge)) {
+			plot_area_right_edge = width - right_side_x_tic_label_width;
+		}
+		priv->plot.plot_area.left_edge = plot_area_left_edge;
+		priv->plot.plot_area.ideal_left_margin = plot_area_left_edge;
+		priv->plot.plot_area.right_edge = plot_area_right_edge;
+		priv->plot.plot_area.ideal_right_margin = width - plot_area_right_edge;
+	}
+	if(priv->get_ideal_lr) {
+		return -1;
+	}
+	if(priv->plot.plot_area.LR_margin_mode != MARGIN_AUTO) {
+		if(priv->plot.plot_area.LR_margin_mode == MARGIN_PERCENT) {
+			plot_area_left_edge = priv->plot.plot_area.lmargin * width;
+			plot_area_right_edge = width - priv->plot.plot_area.rmargin * width;
+		}
+		else { // pixels
+			plot_area_left_edge = priv->plot.plot_area.lmargin;
+			plot_area_right_edge = width - priv->plot.plot_area.rmargin;
+		}
+		priv->plot.plot_area.left_edge = plot_area_left_edge;
+		priv->plot.plot_area.right_edge = plot_area_right_edge;
+		y_tic_labels_right_edge = plot_area_left_edge - MED_GAP;
+		y_tic_labels_left_edge = y_tic_labels_right_edge - max_y_label_width;
+		y_label_right_edge = y_tic_labels_left_edge - MED_GAP;
+		y_label_left_edge = y_label_right_edge - 
+			get_text_height(cr, y_axis->axis_label, y_axis->axis_label_font_size);
+	}
+
+	double plot_area_top_edge;
+	if(l->position == LEGEND_POS_TOP) {
+		plot_area_top_edge = legend_top_edge + legend_height + 2*MED_GAP;
+	}
+	else {
+		plot_area_top_edge = title_bottom_edge + 2*MED_GAP;
+	}
+	priv->plot.plot_area.top_edge = plot_area_top_edge;
+  double x_tic_labels_bottom_edge;
+	if(x_axis->do_show_axis_label) {
+		x_tic_labels_bottom_edge = x_label_top_edge - MED_GAP;
+	}
+	else {
+		x_tic_labels_bottom_edge = height - MED_GAP;
+	}
+
+  double x_tic_labels_height = get_text_height(cr, x_axis->major_tic_labels[0], x_axis->tic_label_font_size);
+  double x_tic_labels_top_edge = x_tic_labels_bottom_edge - x_tic_labels_height;
+  double plot_area_bottom_edge = x_tic_labels_top_edge - MED_GAP;
+	priv->plot.plot_area.bottom_edge = plot_area_bottom_edge;
+  double plot_area_height = plot_area_bottom_edge - plot_area_top_edge;
+  double plot_area_width = plot_area_right_edge - plot_area_left_edge;
+  double y_label_middle_y = plot_area_top_edge + plot_area_height/2;
+  double y_label_bottom_edge = y_label_middle_y + 0.5*get_text_width(cr, y_axis->axis_label, y_axis->axis_label_font_size);
+  double x_label_middle_x = plot_area_left_edge + plot_area_width/2;
+
+	// these params can be used to transform from data coordinates to pixel coords
+	// for x-direction, use: x_pixel = x_m * x_data + x_b
+	// for y-direction, use: y_pixel = y_m * y_data + y_b	
+	double x_m = (plot_area_right_edge - plot_area_left_edge) / (x_axis->max_val - x_axis->min_val);	
+	double x_b = plot_area_left_edge - x_m * x_axis->min_val;	
+	double y_m = (plot_area_top_edge - plot_area_bottom_edge) / (y_axis->max_val - y_axis->min_val);	
+	double y_b = plot_area_bottom_edge - y_m * y_axis->min_val;
+	priv->x_m = x_m;	
+	priv->y_m = y_m;	
+	priv->x_b = x_b;	
+	priv->y_b = y_b;	
+	
+	// fill the plot area (we'll stroke the border later)
+	cairo_set_source_rgb (cr, pa->bg_color.red, pa->bg_color.green, pa->bg_color.blue);
+	cairo_rectangle(	cr, 
+										plot_area_left_edge,
+										plot_area_top_edge,
+										(plot_area_right_edge-plot_area_left_edge),
+										(plot_area_bottom_edge-plot_area_top_edge)
+									);
+	cairo_fill(cr);
+
+	// draw the y tic labels
+	cairo_set_source_rgb (cr, 0., 0., 0.);
+	cairo_save(cr);
+	cairo_set_font_size(cr, y_axis->tic_label_font_size);
+	if(y_axis->do_manual_tics) {
+		for(i=0; i<y_axis->num_actual_major_tics; i++) {
+			double val = y_axis->major_tic_values[i];
+			if(val <= y_axis->max_val && val >= y_axis->min_val) {
+				draw_horiz_text_at_point(	cr, 
+																	y_axis->major_tic_labels[i], 
+																	y_tic_labels_right_edge, 
+																	y_m * y_axis->major_tic_values[i] + y_b, 
+																	ANCHOR_MIDDLE_RIGHT
+																);
+			}
+		}
+	}
+	else {
+		for(i=0; i<y_axis->num_actual_major_tics; i++) {
+			draw_horiz_text_at_point(	cr, 
+																y_axis->major_tic_labels[i], 
+																y_tic_labels_right_edge, 
+																y_m * y_axis->major_tic_values[i] + y_b, 
+																ANCHOR_MIDDLE_RIGHT
+															);
+		}
+	}
+	cairo_restore(cr);
+
+	// draw the y major gridlines
+	if(y_axis->do_show_major_gridlines && y_axis->major_gridline_type != LINETYPE_NONE) {
+		cairo_save(cr);
+		if(y_axis->major_gridline_type == LINETYPE_SOLID) {
+			cairo_set_dash(cr, dash_pattern, 0, 0);
+		}	
+		else if(y_axis->major_gridline_type == LINETYPE_DASHED) {
+			cairo_set_dash(cr, dash_pattern, 2, 0);
+		}	
+		else if(y_axis->major_gridline_type == LINETYPE_DOTTED) {
+			cairo_set_dash(cr, dot_pattern, 2, 0);
+		}	
+		cairo_set_source_rgb(cr, 
+		                     y_axis->major_gridline_color.red, 
+		                     y_axis->major_gridline_color.green, 
+		                     y_axis->major_gridline_color.blue
+		);
+		cairo_set_line_width(cr, y_axis->major_gridline_width);
+		if(y_axis->do_manual_tics) {
+			for(i=0; i<y_axis->num_actual_major_tics; i++) {
+				double val = y_axis->major_tic_values[i];
+				if(val <= y_axis->max_val && val >= y_axis->min_val) {
+					double y = y_m * y_axis->major_tic_values[i] + y_b;
+					cairo_move_to(cr, plot_area_left_edge, y);
+					cairo_line_to(cr, plot_area_right_edge, y);
+					cairo_stroke(cr);
+				}
+			}
+		}	
+		else {
+			for(i=0; i<y_axis->num_actual_major_tics; i++) {
+				double y = y_m * y_axis->major_tic_values[i] + y_b;
+				cairo_move_to(cr, plot_area_left_edge, y);
+				cairo_line_to(cr, plot_area_right_edge, y);
+				cairo_stroke(cr);
+			}
+		}
+		cairo_restore(cr);
+	}
+	
+	// draw the x tic labels
+	cairo_set_source_rgb (cr, 0., 0., 0.);
+	cairo_save(cr);
+	cairo_set_font_size(cr, x_axis->tic_label_font_size);
+	if(x_axis->do_manual_tics) {
+		for(i=0; i<x_axis->num_actual_major_tics; i++) {
+			double val = x_axis->major_tic_values[i];
+			if(val <= x_axis->max_val && val >= x_axis->min_val) {
+				draw_horiz_text_at_point(	cr, 
+																	x_axis->major_tic_labels[i], 
+																	x_m * val + x_b, 
+																	x_tic_labels_top_edge, 
+																	ANCHOR_TOP_MIDDLE
+																);
+			}
+		}
+	}
+	else {
+		for(i=0; i<x_axis->num_actual_major_tics; i++) {
+			draw_horiz_text_at_point(	cr, 
+																x_axis->major_tic_labels[i], 
+																x_m * x_axis->major_tic_values[i] + x_b, 
+																x_tic_labels_top_edge, 
+																ANCHOR_TOP_MIDDLE
+															);
+		}
+	}
+	cairo_restore(cr);
+
+	// draw the x major gridlines
+	if(x_axis->do_show_major_gridlines && x_axis->major_gridline_type != LINETYPE_NONE) {
+		cairo_save(cr);
+		if(x_axis->major_gridline_type == LINETYPE_SOLID) {
+			cairo_set_dash(cr, dash_pattern, 0, 0);
+		}	
+		else if(x_axis->major_gridline_type == LINETYPE_DASHED) {
+			cairo_set_dash(cr, dash_pattern, 2, 0);
+		}	
+		else if(x_axis->major_gridline_type == LINETYPE_DOTTED) {
+			cairo_set_dash(cr, dot_pattern, 2, 0);
+		}	
+		cairo_set_source_rgb(cr, 
+		                     x_axis->major_gridline_color.red, 
+		                     x_axis->major_gridline_color.green, 
+		                     x_axis->major_gridline_color.blue
+		);
+		cairo_set_line_width(cr, x_axis->major_gridline_width);
+		if(x_axis->do_manual_tics) {
+			for(i=0; i<x_axis->num_actual_major_tics; i++) {
+				double val = x_axis->major_tic_values[i];
+				if(val <= x_axis->max_val && val >= x_axis->min_val) {
+					double x = x_m * val + x_b;		
+					cairo_move_to(cr, x, plot_area_bottom_edge);
+					cairo_line_to(cr, x, plot_area_top_edge);
+					cairo_stroke(cr);
+				}
+			}
+		}
+		else {
+			for(i=0; i<x_axis->num_actual_major_tics; i++) {
+				double x = x_m * x_axis->major_tic_values[i] + x_b;		
+				cairo_move_to(cr, x, plot_area_bottom_edge);
+				cairo_line_to(cr, x, plot_area_top_edge);
+				cairo_stroke(cr);
+			}
+		}
+		cairo_restore(cr);
+	}
+			
+	// draw the y-axis label if desired
+	cairo_set_source_rgb (cr, 0, 0, 0);
+	if(y_axis->do_show_axis_label) {
+		draw_vert_text_at_point(	plot,
+															cr, 
+															y_axis->axis_label, 
+															y_label_left_edge, 
+															y_label_bottom_edge, 
+															ANCHOR_BOTTOM_LEFT
+														);
+	}
+	
+	// draw the x-axis label if desired
+	cairo_set_source_rgb (cr, 0, 0, 0);
+	if(x_axis->do_show_axis_label) {
+		draw_horiz_text_at_point(	cr, 
+															x_axis->axis_label, 
+															x_label_middle_x, 
+															x_label_top_edge, 
+															ANCHOR_TOP_MIDDLE
+														);
+	}
+	
+
+	/*********** draw the plot area border ******************/
+	if(pa->do_show_bounding_box) {
+		cairo_set_source_rgb (cr, pa->border_color.red, pa->border_color.green, pa->border_color.blue);
+		cairo_set_line_width(cr, pa->bounding_box_width);
+		cairo_rectangle(
+			cr, 
+			plot_area_left_edge - pa->bounding_box_width, 
+			plot_area_top_edge - pa->bounding_box_width,
+			plot_area_right_edge - plot_area_left_edge + 2*pa->bounding_box_width,
+			plot_area_bottom_edge - plot_area_top_edge + 2*pa->bounding_box_width
+		);
+		cairo_stroke(cr);	
+	}
+
+	return 0;
+}
+
+/* Points view at the widget's own traces and layout */
+static void render_view_init(jbplotPrivate *priv, render_view_t *view) {
+	plot_t *p = &(priv->plot);
+	view->traces = p->traces;
+	view->pa = p->plot_area;
+	view->x_min = p->x_axis.min_val;
+	view->x_max = p->x_axis.max_val;
+	view->y_min = p->y_axis.min_val;
+	view->y_max = p->y_axis.max_val;
+	view->antialias = priv->antialias;
+	view->env = NULL;
+	view->env_length = NULL;
+	return;
+}
+
+/* Draws traces [i0, i1) for one pass of the renderer (see trace_pass_t):
+ * the lines, the markers or both, as given by what.  All scratch space
+ * comes from rs, so calls with different rs can run at the same time.
+ */
+static void draw_trace_range(render_view_t *view, cairo_t *cr, trace_pass_t *tp, render_scratch_t *rs, int i0, int i1, int what) {
+	int i, j;
+	plot_area_t *pa = &(view->pa);
+	double x_m = tp->x_m;
+	double x_b = tp->x_b;
+	double y_m = tp->y_m;
+	double y_b = tp->y_b;
+
+	// pixel extents of the axes; samples beyond them are out of range
+	double x_px_min = fmin(x_m * view->x_min + x_b, x_m * view->x_max + x_b);
+	double x_px_max = fmax(x_m * view->x_min + x_b, x_m * view->x_max + x_b);
+	double y_px_min = fmin(y_m * view->y_min + y_b, y_m * view->y_max + y_b);
+	double y_px_max = fmax(y_m * view->y_min + y_b, y_m * view->y_max + y_b);
+	int k;
+	rs->bounds[0] = x_px_min;
+	rs->bounds[1] = x_px_max;
+	rs->bounds[2] = y_px_min;
+	rs->bounds[3] = y_px_max;
+
+	// when drawing to an image surface, markers with a sprite are stamped
+	// straight into the pixels, and with antialiasing off, so are 1-px
+	// solid lines and point/square markers
+	raster_t raster;
+	int antialias = view->antialias && !tp->draft;
+	int have_image = raster_begin(&raster, cr) == 0;
+	int have_raster = !antialias && have_image;
+	pen_t pen;
+	pen.cr = cr;
+	if(have_image) {
+		raster_set_guard(&raster, pa->left_edge, pa->top_edge, pa->right_edge, pa->bottom_edge);
+	}
+	cairo_save(cr);
+	cairo_set_antialias(cr, antialias ? CAIRO_ANTIALIAS_DEFAULT : CAIRO_ANTIALIAS_NONE);
+
+	// now draw the trace lines (if requested)
+	if(what & DRAW_LINES) {
+		// clip to the plot area rows and the columns of this pass
+		cairo_save(cr);
+		cairo_rectangle(	cr, 
+											tp->clip_left,
+											pa->top_edge,
+											(tp->clip_right - tp->clip_left),
+											(pa->bottom_edge - pa->top_edge)
+										);
+		cairo_clip(cr);
+		for(i = i0; i < i1; i++) {
+			char first_pt = 1;
+			char last_was_NAN = 0;
+			char last_was_out = 0;
+			trace_t *t = view->traces[i];
+			if(t->line_type == LINETYPE_NONE) {
+				continue;
+			}
+			cairo_set_source_rgb (cr, t->line_color.red, t->line_color.green, t->line_color.blue);
+			cairo_set_line_width(cr, t->line_width);
+			if(t->line_type == LINETYPE_SOLID) {
+				cairo_set_dash(cr, dash_pattern, 0, 0);
+			}	
+			else if(t->line_type == LINETYPE_DASHED) {
+				cairo_set_dash(cr, dash_pattern, 2, 0);
+			}	
+			else if(t->line_type == LINETYPE_DOTTED) {
+				cairo_set_dash(cr, dot_pattern, 2, 0);
+			}	
+			if(t->length <= 0) continue;
+			pen.r = NULL;
+			if(have_raster && t->line_type == LINETYPE_SOLID && t->line_width <= 1.0) {
+				raster_set_clip(&raster, tp->clip_left, pa->top_edge, tp->clip_right, pa->bottom_edge);
+				raster_set_color(&raster, &(t->line_color));
+				raster_acquire(&raster);
+				pen.r = &raster;
+			}
+			int j0, j1;
+			int span = trace_get_visible_span(t, tp->x_lo, tp->x_hi, &j0, &j1);
+			int level = pass_pick_level(t, tp, span, fabs(x_m) * (tp->x_hi - tp->x_lo));
+			int dd = pass_stride(t, tp, span);
+			j0 -= j0 % dd;
+			if(view->env != NULL && view->env[i] != NULL) {
+				draw_envelope(&pen, view->env[i], view->env_length[i]);
+			}
+			else if(level >= 0 && lod_build_envelope(t, j0, j1, level, x_m, x_b, y_m, y_b, rs) >= 0) {
+				draw_envelope(&pen, rs->env, rs->env_length);
+			}
+			else if(t->lossless_decimation) {
+				for(j = j0, k = RENDER_CHUNK; j <= j1; j += dd, k++) {
+					int last_x_px, last_y_px;
+					double min_y, max_y;
+					if(k == RENDER_CHUNK) {
+						trace_to_px(t, j, j1, dd, x_m, x_b, y_m, y_b, rs);
+						k = 0;
+					}
+					double x_px = rs->x_px[k];
+					double y_px = rs->y_px[k];
+					if(first_pt) {
+						pen_move_to(&pen,	x_px,	y_px);
+						first_pt = 0;
+						min_y = max_y = y_px;
+					}
+					else {
+						if(x_px != last_x_px) {
+							/* first draw vertical line spanning min to max for previous x-pixel */
+							pen_move_to(&pen,	last_x_px,	min_y);
+							pen_line_to(&pen,	last_x_px,	max_y);
+							/* then draw a line connecting last point to this point */
+							pen_move_to(&pen,	last_x_px,	last_y_px);
+							pen_line_to(&pen,	x_px,	y_px);
+							min_y = max_y = y_px;
+						}
+						else {
+							if(y_px > max_y) 
+								max_y = y_px;
+							if(y_px < min_y) 
+								min_y = y_px;
+						}
+					}
+					last_x_px = x_px;
+					last_y_px = y_px;
+				}
+			}
+			else {
+				double last_x_px = 0, last_y_px = 0;
+				double margin = t->line_width + 2;
+				if(pen.r != NULL) {
+					px_dedup_runs(rs, raster.gx0, raster.gy0, raster.gx1, raster.gy1);
+				}
+				for(j = j0, k = RENDER_CHUNK; j <= j1; j += dd, k++) {
+					if(k == RENDER_CHUNK) {
+						px_dedup(rs, trace_to_px(t, j, j1, dd, x_m, x_b, y_m, y_b, rs));
+						k = 0;
+					}
+					double x_px = rs->x_px[k];
+					double y_px = rs->y_px[k];
+					if(rs->cls[k] == PX_DUP) {
+						continue;
+					}
+					if(rs->cls[k] == PX_NAN) {
+						last_was_NAN = 1;
+						continue;
+					}
+					char this_is_out = (rs->cls[k] == PX_OUT);
+					if(first_pt) {
+						pen_move_to(&pen,	x_px,	y_px);
+						first_pt = 0;
+					}
+					else if(last_was_NAN) {
+						pen_move_to(&pen,	x_px,	y_px);
+					}
+					else if(!this_is_out && last_was_out) {
+						pen_line_to(&pen,	x_px,	y_px);
+					}
+					else if(this_is_out && !last_was_out) {
+						pen_line_to(&pen,	x_px,	y_px);
+					}
+					else if(this_is_out && last_was_out) {
+						// both ends out of range, but the line may still
+						// cross the plot area: draw the part that does
+						double cx1 = last_x_px, cy1 = last_y_px, cx2 = x_px, cy2 = y_px;
+						if(clip_line(tp->clip_left - margin, pa->top_edge - margin, tp->clip_right + margin, pa->bottom_edge + margin,
+						             &cx1, &cy1, &cx2, &cy2) == 0) {
+							pen_move_to(&pen, cx1, cy1);
+							pen_line_to(&pen, cx2, cy2);
+						}
+						pen_move_to(&pen,	x_px,	y_px);
+					}
+					else {
+						pen_line_to(&pen,	x_px,	y_px);
+					}
+					last_was_NAN = 0;
+					last_was_out = this_is_out;
+					last_x_px = x_px;
+					last_y_px = y_px;
+				}
+				px_dedup_off(rs);
+			}
+			if(pen.r != NULL) {
+				raster_release(&raster);
+			}
+			else {
+				cairo_stroke(cr);
+			}
+		}
+		cairo_restore(cr);
+	}
+
+	// now draw the trace markers (if requested)
+	if(what & DRAW_MARKERS) {
+		cairo_save(cr);
+		if(tp->clip_markers) {
+			double cx0, cy0, cx1, cy1;
+			cairo_clip_extents(cr, &cx0, &cy0, &cx1, &cy1);
+			cairo_rectangle(cr, tp->mark_left, cy0, tp->mark_right - tp->mark_left, cy1 - cy0);
+			cairo_clip(cr);
+		}
+		for(i = i0; i < i1; i++) {
+			trace_t *t = view->traces[i];
+			if(trace_is_density(t)) {
+				draw_density(cr, t, tp, pa);
+				continue;
+			}
+			if(t->marker_type == MARKER_NONE || t->length <= 0) {
+				continue;
+			}
+			// a draft leaves the markers to traces that have no lines
+			if(tp->draft && t->line_type != LINETYPE_NONE) {
+				continue;
+			}
+			int use_raster = have_raster && raster_marker_ok(t->marker_type);
+			sprite_t *sprite = (have_image && !use_raster) ? trace_sprite(t, antialias) : NULL;
+			int batched = 0;
+			// markers that are opaque and drawn by their cell alone need only
+			// be drawn once per cell
+			double dedup_q = 0, dedup_off = 0;
+			if(sprite != NULL && !antialias) {
+				dedup_q = SPRITE_PHASES;
+			}
+			else if(use_raster && t->marker_type == MARKER_POINT) {
+				dedup_q = 1;
+			}
+			else if(use_raster && t->marker_type == MARKER_SQUARE && t->marker_size == floor(t->marker_size)) {
+				dedup_q = -1;
+				dedup_off = t->marker_size / 2.0 + 0.5;
+			}
+			if(use_raster || sprite != NULL) {
+				if(tp->clip_markers) {
+					raster_set_clip(&raster, tp->mark_left, -raster.oy, tp->mark_right, raster.height - raster.oy);
+				}
+				else {
+					raster_set_clip(&raster, -raster.ox, -raster.oy, raster.width - raster.ox, raster.height - raster.oy);
+				}
+				raster_set_color(&raster, &(t->marker_color));
+			}
+			cairo_save(cr);
+			cairo_set_source_rgb (cr, t->marker_color.red, t->marker_color.green, t->marker_color.blue);
+			if(t->marker_type == MARKER_POINT) {
+				cairo_set_line_cap(cr, CAIRO_LINE_CAP_ROUND);
+			}
+			double raster_size = (t->marker_type == MARKER_POINT) ? cairo_get_line_width(cr) : t->marker_size;
+			if(use_raster || sprite != NULL) {
+				raster_acquire(&raster);
+			}
+			// markers reach past the pass by up to their size
+			int j0, j1;
+			double pad = (x_m != 0) ? (t->marker_size / 2.0 + 1.0) / fabs(x_m) : 0;
+			int span = trace_get_visible_span(t, tp->x_lo - pad, tp->x_hi + pad, &j0, &j1);
+			int dd = pass_stride(t, tp, span);
+			j0 -= j0 % dd;
+			if(dedup_q != 0) {
+				px_dedup_markers(rs, dedup_q, dedup_off, (j1 - j0) / dd + 1);
+			}
+			for(j = j0, k = RENDER_CHUNK; j <= j1; j += dd, k++) {
+				if(k == RENDER_CHUNK) {
+					px_dedup(rs, trace_to_px(t, j, j1, dd, x_m, x_b, y_m, y_b, rs));
+					k = 0;
+				}
+				double x_px = rs->x_px[k];
+				double y_px = rs->y_px[k];
+				if(rs->cls[k] != PX_IN) {
+					continue;
+				}
+				if(sprite != NULL) {
+					raster_sprite(&raster, sprite, x_px, y_px);
+				}
+				else if(use_raster) {
+					raster_marker(&raster, t->marker_type, raster_size, x_px, y_px);
+				}
+				else {
+					marker_path(cr, t->marker_type, t->marker_size, x_px, y_px);
+					if(++batched == MARKER_BATCH) {
+						marker_paint(cr, t->marker_type);
+						batched = 0;
+					}
+				}
+			}
+			if(batched > 0) {
+				marker_paint(cr, t->marker_type);
+			}
+			px_dedup_off(rs);
+			if(use_raster || sprite != NULL) {
+				raster_release(&raster);
+			}
+			cairo_restore(cr);
+		}
+		cairo_restore(cr);
+	}
+	cairo_restore(cr);
+	return;
+}
+
+static void render_layers_free(jbplotPrivate *priv) {
+	int i;
+	for(i = 0; i < MAX_RENDER_JOBS; i++) {
+		if(priv->render_layers[i] != NULL) {
+			cairo_surface_destroy(priv->render_layers[i]);
+			priv->render_layers[i] = NULL;
+		}
+	}
+	return;
+}
+
+typedef struct render_batch_t {
+	GtkWidget *plot;
+	render_view_t view;
+	int what;
+} render_batch_t;
+
+/* clears a job's layer and draws its share of the phase into it */
+static void run_render_job(void *ctx, int n, render_scratch_t *rs) {
+	render_batch_t *batch = ctx;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(batch->plot);
+	render_job_t *job = &(priv->render_jobs[n]);
+	if((batch->what == DRAW_LINES && !job->lines) || (batch->what == DRAW_MARKERS && !job->markers)) {
+		return;
+	}
+	cairo_t *cr = cairo_create(priv->render_layers[n]);
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	cairo_paint(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_OVER);
+	cairo_translate(cr, -job->left, 0);
+	draw_trace_range(&(batch->view), cr, &(job->tp), rs, job->i0, job->i1, batch->what);
+	cairo_destroy(cr);
+	return;
+}
+
+/* Rough cost of drawing trace t in pass tp, in samples visited */
+static double trace_cost(trace_t *t, trace_pass_t *tp, int *level) {
+	int j0, j1;
+	double width_px = fabs(tp->x_m) * (tp->x_hi - tp->x_lo);
+	int span = trace_get_visible_span(t, tp->x_lo, tp->x_hi, &j0, &j1);
+	int dd = pass_stride(t, tp, span);
+	double cost = 1;
+	*level = pass_pick_level(t, tp, span, width_px);
+	if(t->line_type != LINETYPE_NONE) {
+		cost += (*level >= 0) ? 4 * width_px : span / dd;
+	}
+	if(trace_is_density(t)) {
+		cost += width_px;
+	}
+	else if(t->marker_type != MARKER_NONE) {
+		cost += span / dd;
+	}
+	return cost;
+}
+
+static void add_render_job(jbplotPrivate *priv, render_job_t *job, trace_pass_t *tp, int i0, int i1, int left, int right) {
+	int i;
+	job->tp = *tp;
+	job->i0 = i0;
+	job->i1 = i1;
+	job->left = left;
+	job->right = right;
+	job->lines = 0;
+	job->markers = 0;
+	for(i = i0; i < i1; i++) {
+		trace_t *t = priv->plot.traces[i];
+		if(t->length > 0 && t->line_type != LINETYPE_NONE) {
+			job->lines = 1;
+		}
+		if(t->length > 0 && (t->marker_type != MARKER_NONE || trace_is_density(t))) {
+			job->markers = 1;
+		}
+	}
+	return;
+}
+
+/* Splits the traces into num_threads jobs of roughly equal cost, put in
+ * jobs (which has room for MAX_RENDER_JOBS); returns how many there are.
+ * Runs of cheap traces are grouped; a trace costing more than a share on
+ * its own is cut into column bands if that draws the same pixels, which
+ * holds for x-monotonic traces drawn from the raw samples with 1-px solid
+ * lines. */
+static int plan_render_jobs(jbplotPrivate *priv, trace_pass_t *tp, int width, int num_threads, render_job_t *jobs) {
+	int i, k;
+	int n = 0;
+	plot_t *p = &(priv->plot);
+	int levels[MAX_NUM_TRACES];
+	double costs[MAX_NUM_TRACES];
+	double total = 0;
+	for(i = 0; i < p->num_traces; i++) {
+		costs[i] = trace_cost(p->traces[i], tp, &(levels[i]));
+		total += costs[i];
+	}
+	double share = total / num_threads;
+	int left = floor(tp->clip_left);
+	int right = ceil(tp->clip_right);
+	int start = 0;
+	double group = 0;
+
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		int bands = num_threads;
+		if(bands > (right - left) / 16) {
+			bands = (right - left) / 16;
+		}
+		if(bands > MAX_RENDER_JOBS - n - 2) {
+			bands = MAX_RENDER_JOBS - n - 2;
+		}
+		if(costs[i] > share && bands >= 2 && t->x_monotonic && levels[i] < 0 && tp->x_m > 0 && !trace_is_density(t) &&
+		   (t->line_type == LINETYPE_NONE || (t->line_type == LINETYPE_SOLID && t->line_width <= 1.0))) {
+			if(i > start) {
+				add_render_job(priv, &(jobs[n++]), tp, start, i, 0, width);
+			}
+			for(k = 0; k < bands; k++) {
+				int c0 = left + (int)((double)(right - left) * k / bands);
+				int c1 = left + (int)((double)(right - left) * (k + 1) / bands);
+				trace_pass_t band = *tp;
+				band.raw = 1;
+				band.clip_markers = 1;
+				band.mark_left = tp->clip_markers ? tp->mark_left : 0;
+				band.mark_right = tp->clip_markers ? tp->mark_right : width;
+				// pad the samples by a pixel so the segments crossing the
+				// band edges are drawn whatever the rounding
+				if(k > 0) {
+					band.clip_left = band.mark_left = c0;
+					band.x_lo = (c0 - 1 - tp->x_b) / tp->x_m;
+				}
+				if(k < bands - 1) {
+					band.clip_right = band.mark_right = c1;
+					band.x_hi = (c1 + 1 - tp->x_b) / tp->x_m;
+				}
+				int l = floor(band.mark_left);
+				int r = ceil(band.mark_right);
+				add_render_job(priv, &(jobs[n++]), &band, i, i + 1, l < 0 ? 0 : l, r > width ? width : r);
+			}
+			start = i + 1;
+			group = 0;
+			continue;
+		}
+		group += costs[i];
+		if(group >= share && n < MAX_RENDER_JOBS - 2) {
+			add_render_job(priv, &(jobs[n++]), tp, start, i + 1, 0, width);
+			start = i + 1;
+			group = 0;
+		}
+	}
+	if(start < p->num_traces) {
+		add_render_job(priv, &(jobs[n++]), tp, start, p->num_traces, 0, width);
+	}
+	return n;
+}
+
+/* Draws the traces on the render pool: each job draws into its own layer
+ * and the layers are laid over cr in trace order, all the lines first and
+ * then all the markers as the serial renderer does.  Returns -1 if the
+ * pass isn't worth splitting or cr isn't an image surface the layers
+ * line up with, in which case nothing was drawn. */
+static int draw_traces_parallel(GtkWidget *plot, cairo_t *cr, trace_pass_t *tp) {
+	int i, n, what;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	raster_t target;
+	if(p->num_traces < 1 || raster_begin(&target, cr) < 0 || target.ox != 0 || target.oy != 0) {
+		return -1;
+	}
+	if(get_render_pool(priv) == NULL) {
+		return -1;
+	}
+
+	// the pyramids are brought up to date lazily; do it here, not in the
+	// workers
+	for(i = 0; i < p->num_traces; i++) {
+		lod_sync(p->traces[i]);
+	}
+	priv->num_render_jobs = plan_render_jobs(priv, tp, target.width, priv->render_pool->num_workers + 1, priv->render_jobs);
+	if(priv->num_render_jobs < 2) {
+		return -1;
+	}
+	for(n = 0; n < priv->num_render_jobs; n++) {
+		render_job_t *job = &(priv->render_jobs[n]);
+		cairo_surface_t *s = priv->render_layers[n];
+		int w = job->right - job->left;
+		if(w < 1) {
+			w = 1;
+		}
+		if(s != NULL && (cairo_image_surface_get_width(s) != w || cairo_image_surface_get_height(s) != target.height)) {
+			cairo_surface_destroy(s);
+			s = NULL;
+		}
+		if(s == NULL) {
+			s = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, w, target.height);
+			if(cairo_surface_status(s) != CAIRO_STATUS_SUCCESS) {
+				printf("Error creating render layer: %s\n", cairo_status_to_string(cairo_surface_status(s)));
+				cairo_surface_destroy(s);
+				priv->render_layers[n] = NULL;
+				return -1;
+			}
+		}
+		priv->render_layers[n] = s;
+	}
+
+	render_batch_t batch;
+	batch.plot = plot;
+	render_view_init(priv, &(batch.view));
+	for(what = DRAW_LINES; what <= DRAW_MARKERS; what <<= 1) {
+		batch.what = what;
+		render_pool_run(priv->render_pool, run_render_job, &batch, priv->num_render_jobs, &(priv->scratch));
+		for(n = 0; n < priv->num_render_jobs; n++) {
+			render_job_t *job = &(priv->render_jobs[n]);
+			if((what == DRAW_LINES && !job->lines) || (what == DRAW_MARKERS && !job->markers)) {
+				continue;
+			}
+			cairo_save(cr);
+			cairo_rectangle(cr, job->left, 0, job->right - job->left, target.height);
+			cairo_clip(cr);
+			cairo_set_source_surface(cr, priv->render_layers[n], job->left, 0);
+			cairo_paint(cr);
+			cairo_restore(cr);
+		}
+	}
+	return 0;
+}
+
+/* Draws the traces for one pass of the renderer (see trace_pass_t) */
+static void draw_traces(GtkWidget *plot, cairo_t *cr, trace_pass_t *tp) {
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	int i;
+	density_update(priv, tp);
+	// sprites are rendered here so render jobs only read them
+	for(i = 0; i < priv->plot.num_traces; i++) {
+		trace_t *t = priv->plot.traces[i];
+		if(!trace_is_density(t) && t->length > 0) {
+			sprite_update(t, priv->antialias && !tp->draft);
+		}
+	}
+	if(priv->render_threads > 1 && draw_traces_parallel(plot, cr, tp) == 0) {
+		return;
+	}
+	render_view_t view;
+	render_view_init(priv, &view);
+	draw_trace_range(&view, cr, tp, &(priv->scratch), 0, priv->plot.num_traces, DRAW_LINES | DRAW_MARKERS);
+	return;
+}
+
+/* (Re)allocates the scroll layer surface if the widget size changed */
+static int scroll_layer_alloc(GtkWidget *plot, int width, int height) {
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	scroll_layer_t *sl = &(priv->scroll);
+	if(priv->data_buffer != NULL && sl->width == width && sl->height == height) {
+		return 0;
+	}
+	if(priv->data_context != NULL) {
+		cairo_destroy(priv->data_context);
+		priv->data_context = NULL;
+	}
+	if(priv->data_buffer != NULL) {
+		cairo_surface_destroy(priv->data_buffer);
+		priv->data_buffer = NULL;
+	}
+	cairo_surface_t *buf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(buf) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating scroll layer: %s\n", cairo_status_to_string(cairo_surface_status(buf)));
+		cairo_surface_destroy(buf);
+		return -1;
+	}
+	priv->data_buffer = buf;
+	priv->data_context = cairo_create(buf);
+	sl->width = width;
+	sl->height = height;
+	sl->valid = 0;
+	return 0;
+}
+
+/* Brings the scroll layer up to date: shifts what is still good left by
+ * whole pixels and draws only what was exposed or added.  The layer is
+ * transparent wherever there's no data, so it can be laid over the chrome.
+ */
+static void draw_scroll_layer(GtkWidget *plot, trace_pass_t *tp) {
+	int r;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_area_t *pa = &(priv->plot.plot_area);
+	scroll_layer_t *sl = &(priv->scroll);
+	cairo_t *cr = priv->data_context;
+	int shift;
+
+	cairo_save(cr);
+	cairo_set_operator(cr, CAIRO_OPERATOR_CLEAR);
+	if(scroll_layer_plan(priv, tp, &shift)) {
+		if(shift > 0) {
+			// move the rows of the plot area left in place
+			int left = floor(pa->left_edge);
+			int right = ceil(pa->right_edge);
+			int top = floor(pa->top_edge);
+			int bottom = ceil(pa->bottom_edge);
+			if(left < 0) left = 0;
+			if(right > sl->width) right = sl->width;
+			if(top < 0) top = 0;
+			if(bottom > sl->height) bottom = sl->height;
+			cairo_surface_flush(priv->data_buffer);
+			unsigned char *data = cairo_image_surface_get_data(priv->data_buffer);
+			int stride = cairo_image_surface_get_stride(priv->data_buffer);
+			for(r = top; r < bottom && right - left > shift; r++) {
+				unsigned char *row = data + r * stride;
+				memmove(row + 4 * left, row + 4 * (left + shift), 4 * (right - left - shift));
+			}
+			cairo_surface_mark_dirty(priv->data_buffer);
+		}
+		cairo_rectangle(cr, tp->clip_left, 0, sl->width - tp->clip_left, sl->height);
+		cairo_fill(cr);
+	}
+	else {
+		cairo_paint(cr);
+	}
+	cairo_restore(cr);
+
+	draw_traces(plot, cr, tp);
+	scroll_layer_commit(priv, tp);
+	return;
+}
+
+static gboolean draw_plot(GtkWidget *plot, cairo_t *cr, double width, double height) {
+	int i;
+	jbplotPrivate	*priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
+
+	if(!priv->needs_redraw) {
+		return FALSE;
+	}
+	priv->needs_redraw = FALSE;
+
+	// take in whatever the acquisition threads have published
+	for(i = 0; i < p->num_traces; i++) {
+		jbplot_trace_drain_feed(p->traces[i]);
+	}
+
+	update_axis_ranges(p);
+
+	if(priv->exposing) {
+		if(progress_defer(priv, width, height) || progress_follow(plot, width, height)) {
+			return FALSE;
+		}
+		progress_cancel(priv);
+	}
+
+	if(cr == priv->plot_context && frame_cache_reuse(plot, width, height)) {
+		return FALSE;
+	}
+
+	// only the widget's own buffer keeps a chrome layer; captures draw
+	// everything straight to their context
+	if(cr != priv->plot_context || priv->chrome_context == NULL) {
+		if(draw_plot_chrome(plot, cr, width, height) < 0) {
+			return FALSE;
+		}
+	}
+	else {
+		if(!chrome_is_current(priv, width, height)) {
+			priv->chrome_valid = FALSE;
+			if(draw_plot_chrome(plot, priv->chrome_context, width, height) < 0) {
+				return FALSE;
+			}
+			get_chrome_key(priv, width, height, &(priv->chrome_key));
+			priv->chrome_valid = TRUE;
+		}
+		cairo_save(cr);
+		cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface(cr, priv->chrome_buffer, 0, 0);
+		cairo_paint(cr);
+		cairo_restore(cr);
+	}
+	cairo_set_line_width(cr, 1.0);
+
+	/*************** Draw the data ******************/
+	trace_pass_t tp;
+	frame_pass_init(priv, &tp, width);
+	tp.draft = priv->interacting && cr == priv->plot_context;
+
+	// a middle-button pan is laid out from tiles at the scale it started at
+	if(priv->panning && cr == priv->plot_context && draw_pan_tiles(plot, &tp) == 0) {
+		return FALSE;
+	}
+	if(priv->wheel.active && !priv->panning && cr == priv->plot_context && wheel_preview_show(plot, &tp, width, height) == 0) {
+		return FALSE;
+	}
+
+	// drafts don't go into the scroll layer, which has to be redrawn after
+	if(tp.draft) {
+		priv->drew_draft = TRUE;
+		priv->scroll.valid = 0;
+	}
+	if(priv->scroll_mode && !tp.draft && cr == priv->plot_context && scroll_layer_alloc(plot, width, height) == 0) {
+		draw_scroll_layer(plot, &tp);
+		cairo_save(cr);
+		cairo_rectangle(cr, pa->left_edge, pa->top_edge, 
+			pa->right_edge - pa->left_edge, pa->bottom_edge - pa->top_edge);
+		cairo_clip(cr);
+		cairo_set_source_surface(cr, priv->data_buffer, 0, 0);
+		cairo_paint(cr);
+		cairo_restore(cr);
+	}
+	else if(cr == priv->plot_context && progress_plan(priv, &tp, width) == 0 && progress_begin(plot, width, height, 0) == 0) {
+		// a coarse pass for now; the idle callbacks draw the rest
+		tp.draft = 1;
+		priv->drew_draft = TRUE;
+		draw_traces(plot, cr, &tp);
+	}
+	else {
+		draw_traces(plot, cr, &tp);
+	}
+	if(cr == priv->plot_context && !tp.draft) {
+		frame_shown(priv);
+	}
+	return FALSE;
+}
+
+/* This get's called by GtkMain when the widget is resized. 
+ * We'll use it to resize (reallocate) our plot image buffer
+ */
+static gboolean jbplot_configure (GtkWidget *plot, GdkEventConfigure *event) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+
+	double width = plot->allocation.width;
+	double height = plot->allocation.height;
+
+#if DRAW_WITH_XLIB
+	// handle X initialization stuff here
+	if(priv->xdisp == NULL) {
+		priv->xdisp = gdk_x11_drawable_get_xdisplay(plot->window);
+		priv->xwin =gdk_x11_drawable_get_xid(plot->window);
+
+		// just allocate a big, fixed-size pixmap for the legend
+		priv->legend_pixmap = XCreatePixmap(
+			priv->xdisp, priv->xwin, 
+			2000, 2000, 
+			XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
+		);
+	}
+
+	// load font and font information use for text metrics
+
+	// free the current plot pixmap, and allocate a new one of the new size
+	if(priv->plot_pixmap) {
+		XFreePixmap(priv->xdisp, priv->plot_pixmap);
+	}
+	Pixmap pm = XCreatePixmap(
+		priv->xdisp, priv->xwin, 
+		width, height, 
+		XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
+	);
+	priv->plot_pixmap = pm;
+
+	// and the same for the chrome layer
+	if(priv->chrome_pixmap) {
+		XFreePixmap(priv->xdisp, priv->chrome_pixmap);
+	}
+	priv->chrome_pixmap = XCreatePixmap(
+		priv->xdisp, priv->xwin, 
+		width, height, 
+		XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
+	);
+#else
+	if(priv->chrome_context != NULL) {
+		cairo_destroy(priv->chrome_context);
+	}
+	if(priv->chrome_buffer != NULL) {
+		cairo_surface_destroy(priv->chrome_buffer);
+	}
+	priv->chrome_buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	priv->chrome_context = cairo_create(priv->chrome_buffer);
+	if(cairo_status(priv->chrome_context) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating chrome context: %s\n", cairo_status_to_string(cairo_status(priv->chrome_context)));
+		cairo_destroy(priv->chrome_context);
+		cairo_surface_destroy(priv->chrome_buffer);
+		priv->chrome_context = NULL;
+		priv->chrome_buffer = NULL;
+	}
+#endif
+	priv->chrome_valid = FALSE;
+	priv->scroll.valid = 0;
+	priv->frames.shown_valid = FALSE;
+	progress_cancel(priv);
+	tile_cache_reset(priv);
+	wheel_preview_reset(priv);
+
+
+	if(priv->plot_context != NULL) {
+		cairo_destroy(priv->plot_context);
+	}
+	if(priv->plot_buffer != NULL) {
+		cairo_surface_destroy(priv->plot_buffer);
+	}
+	priv->plot_buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	cairo_status_t stat = cairo_surface_status(priv->plot_buffer);
+	if(stat != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating cairo image surface: %s\n", cairo_status_to_string(stat));
+	}
+	priv->plot_context = cairo_create(priv->plot_buffer);
+	cairo_status_t cr_stat = cairo_status(priv->plot_context);
+	if(cr_stat != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating cairo image context: %s\n", cairo_status_to_string(cr_stat));
+		return FALSE;
+	}
+	priv->needs_redraw = TRUE;
+	priv->plot.legend.needs_redraw = 1;
+	return FALSE;
+}
+
+static double ms_between(GTimeVal *from, GTimeVal *to) {
+	return (to->tv_sec - from->tv_sec) * 1.e3 + (to->tv_usec - from->tv_usec) * 1.e-3;
+}
+
+static gboolean frame_timeout(gpointer data) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(data);
+	priv->sched.timer = 0;
+	gtk_widget_queue_draw((GtkWidget *)data);
+	return FALSE;
+}
+
+/* Asks for a frame at the next slot the scheduler allows, unless one is
+ * already on its way */
+static void frame_request(GtkWidget *plot) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	frame_sched_t *s = &(priv->sched);
+	GTimeVal now;
+	s->stats.refreshes++;
+	if(s->max_fps <= 0) {
+		gtk_widget_queue_draw(plot);
+		return;
+	}
+	if(s->pending) {
+		s->stats.coalesced++;
+		return;
+	}
+	s->pending = 1;
+	g_get_current_time(&now);
+	double wait = ms_between(&now, &(s->next_due));
+	// a wait longer than a frame slot means the clock was set back
+	if(wait <= 0 || wait > 1000.0 / s->max_fps) {
+		gtk_widget_queue_draw(plot);
+	}
+	else {
+		// the redraw itself then runs below input events too
+		s->timer = g_timeout_add_full(G_PRIORITY_DEFAULT_IDLE, (guint)ceil(wait), frame_timeout, plot, NULL);
+	}
+	return;
+}
+
+/* Scales what a draft may draw so that drafts take about the frame budget */
+static void draft_tune(jbplotPrivate *priv, double took_ms) {
+	double budget = (priv->sched.budget_ms > 0) ? priv->sched.budget_ms : DRAFT_BUDGET_MS;
+	double scale = (took_ms > 0) ? budget / took_ms : 2;
+	if(scale < 0.5) scale = 0.5;
+	if(scale > 2) scale = 2;
+	priv->draft_samples *= scale;
+	if(priv->draft_samples < DRAFT_MIN_SAMPLES) priv->draft_samples = DRAFT_MIN_SAMPLES;
+	if(priv->draft_samples > DRAFT_MAX_SAMPLES) priv->draft_samples = DRAFT_MAX_SAMPLES;
+	return;
+}
+
+static gboolean interaction_settled(gpointer data) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(data);
+	priv->settle_timer = 0;
+	priv->interacting = FALSE;
+	priv->needs_redraw = TRUE;
+	gtk_widget_queue_draw((GtkWidget *)data);
+	return FALSE;
+}
+
+/* A pan or zoom gesture moved the view: frames are drafts until none
+ * has for settle_ms, and then one at full quality follows */
+static void interaction_tick(GtkWidget *plot) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	if(!priv->draft_quality) {
+		return;
+	}
+	priv->interacting = TRUE;
+	if(priv->settle_timer != 0) {
+		g_source_remove(priv->settle_timer);
+	}
+	priv->settle_timer = g_timeout_add(priv->settle_ms, interaction_settled, plot);
+	return;
+}
+
+/* Sets tp up to draw the whole view at full quality */
+static void frame_pass_init(jbplotPrivate *priv, trace_pass_t *tp, double width) {
+	plot_t *p = &(priv->plot);
+	tp->x_lo = p->x_axis.min_val;
+	tp->x_hi = p->x_axis.max_val;
+	tp->x_m = priv->x_m;
+	tp->x_b = priv->x_b;
+	tp->y_m = priv->y_m;
+	tp->y_b = priv->y_b;
+	tp->clip_left = p->plot_area.left_edge;
+	tp->clip_right = p->plot_area.right_edge;
+	tp->clip_markers = 0;
+	tp->mark_left = 0;
+	tp->mark_right = width;
+	tp->raw = 0;
+	tp->mono = 0;
+	tp->draft = 0;
+	tp->draft_samples = (int)(priv->draft_samples / (p->num_traces > 0 ? p->num_traces : 1));
+	return;
+}
+
+/* Splits the refinement of pass tp into jobs */
+static void progress_prepare(jbplotPrivate *priv, trace_pass_t *tp, int width) {
+	int i;
+	plot_t *p = &(priv->plot);
+	progress_t *pr = &(priv->progress);
+	pr->tp = *tp;
+	pr->deferred = 0;
+	pr->num_jobs = plan_render_jobs(priv, tp, width, PROGRESS_JOBS, pr->jobs);
+	pr->phase = DRAW_LINES;
+	pr->next_job = 0;
+	pr->num_traces = p->num_traces;
+	for(i = 0; i < p->num_traces; i++) {
+		pr->traces[i] = p->traces[i];
+		pr->data_gen[i] = p->traces[i]->data_gen;
+		pr->edit_gen[i] = p->traces[i]->edit_gen;
+	}
+	return;
+}
+
+/* Decides whether pass tp has too many samples to draw in one go, going
+ * by what the drafts manage within a frame budget, and if so plans its
+ * refinement.  Returns -1 if it should just be drawn. */
+static int progress_plan(jbplotPrivate *priv, trace_pass_t *tp, int width) {
+	int i, level;
+	plot_t *p = &(priv->plot);
+	double total = 0;
+	if(!priv->progressive || !priv->exposing || tp->draft || p->num_traces < 1) {
+		return -1;
+	}
+	for(i = 0; i < p->num_traces; i++) {
+		total += trace_cost(p->traces[i], tp, &level);
+	}
+	if(total < PROGRESS_FRAMES * priv->draft_samples) {
+		return -1;
+	}
+	progress_prepare(priv, tp, width);
+	return 0;
+}
+
+/* (Re)allocates the buffer the refinement is drawn into */
+static int progress_alloc(GtkWidget *plot, int width, int height) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	progress_t *pr = &(priv->progress);
+#if DRAW_WITH_XLIB
+	if(priv->progress_pixmap && pr->width == width && pr->height == height) {
+		return 0;
+	}
+	if(priv->progress_pixmap) {
+		XFreePixmap(priv->xdisp, priv->progress_pixmap);
+	}
+	priv->progress_pixmap = XCreatePixmap(
+		priv->xdisp, priv->xwin, 
+		width, height, 
+		XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp))
+	);
+#else
+	if(priv->progress_buffer != NULL && pr->width == width && pr->height == height) {
+		return 0;
+	}
+	if(priv->progress_context != NULL) {
+		cairo_destroy(priv->progress_context);
+		priv->progress_context = NULL;
+	}
+	if(priv->progress_buffer != NULL) {
+		cairo_surface_destroy(priv->progress_buffer);
+		priv->progress_buffer = NULL;
+	}
+	cairo_surface_t *buf = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(buf) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating refinement buffer: %s\n", cairo_status_to_string(cairo_surface_status(buf)));
+		cairo_surface_destroy(buf);
+		return -1;
+	}
+	priv->progress_buffer = buf;
+	priv->progress_context = cairo_create(buf);
+#endif
+	pr->width = width;
+	pr->height = height;
+	return 0;
+}
+
+/* The refinement is still good if no frame has been asked for since and
+ * the traces are the ones it started with, changed at most by appending */
+static int progress_is_current(jbplotPrivate *priv) {
+	int i;
+	plot_t *p = &(priv->plot);
+	progress_t *pr = &(priv->progress);
+	if(priv->needs_redraw || p->num_traces != pr->num_traces) {
+		return 0;
+	}
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		if(t != pr->traces[i] || t->edit_gen != pr->edit_gen[i]) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+/* A frame is wanted while a refinement goes on.  If all that changed
+ * since it started is samples appended to the traces, the refinement goes
+ * on and the frame is put off until it's done; otherwise a plot taking in
+ * samples faster than it refines would start over at every frame and
+ * never get past the coarse pass.  Returns 1 if the frame is put off. */
+static int progress_defer(jbplotPrivate *priv, double width, double height) {
+	int i;
+	plot_t *p = &(priv->plot);
+	progress_t *pr = &(priv->progress);
+	if(pr->idle == 0 || p->num_traces != pr->num_traces || !chrome_is_current(priv, width, height)) {
+		return 0;
+	}
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		if(t != pr->traces[i] || t->edit_gen != pr->edit_gen[i]) {
+			return 0;
+		}
+	}
+	pr->deferred = 1;
+	return 1;
+}
+
+/* Asks for the frame put off for a refinement, now that it's on screen */
+static gboolean progress_owed(gpointer data) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(data);
+	priv->progress.owed = 0;
+	priv->progress.follow = 1;
+	priv->needs_redraw = TRUE;
+	frame_request((GtkWidget *)data);
+	return FALSE;
+}
+
+/* Draws one job's share of a phase of the refinement */
+static void progress_draw_job(GtkWidget *plot, render_job_t *job, int what) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	if((what == DRAW_LINES && !job->lines) || (what == DRAW_MARKERS && !job->markers)) {
+		return;
+	}
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	render_view_t view;
+	render_view_init(priv, &view);
+	XSetLineAttributes(priv->xdisp, gc, 1, LineSolid, CapRound, JoinMiter);
+	draw_trace_range_x(plot, &view, priv->progress_pixmap, gc, &(job->tp), job->i0, job->i1, what);
+#else
+	int i;
+	// the coarse pass left the sprites without antialiasing
+	for(i = job->i0; i < job->i1; i++) {
+		trace_t *t = priv->plot.traces[i];
+		if(!trace_is_density(t) && t->length > 0) {
+			sprite_update(t, priv->antialias);
+		}
+	}
+	render_view_t view;
+	render_view_init(priv, &view);
+	draw_trace_range(&view, priv->progress_context, &(job->tp), &(priv->scratch), job->i0, job->i1, what);
+#endif
+	return;
+}
+
+/* All jobs are drawn: the refined frame replaces the coarse one */
+static void progress_finish(GtkWidget *plot) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	progress_t *pr = &(priv->progress);
+	pr->idle = 0;
+	pr->num_jobs = 0;
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	XCopyArea(priv->xdisp, priv->progress_pixmap, priv->plot_pixmap, gc, 0, 0, pr->width, pr->height, 0, 0);
+#else
+	cairo_surface_flush(priv->progress_buffer);
+	cairo_save(priv->plot_context);
+	cairo_set_operator(priv->plot_context, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(priv->plot_context, priv->progress_buffer, 0, 0);
+	cairo_paint(priv->plot_context);
+	cairo_restore(priv->plot_context);
+#endif
+	// it takes the place of a wheel preview too
+	wheel_preview_reset(priv);
+	frame_shown(priv);
+	priv->sched.stats.refined++;
+	gtk_widget_queue_draw(plot);
+	// the samples that came in meanwhile follow, once this one is shown
+	if(pr->deferred) {
+		pr->deferred = 0;
+		pr->owed = g_idle_add(progress_owed, plot);
+	}
+	return;
+}
+
+/* Draws refinement jobs for up to a time slice (at least one job), and
+ * keeps being called until they're all done */
+static gboolean progress_idle(gpointer data) {
+	GtkWidget *plot = (GtkWidget *)data;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	progress_t *pr = &(priv->progress);
+	GTimeVal start, now;
+	if(!progress_is_current(priv)) {
+		// make sure a frame of what's there now follows
+		pr->idle = 0;
+		pr->num_jobs = 0;
+		priv->sched.stats.abandoned++;
+		priv->needs_redraw = TRUE;
+		gtk_widget_queue_draw(plot);
+		return FALSE;
+	}
+	density_update(priv, &(pr->tp));
+	g_get_current_time(&start);
+	do {
+		progress_draw_job(plot, &(pr->jobs[pr->next_job]), pr->phase);
+		if(++pr->next_job == pr->num_jobs) {
+			if(pr->phase == DRAW_MARKERS) {
+				progress_finish(plot);
+				return FALSE;
+			}
+			pr->phase = DRAW_MARKERS;
+			pr->next_job = 0;
+		}
+		g_get_current_time(&now);
+	} while(ms_between(&start, &now) < pr->slice_ms);
+	return TRUE;
+}
+
+#if !DRAW_WITH_XLIB
+/* Frees a snapshot and everything it holds */
+static void snapshot_free(render_snapshot_t *ss) {
+	int i;
+	if(ss == NULL) {
+		return;
+	}
+	for(i = 0; i < MAX_NUM_TRACES; i++) {
+		free(ss->x_data[i]);
+		free(ss->y_data[i]);
+		free(ss->env[i]);
+		free(ss->sprites[i].pixels);
+		if(ss->densities[i].image != NULL) {
+			cairo_surface_destroy(ss->densities[i].image);
+		}
+	}
+	if(ss->buffer != NULL) {
+		cairo_surface_destroy(ss->buffer);
+	}
+	free(ss);
+	return;
+}
+
+/* Copies logical samples [a, a + n) of column src of trace t, packed */
+static int snapshot_column(render_snapshot_t *ss, sample_col_t *dst, void **buf, sample_col_t *src, trace_t *t, int a, int n) {
+	int k;
+	int size = sample_size(src->type);
+	ss->bytes += (size_t)n * size;
+	if(ss->bytes > SNAPSHOT_MAX_BYTES) {
+		return -1;
+	}
+	*buf = malloc((size_t)n * size);
+	if(*buf == NULL) {
+		printf("Error allocating render snapshot\n");
+		return -1;
+	}
+	for(k = 0; k < n; k++) {
+		memcpy((char *)*buf + (size_t)k * size, (char *)src->data + (size_t)trace_slot(t, a + k) * src->stride, size);
+	}
+	*dst = *src;
+	dst->data = *buf;
+	dst->stride = size;
+	return 0;
+}
+
+/* Fills in snapshot trace i: a copy of the trace holding just the samples
+ * pass tp reads, starting on a multiple of the decimate divisor so the
+ * same ones are picked, and its envelope if its lines come from the
+ * pyramid.  Returns -1 if that's more than a snapshot may hold. */
+static int snapshot_trace(jbplotPrivate *priv, render_snapshot_t *ss, trace_pass_t *tp, int i) {
+	trace_t *t = priv->plot.traces[i];
+	trace_t *c = &(ss->traces[i]);
+	int j0, j1, span, level, dd;
+	int a = t->length;
+	int b = -1;
+
+	*c = *t;
+	c->feed = NULL;
+	c->snap = NULL;
+	c->density = NULL;
+	c->sprite = NULL;
+	lod_init(&(c->lod));
+	memset(&(c->ext), 0, sizeof(extrema_t));
+	ss->trace_list[i] = c;
+	if(t->length <= 0) {
+		c->length = 0;
+		return 0;
+	}
+
+	if(t->line_type != LINETYPE_NONE) {
+		span = trace_get_visible_span(t, tp->x_lo, tp->x_hi, &j0, &j1);
+		level = pass_pick_level(t, tp, span, fabs(tp->x_m) * (tp->x_hi - tp->x_lo));
+		dd = pass_stride(t, tp, span);
+		j0 -= j0 % dd;
+		if(level >= 0 && lod_build_envelope(t, j0, j1, level, tp->x_m, tp->x_b, tp->y_m, tp->y_b, &(priv->scratch)) >= 0) {
+			int n = priv->scratch.env_length;
+			ss->bytes += (size_t)n * sizeof(env_pt_t);
+			ss->env[i] = malloc((n > 0 ? n : 1) * sizeof(env_pt_t));
+			if(ss->env[i] == NULL) {
+				printf("Error allocating render snapshot\n");
+				return -1;
+			}
+			memcpy(ss->env[i], priv->scratch.env, n * sizeof(env_pt_t));
+			ss->env_length[i] = n;
+		}
+		else {
+			a = j0;
+			b = j1;
+		}
+	}
+	if(trace_is_density(t)) {
+		// the counts were binned for this pass by snapshot_create(); the
+		// copy only gets their image, shaded now so it's current and the
+		// worker never has to look at the counts
+		density_t *d = &(ss->densities[i]);
+		int shaded = t->density->valid && density_image_update(t) == 0;
+		*d = *(t->density);
+		d->counts = NULL;
+		d->size = 0;
+		d->image = NULL;
+		if(shaded) {
+			ss->bytes += (size_t)d->width * d->height * 4;
+			if(ss->bytes > SNAPSHOT_MAX_BYTES) {
+				return -1;
+			}
+			d->image = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, d->width, d->height);
+			if(cairo_surface_status(d->image) != CAIRO_STATUS_SUCCESS) {
+				printf("Error creating render snapshot density: %s\n", cairo_status_to_string(cairo_surface_status(d->image)));
+				cairo_surface_destroy(d->image);
+				d->image = NULL;
+				return -1;
+			}
+			cairo_t *cr = cairo_create(d->image);
+			cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+			cairo_set_source_surface(cr, t->density->image, 0, 0);
+			cairo_paint(cr);
+			cairo_destroy(cr);
+		}
+		else {
+			d->valid = 0;
+		}
+		c->density = d;
+	}
+	else if(t->marker_type != MARKER_NONE) {
+		double pad = (tp->x_m != 0) ? (t->marker_size / 2.0 + 1.0) / fabs(tp->x_m) : 0;
+		span = trace_get_visible_span(t, tp->x_lo - pad, tp->x_hi + pad, &j0, &j1);
+		dd = pass_stride(t, tp, span);
+		j0 -= j0 % dd;
+		a = (j0 < a) ? j0 : a;
+		b = (j1 > b) ? j1 : b;
+		sprite_update(t, priv->antialias);
+		sprite_t *sp = trace_sprite(t, priv->antialias);
+		if(sp != NULL) {
+			size_t size = (size_t)sp->width * sp->width * SPRITE_PHASES * SPRITE_PHASES * sizeof(guint32);
+			ss->sprites[i] = *sp;
+			ss->sprites[i].pixels = malloc(size);
+			if(ss->sprites[i].pixels == NULL) {
+				printf("Error allocating render snapshot\n");
+				return -1;
+			}
+			memcpy(ss->sprites[i].pixels, sp->pixels, size);
+			c->sprite = &(ss->sprites[i]);
+		}
+	}
+	// a trace drawn from its envelope alone still keeps a sample, so it
+	// isn't taken for an empty one
+	if(b < a) {
+		a = b = 0;
+	}
+	a -= a % t->decimate_divisor;
+
+	c->start_index = 0;
+	c->end_index = b - a;
+	c->capacity = b - a + 1;
+	c->length = b - a + 1;
+	c->first_seq = t->first_seq + a;
+	if(!t->x_uniform && snapshot_column(ss, &(c->x_col), &(ss->x_data[i]), &(t->x_col), t, a, c->length) < 0) {
+		return -1;
+	}
+	if(snapshot_column(ss, &(c->y_col), &(ss->y_data[i]), &(t->y_col), t, a, c->length) < 0) {
+		return -1;
+	}
+	return 0;
+}
+
+/* Takes a snapshot of the refinement progress_prepare() set up, over a copy
+ * of the chrome in base.  NULL if it would be too big. */
+static render_snapshot_t *snapshot_create(jbplotPrivate *priv, int width, int height, cairo_surface_t *base) {
+	int i;
+	progress_t *pr = &(priv->progress);
+	render_snapshot_t *ss = calloc(1, sizeof(render_snapshot_t));
+	if(ss == NULL) {
+		printf("Error allocating render snapshot\n");
+		return NULL;
+	}
+	render_view_init(priv, &(ss->view));
+	ss->view.traces = ss->trace_list;
+	ss->view.env = ss->env;
+	ss->view.env_length = ss->env_length;
+	memcpy(ss->jobs, pr->jobs, pr->num_jobs * sizeof(render_job_t));
+	ss->num_jobs = pr->num_jobs;
+	density_update(priv, &(pr->tp));
+	for(i = 0; i < priv->plot.num_traces; i++) {
+		if(snapshot_trace(priv, ss, &(pr->tp), i) < 0) {
+			snapshot_free(ss);
+			return NULL;
+		}
+	}
+
+	ss->buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, width, height);
+	if(cairo_surface_status(ss->buffer) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating render snapshot buffer: %s\n", cairo_status_to_string(cairo_surface_status(ss->buffer)));
+		snapshot_free(ss);
+		return NULL;
+	}
+	cairo_surface_flush(base);
+	cairo_t *cr = cairo_create(ss->buffer);
+	cairo_set_operator(cr, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(cr, base, 0, 0);
+	cairo_paint(cr);
+	cairo_destroy(cr);
+	return ss;
+}
+
+/* Draws a snapshot's jobs into its buffer; returns 0 if a newer request
+ * came in first */
+static int snapshot_draw(async_worker_t *w, render_snapshot_t *ss) {
+	int n, what;
+	cairo_t *cr = cairo_create(ss->buffer);
+	cairo_set_line_width(cr, 1.0);
+	for(what = DRAW_LINES; what <= DRAW_MARKERS; what <<= 1) {
+		for(n = 0; n < ss->num_jobs; n++) {
+			render_job_t *job = &(ss->jobs[n]);
+			if(__atomic_load_n(&(w->gen), __ATOMIC_RELAXED) != ss->gen) {
+				cairo_destroy(cr);
+				return 0;
+			}
+			if((what == DRAW_LINES && !job->lines) || (what == DRAW_MARKERS && !job->markers)) {
+				continue;
+			}
+			draw_trace_range(&(ss->view), cr, &(job->tp), &(w->scratch), job->i0, job->i1, what);
+		}
+	}
+	cairo_destroy(cr);
+	cairo_surface_flush(ss->buffer);
+	return 1;
+}
+
+static void *async_worker_main(void *arg) {
+	async_worker_t *w = arg;
+	pthread_mutex_lock(&(w->lock));
+	for(;;) {
+		while(!w->quit && w->pending == NULL) {
+			pthread_cond_wait(&(w->wake), &(w->lock));
+		}
+		if(w->quit) {
+			break;
+		}
+		render_snapshot_t *ss = w->pending;
+		w->pending = NULL;
+		pthread_mutex_unlock(&(w->lock));
+		int finished = snapshot_draw(w, ss);
+		pthread_mutex_lock(&(w->lock));
+		if(finished && ss->gen == w->gen) {
+			snapshot_free(w->done);
+			w->done = ss;
+		}
+		else {
+			snapshot_free(ss);
+		}
+	}
+	pthread_mutex_unlock(&(w->lock));
+	return NULL;
+}
+
+static void async_worker_destroy(async_worker_t *w) {
+	if(w == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&(w->lock));
+	w->quit = 1;
+	pthread_cond_signal(&(w->wake));
+	pthread_mutex_unlock(&(w->lock));
+	pthread_join(w->thread, NULL);
+	snapshot_free(w->pending);
+	snapshot_free(w->done);
+	free(w->scratch.env);
+	free(w->scratch.occupied);
+	pthread_mutex_destroy(&(w->lock));
+	pthread_cond_destroy(&(w->wake));
+	free(w);
+	return;
+}
+
+/* Starts the render worker the first time it's wanted; NULL if it's off
+ * or won't start */
+static async_worker_t *get_async_worker(jbplotPrivate *priv) {
+	if(!priv->render_worker) {
+		return NULL;
+	}
+	if(priv->async == NULL) {
+		async_worker_t *w = calloc(1, sizeof(async_worker_t));
+		if(w == NULL) {
+			printf("Error allocating render worker\n");
+			return NULL;
+		}
+		pthread_mutex_init(&(w->lock), NULL);
+		pthread_cond_init(&(w->wake), NULL);
+		if(pthread_create(&(w->thread), NULL, async_worker_main, w) != 0) {
+			printf("Error starting render worker\n");
+			pthread_mutex_destroy(&(w->lock));
+			pthread_cond_destroy(&(w->wake));
+			free(w);
+			priv->render_worker = FALSE;
+			return NULL;
+		}
+		priv->async = w;
+	}
+	return priv->async;
+}
+
+/* Makes whatever the worker is drawing, or about to, out of date */
+static void async_cancel(async_worker_t *w) {
+	if(w == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&(w->lock));
+	__atomic_store_n(&(w->gen), w->gen + 1, __ATOMIC_RELAXED);
+	snapshot_free(w->pending);
+	w->pending = NULL;
+	snapshot_free(w->done);
+	w->done = NULL;
+	pthread_mutex_unlock(&(w->lock));
+	return;
+}
+
+/* Looks for the frame the worker was asked for; once it's in, it replaces
+ * the coarse one, unless the traces changed meanwhile */
+static gboolean async_poll(gpointer data) {
+	GtkWidget *plot = (GtkWidget *)data;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	progress_t *pr = &(priv->progress);
+	async_worker_t *w = priv->async;
+	pthread_mutex_lock(&(w->lock));
+	render_snapshot_t *ss = w->done;
+	w->done = NULL;
+	pthread_mutex_unlock(&(w->lock));
+	if(ss == NULL) {
+		return TRUE;
+	}
+	pr->idle = 0;
+	pr->num_jobs = 0;
+	if(progress_is_current(priv)) {
+		cairo_save(priv->plot_context);
+		cairo_set_operator(priv->plot_context, CAIRO_OPERATOR_SOURCE);
+		cairo_set_source_surface(priv->plot_context, ss->buffer, 0, 0);
+		cairo_paint(priv->plot_context);
+		cairo_restore(priv->plot_context);
+		wheel_preview_reset(priv);
+		frame_shown(priv);
+		priv->sched.stats.refined++;
+		if(pr->deferred) {
+			pr->deferred = 0;
+			pr->owed = g_idle_add(progress_owed, plot);
+		}
+	}
+	else {
+		priv->sched.stats.abandoned++;
+		priv->needs_redraw = TRUE;
+	}
+	snapshot_free(ss);
+	gtk_widget_queue_draw(plot);
+	return FALSE;
+}
+
+/* Hands the refinement progress_prepare() set up to the render worker.
+ * Returns -1 if it's to be drawn on the GTK thread after all. */
+static int async_post(GtkWidget *plot, int width, int height, cairo_surface_t *base) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	async_worker_t *w = get_async_worker(priv);
+	render_snapshot_t *ss;
+	if(w == NULL || (ss = snapshot_create(priv, width, height, base)) == NULL) {
+		return -1;
+	}
+	pthread_mutex_lock(&(w->lock));
+	ss->gen = w->gen + 1;
+	__atomic_store_n(&(w->gen), ss->gen, __ATOMIC_RELAXED);
+	snapshot_free(w->pending);
+	w->pending = ss;
+	pthread_cond_signal(&(w->wake));
+	pthread_mutex_unlock(&(w->lock));
+	priv->progress.idle = g_timeout_add(WORKER_POLL_MS, async_poll, plot);
+	return 0;
+}
+#endif
+
+/* Starts the refinement set up by progress_prepare(), keeping a copy of the
+ * chrome to draw it into: the chrome layer if over_chrome is set, else the
+ * chrome just drawn to the widget's buffer.  Returns -1 if there's no
+ * buffer for it. */
+static int progress_begin(GtkWidget *plot, int width, int height, int over_chrome) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	progress_t *pr = &(priv->progress);
+#if DRAW_WITH_XLIB
+	Drawable base = over_chrome ? priv->chrome_pixmap : priv->plot_pixmap;
+#else
+	cairo_surface_t *base = over_chrome ? priv->chrome_buffer : priv->plot_buffer;
+	if(async_post(plot, width, height, base) == 0) {
+		return 0;
+	}
+#endif
+	if(progress_alloc(plot, width, height) < 0) {
+		pr->num_jobs = 0;
+		return -1;
+	}
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	XCopyArea(priv->xdisp, base, priv->progress_pixmap, gc, 0, 0, width, height, 0, 0);
+#else
+	cairo_surface_flush(base);
+	cairo_save(priv->progress_context);
+	cairo_set_operator(priv->progress_context, CAIRO_OPERATOR_SOURCE);
+	cairo_set_source_surface(priv->progress_context, base, 0, 0);
+	cairo_paint(priv->progress_context);
+	cairo_restore(priv->progress_context);
+#endif
+	pr->idle = g_idle_add(progress_idle, plot);
+	return 0;
+}
+
+/* Drops the refinement going on, if any */
+static void progress_cancel(jbplotPrivate *priv) {
+	progress_t *pr = &(priv->progress);
+	if(pr->idle != 0) {
+		g_source_remove(pr->idle);
+		pr->idle = 0;
+		priv->sched.stats.abandoned++;
+	}
+	if(pr->owed != 0) {
+		g_source_remove(pr->owed);
+		pr->owed = 0;
+	}
+	pr->num_jobs = 0;
+	pr->deferred = 0;
+	pr->follow = 0;
+#if !DRAW_WITH_XLIB
+	async_cancel(priv->async);
+#endif
+	return;
+}
+
+/* The frame put off for a refinement (see progress_defer()) is drawn.  If
+ * the traces have still only had samples appended, its refinement starts
+ * at once over the chrome layer and the last refined frame stays up until
+ * it's done, rather than a coarse pass.  Returns 1 if it's drawn that way. */
+static int progress_follow(GtkWidget *plot, double width, double height) {
+	int i;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	progress_t *pr = &(priv->progress);
+	trace_pass_t tp;
+	if(!pr->follow) {
+		return 0;
+	}
+	pr->follow = 0;
+#if DRAW_WITH_XLIB
+	if(!priv->chrome_pixmap) {
+		return 0;
+	}
+#else
+	if(priv->chrome_context == NULL) {
+		return 0;
+	}
+#endif
+	if(priv->interacting || priv->panning || priv->wheel.active || priv->scroll_mode ||
+	   p->num_traces != pr->num_traces || !chrome_is_current(priv, width, height)) {
+		return 0;
+	}
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		if(t != pr->traces[i] || t->edit_gen != pr->edit_gen[i]) {
+			return 0;
+		}
+	}
+	frame_pass_init(priv, &tp, width);
+	if(progress_plan(priv, &tp, width) < 0 || progress_begin(plot, width, height, 1) < 0) {
+		return 0;
+	}
+	return 1;
+}
+
+static void tile_free(jbplotPrivate *priv, tile_t *tile) {
+#if DRAW_WITH_XLIB
+	XFreePixmap(priv->xdisp, tile->pixmap);
+	XFreePixmap(priv->xdisp, tile->mask);
+#else
+	cairo_surface_destroy(tile->buffer);
+#endif
+	return;
+}
+
+/* Drops all tiles, and the prefetch going on */
+static void tile_cache_reset(jbplotPrivate *priv) {
+	int i;
+	tile_cache_t *tc = &(priv->tiles);
+	if(tc->idle != 0) {
+		g_source_remove(tc->idle);
+		tc->idle = 0;
+	}
+	for(i = 0; i < tc->num_tiles; i++) {
+		tile_free(priv, &(tc->tiles[i]));
+	}
+	tc->num_tiles = 0;
+	tc->valid = 0;
+	return;
+}
+
+static tile_t *tile_find(tile_cache_t *tc, int col, int row) {
+	int i;
+	for(i = 0; i < tc->num_tiles; i++) {
+		if(tc->tiles[i].col == col && tc->tiles[i].row == row) {
+			return &(tc->tiles[i]);
+		}
+	}
+	return NULL;
+}
+
+/* The pass that draws tile (col, row) in its own pixels; markers from
+ * next door are cut off at its edges */
+static void tile_pass(tile_cache_t *tc, int col, int row, trace_pass_t *tp) {
+	tp->x_m = tc->x_m;
+	tp->x_b = tc->x_b - col * TILE_SIZE;
+	tp->y_m = tc->y_m;
+	tp->y_b = tc->y_b - row * TILE_SIZE;
+	tp->x_lo = fmin(-tp->x_b / tp->x_m, (TILE_SIZE - tp->x_b) / tp->x_m);
+	tp->x_hi = fmax(-tp->x_b / tp->x_m, (TILE_SIZE - tp->x_b) / tp->x_m);
+	tp->clip_left = 0;
+	tp->clip_right = TILE_SIZE;
+	tp->clip_markers = 1;
+	tp->mark_left = 0;
+	tp->mark_right = TILE_SIZE;
+	tp->raw = 0;
+	tp->mono = 0;
+	tp->draft = 0;
+	tp->draft_samples = 0;
+	return;
+}
+
+/* Draws tile (col, row); returns -1 if there's no buffer for it */
+static int tile_render(GtkWidget *plot, tile_t *tile, int col, int row) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	tile_cache_t *tc = &(priv->tiles);
+	trace_pass_t tp;
+	tile_pass(tc, col, row, &tp);
+	double y_lo = fmin(-tp.y_b / tp.y_m, (TILE_SIZE - tp.y_b) / tp.y_m);
+	double y_hi = fmax(-tp.y_b / tp.y_m, (TILE_SIZE - tp.y_b) / tp.y_m);
+	tile->col = col;
+	tile->row = row;
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	tile->pixmap = XCreatePixmap(priv->xdisp, priv->xwin, TILE_SIZE, TILE_SIZE, XDefaultDepth(priv->xdisp, DefaultScreen(priv->xdisp)));
+	tile->mask = XCreatePixmap(priv->xdisp, priv->xwin, TILE_SIZE, TILE_SIZE, 1);
+	if(!priv->mask_gc) {
+		priv->mask_gc = XCreateGC(priv->xdisp, tile->mask, 0, NULL);
+		XSetBackground(priv->xdisp, priv->mask_gc, 0);
+	}
+	XSetClipMask(priv->xdisp, priv->mask_gc, None);
+	XSetForeground(priv->xdisp, priv->mask_gc, 0);
+	XFillRectangle(priv->xdisp, tile->mask, priv->mask_gc, 0, 0, TILE_SIZE, TILE_SIZE);
+	XSetForeground(priv->xdisp, priv->mask_gc, 1);
+
+	// the tile stands in for the plot area: its rows, and its bounds for
+	// what counts as out of range
+	render_view_t view;
+	render_view_init(priv, &view);
+	view.pa.top_edge = 0;
+	view.pa.bottom_edge = TILE_SIZE;
+	view.x_min = tp.x_lo;
+	view.x_max = tp.x_hi;
+	view.y_min = y_lo;
+	view.y_max = y_hi;
+	XSetLineAttributes(priv->xdisp, gc, 1, LineSolid, CapRound, JoinMiter);
+	draw_trace_range_x(plot, &view, tile->pixmap, gc, &tp, 0, p->num_traces, DRAW_LINES | DRAW_MARKERS);
+	tp.mono = 1;
+	draw_trace_range_x(plot, &view, tile->mask, priv->mask_gc, &tp, 0, p->num_traces, DRAW_LINES | DRAW_MARKERS);
+	XSetClipMask(priv->xdisp, gc, None);
+	XSetClipMask(priv->xdisp, priv->mask_gc, None);
+#else
+	int i;
+	tile->buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, TILE_SIZE, TILE_SIZE);
+	if(cairo_surface_status(tile->buffer) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating pan tile: %s\n", cairo_status_to_string(cairo_surface_status(tile->buffer)));
+		cairo_surface_destroy(tile->buffer);
+		return -1;
+	}
+	for(i = 0; i < p->num_traces; i++) {
+		if(p->traces[i]->length > 0) {
+			sprite_update(p->traces[i], tc->antialias);
+		}
+	}
+	render_view_t view;
+	render_view_init(priv, &view);
+	view.pa.left_edge = 0;
+	view.pa.right_edge = TILE_SIZE;
+	view.pa.top_edge = 0;
+	view.pa.bottom_edge = TILE_SIZE;
+	view.x_min = tp.x_lo;
+	view.x_max = tp.x_hi;
+	view.y_min = y_lo;
+	view.y_max = y_hi;
+	view.antialias = tc->antialias;
+	cairo_t *cr = cairo_create(tile->buffer);
+	cairo_set_line_width(cr, 1.0);
+	draw_trace_range(&view, cr, &tp, &(priv->scratch), 0, p->num_traces, DRAW_LINES | DRAW_MARKERS);
+	cairo_destroy(cr);
+	cairo_surface_flush(tile->buffer);
+#endif
+	return 0;
+}
+
+/* Finds tile (col, row), drawing it if it isn't there.  Room for it is
+ * only made by dropping tiles the last pan frame didn't show. */
+static tile_t *tile_get(GtkWidget *plot, int col, int row) {
+	int i;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	tile_cache_t *tc = &(priv->tiles);
+	tile_t *tile = tile_find(tc, col, row);
+	if(tile != NULL) {
+		tile->last_used = tc->clock;
+		return tile;
+	}
+	if(tc->num_tiles == TILE_MAX) {
+		int lru = -1;
+		for(i = 0; i < tc->num_tiles; i++) {
+			if(tc->tiles[i].last_used < tc->clock && (lru < 0 || tc->tiles[i].last_used < tc->tiles[lru].last_used)) {
+				lru = i;
+			}
+		}
+		if(lru < 0) {
+			return NULL;
+		}
+		tile_free(priv, &(tc->tiles[lru]));
+		tc->tiles[lru] = tc->tiles[--tc->num_tiles];
+	}
+	tile = &(tc->tiles[tc->num_tiles]);
+	if(tile_render(plot, tile, col, row) < 0) {
+		return NULL;
+	}
+	tile->last_used = tc->clock;
+	tc->num_tiles++;
+	return tile;
+}
+
+/* Picks the next tile to draw ahead: from the ring around the last pan
+ * frame's tiles, plus one more row or column the way the view is going,
+ * those furthest that way first.  Returns 0 once they're all there. */
+static int tile_next_prefetch(tile_cache_t *tc, int *col, int *row) {
+	int c, r;
+	int found = 0;
+	int best = 0;
+	for(c = tc->col0 - 1 - (tc->dir_x < 0); c <= tc->col1 + 1 + (tc->dir_x > 0); c++) {
+		for(r = tc->row0 - 1 - (tc->dir_y < 0); r <= tc->row1 + 1 + (tc->dir_y > 0); r++) {
+			int ahead_x = (tc->dir_x > 0) ? c - tc->col1 : (tc->dir_x < 0) ? tc->col0 - c : 0;
+			int ahead_y = (tc->dir_y > 0) ? r - tc->row1 : (tc->dir_y < 0) ? tc->row0 - r : 0;
+			// the second ring only ahead of the view
+			if((c < tc->col0 - 1 || c > tc->col1 + 1) && ahead_x <= 0) {
+				continue;
+			}
+			if((r < tc->row0 - 1 || r > tc->row1 + 1) && ahead_y <= 0) {
+				continue;
+			}
+			if(c >= tc->col0 && c <= tc->col1 && r >= tc->row0 && r <= tc->row1) {
+				continue;
+			}
+			if((found && ahead_x + ahead_y <= best) || tile_find(tc, c, r) != NULL) {
+				continue;
+			}
+			found = 1;
+			best = ahead_x + ahead_y;
+			*col = c;
+			*row = r;
+		}
+	}
+	return found;
+}
+
+/* Draws tiles ahead of the pan for up to a time slice at a time */
+static gboolean tile_idle(gpointer data) {
+	GtkWidget *plot = (GtkWidget *)data;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	tile_cache_t *tc = &(priv->tiles);
+	frame_traces_t ft;
+	GTimeVal start, now;
+	int col, row;
+	// tiles of changed traces would be dropped by the next pan frame
+	get_frame_traces(priv, &ft);
+	if(!priv->panning || memcmp(&ft, &(tc->traces), sizeof(frame_traces_t)) != 0) {
+		tc->idle = 0;
+		return FALSE;
+	}
+	g_get_current_time(&start);
+	do {
+		if(!tile_next_prefetch(tc, &col, &row) || tile_get(plot, col, row) == NULL) {
+			tc->idle = 0;
+			return FALSE;
+		}
+		g_get_current_time(&now);
+	} while(ms_between(&start, &now) < priv->progress.slice_ms);
+	return TRUE;
+}
+
+/* Lays the tiles in view over the chrome in the widget's buffer, for a
+ * pan frame of pass tp.  Returns -1 if the frame has to be drawn as
+ * usual: tiles are off, there are too many for the view, or a density
+ * trace is showing (they're binned over the whole plot area). */
+static int draw_pan_tiles(GtkWidget *plot, trace_pass_t *tp) {
+	int i, c, r;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	plot_t *p = &(priv->plot);
+	plot_area_t *pa = &(p->plot_area);
+	tile_cache_t *tc = &(priv->tiles);
+	frame_traces_t ft;
+	if(!priv->pan_tiles) {
+		return -1;
+	}
+	for(i = 0; i < p->num_traces; i++) {
+		if(trace_is_density(p->traces[i])) {
+			return -1;
+		}
+	}
+
+	// tiles are kept as long as the scale and the traces stay the same
+	get_frame_traces(priv, &ft);
+	double dy = p->y_axis.max_val - p->y_axis.min_val;
+	if(!tc->valid || tc->antialias != priv->antialias ||
+	   fabs((tp->x_m - tc->x_m) * (tp->x_hi - tp->x_lo)) > 1e-3 ||
+	   fabs((tp->y_m - tc->y_m) * dy) > 1e-3 ||
+	   memcmp(&ft, &(tc->traces), sizeof(frame_traces_t)) != 0) {
+		tile_cache_reset(priv);
+		tc->valid = 1;
+		tc->x_m = tp->x_m;
+		tc->x_b = tp->x_b;
+		tc->y_m = tp->y_m;
+		tc->y_b = tp->y_b;
+		tc->antialias = priv->antialias;
+		tc->traces = ft;
+		tc->shift_x = tc->shift_y = 0;
+		tc->dir_x = tc->dir_y = 0;
+	}
+	int sx = floor(tp->x_b - tc->x_b + 0.5);
+	int sy = floor(tp->y_b - tc->y_b + 0.5);
+	int left = floor(pa->left_edge);
+	int right = ceil(pa->right_edge);
+	int top = floor(pa->top_edge);
+	int bottom = ceil(pa->bottom_edge);
+	int col0 = floor((double)(left - sx) / TILE_SIZE);
+	int col1 = floor((double)(right - 1 - sx) / TILE_SIZE);
+	int row0 = floor((double)(top - sy) / TILE_SIZE);
+	int row1 = floor((double)(bottom - 1 - sy) / TILE_SIZE);
+	if((col1 - col0 + 1) * (row1 - row0 + 1) > TILE_MAX) {
+		return -1;
+	}
+
+	// the view moves the other way to the data
+	if(sx != tc->shift_x) {
+		tc->dir_x = (sx < tc->shift_x) ? 1 : -1;
+	}
+	if(sy != tc->shift_y) {
+		tc->dir_y = (sy < tc->shift_y) ? 1 : -1;
+	}
+	tc->shift_x = sx;
+	tc->shift_y = sy;
+	tc->clock++;
+
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+#else
+	cairo_t *cr = priv->plot_context;
+	cairo_save(cr);
+	cairo_rectangle(cr, pa->left_edge, pa->top_edge, pa->right_edge - pa->left_edge, pa->bottom_edge - pa->top_edge);
+	cairo_clip(cr);
+#endif
+	for(c = col0; c <= col1; c++) {
+		for(r = row0; r <= row1; r++) {
+			tile_t *tile = tile_get(plot, c, r);
+			if(tile == NULL) {
+				continue;
+			}
+			int x = c * TILE_SIZE + sx;
+			int y = r * TILE_SIZE + sy;
+#if DRAW_WITH_XLIB
+			int x0 = (x > left) ? x : left;
+			int y0 = (y > top) ? y : top;
+			int x1 = (x + TILE_SIZE < right) ? x + TILE_SIZE : right;
+			int y1 = (y + TILE_SIZE < bottom) ? y + TILE_SIZE : bottom;
+			XSetClipMask(priv->xdisp, gc, tile->mask);
+			XSetClipOrigin(priv->xdisp, gc, x, y);
+			XCopyArea(priv->xdisp, tile->pixmap, priv->plot_pixmap, gc, x0 - x, y0 - y, x1 - x0, y1 - y0, x0, y0);
+#else
+			cairo_set_source_surface(cr, tile->buffer, x, y);
+			cairo_paint(cr);
+#endif
+		}
+	}
+#if DRAW_WITH_XLIB
+	XSetClipMask(priv->xdisp, gc, None);
+	XSetClipOrigin(priv->xdisp, gc, 0, 0);
+#else
+	cairo_restore(cr);
+#endif
+
+	tc->col0 = col0;
+	tc->col1 = col1;
+	tc->row0 = row0;
+	tc->row1 = row1;
+	if(tc->idle == 0) {
+		tc->idle = g_idle_add(tile_idle, plot);
+	}
+	priv->sched.stats.tiled++;
+	return 0;
+}
+
+/* Drops the wheel preview, if any */
+static void wheel_preview_reset(jbplotPrivate *priv) {
+	wheel_preview_t *wp = &(priv->wheel);
+	if(wp->timer != 0) {
+		g_source_remove(wp->timer);
+		wp->timer = 0;
+	}
+#if DRAW_WITH_XLIB
+	if(wp->image != NULL) {
+		XDestroyImage(wp->image);
+		wp->image = NULL;
+	}
+	free(wp->mask);
+	wp->mask = NULL;
+#else
+	if(wp->buffer != NULL) {
+		cairo_surface_destroy(wp->buffer);
+		wp->buffer = NULL;
+	}
+#endif
+	wp->active = 0;
+	return;
+}
+
+static gboolean wheel_preview_settled(gpointer data) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(data);
+	priv->wheel.timer = 0;
+	// the exact frame is on its way already and will replace the preview
+	if(priv->progress.idle != 0) {
+		return FALSE;
+	}
+	wheel_preview_reset(priv);
+	priv->needs_redraw = TRUE;
+	gtk_widget_queue_draw((GtkWidget *)data);
+	return FALSE;
+}
+
+#if DRAW_WITH_XLIB
+/* Bytes per pixel of an image whose pixels can be read and copied straight
+ * from its rows, or 0 if they have to go through XGetPixel() */
+static int ximage_pixel_bytes(XImage *img) {
+	if(img->format != ZPixmap || img->bits_per_pixel % 8 != 0) {
+		return 0;
+	}
+	return img->bits_per_pixel / 8;
+}
+#endif
+
+/* Copies the data layer of the frame in the widget's buffer, and the
+ * transform it was drawn with.  Returns -1 if there's none to copy. */
+static int wheel_preview_capture(GtkWidget *plot) {
+	int x, y;
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	plot_area_t *pa = &(priv->plot.plot_area);
+	wheel_preview_t *wp = &(priv->wheel);
+#if DRAW_WITH_XLIB
+	if(!priv->plot_pixmap) {
+		return -1;
+	}
+	int width = plot->allocation.width;
+	int height = plot->allocation.height;
+#else
+	if(priv->plot_buffer == NULL) {
+		return -1;
+	}
+	int width = cairo_image_surface_get_width(priv->plot_buffer);
+	int height = cairo_image_surface_get_height(priv->plot_buffer);
+#endif
+	int left = floor(pa->left_edge);
+	int top = floor(pa->top_edge);
+	int right = ceil(pa->right_edge);
+	int bottom = ceil(pa->bottom_edge);
+	if(left < 0) left = 0;
+	if(top < 0) top = 0;
+	if(right > width) right = width;
+	if(bottom > height) bottom = height;
+	if(right <= left || bottom <= top) {
+		return -1;
+	}
+
+	// without a chrome layer that matches the frame the whole plot area is
+	// taken, grid and all
+#if DRAW_WITH_XLIB
+	int keyed = priv->chrome_pixmap && chrome_is_current(priv, width, height);
+	wp->image = XGetImage(priv->xdisp, priv->plot_pixmap, left, top, right - left, bottom - top, AllPlanes, ZPixmap);
+	if(wp->image == NULL) {
+		printf("Error getting the frame for a wheel preview\n");
+		return -1;
+	}
+	wp->mask = malloc((right - left) * (bottom - top));
+	if(wp->mask == NULL) {
+		printf("Error allocating memory for a wheel preview\n");
+		XDestroyImage(wp->image);
+		wp->image = NULL;
+		return -1;
+	}
+	memset(wp->mask, 1, (right - left) * (bottom - top));
+	if(keyed) {
+		XImage *chrome = XGetImage(priv->xdisp, priv->chrome_pixmap, left, top, right - left, bottom - top, AllPlanes, ZPixmap);
+		if(chrome != NULL) {
+			int bpp = ximage_pixel_bytes(wp->image);
+			if(ximage_pixel_bytes(chrome) != bpp) {
+				bpp = 0;
+			}
+			for(y = 0; y < bottom - top; y++) {
+				char *src = wp->image->data + y * wp->image->bytes_per_line;
+				char *under = chrome->data + y * chrome->bytes_per_line;
+				char *mask = wp->mask + y * (right - left);
+				if(bpp == 4) {
+					guint32 *s32 = (guint32 *)src;
+					guint32 *u32 = (guint32 *)under;
+					for(x = 0; x < right - left; x++) {
+						if(s32[x] == u32[x]) {
+							mask[x] = 0;
+						}
+					}
+				}
+				else if(bpp > 0) {
+					for(x = 0; x < right - left; x++) {
+						if(memcmp(src + x * bpp, under + x * bpp, bpp) == 0) {
+							mask[x] = 0;
+						}
+					}
+				}
+				else {
+					for(x = 0; x < right - left; x++) {
+						if(XGetPixel(wp->image, x, y) == XGetPixel(chrome, x, y)) {
+							mask[x] = 0;
+						}
+					}
+				}
+			}
+			XDestroyImage(chrome);
+		}
+	}
+#else
+	int keyed = priv->chrome_buffer != NULL && chrome_is_current(priv, width, height);
+	wp->buffer = cairo_image_surface_create(CAIRO_FORMAT_ARGB32, right - left, bottom - top);
+	if(cairo_surface_status(wp->buffer) != CAIRO_STATUS_SUCCESS) {
+		printf("Error creating wheel preview buffer: %s\n", cairo_status_to_string(cairo_surface_status(wp->buffer)));
+		cairo_surface_destroy(wp->buffer);
+		wp->buffer = NULL;
+		return -1;
+	}
+	cairo_surface_flush(priv->plot_buffer);
+	unsigned char *frame = cairo_image_surface_get_data(priv->plot_buffer);
+	int frame_stride = cairo_image_surface_get_stride(priv->plot_buffer);
+	unsigned char *chrome = NULL;
+	int chrome_stride = 0;
+	if(keyed) {
+		cairo_surface_flush(priv->chrome_buffer);
+		chrome = cairo_image_surface_get_data(priv->chrome_buffer);
+		chrome_stride = cairo_image_surface_get_stride(priv->chrome_buffer);
+	}
+	unsigned char *data = cairo_image_surface_get_data(wp->buffer);
+	int stride = cairo_image_surface_get_stride(wp->buffer);
+	for(y = 0; y < bottom - top; y++) {
+		guint32 *src = (guint32 *)(frame + (y + top) * frame_stride) + left;
+		guint32 *dst = (guint32 *)(data + y * stride);
+		guint32 *under = keyed ? (guint32 *)(chrome + (y + top) * chrome_stride) + left : NULL;
+		for(x = 0; x < right - left; x++) {
+			dst[x] = (under != NULL && src[x] == under[x]) ? 0 : src[x];
+		}
+	}
+	cairo_surface_mark_dirty(wp->buffer);
+#endif
+	wp->x_m = priv->x_m;
+	wp->x_b = priv->x_b;
+	wp->y_m = priv->y_m;
+	wp->y_b = priv->y_b;
+	wp->left = left;
+	wp->top = top;
+	wp->width = right - left;
+	wp->height = bottom - top;
+	return 0;
+}
+
+/* A wheel notch is about to change the view.  The first of a burst copies
+ * the frame shown; every one puts the exact frame off for another
+ * settle_ms.  Returns -1 if the notch can't be previewed. */
+static int wheel_preview_tick(GtkWidget *plot) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	wheel_preview_t *wp = &(priv->wheel);
+	if(!priv->wheel_preview) {
+		return -1;
+	}
+	if(!wp->active) {
+		if(wheel_preview_capture(plot) < 0) {
+			wheel_preview_reset(priv);
+			return -1;
+		}
+		wp->active = 1;
+	}
+	if(wp->timer != 0) {
+		g_source_remove(wp->timer);
+	}
+	wp->timer = g_timeout_add(priv->settle_ms, wheel_preview_settled, plot);
+	return 0;
+}
+
+/* Lays the copied data layer over the chrome, moved and stretched from the
+ * transform it was drawn with to the current one */
+static int draw_wheel_preview(GtkWidget *plot) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	plot_area_t *pa = &(priv->plot.plot_area);
+	wheel_preview_t *wp = &(priv->wheel);
+	double kx = priv->x_m / wp->x_m;
+	double ky = priv->y_m / wp->y_m;
+#if DRAW_WITH_XLIB
+	int x, y;
+	int left = floor(pa->left_edge);
+	int top = floor(pa->top_edge);
+	int width = ceil(pa->right_edge) - left;
+	int height = ceil(pa->bottom_edge) - top;
+	if(width <= 0 || height <= 0) {
+		return -1;
+	}
+	XImage *img = XGetImage(priv->xdisp, priv->plot_pixmap, left, top, width, height, AllPlanes, ZPixmap);
+	int *cols = malloc(width * sizeof(int));
+	if(img == NULL || cols == NULL) {
+		printf("Error drawing a wheel preview\n");
+		if(img != NULL) {
+			XDestroyImage(img);
+		}
+		free(cols);
+		return -1;
+	}
+
+	// each pixel takes the one of the copy its centre falls in
+	for(x = 0; x < width; x++) {
+		int u = floor((left + x + 0.5 - priv->x_b) / kx + wp->x_b) - wp->left;
+		cols[x] = (u >= 0 && u < wp->width) ? u : -1;
+	}
+	int bpp = ximage_pixel_bytes(img);
+	if(ximage_pixel_bytes(wp->image) != bpp) {
+		bpp = 0;
+	}
+	for(y = 0; y < height; y++) {
+		int v = floor((top + y + 0.5 - priv->y_b) / ky + wp->y_b) - wp->top;
+		if(v < 0 || v >= wp->height) {
+			continue;
+		}
+		char *dst = img->data + y * img->bytes_per_line;
+		char *src = wp->image->data + v * wp->image->bytes_per_line;
+		char *mask = wp->mask + v * wp->width;
+		if(bpp == 4) {
+			guint32 *d32 = (guint32 *)dst;
+			guint32 *s32 = (guint32 *)src;
+			for(x = 0; x < width; x++) {
+				if(cols[x] >= 0 && mask[cols[x]]) {
+					d32[x] = s32[cols[x]];
+				}
+			}
+		}
+		else if(bpp > 0) {
+			for(x = 0; x < width; x++) {
+				if(cols[x] >= 0 && mask[cols[x]]) {
+					memcpy(dst + x * bpp, src + cols[x] * bpp, bpp);
+				}
+			}
+		}
+		else {
+			for(x = 0; x < width; x++) {
+				if(cols[x] >= 0 && mask[cols[x]]) {
+					XPutPixel(img, x, y, XGetPixel(wp->image, cols[x], v));
+				}
+			}
+		}
+	}
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+	XPutImage(priv->xdisp, priv->plot_pixmap, gc, img, 0, 0, left, top, width, height);
+	XDestroyImage(img);
+	free(cols);
+#else
+	cairo_t *cr = priv->plot_context;
+	cairo_save(cr);
+	cairo_rectangle(cr, pa->left_edge, pa->top_edge, pa->right_edge - pa->left_edge, pa->bottom_edge - pa->top_edge);
+	cairo_clip(cr);
+	cairo_translate(cr, priv->x_b + kx * (wp->left - wp->x_b), priv->y_b + ky * (wp->top - wp->y_b));
+	cairo_scale(cr, kx, ky);
+	cairo_set_source_surface(cr, wp->buffer, 0, 0);
+	cairo_paint(cr);
+	cairo_restore(cr);
+#endif
+	priv->sched.stats.previewed++;
+	return 0;
+}
+
+/* Shows the wheel preview over the chrome just drawn, and starts the
+ * exact frame off as a refinement (see progress_t) that replaces the
+ * preview once it's done.  Returns -1 if the exact frame is to be drawn
+ * now instead. */
+static int wheel_preview_show(GtkWidget *plot, trace_pass_t *tp, int width, int height) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	// the refinement copies the frame as it is now, the chrome alone
+	int refining = priv->progressive && priv->exposing && !tp->draft && priv->plot.num_traces > 0;
+	if(refining) {
+		progress_prepare(priv, tp, width);
+		refining = progress_begin(plot, width, height, 0) == 0;
+	}
+	// without one, the preview stays up only until the wheel has settled
+	if(!refining && priv->wheel.timer == 0) {
+		wheel_preview_reset(priv);
+		return -1;
+	}
+	if(draw_wheel_preview(plot) < 0) {
+		progress_cancel(priv);
+		return -1;
+	}
+	return 0;
+}
+
+/* A frame is being drawn, for whatever reason: it takes care of any
+ * refresh waiting for one */
+static void frame_begin(jbplotPrivate *priv) {
+	frame_sched_t *s = &(priv->sched);
+	if(s->timer != 0) {
+		g_source_remove(s->timer);
+		s->timer = 0;
+	}
+	s->pending = 0;
+	g_get_current_time(&(s->start));
+	return;
+}
+
+/* Works out when the next frame may start: one slot after this one
+ * started, or if it overran its budget, after the slots it ran into */
+static void frame_end(jbplotPrivate *priv) {
+	frame_sched_t *s = &(priv->sched);
+	GTimeVal now;
+	g_get_current_time(&now);
+	double took = ms_between(&(s->start), &now);
+	s->stats.frames++;
+	s->stats.last_frame_ms = took;
+	if(priv->drew_draft) {
+		priv->drew_draft = FALSE;
+		s->stats.drafts++;
+		draft_tune(priv, took);
+	}
+	if(s->max_fps <= 0) {
+		return;
+	}
+	double slot = 1000.0 / s->max_fps;
+	double slots = 1;
+	if(took > s->budget_ms && took > slot) {
+		slots = ceil(took / slot);
+		s->stats.dropped += (unsigned long)slots - 1;
+	}
+	double due_us = s->start.tv_usec + slots * slot * 1000;
+	s->next_due.tv_sec = s->start.tv_sec + (glong)floor(due_us / 1.e6);
+	s->next_due.tv_usec = (glong)(due_us - floor(due_us / 1.e6) * 1.e6);
+	return;
+}
+
+static gboolean jbplot_expose (GtkWidget *plot, GdkEventExpose *event) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	frame_begin(priv);
+
+	/* change the mouse cursor to show we're busy */
+	GdkCursor *cursor = gdk_cursor_new(GDK_WATCH);
+	gdk_window_set_cursor(plot->window, cursor);
+	
+
+	plot_t *p = &(priv->plot);
+	axis_t *x_axis = &(p->x_axis);
+	axis_t *y_axis = &(p->y_axis);
+	plot_area_t *pa = &(p->plot_area);
+	legend_t *l = &(p->legend);
+	
+	double x_m = priv->x_m;	
+	double y_m = priv->y_m;	
+	double x_b = priv->x_b;	
+	double y_b = priv->y_b;	
+
+#if DRAW_WITH_XLIB
+	GC gc = DefaultGC(priv->xdisp, DefaultScreen(priv->xdisp));
+
+	Window root_win;
+	int x,y;
+	unsigned int w, h;
+	unsigned int bord_w, depth;
+	XGetGeometry(priv->xdisp, priv->plot_pixmap, &root_win, &x, &y, &w, &h, &bord_w, &depth);
+	priv->exposing = TRUE;
+	draw_plot_x(plot, priv->plot_pixmap, w, h);
+	priv->exposing = FALSE;
+	XCopyArea(priv->xdisp, priv->plot_pixmap, priv->xwin, gc, 0, 0, w, h, 0, 0);
+
+	/********************** draw the cursor (if needed) *************************/
+	if(p->cursor.type != CURSOR_NONE) {
+		cursor_t *c = &(p->cursor);
+		XSetForeground(priv->xdisp, gc, rgb_color_to_uint(&(c->color)) );
+		int lineStyle = LineSolid;
+		if(c->line_type == LINETYPE_SOLID) {
+			lineStyle = LineSolid;
+		}	
+		else if(c->line_type == LINETYPE_DASHED) {
+			lineStyle = LineOnOffDash;
+		}	
+		else if(c->line_type == LINETYPE_DOTTED) {
+			lineStyle = LineDoubleDash;
+		}
+		XSetLineAttributes(
+			priv->xdisp, gc, 
+			c->line_width,  // lineWidth
+			lineStyle, // lineStyle
+			CapRound,  //cap_style
+			JoinMiter  // jointStyle
+		);
+		double x_px = x_m * c->x + x_b;	
+		double y_px = y_m * c->y + y_b;	
+		if(c->type == CURSOR_VERT || c->type == CURSOR_CROSS) {
+			if(x_px >= p->plot_area.left_edge && x_px <= p->plot_area.right_edge) {
+				XDrawLine(
+					priv->xdisp, priv->xwin, gc, 
+					x_px, p->plot_area.top_edge, 
+					x_px, p->plot_area.bottom_edge
+				);
+			}
+		}
+		if(c->type == CURSOR_HORIZ || c->type == CURSOR_CROSS) {
+			if(y_px >= p->plot_area.top_edge && y_px <= p->plot_area.bottom_edge) {
+				XDrawLine(
+					priv->xdisp, priv->xwin, gc, 
+					p->plot_area.left_edge, y_px,
+					p->plot_area.right_edge, y_px
+				);
+			}
+		}
+	}
+
+	/************* draw the zoom box if zooming is active *****************/
+	if(priv->zooming) {
+		double dashes[] = {8.0,4.0};
+		XSetForeground(priv->xdisp, gc, 0x6CA5C8);
+		//XSetLineAttributes(priv->xdisp, gc, 1, LineOnOffDash,	CapRound, JoinMiter);
+		XSetLineAttributes(priv->xdisp, gc, 1, LineSolid,	CapRound, JoinMiter);
+		double x_e = priv->drag_end_x;
+		double y_e = priv->drag_end_y;
+		double x_s = priv->drag_start_x;
+		double y_s = priv->drag_start_y;
+		if(priv->drag_end_x < priv->plot.plot_area.left_edge) {
+			x_e = priv->plot.plot_area.left_edge;
+		}
+		else if(priv->drag_end_x > priv->plot.plot_area.right_edge) {
+			x_e = priv->plot.plot_area.right_edge;
+		}
+		if(priv->drag_end_y < priv->plot.plot_area.top_edge) {
+			y_e = priv->plot.plot_area.top_edge;
+		}
+		else if(priv->drag_end_y > priv->plot.plot_area.bottom_edge) {
+			y_e = priv->plot.plot_area.bottom_edge;
+		}
+		if(priv->h_zoom) {
+			y_s = priv->plot.plot_area.top_edge;
+			y_e = priv->plot.plot_area.bottom_edge;
+		}
+		if(priv->v_zoom) {
+			x_s = priv->plot.plot_area.left_edge;
+			x_e = priv->plot.plot_area.right_edge;
+		}
+		int x_min = x_s < x_e ? x_s : x_e;
+		int y_min = y_s < y_e ? y_s : y_e;
+		int w = fabs(x_s-x_e);
+		int h = fabs(y_s-y_e);
+		XDrawRectangle(priv->xdisp, priv->xwin, gc, x_min, y_min, w, h);	
+	}
+
+	/********** find closest data point if showing coords or cross-hair *****/
+	double x_px = 0.0;
+	double y_px = 0.0;
+	gboolean is_in_plot_area = FALSE;
+	priv->closest_x = 0.0;
+	priv->closest_y = 0.0;
+	if(priv->do_snap_to_data && (priv->do_show_cross_hair || priv->do_show_coords)) {
+		gint x,y;
+		gtk_widget_get_pointer(plot, &x, &y);
+		if(x >= priv->plot.plot_area.left_edge-1 && x <= priv->plot.plot_area.right_edge+1 &&
+		   y >= priv->plot.plot_area.top_edge-1 &&  y <= priv->plot.plot_area.bottom_edge+1) {
+			int n;
+			trace_t *t = find_closest_point(priv, x, y, &n);
+			is_in_plot_area = TRUE;
+			if(t != NULL) {
+				priv->closest_x = trace_x(t, n);
+				priv->closest_y = trace_y(t, n);
+			}
+			x_px = x_m * priv->closest_x + x_b;
+			y_px = y_m * priv->closest_y + y_b;
+			
+		}
+		else {
+			is_in_plot_area = FALSE;
+		}
+	}
+
+	/************** draw crosshair if active ****************************/
+	if(priv->do_show_cross_hair) {
+		gint x,y;
+		int inhibit_ch = 0;
+		gtk_widget_get_pointer(plot, &x, &y);
+		if(x < priv->plot.plot_area.left_edge-1) {
+			x = priv->plot.plot_area.left_edge;
+			inhibit_ch = 1;
+		}
+		if(x > priv->plot.plot_area.right_edge+1) {
+			x = priv->plot.plot_area.right_edge;
+			inhibit_ch = 1;
+		}
+		if(y < priv->plot.plot_area.top_edge-1) {
+			y = priv->plot.plot_area.top_edge;
+			inhibit_ch = 1;
+		}
+		if(y > priv->plot.plot_area.bottom_edge+1) {
+			y = priv->plot.plot_area.bottom_edge;
+			inhibit_ch = 1;
+		}
+		if(priv->do_snap_to_data && is_in_plot_area) {
+			x = x_px;
+			y = y_px;
+		}
+		if(!inhibit_ch) {
+			XSetForeground(priv->xdisp, gc, BLUE);
+			XSetLineAttributes(priv->xdisp, gc, 1, LineSolid,	CapRound, JoinMiter);
+
+			XDrawLine(priv->xdisp, priv->xwin, gc, priv->plot.plot_area.left_edge, y, x-10, y);
+			XDrawLine(priv->xdisp, priv->xwin, gc, x-5, y, x+5, y);
+			XDrawLine(priv->xdisp, priv->xwin, gc, x+10, y, priv->plot.plot_area.right_edge, y);
+
+			XDrawLine(priv->xdisp, priv->xwin, gc, x, priv->plot.plot_area.top_edge, x, y-10);
+			XDrawLine(priv->xdisp, priv->xwin, gc, x, y-5, x, y+5);
+			XDrawLine(priv->xdisp, priv->xwin, gc, x, y+10, x, priv->plot.plot_area.bottom_edge);
+
+			priv->cross_hair_is_visible = TRUE;
+		}
+		else {
+			priv->cross_hair_is_visible = FALSE;
+		}
+	}
+
+
+	/**************** draw coordinates if active (whether zooming or not) *************/
+	if(priv->do_show_coords) {
+		gint x,y;
+		gtk_widget_get_pointer(plot, &x, &y);
+		if(priv->do_snap_to_data && is_in_plot_area) {
+			x = x_px;
+			y = y_px;
+		}
+		if(x >= (priv->plot.plot_area.left_edge-1) &&
+		   x <= (priv->plot.plot_area.right_edge+1) &&
+		   y >= (priv->plot.plot_area.top_edge-1) &&
+		   y <= (priv->plot.plot_area.bottom_edge+1)
+		  ) {
+			char x_str[100], y_str[100];
+			int x_w, x_h, y_w, y_h;
+			double box_w, box_h;
+
+			char x_fs[200]="x=";
+			char y_fs[200]="y=";
+			strcat(x_fs, p->x_axis.coord_label_format_string);
+			strcat(y_fs, p->y_axis.coord_label_format_string);
+
+			if(priv->do_snap_to_data) {
+				sprintf(x_str, x_fs, priv->closest_x);
+				sprintf(y_str, y_fs, priv->closest_y);
+			}
+			else {
+				sprintf(x_str, x_fs, ((double)x-x_b)/x_m);
+				sprintf(y_str, y_fs, ((double)y-y_b)/y_m);
+			}
+			get_text_dims_x(priv->xdisp, gc, x_str, &x_w, &x_h);
+			get_text_dims_x(priv->xdisp, gc, y_str, &y_w, &y_h);
+			box_w = 10 + ((x_w > y_w) ? x_w : y_w);
+			box_h = 10 + (x_h + y_h);
+
+			gint mid_x = (priv->plot.plot_area.left_edge + priv->plot.plot_area.right_edge)/2.;
+			gint mid_y = (priv->plot.plot_area.top_edge + priv->plot.plot_area.bottom_edge)/2.;
+
+			// draw white rectangle
+			int rect_x, rect_y;
+			if(x < mid_x) { // left half
+				if(y > mid_y) { // bottom left quadrant
+					rect_x = x+3;
+					rect_y = y - box_h - 3;
+				}
+				else { // top left quadrant
+					rect_x = x+3;
+					rect_y = y+3;
+				}
+			}
+			else { // right half
+				if(y > mid_y) { // bottom right quadrant
+					rect_x = x - box_w - 3;
+					rect_y = y - box_h - 3;
+				}
+				else { // top right quadrant
+					rect_x = x - box_w - 3;
+					rect_y = y+3;
+				}
+			}
+			XSetForeground(priv->xdisp, gc, WHITE);
+			XFillRectangle(priv->xdisp, priv->xwin, gc, rect_x, rect_y, box_w, box_h);	
+			XSetForeground(priv->xdisp, gc, BLACK);
+			XSetLineAttributes(priv->xdisp, gc, 1, LineSolid,	CapRound, JoinMiter);
+			XDrawRectangle(priv->xdisp, priv->xwin, gc, rect_x, rect_y, box_w, box_h);	
+
+			// draw coordinates...
+			XSetForeground(priv->xdisp, gc, BLACK);
+			if(x < mid_x) { // left half
+				if(y > mid_y) { // bottom left quadrant
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x+5+3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x+5+3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
+				}
+				else { // top left quadrant
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x+5+3, y+6, ANCHOR_TOP_LEFT);
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x+5+3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
+				}
+			}
+			else { // right half
+				if(y > mid_y) { // bottom right quadrant
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x-box_w+5-3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x-box_w+5-3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
+				}
+				else { // top right quadrant
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x-box_w+5-3, y+6, ANCHOR_TOP_LEFT);
+					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x-box_w+5-3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
+				}
+			}
+		}
+			
+	}
+#else
+	cairo_t *cr = gdk_cairo_create(plot->window);
+	if(!cr) {
+		printf("ERROR creating cairo context!!!\n");
+		exit(-1);
+	}
+	cairo_rectangle(cr, 10, 10, 100, 100);
+	if(priv->antialias) {
+		cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
+	}
+	else {
+		cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+	}
+
+	// make sure the plot_context is valid (no latched errors)
+	// If invalid, create a new one...
+	cairo_status_t cr_stat = cairo_status(priv->plot_context);
+	if(cr_stat != CAIRO_STATUS_SUCCESS) {
+		//printf("Invalid cairo context: %s\n", cairo_status_to_string(cr_stat));
+		cairo_destroy(priv->plot_context);
+		priv->plot_context = cairo_create(priv->plot_buffer);
+	}
+
+	/* Draw the plot to the plot image buffer */
+	priv->exposing = TRUE;
+	draw_plot(plot, priv->plot_context, plot->allocation.width, plot->allocation.height);
+	priv->exposing = FALSE;
+
+	/* Then paint the plot image buffer on the widget itself */
+	cairo_save(cr);
+	cairo_set_source_surface(cr, priv->plot_buffer, 0, 0);
+	cairo_rectangle(cr, 0, 0, plot->allocation.width, plot->allocation.height);
+	cairo_clip(cr);
+	cairo_paint(cr);
+	cairo_restore(cr);
+	
+	/********************** draw the cursor (if needed) *************************/
+	if(p->cursor.type != CURSOR_NONE) {
+		cursor_t *c = &(p->cursor);
+		cairo_save(cr);
+		cairo_set_source_rgb (cr, c->color.red, c->color.green, c->color.blue);
+		cairo_set_line_width(cr, c->line_width);
+		if(c->line_type == LINETYPE_SOLID) {
+			cairo_set_dash(cr, dash_pattern, 0, 0);
+		}	
+		else if(c->line_type == LINETYPE_DASHED) {
+			cairo_set_dash(cr, dash_pattern, 2, 0);
+		}	
+		else if(c->line_type == LINETYPE_DOTTED) {
+			cairo_set_dash(cr, dot_pattern, 2, 0);
+		}
+		double x_px = x_m * c->x + x_b;	
+		double y_px = y_m * c->y + y_b;	
+		if(c->type == CURSOR_VERT || c->type == CURSOR_CROSS) {
+			if(x_px >= p->plot_area.left_edge && x_px <= p->plot_area.right_edge) {
+				cairo_move_to(cr, x_px, p->plot_area.top_edge);
+				cairo_line_to(cr, x_px, p->plot_area.bottom_edge);
+				cairo_stroke(cr);
+			}
+		}
+		if(c->type == CURSOR_HORIZ || c->type == CURSOR_CROSS) {
+			if(y_px >= p->plot_area.top_edge && y_px <= p->plot_area.bottom_edge) {
+				cairo_move_to(cr, p->plot_area.left_edge, y_px);
+				cairo_line_to(cr, p->plot_area.right_edge, y_px);
+				cairo_stroke(cr);
+			}
+		}
+		cairo_restore(cr);
+	}
+
+
+	/************* draw the zoom box if zooming is active *****************/
+	if(priv->zooming) {
+		double dashes[] = {8.0,4.0};
+		cairo_save(cr);
+		cairo_set_source_rgba (cr, 0.423, 0.646, 0.784, 0.3);
+		cairo_set_line_width (cr, 1.0);
+		double x_e = priv->drag_end_x;
+		double y_e = priv->drag_end_y;
+		double x_s = priv->drag_start_x;
+		double y_s = priv->drag_start_y;
+		if(priv->drag_end_x < priv->plot.plot_area.left_edge) {
+			x_e = priv->plot.plot_area.left_edge;
+		}
+		else if(priv->drag_end_x > priv->plot.plot_area.right_edge) {
+			x_e = priv->plot.plot_area.right_edge;
+		}
+		if(priv->drag_end_y < priv->plot.plot_area.top_edge) {
+			y_e = priv->plot.plot_area.top_edge;
+		}
+		else if(priv->drag_end_y > priv->plot.plot_area.bottom_edge) {
+			y_e = priv->plot.plot_area.bottom_edge;
+		}
+		if(priv->h_zoom) {
+			y_s = priv->plot.plot_area.top_edge;
 			y_e = priv->plot.plot_area.bottom_edge;
 		}
-		if(priv->v_zoom) {
-			x_s = priv->plot.plot_area.left_edge;
-			x_e = priv->plot.plot_area.right_edge;
+		if(priv->v_zoom) {
+			x_s = priv->plot.plot_area.left_edge;
+			x_e = priv->plot.plot_area.right_edge;
+		}
+			
+		cairo_rectangle(cr, x_s, y_s,	x_e - x_s, y_e - y_s);
+		cairo_fill_preserve(cr);
+		cairo_set_source_rgb (cr, 0.423, 0.646, 0.784);
+		cairo_stroke(cr);	
+		cairo_restore(cr);
+	}
+
+	/********** find closest data point if showing coords or cross-hair *****/
+	double x_px = 0.0;
+	double y_px = 0.0;
+	gboolean is_in_plot_area = FALSE;
+	priv->closest_x = 0.0;
+	priv->closest_y = 0.0;
+	if(priv->do_snap_to_data && (priv->do_show_cross_hair || priv->do_show_coords)) {
+		gint x,y;
+		gtk_widget_get_pointer(plot, &x, &y);
+		if(x >= priv->plot.plot_area.left_edge-1 && x <= priv->plot.plot_area.right_edge+1 &&
+		   y >= priv->plot.plot_area.top_edge-1 &&  y <= priv->plot.plot_area.bottom_edge+1) {
+			int n;
+			trace_t *t = find_closest_point(priv, x, y, &n);
+			is_in_plot_area = TRUE;
+			if(t != NULL) {
+				priv->closest_x = trace_x(t, n);
+				priv->closest_y = trace_y(t, n);
+			}
+			x_px = x_m * priv->closest_x + x_b;
+			y_px = y_m * priv->closest_y + y_b;
+			
+		}
+		else {
+			is_in_plot_area = FALSE;
+		}
+	}
+
+	/************** draw crosshair if active ****************************/
+	if(priv->do_show_cross_hair) {
+		gint x,y;
+		int inhibit_ch = 0;
+		gtk_widget_get_pointer(plot, &x, &y);
+		if(x < priv->plot.plot_area.left_edge-1) {
+			x = priv->plot.plot_area.left_edge;
+			inhibit_ch = 1;
+		}
+		if(x > priv->plot.plot_area.right_edge+1) {
+			x = priv->plot.plot_area.right_edge;
+			inhibit_ch = 1;
+		}
+		if(y < priv->plot.plot_area.top_edge-1) {
+			y = priv->plot.plot_area.top_edge;
+			inhibit_ch = 1;
+		}
+		if(y > priv->plot.plot_area.bottom_edge+1) {
+			y = priv->plot.plot_area.bottom_edge;
+			inhibit_ch = 1;
+		}
+		if(priv->do_snap_to_data && is_in_plot_area) {
+			x = x_px;
+			y = y_px;
+		}
+		if(!inhibit_ch) {
+			cairo_save(cr);
+			//cairo_set_source_rgb (cr, 1.0, 1.0, 0.0); // yellow
+			cairo_set_source_rgb (cr, 0.0, 0.0, 1.0); // blue
+			cairo_set_line_width (cr, 1.0);
+
+			cairo_move_to(cr, priv->plot.plot_area.left_edge, y);
+			cairo_line_to(cr, x-10, y);
+			cairo_move_to(cr, x-5, y);
+			cairo_line_to(cr, x+5, y);
+			cairo_move_to(cr, x+10, y);
+			cairo_line_to(cr, priv->plot.plot_area.right_edge, y);
+
+			cairo_move_to(cr, x, priv->plot.plot_area.top_edge);
+			cairo_line_to(cr, x, y-10);
+			cairo_move_to(cr, x, y-5);
+			cairo_line_to(cr, x, y+5);
+			cairo_move_to(cr, x, y+10);
+			cairo_line_to(cr, x, priv->plot.plot_area.bottom_edge);
+			cairo_stroke(cr);	
+			cairo_restore(cr);
+			priv->cross_hair_is_visible = TRUE;
+		}
+		else {
+			priv->cross_hair_is_visible = FALSE;
+		}
+	}
+
+	/**************** draw coordinates if active (whether zooming or not) *************/
+	if(priv->do_show_coords) {
+		gint x,y;
+		gtk_widget_get_pointer(plot, &x, &y);
+		if(priv->do_snap_to_data && is_in_plot_area) {
+			x = x_px;
+			y = y_px;
+		}
+		if(x >= (priv->plot.plot_area.left_edge-1) &&
+		   x <= (priv->plot.plot_area.right_edge+1) &&
+		   y >= (priv->plot.plot_area.top_edge-1) &&
+		   y <= (priv->plot.plot_area.bottom_edge+1)
+		  ) {
+			char x_str[100], y_str[100];
+			double x_w, x_h, y_w, y_h;
+			double box_w, box_h;
+
+			char x_fs[200]="x=";
+			char y_fs[200]="y=";
+			strcat(x_fs, p->x_axis.coord_label_format_string);
+			strcat(y_fs, p->y_axis.coord_label_format_string);
+
+			if(priv->do_snap_to_data) {
+				sprintf(x_str, x_fs, priv->closest_x);
+				sprintf(y_str, y_fs, priv->closest_y);
+			}
+			else {
+				sprintf(x_str, x_fs, ((double)x-x_b)/x_m);
+				sprintf(y_str, y_fs, ((double)y-y_b)/y_m);
+			}
+			x_w = get_text_width(cr, x_str, 10);
+			y_w = get_text_width(cr, y_str, 10);
+			x_h = get_text_height(cr, x_str, 10);
+			y_h = get_text_height(cr, y_str, 10);
+			box_w = 10 + ((x_w > y_w) ? x_w : y_w);
+			box_h = 10 + (x_h + y_h);
+
+			gint mid_x = (priv->plot.plot_area.left_edge + priv->plot.plot_area.right_edge)/2.;
+			gint mid_y = (priv->plot.plot_area.top_edge + priv->plot.plot_area.bottom_edge)/2.;
+
+			cairo_save(cr);
+
+			// draw white rectangle
+			cairo_set_source_rgb (cr, 1, 1, 1);
+			if(x < mid_x) { // left half
+				if(y > mid_y) { // bottom left quadrant
+					cairo_rectangle(cr, x+3, y-box_h-3, box_w, box_h);
+				}
+				else { // top left quadrant
+					cairo_rectangle(cr, x+3, y+3, box_w, box_h);
+				}
+			}
+			else { // right half
+				if(y > mid_y) { // bottom right quadrant
+					cairo_rectangle(cr, x-box_w-3, y-box_h-3, box_w, box_h);
+				}
+				else { // top right quadrant
+					cairo_rectangle(cr, x-box_w-3, y+3, box_w, box_h);
+				}
+			}
+			cairo_fill_preserve(cr);
+			cairo_set_source_rgb (cr, 0, 0, 0);
+			cairo_set_line_width (cr, 1.0);
+			cairo_stroke(cr);
+
+			// draw coordinates...
+			cairo_set_source_rgb (cr, 0, 0, 0);
+			if(x < mid_x) { // left half
+				if(y > mid_y) { // bottom left quadrant
+					draw_horiz_text_at_point(cr, x_str, x+5+3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
+					draw_horiz_text_at_point(cr, y_str, x+5+3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
+				}
+				else { // top left quadrant
+					draw_horiz_text_at_point(cr, x_str, x+5+3, y+6, ANCHOR_TOP_LEFT);
+					draw_horiz_text_at_point(cr, y_str, x+5+3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
+				}
+			}
+			else { // right half
+				if(y > mid_y) { // bottom right quadrant
+					draw_horiz_text_at_point(cr, x_str, x-box_w+5-3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
+					draw_horiz_text_at_point(cr, y_str, x-box_w+5-3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
+				}
+				else { // top right quadrant
+					draw_horiz_text_at_point(cr, x_str, x-box_w+5-3, y+6, ANCHOR_TOP_LEFT);
+					draw_horiz_text_at_point(cr, y_str, x-box_w+5-3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
+				}
+			}
+
+			cairo_restore(cr);
+		}
+			
+	}
+
+	cairo_destroy(cr);
+#endif
+
+	gdk_window_set_cursor(plot->window, NULL);
+	gdk_cursor_unref(cursor);
+	frame_end(priv);
+	return FALSE;
+}
+
+
+
+/******************* Plot Drawing Functions **************************/
+static int set_linear_tic_values(axis_t *a, double min, double max) {
+	double raw_range = max - min;
+	double raw_tic_delta = raw_range / (a->num_request_major_tics - 1);
+	double mantissa;
+	int exponent;
+	get_double_parts(raw_tic_delta, &mantissa, &exponent);
+	double actual_tic_delta;
+
+	if(mantissa <= 1.0) {
+		actual_tic_delta = 1.0 * pow(10., exponent);
+	}
+	else if(mantissa <= 2.0) {
+		actual_tic_delta = 2.0 * pow(10., exponent);
+	}
+	else if(mantissa <= 2.5) {
+		actual_tic_delta = 2.5 * pow(10., exponent);
+	}
+	else if(mantissa <= 5.0) {
+		actual_tic_delta = 5.0 * pow(10., exponent);
+	}
+	else {
+		actual_tic_delta = 1.0 * pow(10., exponent+1);
+	}
+
+	double min_tic_val;
+	if(a->do_autoscale && a->do_loose_fit) {
+		min_tic_val = round_down_to_nearest(min, actual_tic_delta);
+		a->min_val = min_tic_val;
+	}
+	else {
+		min_tic_val = round_up_to_nearest(min, actual_tic_delta);
+		a->min_val = min;
+		a->max_val = max;
+	}
+		
+	double tic_val;
+	int i = 0;
+	for(tic_val = min_tic_val; tic_val < max && i < MAX_NUM_MAJOR_TICS; tic_val += actual_tic_delta) {
+		/* perform check to see if it should be equal to zero */
+		if(fabs(tic_val / actual_tic_delta) < 0.5) {
+			tic_val = 0.0;
+		}
+		if(!a->do_manual_tics) {
+			a->major_tic_values[i] = tic_val;
+		}
+		i++;
+	}
+	if(i >= MAX_NUM_MAJOR_TICS) {
+		printf("Too many major tics!!!\n");
+		return -1;
+	}
+	
+	if(a->do_autoscale && a->do_loose_fit) {
+		a->max_val = tic_val;	
+		if(!a->do_manual_tics) {
+			a->major_tic_values[i] = tic_val;
+			a->num_actual_major_tics = i+1;
+		}
+	}
+	else {
+		a->max_val = max;		
+		if(!a->do_manual_tics) {
+			a->num_actual_major_tics = i;		
+		}
+	}
+	a->major_tic_delta = actual_tic_delta;
+
+
+	return 0;
+}
+
+static int set_log_tic_values(axis_t *a, double min, double max) {
+	// all values must be positive!!!
+	if(min < 0) {
+		return -1;
+	}
+	return set_linear_tic_values(a, log10(min), log10(max));
+}
+
+static int set_major_tic_values(axis_t *a, double min, double max) {
+	if(a->log_scale) {
+		// try doing log scale. If it succeeds, great.  Otherwise, do linear scale
+		a->log_scale_ok = 0;
+		if(!set_log_tic_values(a, min, max)) {
+			a->log_scale_ok = 1;
+			return 0;
+		}
+	}
+	return set_linear_tic_values(a, min, max);
+}
+
+static int set_major_tic_labels(axis_t *a) {
+	int i, ret;
+	int err = 0;
+	if(a->do_auto_tic_format) { // do automagic formatting...
+		double dd = log10( fabs(a->major_tic_delta) );
+		double d1 = log10(fabs(a->major_tic_values[0]));
+		double d2 = log10(fabs(a->major_tic_values[a->num_actual_major_tics-1]));
+		double d = (d2>d1) ? d2 : d1;
+		int sigs = ceil(d) - floor(dd) + 1.5;
+		if(sigs < 4) 
+			sigs = 4;
+		sprintf(a->tic_label_format_string, "%%.%dg", sigs);
+		sprintf(a->coord_label_format_string, "%%.%dg", sigs+2);
+		for(i=0; i<a->num_actual_major_tics; i++) { 
+			if(a->log_scale && a->log_scale_ok) {
+				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, "%g", pow(10,a->major_tic_values[i]));
+			}
+			else {
+				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, a->tic_label_format_string, a->major_tic_values[i]);
+			}
+		}
+	}
+	else { // otherwise, use standard fprintf type of format string
+		for(i=0; i<a->num_actual_major_tics; i++) { 
+			if(a->log_scale && a->log_scale_ok) {
+				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, "%g", pow(10,a->major_tic_values[i]));
+			}
+			else {
+				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, a->tic_label_format_string, a->major_tic_values[i]);
+			}
+		}
+	}
+	return err;
+}
+
+#if DRAW_WITH_XLIB
+static int get_text_dims_x(Display *display, GC gc, char *text, int *width_out, int *height_out) {
+
+	int direction;
+	int font_ascent;
+	int font_descent;
+	XCharStruct overall;
+
+	XFontStruct *fp = XQueryFont(display, XGContextFromGC(gc));
+	XTextExtents(fp, text, strlen(text), &direction, &font_ascent, &font_descent, &overall);
+
+	XFreeFontInfo(NULL, fp, 1);
+
+	*height_out = overall.ascent + overall.descent;
+	*width_out = overall.width;
+	return 0;
+}
+#endif
+
+#if DRAW_WITH_XLIB
+static double get_text_height_x(Display *display, GC gc, char *text) {
+
+	int direction;
+	int font_ascent;
+	int font_descent;
+	XCharStruct overall;
+
+	XFontStruct *fp = XQueryFont(display, XGContextFromGC(gc));
+	XTextExtents(fp, text, strlen(text), &direction, &font_ascent, &font_descent, &overall);
+
+	XFreeFontInfo(NULL, fp, 1);
+
+	return (overall.ascent + overall.descent);
+}
+#endif
+	
+#if DRAW_WITH_XLIB
+static double get_text_width_x(Display *display, GC gc, char *text) {
+
+	int direction;
+	int font_ascent;
+	int font_descent;
+	XCharStruct overall;
+
+	XFontStruct *fp = XQueryFont(display, XGContextFromGC(gc));
+	XTextExtents(fp, text, strlen(text), &direction, &font_ascent, &font_descent, &overall);
+
+	XFreeFontInfo(NULL, fp, 1);
+
+	return (overall.width);
+}
+#endif
+	
+
+static double get_text_height(cairo_t *cr, char *text, double font_size) {
+	cairo_text_extents_t te;
+	cairo_save(cr);
+	cairo_set_font_size(cr, font_size);
+	cairo_text_extents(cr, text, &te);
+	cairo_restore(cr);
+	return te.height;
+}
+	
+static double get_text_width(cairo_t *cr, char *text, double font_size) {
+	cairo_text_extents_t te;
+	cairo_save(cr);
+	cairo_set_font_size(cr, font_size);
+	cairo_text_extents(cr, text, &te);
+	cairo_restore(cr);
+	return te.width;
+}
+	
+
+#if DRAW_WITH_XLIB
+static double get_widest_label_width_x(axis_t *a, Display *display, GC gc) {
+	double max = 0.0;
+	double w;
+	int i;
+	for(i=0; i<a->num_actual_major_tics; i++) {
+		w = get_text_width_x(display, gc, a->major_tic_labels[i]);
+		if(w > max) {
+			max = w;
+		}
+	}
+	return max;
+}
+#endif
+
+static double get_widest_label_width(axis_t *a, cairo_t *cr) {
+  double max = 0.0;
+  double w;
+	cairo_text_extents_t te;
+  int i;
+  for(i=0; i<a->num_actual_major_tics; i++) {
+		cairo_text_extents(cr, a->major_tic_labels[i], &te);
+    w = te.width;
+    if(w > max) {
+      max = w;
+    }
+  }
+  return max;
+}
+      
+
+static void get_double_parts(double f, double *mantissa, int *exponent) {
+  int neg = 0;
+  if(f == 0.0) {  
+    *mantissa = 0.0;
+    *exponent = 0;
+    return;
+  }
+  if(f < 0) neg = 1;
+  *exponent = floor(log10(fabs(f)));
+  *mantissa = f / pow(10, *exponent);
+  return;
+}
+
+
+static double round_to_nearest(double num, double nearest) {
+  double a = num / nearest;
+  return (floor(a + 0.5) * nearest);
+}
+
+static double round_up_to_nearest(double num, double nearest) {
+  double a = num / nearest;
+  return (ceil(a) * nearest);
+}
+
+static double round_down_to_nearest(double num, double nearest) {
+  double a = num / nearest;
+  return (floor(a) * nearest);
+}
+
+
+static data_range get_y_range(trace_t **traces, int num_traces) {
+  data_range r, xr, yr;
+  int i;
+  double min = DBL_MAX, max = -DBL_MAX;
+  for(i = 0; i < num_traces; i++) {
+    trace_get_extrema(traces[i], &xr, &yr);
+    if(yr.max > max) {
+      max = yr.max;
+    }
+    if(yr.min < min) {
+      min = yr.min;
+    }
+  }
+	if(min == max) {
+		if(min == 0) {
+			min = -1.0;
+			max = +1.0;
+		}
+		else {
+			min = min - 0.1 * fabs(min);
+			max = max + 0.1 * fabs(max);
 		}
-		int x_min = x_s < x_e ? x_s : x_e;
-		int y_min = y_s < y_e ? y_s : y_e;
-		int w = fabs(x_s-x_e);
-		int h = fabs(y_s-y_e);
-		XDrawRectangle(priv->xdisp, priv->xwin, gc, x_min, y_min, w, h);	
 	}
+  r.min = min;
+  r.max = max;
+  return r;
+}
 
-	/********** find closest data point if showing coords or cross-hair *****/
-	double x_px = 0.0;
-	double y_px = 0.0;
-	int closest_point_index = 0;
-	int closest_trace_index = 0;
-	gboolean is_in_plot_area = FALSE;
-	priv->closest_x = 0.0;
-	priv->closest_y = 0.0;
-	if(priv->do_snap_to_data && (priv->do_show_cross_hair || priv->do_show_coords)) {
-		gint x,y;
-		gtk_widget_get_pointer(plot, &x, &y);
-		if(x >= priv->plot.plot_area.left_edge-1 && x <= priv->plot.plot_area.right_edge+1 &&
-		   y >= priv->plot.plot_area.top_edge-1 &&  y <= priv->plot.plot_area.bottom_edge+1) {
-			int i, j;
-			double min_dist = DBL_MAX;
-			is_in_plot_area = TRUE;
-			for(j=0; j < p->num_traces; j++) {
-				for(i=0; i<(p->traces[0])->length; i++) {
-					double dist;
-					dist = pow((p->traces[j])->x_data[i] * x_m + x_b - x,2) + pow((p->traces[j])->y_data[i] * y_m + y_b - y,2);
-					if(dist < min_dist) {
-						min_dist = dist;
-						closest_point_index = i;
-						closest_trace_index = j;
-					}
-				}
-			}
-			priv->closest_x = (p->traces[closest_trace_index])->x_data[closest_point_index];
-			priv->closest_y = (p->traces[closest_trace_index])->y_data[closest_point_index];
-			x_px = x_m * (p->traces[closest_trace_index])->x_data[closest_point_index] + x_b;
-			y_px = y_m * (p->traces[closest_trace_index])->y_data[closest_point_index] + y_b;
-			
+static data_range get_y_range_within_x_range(trace_t **traces, int num_traces, data_range xr) {
+  data_range r, tr;
+  int i;
+  double min = DBL_MAX, max = -DBL_MAX;
+  for(i = 0; i < num_traces; i++) {
+    trace_get_range_within(traces[i], 1, xr, &tr);
+    if(tr.max > max) {
+      max = tr.max;
+    }
+    if(tr.min < min) {
+      min = tr.min;
+    }
+  }
+	if(min == max) {
+		if(min == 0) {
+			min = -1.0;
+			max = +1.0;
 		}
 		else {
-			is_in_plot_area = FALSE;
+			min = min - 0.1 * fabs(min);
+			max = max + 0.1 * fabs(max);
 		}
 	}
+  r.min = min;
+  r.max = max;
+  return r;
+}
 
-	/************** draw crosshair if active ****************************/
-	if(priv->do_show_cross_hair) {
-		gint x,y;
-		int inhibit_ch = 0;
-		gtk_widget_get_pointer(plot, &x, &y);
-		if(x < priv->plot.plot_area.left_edge-1) {
-			x = priv->plot.plot_area.left_edge;
-			inhibit_ch = 1;
-		}
-		if(x > priv->plot.plot_area.right_edge+1) {
-			x = priv->plot.plot_area.right_edge;
-			inhibit_ch = 1;
+static data_range get_x_range(trace_t **traces, int num_traces) {
+  data_range r, xr, yr;
+  int i;
+  double min = DBL_MAX, max = -DBL_MAX;
+  for(i = 0; i < num_traces; i++) {
+    trace_get_extrema(traces[i], &xr, &yr);
+    if(xr.max > max) {
+      max = xr.max;
+    }
+    if(xr.min < min) {
+      min = xr.min;
+    }
+  }
+	if(min == max) {
+		if(min == 0) {
+			min = -1.0;
+			max = +1.0;
 		}
-		if(y < priv->plot.plot_area.top_edge-1) {
-			y = priv->plot.plot_area.top_edge;
-			inhibit_ch = 1;
+		else {
+			min = min - 0.1 * fabs(min);
+			max = max + 0.1 * fabs(max);
 		}
-		if(y > priv->plot.plot_area.bottom_edge+1) {
-			y = priv->plot.plot_area.bottom_edge;
-			inhibit_ch = 1;
+	}
+  r.min = min;
+  r.max = max;
+  return r;
+}
+
+static data_range get_x_range_within_y_range(trace_t **traces, int num_traces, data_range yr) {
+  data_range r, tr;
+  int i;
+  double min = DBL_MAX, max = -DBL_MAX;
+  for(i = 0; i < num_traces; i++) {
+    trace_get_range_within(traces[i], 0, yr, &tr);
+    if(tr.max > max) {
+      max = tr.max;
+    }
+    if(tr.min < min) {
+      min = tr.min;
+    }
+  }
+	if(min == max) {
+		if(min == 0) {
+			min = -1.0;
+			max = +1.0;
 		}
-		if(priv->do_snap_to_data && is_in_plot_area) {
-			x = x_px;
-			y = y_px;
+		else {
+			min = min - 0.1 * fabs(min);
+			max = max + 0.1 * fabs(max);
 		}
-		if(!inhibit_ch) {
-			XSetForeground(priv->xdisp, gc, BLUE);
-			XSetLineAttributes(priv->xdisp, gc, 1, LineSolid,	CapRound, JoinMiter);
+	}
+  r.min = min;
+  r.max = max;
+  return r;
+}
 
-			XDrawLine(priv->xdisp, priv->xwin, gc, priv->plot.plot_area.left_edge, y, x-10, y);
-			XDrawLine(priv->xdisp, priv->xwin, gc, x-5, y, x+5, y);
-			XDrawLine(priv->xdisp, priv->xwin, gc, x+10, y, priv->plot.plot_area.right_edge, y);
 
-			XDrawLine(priv->xdisp, priv->xwin, gc, x, priv->plot.plot_area.top_edge, x, y-10);
-			XDrawLine(priv->xdisp, priv->xwin, gc, x, y-5, x, y+5);
-			XDrawLine(priv->xdisp, priv->xwin, gc, x, y+10, x, priv->plot.plot_area.bottom_edge);
+/******************* Trace Index Functions **************************/
 
-			priv->cross_hair_is_visible = TRUE;
-		}
-		else {
-			priv->cross_hair_is_visible = FALSE;
-		}
+/* maps a logical sample index (0 = oldest) to its ring-buffer slot */
+static int trace_slot(trace_t *t, int j) {
+	int n = t->start_index + j;
+	if(n >= t->capacity) {
+		n -= t->capacity;
 	}
+	return n;
+}
 
+static int sample_size(sample_type_t type) {
+	switch(type) {
+		case SAMPLE_FLOAT: return sizeof(float);
+		case SAMPLE_INT16: return sizeof(gint16);
+		case SAMPLE_INT32: return sizeof(gint32);
+		default: return sizeof(double);
+	}
+}
 
-	/**************** draw coordinates if active (whether zooming or not) *************/
-	if(priv->do_show_coords) {
-		gint x,y;
-		gtk_widget_get_pointer(plot, &x, &y);
-		if(priv->do_snap_to_data && is_in_plot_area) {
-			x = x_px;
-			y = y_px;
-		}
-		if(x >= (priv->plot.plot_area.left_edge-1) &&
-		   x <= (priv->plot.plot_area.right_edge+1) &&
-		   y >= (priv->plot.plot_area.top_edge-1) &&
-		   y <= (priv->plot.plot_area.bottom_edge+1)
-		  ) {
-			char x_str[100], y_str[100];
-			int x_w, x_h, y_w, y_h;
-			double box_w, box_h;
+static void col_init(sample_col_t *c, sample_type_t type, void *data) {
+	c->data = data;
+	c->type = type;
+	c->stride = sample_size(type);
+	c->gain = 1.0;
+	c->offset = 0.0;
+}
 
-			char x_fs[200]="x=";
-			char y_fs[200]="y=";
-			strcat(x_fs, p->x_axis.coord_label_format_string);
-			strcat(y_fs, p->y_axis.coord_label_format_string);
+#define COL_AT(c, ctype, n) (*(ctype *)((char *)(c)->data + (size_t)(n) * (c)->stride))
 
-			if(priv->do_snap_to_data) {
-				sprintf(x_str, x_fs, (p->traces[closest_trace_index])->x_data[closest_point_index]);
-				sprintf(y_str, y_fs, (p->traces[closest_trace_index])->y_data[closest_point_index]);
+static double col_get(sample_col_t *c, int n) {
+	switch(c->type) {
+		case SAMPLE_FLOAT:
+			return c->gain * COL_AT(c, float, n) + c->offset;
+		case SAMPLE_INT16:
+			if(COL_AT(c, gint16, n) == G_MININT16) {
+				return NAN;
 			}
-			else {
-				sprintf(x_str, x_fs, ((double)x-x_b)/x_m);
-				sprintf(y_str, y_fs, ((double)y-y_b)/y_m);
+			return c->gain * COL_AT(c, gint16, n) + c->offset;
+		case SAMPLE_INT32:
+			if(COL_AT(c, gint32, n) == G_MININT32) {
+				return NAN;
 			}
-			get_text_dims_x(priv->xdisp, gc, x_str, &x_w, &x_h);
-			get_text_dims_x(priv->xdisp, gc, y_str, &y_w, &y_h);
-			box_w = 10 + ((x_w > y_w) ? x_w : y_w);
-			box_h = 10 + (x_h + y_h);
-
-			gint mid_x = (priv->plot.plot_area.left_edge + priv->plot.plot_area.right_edge)/2.;
-			gint mid_y = (priv->plot.plot_area.top_edge + priv->plot.plot_area.bottom_edge)/2.;
+			return c->gain * COL_AT(c, gint32, n) + c->offset;
+		default:
+			return COL_AT(c, double, n);
+	}
+}
 
-			// draw white rectangle
-			int rect_x, rect_y;
-			if(x < mid_x) { // left half
-				if(y > mid_y) { // bottom left quadrant
-					rect_x = x+3;
-					rect_y = y - box_h - 3;
-				}
-				else { // top left quadrant
-					rect_x = x+3;
-					rect_y = y+3;
-				}
+/* integer storage rounds and saturates; NaN becomes the missing-sample code */
+static void col_set(sample_col_t *c, int n, double v) {
+	double r;
+	if(c->type == SAMPLE_DOUBLE) {
+		COL_AT(c, double, n) = v;
+		return;
+	}
+	r = (v - c->offset) / c->gain;
+	switch(c->type) {
+		case SAMPLE_FLOAT:
+			COL_AT(c, float, n) = r;
+			break;
+		case SAMPLE_INT16:
+			if(isnan(r)) {
+				COL_AT(c, gint16, n) = G_MININT16;
 			}
-			else { // right half
-				if(y > mid_y) { // bottom right quadrant
-					rect_x = x - box_w - 3;
-					rect_y = y - box_h - 3;
-				}
-				else { // top right quadrant
-					rect_x = x - box_w - 3;
-					rect_y = y+3;
-				}
+			else {
+				r = floor(r + 0.5);
+				COL_AT(c, gint16, n) = (r < -G_MAXINT16) ? -G_MAXINT16 : (r > G_MAXINT16) ? G_MAXINT16 : (gint16)r;
 			}
-			XSetForeground(priv->xdisp, gc, WHITE);
-			XFillRectangle(priv->xdisp, priv->xwin, gc, rect_x, rect_y, box_w, box_h);	
-			XSetForeground(priv->xdisp, gc, BLACK);
-			XSetLineAttributes(priv->xdisp, gc, 1, LineSolid,	CapRound, JoinMiter);
-			XDrawRectangle(priv->xdisp, priv->xwin, gc, rect_x, rect_y, box_w, box_h);	
-
-			// draw coordinates...
-			XSetForeground(priv->xdisp, gc, BLACK);
-			if(x < mid_x) { // left half
-				if(y > mid_y) { // bottom left quadrant
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x+5+3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x+5+3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
-				}
-				else { // top left quadrant
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x+5+3, y+6, ANCHOR_TOP_LEFT);
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x+5+3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
-				}
+			break;
+		case SAMPLE_INT32:
+			if(isnan(r)) {
+				COL_AT(c, gint32, n) = G_MININT32;
 			}
-			else { // right half
-				if(y > mid_y) { // bottom right quadrant
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x-box_w+5-3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x-box_w+5-3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
-				}
-				else { // top right quadrant
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, x_str, x-box_w+5-3, y+6, ANCHOR_TOP_LEFT);
-					draw_horiz_text_at_point_x(priv->xdisp, priv->xwin, gc, y_str, x-box_w+5-3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
-				}
+			else {
+				r = floor(r + 0.5);
+				COL_AT(c, gint32, n) = (r < -G_MAXINT32) ? -G_MAXINT32 : (r > G_MAXINT32) ? G_MAXINT32 : (gint32)r;
 			}
-		}
-			
+			break;
+		default:
+			break;
+	}
+}
+
+/* stores count values into consecutive slots starting at slot n */
+static void col_store(sample_col_t *c, int n, double *v, int count) {
+	int i;
+	if(c->type == SAMPLE_DOUBLE && c->stride == sizeof(double)) {
+		memcpy((double *)c->data + n, v, count * sizeof(double));
+		return;
 	}
-#else
-	cairo_t *cr = gdk_cairo_create(plot->window);
-	if(!cr) {
-		printf("ERROR creating cairo context!!!\n");
-		exit(-1);
+	for(i = 0; i < count; i++) {
+		col_set(c, n + i, v[i]);
 	}
-	cairo_rectangle(cr, 10, 10, 100, 100);
-	if(priv->antialias) {
-		cairo_set_antialias(cr, CAIRO_ANTIALIAS_DEFAULT);
+}
+
+/* The data-to-pixel kernels.  Each converts a contiguous run of samples
+ * with out = m * value + b (integer sentinels become NaN), or classifies
+ * a run of pixel points against the plot area.  There are scalar, SSE2
+ * and AVX2 versions; px_kernels_init() picks the best the CPU has.
+ * All of them round exactly like the scalar code (no FMA), so the choice
+ * never changes what gets drawn.
+ */
+typedef struct px_kernels_t {
+	void (*f64)(const double *in, int count, double m, double b, double *out);
+	void (*f32)(const float *in, int count, double m, double b, double *out);
+	void (*i16)(const gint16 *in, int count, double m, double b, double *out);
+	void (*i32)(const gint32 *in, int count, double m, double b, double *out);
+	void (*classify)(const double *x, const double *y, int count, const double *bounds, unsigned char *cls);
+} px_kernels_t;
+
+static void px_f64_scalar(const double *in, int count, double m, double b, double *out) {
+	int i;
+	for(i = 0; i < count; i++) {
+		out[i] = m * in[i] + b;
 	}
-	else {
-		cairo_set_antialias(cr, CAIRO_ANTIALIAS_NONE);
+}
+
+static void px_f32_scalar(const float *in, int count, double m, double b, double *out) {
+	int i;
+	for(i = 0; i < count; i++) {
+		out[i] = m * in[i] + b;
 	}
+}
 
-	// make sure the plot_context is valid (no latched errors)
-	// If invalid, create a new one...
-	cairo_status_t cr_stat = cairo_status(priv->plot_context);
-	if(cr_stat != CAIRO_STATUS_SUCCESS) {
-		//printf("Invalid cairo context: %s\n", cairo_status_to_string(cr_stat));
-		cairo_destroy(priv->plot_context);
-		priv->plot_context = cairo_create(priv->plot_buffer);
+static void px_i16_scalar(const gint16 *in, int count, double m, double b, double *out) {
+	int i;
+	for(i = 0; i < count; i++) {
+		out[i] = (in[i] == G_MININT16) ? NAN : m * in[i] + b;
 	}
+}
 
-	/* Draw the plot to the plot image buffer */
-	draw_plot(plot, priv->plot_context, plot->allocation.width, plot->allocation.height);
+static void px_i32_scalar(const gint32 *in, int count, double m, double b, double *out) {
+	int i;
+	for(i = 0; i < count; i++) {
+		out[i] = (in[i] == G_MININT32) ? NAN : m * in[i] + b;
+	}
+}
 
-	/* Then paint the plot image buffer on the widget itself */
-	cairo_save(cr);
-	cairo_set_source_surface(cr, priv->plot_buffer, 0, 0);
-	cairo_rectangle(cr, 0, 0, plot->allocation.width, plot->allocation.height);
-	cairo_clip(cr);
-	cairo_paint(cr);
-	cairo_restore(cr);
-	
-	/********************** draw the cursor (if needed) *************************/
-	if(p->cursor.type != CURSOR_NONE) {
-		cursor_t *c = &(p->cursor);
-		cairo_save(cr);
-		cairo_set_source_rgb (cr, c->color.red, c->color.green, c->color.blue);
-		cairo_set_line_width(cr, c->line_width);
-		if(c->line_type == LINETYPE_SOLID) {
-			cairo_set_dash(cr, dash_pattern, 0, 0);
-		}	
-		else if(c->line_type == LINETYPE_DASHED) {
-			cairo_set_dash(cr, dash_pattern, 2, 0);
-		}	
-		else if(c->line_type == LINETYPE_DOTTED) {
-			cairo_set_dash(cr, dot_pattern, 2, 0);
+static void px_classify_scalar(const double *x, const double *y, int count, const double *bounds, unsigned char *cls) {
+	int i;
+	for(i = 0; i < count; i++) {
+		if(isnan(x[i]) || isnan(y[i])) {
+			cls[i] = PX_NAN;
 		}
-		double x_px = x_m * c->x + x_b;	
-		double y_px = y_m * c->y + y_b;	
-		if(c->type == CURSOR_VERT || c->type == CURSOR_CROSS) {
-			if(x_px >= p->plot_area.left_edge && x_px <= p->plot_area.right_edge) {
-				cairo_move_to(cr, x_px, p->plot_area.top_edge);
-				cairo_line_to(cr, x_px, p->plot_area.bottom_edge);
-				cairo_stroke(cr);
-			}
+		else if(x[i] < bounds[0] || x[i] > bounds[1] || y[i] < bounds[2] || y[i] > bounds[3]) {
+			cls[i] = PX_OUT;
 		}
-		if(c->type == CURSOR_HORIZ || c->type == CURSOR_CROSS) {
-			if(y_px >= p->plot_area.top_edge && y_px <= p->plot_area.bottom_edge) {
-				cairo_move_to(cr, p->plot_area.left_edge, y_px);
-				cairo_line_to(cr, p->plot_area.right_edge, y_px);
-				cairo_stroke(cr);
-			}
+		else {
+			cls[i] = PX_IN;
 		}
-		cairo_restore(cr);
 	}
+}
 
+#if PX_HAVE_X86
 
-	/************* draw the zoom box if zooming is active *****************/
-	if(priv->zooming) {
-		double dashes[] = {8.0,4.0};
-		cairo_save(cr);
-		cairo_set_source_rgba (cr, 0.423, 0.646, 0.784, 0.3);
-		cairo_set_line_width (cr, 1.0);
-		double x_e = priv->drag_end_x;
-		double y_e = priv->drag_end_y;
-		double x_s = priv->drag_start_x;
-		double y_s = priv->drag_start_y;
-		if(priv->drag_end_x < priv->plot.plot_area.left_edge) {
-			x_e = priv->plot.plot_area.left_edge;
-		}
-		else if(priv->drag_end_x > priv->plot.plot_area.right_edge) {
-			x_e = priv->plot.plot_area.right_edge;
-		}
-		if(priv->drag_end_y < priv->plot.plot_area.top_edge) {
-			y_e = priv->plot.plot_area.top_edge;
-		}
-		else if(priv->drag_end_y > priv->plot.plot_area.bottom_edge) {
-			y_e = priv->plot.plot_area.bottom_edge;
-		}
-		if(priv->h_zoom) {
-			y_s = priv->plot.plot_area.top_edge;
-			y_e = priv->plot.plot_area.bottom_edge;
-		}
-		if(priv->v_zoom) {
-			x_s = priv->plot.plot_area.left_edge;
-			x_e = priv->plot.plot_area.right_edge;
-		}
-			
-		cairo_rectangle(cr, x_s, y_s,	x_e - x_s, y_e - y_s);
-		cairo_fill_preserve(cr);
-		cairo_set_source_rgb (cr, 0.423, 0.646, 0.784);
-		cairo_stroke(cr);	
-		cairo_restore(cr);
+static void px_f64_sse2(const double *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m128d vm = _mm_set1_pd(m), vb = _mm_set1_pd(b);
+	for(; i + 2 <= count; i += 2) {
+		_mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(_mm_loadu_pd(in + i), vm), vb));
 	}
+	px_f64_scalar(in + i, count - i, m, b, out + i);
+}
 
-	/********** find closest data point if showing coords or cross-hair *****/
-	double x_px = 0.0;
-	double y_px = 0.0;
-	int closest_point_index = 0;
-	int closest_trace_index = 0;
-	gboolean is_in_plot_area = FALSE;
-	priv->closest_x = 0.0;
-	priv->closest_y = 0.0;
-	if(priv->do_snap_to_data && (priv->do_show_cross_hair || priv->do_show_coords)) {
-		gint x,y;
-		gtk_widget_get_pointer(plot, &x, &y);
-		if(x >= priv->plot.plot_area.left_edge-1 && x <= priv->plot.plot_area.right_edge+1 &&
-		   y >= priv->plot.plot_area.top_edge-1 &&  y <= priv->plot.plot_area.bottom_edge+1) {
-			int i, j;
-			double min_dist = DBL_MAX;
-			is_in_plot_area = TRUE;
-			for(j=0; j < p->num_traces; j++) {
-				for(i=0; i<(p->traces[0])->length; i++) {
-					double dist;
-					dist = pow((p->traces[j])->x_data[i] * x_m + x_b - x,2) + pow((p->traces[j])->y_data[i] * y_m + y_b - y,2);
-					if(dist < min_dist) {
-						min_dist = dist;
-						closest_point_index = i;
-						closest_trace_index = j;
-					}
-				}
-			}
-			priv->closest_x = (p->traces[closest_trace_index])->x_data[closest_point_index];
-			priv->closest_y = (p->traces[closest_trace_index])->y_data[closest_point_index];
-			x_px = x_m * (p->traces[closest_trace_index])->x_data[closest_point_index] + x_b;
-			y_px = y_m * (p->traces[closest_trace_index])->y_data[closest_point_index] + y_b;
-			
-		}
-		else {
-			is_in_plot_area = FALSE;
-		}
+static void px_f32_sse2(const float *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m128d vm = _mm_set1_pd(m), vb = _mm_set1_pd(b);
+	for(; i + 2 <= count; i += 2) {
+		__m128 f = _mm_castsi128_ps(_mm_loadl_epi64((const __m128i *)(in + i)));
+		_mm_storeu_pd(out + i, _mm_add_pd(_mm_mul_pd(_mm_cvtps_pd(f), vm), vb));
 	}
+	px_f32_scalar(in + i, count - i, m, b, out + i);
+}
 
-	/************** draw crosshair if active ****************************/
-	if(priv->do_show_cross_hair) {
-		gint x,y;
-		int inhibit_ch = 0;
-		gtk_widget_get_pointer(plot, &x, &y);
-		if(x < priv->plot.plot_area.left_edge-1) {
-			x = priv->plot.plot_area.left_edge;
-			inhibit_ch = 1;
-		}
-		if(x > priv->plot.plot_area.right_edge+1) {
-			x = priv->plot.plot_area.right_edge;
-			inhibit_ch = 1;
-		}
-		if(y < priv->plot.plot_area.top_edge-1) {
-			y = priv->plot.plot_area.top_edge;
-			inhibit_ch = 1;
-		}
-		if(y > priv->plot.plot_area.bottom_edge+1) {
-			y = priv->plot.plot_area.bottom_edge;
-			inhibit_ch = 1;
-		}
-		if(priv->do_snap_to_data && is_in_plot_area) {
-			x = x_px;
-			y = y_px;
-		}
-		if(!inhibit_ch) {
-			cairo_save(cr);
-			//cairo_set_source_rgb (cr, 1.0, 1.0, 0.0); // yellow
-			cairo_set_source_rgb (cr, 0.0, 0.0, 1.0); // blue
-			cairo_set_line_width (cr, 1.0);
+/* replaces the lanes of v where s equals the sentinel with NaN */
+static inline __m128d px_sentinel_sse2(__m128d v, __m128d s, __m128d sentinel) {
+	__m128d hit = _mm_cmpeq_pd(s, sentinel);
+	return _mm_or_pd(_mm_and_pd(hit, _mm_set1_pd(NAN)), _mm_andnot_pd(hit, v));
+}
 
-			cairo_move_to(cr, priv->plot.plot_area.left_edge, y);
-			cairo_line_to(cr, x-10, y);
-			cairo_move_to(cr, x-5, y);
-			cairo_line_to(cr, x+5, y);
-			cairo_move_to(cr, x+10, y);
-			cairo_line_to(cr, priv->plot.plot_area.right_edge, y);
+static void px_i16_sse2(const gint16 *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m128d vm = _mm_set1_pd(m), vb = _mm_set1_pd(b), sentinel = _mm_set1_pd(G_MININT16);
+	for(; i + 2 <= count; i += 2) {
+		gint32 pair;
+		memcpy(&pair, in + i, sizeof(pair));
+		__m128i w = _mm_cvtsi32_si128(pair);
+		w = _mm_srai_epi32(_mm_unpacklo_epi16(w, w), 16);
+		__m128d s = _mm_cvtepi32_pd(w);
+		_mm_storeu_pd(out + i, px_sentinel_sse2(_mm_add_pd(_mm_mul_pd(s, vm), vb), s, sentinel));
+	}
+	px_i16_scalar(in + i, count - i, m, b, out + i);
+}
 
-			cairo_move_to(cr, x, priv->plot.plot_area.top_edge);
-			cairo_line_to(cr, x, y-10);
-			cairo_move_to(cr, x, y-5);
-			cairo_line_to(cr, x, y+5);
-			cairo_move_to(cr, x, y+10);
-			cairo_line_to(cr, x, priv->plot.plot_area.bottom_edge);
-			cairo_stroke(cr);	
-			cairo_restore(cr);
-			priv->cross_hair_is_visible = TRUE;
-		}
-		else {
-			priv->cross_hair_is_visible = FALSE;
-		}
+static void px_i32_sse2(const gint32 *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m128d vm = _mm_set1_pd(m), vb = _mm_set1_pd(b), sentinel = _mm_set1_pd(G_MININT32);
+	for(; i + 2 <= count; i += 2) {
+		__m128d s = _mm_cvtepi32_pd(_mm_loadl_epi64((const __m128i *)(in + i)));
+		_mm_storeu_pd(out + i, px_sentinel_sse2(_mm_add_pd(_mm_mul_pd(s, vm), vb), s, sentinel));
 	}
+	px_i32_scalar(in + i, count - i, m, b, out + i);
+}
 
-	/**************** draw coordinates if active (whether zooming or not) *************/
-	if(priv->do_show_coords) {
-		gint x,y;
-		gtk_widget_get_pointer(plot, &x, &y);
-		if(priv->do_snap_to_data && is_in_plot_area) {
-			x = x_px;
-			y = y_px;
-		}
-		if(x >= (priv->plot.plot_area.left_edge-1) &&
-		   x <= (priv->plot.plot_area.right_edge+1) &&
-		   y >= (priv->plot.plot_area.top_edge-1) &&
-		   y <= (priv->plot.plot_area.bottom_edge+1)
-		  ) {
-			char x_str[100], y_str[100];
-			double x_w, x_h, y_w, y_h;
-			double box_w, box_h;
+static void px_classify_sse2(const double *x, const double *y, int count, const double *bounds, unsigned char *cls) {
+	int i = 0, k;
+	__m128d x0 = _mm_set1_pd(bounds[0]), x1 = _mm_set1_pd(bounds[1]);
+	__m128d y0 = _mm_set1_pd(bounds[2]), y1 = _mm_set1_pd(bounds[3]);
+	for(; i + 2 <= count; i += 2) {
+		__m128d vx = _mm_loadu_pd(x + i), vy = _mm_loadu_pd(y + i);
+		int nan = _mm_movemask_pd(_mm_cmpunord_pd(vx, vy));
+		int out = _mm_movemask_pd(_mm_or_pd(
+			_mm_or_pd(_mm_cmplt_pd(vx, x0), _mm_cmpgt_pd(vx, x1)),
+			_mm_or_pd(_mm_cmplt_pd(vy, y0), _mm_cmpgt_pd(vy, y1))));
+		for(k = 0; k < 2; k++) {
+			cls[i + k] = (nan >> k & 1) ? PX_NAN : ((out >> k & 1) ? PX_OUT : PX_IN);
+		}
+	}
+	px_classify_scalar(x + i, y + i, count - i, bounds, cls + i);
+}
 
-			char x_fs[200]="x=";
-			char y_fs[200]="y=";
-			strcat(x_fs, p->x_axis.coord_label_format_string);
-			strcat(y_fs, p->y_axis.coord_label_format_string);
+__attribute__((target("avx2")))
+static void px_f64_avx2(const double *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m256d vm = _mm256_set1_pd(m), vb = _mm256_set1_pd(b);
+	for(; i + 4 <= count; i += 4) {
+		_mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(_mm256_loadu_pd(in + i), vm), vb));
+	}
+	px_f64_scalar(in + i, count - i, m, b, out + i);
+}
+
+__attribute__((target("avx2")))
+static void px_f32_avx2(const float *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m256d vm = _mm256_set1_pd(m), vb = _mm256_set1_pd(b);
+	for(; i + 4 <= count; i += 4) {
+		__m256d s = _mm256_cvtps_pd(_mm_loadu_ps(in + i));
+		_mm256_storeu_pd(out + i, _mm256_add_pd(_mm256_mul_pd(s, vm), vb));
+	}
+	px_f32_scalar(in + i, count - i, m, b, out + i);
+}
+
+__attribute__((target("avx2")))
+static void px_i16_avx2(const gint16 *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m256d vm = _mm256_set1_pd(m), vb = _mm256_set1_pd(b);
+	__m256d sentinel = _mm256_set1_pd(G_MININT16), nan = _mm256_set1_pd(NAN);
+	for(; i + 4 <= count; i += 4) {
+		__m256d s = _mm256_cvtepi32_pd(_mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)(in + i))));
+		__m256d v = _mm256_add_pd(_mm256_mul_pd(s, vm), vb);
+		_mm256_storeu_pd(out + i, _mm256_blendv_pd(v, nan, _mm256_cmp_pd(s, sentinel, _CMP_EQ_OQ)));
+	}
+	px_i16_scalar(in + i, count - i, m, b, out + i);
+}
+
+__attribute__((target("avx2")))
+static void px_i32_avx2(const gint32 *in, int count, double m, double b, double *out) {
+	int i = 0;
+	__m256d vm = _mm256_set1_pd(m), vb = _mm256_set1_pd(b);
+	__m256d sentinel = _mm256_set1_pd(G_MININT32), nan = _mm256_set1_pd(NAN);
+	for(; i + 4 <= count; i += 4) {
+		__m256d s = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(in + i)));
+		__m256d v = _mm256_add_pd(_mm256_mul_pd(s, vm), vb);
+		_mm256_storeu_pd(out + i, _mm256_blendv_pd(v, nan, _mm256_cmp_pd(s, sentinel, _CMP_EQ_OQ)));
+	}
+	px_i32_scalar(in + i, count - i, m, b, out + i);
+}
+
+__attribute__((target("avx2")))
+static void px_classify_avx2(const double *x, const double *y, int count, const double *bounds, unsigned char *cls) {
+	int i = 0, k;
+	__m256d x0 = _mm256_set1_pd(bounds[0]), x1 = _mm256_set1_pd(bounds[1]);
+	__m256d y0 = _mm256_set1_pd(bounds[2]), y1 = _mm256_set1_pd(bounds[3]);
+	for(; i + 4 <= count; i += 4) {
+		__m256d vx = _mm256_loadu_pd(x + i), vy = _mm256_loadu_pd(y + i);
+		int nan = _mm256_movemask_pd(_mm256_cmp_pd(vx, vy, _CMP_UNORD_Q));
+		int out = _mm256_movemask_pd(_mm256_or_pd(
+			_mm256_or_pd(_mm256_cmp_pd(vx, x0, _CMP_LT_OQ), _mm256_cmp_pd(vx, x1, _CMP_GT_OQ)),
+			_mm256_or_pd(_mm256_cmp_pd(vy, y0, _CMP_LT_OQ), _mm256_cmp_pd(vy, y1, _CMP_GT_OQ))));
+		for(k = 0; k < 4; k++) {
+			cls[i + k] = (nan >> k & 1) ? PX_NAN : ((out >> k & 1) ? PX_OUT : PX_IN);
+		}
+	}
+	px_classify_scalar(x + i, y + i, count - i, bounds, cls + i);
+}
+
+#endif
+
+static px_kernels_t px_kernels = {
+	px_f64_scalar, px_f32_scalar, px_i16_scalar, px_i32_scalar, px_classify_scalar
+};
+
+/* picks the kernels for this CPU; called once from class init */
+static void px_kernels_init(void) {
+#if PX_HAVE_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx2")) {
+		px_kernels.f64 = px_f64_avx2;
+		px_kernels.f32 = px_f32_avx2;
+		px_kernels.i16 = px_i16_avx2;
+		px_kernels.i32 = px_i32_avx2;
+		px_kernels.classify = px_classify_avx2;
+	}
+	else {
+		px_kernels.f64 = px_f64_sse2;
+		px_kernels.f32 = px_f32_sse2;
+		px_kernels.i16 = px_i16_sse2;
+		px_kernels.i32 = px_i32_sse2;
+		px_kernels.classify = px_classify_sse2;
+	}
+#endif
+	return;
+}
+
+/* Converts count samples, starting at slot n and stepping by step slots,
+ * to pixels: out = m * value + b.  The stored-value scaling is folded
+ * into m and b, so compact samples cost no more than doubles.  Packed
+ * columns read with step 1 go through the vector kernels, one run per
+ * side of the ring-buffer wrap. */
+static void col_to_px(sample_col_t *c, int n, int count, int step, int capacity, double m, double b, double *out) {
+	double mg = m * c->gain;
+	double bo = m * c->offset + b;
+	int i;
+	if(step == 1 && c->stride == sample_size(c->type)) {
+		while(count > 0) {
+			int run = capacity - n;
+			if(run > count) {
+				run = count;
+			}
+			switch(c->type) {
+				case SAMPLE_FLOAT:
+					px_kernels.f32((float *)c->data + n, run, mg, bo, out);
+					break;
+				case SAMPLE_INT16:
+					px_kernels.i16((gint16 *)c->data + n, run, mg, bo, out);
+					break;
+				case SAMPLE_INT32:
+					px_kernels.i32((gint32 *)c->data + n, run, mg, bo, out);
+					break;
+				default:
+					px_kernels.f64((double *)c->data + n, run, m, b, out);
+			}
+			out += run;
+			count -= run;
+			n = 0;
+		}
+		return;
+	}
+	switch(c->type) {
+		case SAMPLE_FLOAT:
+			for(i = 0; i < count; i++) {
+				out[i] = mg * COL_AT(c, float, n) + bo;
+				n += step;
+				while(n >= capacity) n -= capacity;
+			}
+			break;
+		case SAMPLE_INT16:
+			for(i = 0; i < count; i++) {
+				gint16 s = COL_AT(c, gint16, n);
+				out[i] = (s == G_MININT16) ? NAN : mg * s + bo;
+				n += step;
+				while(n >= capacity) n -= capacity;
+			}
+			break;
+		case SAMPLE_INT32:
+			for(i = 0; i < count; i++) {
+				gint32 s = COL_AT(c, gint32, n);
+				out[i] = (s == G_MININT32) ? NAN : mg * s + bo;
+				n += step;
+				while(n >= capacity) n -= capacity;
+			}
+			break;
+		default:
+			for(i = 0; i < count; i++) {
+				out[i] = m * COL_AT(c, double, n) + b;
+				n += step;
+				while(n >= capacity) n -= capacity;
+			}
+	}
+}
+
+/* Fills rs->x_px and rs->y_px with the pixel coordinates of logical
+ * samples j, j + step, ... up to j1, at most RENDER_CHUNK of them, and
+ * rs->cls with their class against rs->bounds.  Returns how many were
+ * converted. */
+static int trace_to_px(trace_t *t, int j, int j1, int step, double x_m, double x_b, double y_m, double y_b, render_scratch_t *rs) {
+	int count = (j1 - j) / step + 1;
+	int i;
+	if(count > RENDER_CHUNK) {
+		count = RENDER_CHUNK;
+	}
+	if(count <= 0) {
+		return 0;
+	}
+	if(t->x_uniform) {
+		for(i = 0; i < count; i++) {
+			rs->x_px[i] = x_m * (t->x0 + (double)(t->first_seq + j + i * step) * t->dx) + x_b;
+		}
+	}
+	else {
+		col_to_px(&(t->x_col), trace_slot(t, j), count, step, t->capacity, x_m, x_b, rs->x_px);
+	}
+	col_to_px(&(t->y_col), trace_slot(t, j), count, step, t->capacity, y_m, y_b, rs->y_px);
+	px_kernels.classify(rs->x_px, rs->y_px, count, rs->bounds, rs->cls);
+	return count;
+}
 
-			if(priv->do_snap_to_data) {
-				sprintf(x_str, x_fs, (p->traces[closest_trace_index])->x_data[closest_point_index]);
-				sprintf(y_str, y_fs, (p->traces[closest_trace_index])->y_data[closest_point_index]);
-			}
-			else {
-				sprintf(x_str, x_fs, ((double)x-x_b)/x_m);
-				sprintf(y_str, y_fs, ((double)y-y_b)/y_m);
-			}
-			x_w = get_text_width(cr, x_str, 10);
-			y_w = get_text_width(cr, y_str, 10);
-			x_h = get_text_height(cr, x_str, 10);
-			y_h = get_text_height(cr, y_str, 10);
-			box_w = 10 + ((x_w > y_w) ? x_w : y_w);
-			box_h = 10 + (x_h + y_h);
+/* Makes px_dedup() drop markers landing in a cell an earlier marker of
+ * the trace already took.  The caller picks q and off so that what a
+ * marker draws depends on its cell alone, and only does so when markers
+ * are opaque, so the frame comes out the same.  Returns -1 and leaves
+ * deduplication off if there are too few samples for the bitmap to pay
+ * for clearing it. */
+static int px_dedup_markers(render_scratch_t *rs, double q, double off, int samples) {
+	double cx0 = q * rs->bounds[0] + off;
+	double cx1 = q * rs->bounds[1] + off;
+	double cy0 = q * rs->bounds[2] + off;
+	double cy1 = q * rs->bounds[3] + off;
+	rs->dedup = DEDUP_NONE;
+	if(!(cx0 == cx0 && cx1 == cx1 && cy0 == cy0 && cy1 == cy1)) {
+		return -1;
+	}
+	rs->dedup_col0 = (int)floor(fmin(cx0, cx1));
+	rs->dedup_row0 = (int)floor(fmin(cy0, cy1));
+	double cols = floor(fmax(cx0, cx1)) - rs->dedup_col0 + 1;
+	double rows = floor(fmax(cy0, cy1)) - rs->dedup_row0 + 1;
+	if(cols * rows > DEDUP_MAX_CELLS || samples < cols * rows / 64) {
+		return -1;
+	}
+	int size = ((int)(cols * rows) + 31) / 32;
+	if(size > rs->occupied_size) {
+		guint32 *occupied = realloc(rs->occupied, size * sizeof(guint32));
+		if(occupied == NULL) {
+			printf("Error allocating marker occupancy bitmap\n");
+			return -1;
+		}
+		rs->occupied = occupied;
+		rs->occupied_size = size;
+	}
+	memset(rs->occupied, 0, size * sizeof(guint32));
+	rs->dedup_cols = (int)cols;
+	rs->dedup_rows = (int)rows;
+	rs->dedup_q = q;
+	rs->dedup_off = off;
+	rs->dedup = DEDUP_MARKERS;
+	return 0;
+}
 
-			gint mid_x = (priv->plot.plot_area.left_edge + priv->plot.plot_area.right_edge)/2.;
-			gint mid_y = (priv->plot.plot_area.top_edge + priv->plot.plot_area.bottom_edge)/2.;
+/* Makes px_dedup() drop the line vertices inside a run of three or more
+ * landing in the same pixel, keeping the first and last.  The segments
+ * between them only touch that pixel, which the segment ending at the
+ * first draws anyway, so for lines drawn from whole-pixel end points
+ * (the raster pen, or Xlib with round caps) the result is the same as
+ * long as the pixel is inside the box lines are clipped to. */
+static void px_dedup_runs(render_scratch_t *rs, double left, double top, double right, double bottom) {
+	rs->dedup_box[0] = left;
+	rs->dedup_box[1] = right;
+	rs->dedup_box[2] = top;
+	rs->dedup_box[3] = bottom;
+	rs->dedup = DEDUP_RUNS;
+	return;
+}
 
-			cairo_save(cr);
+static void px_dedup_off(render_scratch_t *rs) {
+	rs->dedup = DEDUP_NONE;
+	return;
+}
 
-			// draw white rectangle
-			cairo_set_source_rgb (cr, 1, 1, 1);
-			if(x < mid_x) { // left half
-				if(y > mid_y) { // bottom left quadrant
-					cairo_rectangle(cr, x+3, y-box_h-3, box_w, box_h);
-				}
-				else { // top left quadrant
-					cairo_rectangle(cr, x+3, y+3, box_w, box_h);
-				}
+/* The deduplication stage of the trace renderer: marks as PX_DUP the
+ * samples of the n just converted by trace_to_px() that needn't be
+ * drawn, as set up by px_dedup_markers() or px_dedup_runs(). */
+static void px_dedup(render_scratch_t *rs, int n) {
+	int k;
+	if(rs->dedup == DEDUP_MARKERS) {
+		double q = rs->dedup_q;
+		double off = rs->dedup_off;
+		for(k = 0; k < n; k++) {
+			if(rs->cls[k] != PX_IN) {
+				continue;
 			}
-			else { // right half
-				if(y > mid_y) { // bottom right quadrant
-					cairo_rectangle(cr, x-box_w-3, y-box_h-3, box_w, box_h);
-				}
-				else { // top right quadrant
-					cairo_rectangle(cr, x-box_w-3, y+3, box_w, box_h);
-				}
+			int col = (int)floor(q * rs->x_px[k] + off) - rs->dedup_col0;
+			int row = (int)floor(q * rs->y_px[k] + off) - rs->dedup_row0;
+			if(col < 0 || col >= rs->dedup_cols || row < 0 || row >= rs->dedup_rows) {
+				continue;
 			}
-			cairo_fill_preserve(cr);
-			cairo_set_source_rgb (cr, 0, 0, 0);
-			cairo_set_line_width (cr, 1.0);
-			cairo_stroke(cr);
-
-			// draw coordinates...
-			cairo_set_source_rgb (cr, 0, 0, 0);
-			if(x < mid_x) { // left half
-				if(y > mid_y) { // bottom left quadrant
-					draw_horiz_text_at_point(cr, x_str, x+5+3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
-					draw_horiz_text_at_point(cr, y_str, x+5+3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
-				}
-				else { // top left quadrant
-					draw_horiz_text_at_point(cr, x_str, x+5+3, y+6, ANCHOR_TOP_LEFT);
-					draw_horiz_text_at_point(cr, y_str, x+5+3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
-				}
+			int bit = row * rs->dedup_cols + col;
+			guint32 mask = 1u << (bit & 31);
+			if(rs->occupied[bit >> 5] & mask) {
+				rs->cls[k] = PX_DUP;
 			}
-			else { // right half
-				if(y > mid_y) { // bottom right quadrant
-					draw_horiz_text_at_point(cr, x_str, x-box_w+5-3, y-5-y_h-3-2, ANCHOR_BOTTOM_LEFT);
-					draw_horiz_text_at_point(cr, y_str, x-box_w+5-3, y-5-3+2, ANCHOR_BOTTOM_LEFT);
-				}
-				else { // top right quadrant
-					draw_horiz_text_at_point(cr, x_str, x-box_w+5-3, y+6, ANCHOR_TOP_LEFT);
-					draw_horiz_text_at_point(cr, y_str, x-box_w+5-3, y+5+y_h+3+2, ANCHOR_TOP_LEFT);
-				}
+			else {
+				rs->occupied[bit >> 5] |= mask;
+			}
+		}
+	}
+	else if(rs->dedup == DEDUP_RUNS) {
+		double *box = rs->dedup_box;
+		for(k = 1; k < n - 1; k++) {
+			if(rs->cls[k] != PX_IN || rs->cls[k + 1] != PX_IN || 
+			   (rs->cls[k - 1] != PX_IN && rs->cls[k - 1] != PX_DUP)) {
+				continue;
+			}
+			double x = floor(rs->x_px[k]);
+			double y = floor(rs->y_px[k]);
+			if(x < box[0] || x + 1 > box[1] || y < box[2] || y + 1 > box[3]) {
+				continue;
+			}
+			if(floor(rs->x_px[k - 1]) == x && floor(rs->y_px[k - 1]) == y &&
+			   floor(rs->x_px[k + 1]) == x && floor(rs->y_px[k + 1]) == y) {
+				rs->cls[k] = PX_DUP;
 			}
-
-			cairo_restore(cr);
 		}
-			
 	}
+	return;
+}
 
-	cairo_destroy(cr);
-#endif
+/* x value of the sample in ring-buffer slot n */
+static double trace_x(trace_t *t, int n) {
+	int j;
+	if(!t->x_uniform) {
+		return col_get(&(t->x_col), n);
+	}
+	j = n - t->start_index;
+	if(j < 0) {
+		j += t->capacity;
+	}
+	return t->x0 + (double)(t->first_seq + j) * t->dx;
+}
 
-	gdk_window_set_cursor(plot->window, NULL);
-	gdk_cursor_unref(cursor);
-	return FALSE;
+/* logical index of the first uniform sample at (or, if past is set,
+ * strictly beyond) x, clamped to [0, length] */
+static int uniform_index_at(trace_t *t, double x, int past) {
+	double q = (x - t->x0) / t->dx;
+	double k = (past ? floor(q) + 1 : ceil(q)) - (double)t->first_seq;
+	if(!(k > 0)) {
+		return 0;
+	}
+	if(k > t->length) {
+		return t->length;
+	}
+	return (int)k;
 }
 
+static double trace_y(trace_t *t, int n) {
+	return col_get(&(t->y_col), n);
+}
 
+static int trace_slot_is_filled(trace_t *t, int n) {
+	int j = n - t->start_index;
+	if(j < 0) {
+		j += t->capacity;
+	}
+	return j < t->length;
+}
 
-/******************* Plot Drawing Functions **************************/
-static int set_linear_tic_values(axis_t *a, double min, double max) {
-	double raw_range = max - min;
-	double raw_tic_delta = raw_range / (a->num_request_major_tics - 1);
-	double mantissa;
-	int exponent;
-	get_double_parts(raw_tic_delta, &mantissa, &exponent);
-	double actual_tic_delta;
+static void lod_bucket_clear(lod_bucket_t *b) {
+	b->x_min = DBL_MAX;
+	b->x_max = -DBL_MAX;
+	b->y_min = DBL_MAX;
+	b->y_max = -DBL_MAX;
+	b->y_first = NAN;
+	b->y_last = NAN;
+}
 
-	if(mantissa <= 1.0) {
-		actual_tic_delta = 1.0 * pow(10., exponent);
-	}
-	else if(mantissa <= 2.0) {
-		actual_tic_delta = 2.0 * pow(10., exponent);
+static int lod_bucket_is_empty(lod_bucket_t *b) {
+	return b->y_min > b->y_max;
+}
+
+static void lod_bucket_merge(lod_bucket_t *b, lod_bucket_t *c) {
+	if(lod_bucket_is_empty(c)) {
+		return;
 	}
-	else if(mantissa <= 2.5) {
-		actual_tic_delta = 2.5 * pow(10., exponent);
+	if(lod_bucket_is_empty(b)) {
+		*b = *c;
+		return;
 	}
-	else if(mantissa <= 5.0) {
-		actual_tic_delta = 5.0 * pow(10., exponent);
+	if(c->x_min < b->x_min) b->x_min = c->x_min;
+	if(c->x_max > b->x_max) b->x_max = c->x_max;
+	if(c->y_min < b->y_min) b->y_min = c->y_min;
+	if(c->y_max > b->y_max) b->y_max = c->y_max;
+	b->y_last = c->y_last;
+}
+
+static void lod_bucket_add_sample(lod_bucket_t *b, double x, double y) {
+	if(isnan(x) || isnan(y)) {
+		return;
+	}
+	if(lod_bucket_is_empty(b)) {
+		b->x_min = b->x_max = x;
+		b->y_min = b->y_max = y;
+		b->y_first = b->y_last = y;
+		return;
+	}
+	if(x < b->x_min) b->x_min = x;
+	if(x > b->x_max) b->x_max = x;
+	if(y < b->y_min) b->y_min = y;
+	if(y > b->y_max) b->y_max = y;
+	b->y_last = y;
+}
+
+static void lod_init(lod_t *lod) {
+	int l;
+	lod->num_levels = 0;
+	for(l = 0; l < LOD_MAX_LEVELS; l++) {
+		lod->buckets[l] = NULL;
+		lod->bucket_size[l] = 0;
+		lod->num_buckets[l] = 0;
 	}
-	else {
-		actual_tic_delta = 1.0 * pow(10., exponent+1);
+	lod->dirty_start = 0;
+	lod->dirty_count = 0;
+}
+
+static void lod_free(lod_t *lod) {
+	int l;
+	for(l = 0; l < lod->num_levels; l++) {
+		free(lod->buckets[l]);
 	}
+	lod_init(lod);
+}
 
-	double min_tic_val;
-	if(a->do_autoscale && a->do_loose_fit) {
-		min_tic_val = round_down_to_nearest(min, actual_tic_delta);
-		a->min_val = min_tic_val;
+/* marks every bucket empty, e.g. after the trace has been cleared */
+static void lod_reset(lod_t *lod) {
+	int l, k;
+	for(l = 0; l < lod->num_levels; l++) {
+		for(k = 0; k < lod->num_buckets[l]; k++) {
+			lod_bucket_clear(&(lod->buckets[l][k]));
+		}
 	}
-	else {
-		min_tic_val = round_up_to_nearest(min, actual_tic_delta);
-		a->min_val = min;
-		a->max_val = max;
+	lod->dirty_start = 0;
+	lod->dirty_count = 0;
+}
+
+/* (re)allocates the pyramid to match the trace capacity.  Only traces
+ * that own their data get one: every write to those goes through
+ * jbplot_trace_add_point(), so the pyramid can be kept in sync. */
+static int lod_alloc(trace_t *t) {
+	lod_t *lod = &(t->lod);
+	int size = LOD_BASE;
+	int l;
+
+	lod_free(lod);
+	if(!t->is_data_owner || t->capacity < LOD_MIN_CAPACITY) {
+		return 0;
 	}
-		
-	double tic_val;
-	int i = 0;
-	for(tic_val = min_tic_val; tic_val < max && i < MAX_NUM_MAJOR_TICS; tic_val += actual_tic_delta) {
-		/* perform check to see if it should be equal to zero */
-		if(fabs(tic_val / actual_tic_delta) < 0.5) {
-			tic_val = 0.0;
+	for(l = 0; l < LOD_MAX_LEVELS; l++) {
+		int n = (t->capacity + size - 1) / size;
+		lod->buckets[l] = malloc(n * sizeof(lod_bucket_t));
+		if(lod->buckets[l] == NULL) {
+			lod_free(lod);
+			return -1;
 		}
-		if(!a->do_manual_tics) {
-			a->major_tic_values[i] = tic_val;
+		lod->bucket_size[l] = size;
+		lod->num_buckets[l] = n;
+		lod->num_levels = l + 1;
+		if(n <= LOD_FANOUT) {
+			break;
 		}
-		i++;
+		size *= LOD_FANOUT;
 	}
-	if(i >= MAX_NUM_MAJOR_TICS) {
-		printf("Too many major tics!!!\n");
-		return -1;
+	lod_reset(lod);
+	if(t->length > 0) {
+		lod->dirty_count = t->capacity;
 	}
-	
-	if(a->do_autoscale && a->do_loose_fit) {
-		a->max_val = tic_val;	
-		if(!a->do_manual_tics) {
-			a->major_tic_values[i] = tic_val;
-			a->num_actual_major_tics = i+1;
+	return 0;
+}
+
+/* records that count ring-buffer slots starting at slot n have been written */
+static void lod_mark_dirty_range(trace_t *t, int n, int count) {
+	lod_t *lod = &(t->lod);
+	int j;
+	if(lod->num_levels == 0 || count < 1) {
+		return;
+	}
+	if(lod->dirty_count == 0 && count < t->capacity) {
+		lod->dirty_start = n;
+		lod->dirty_count = count;
+		return;
+	}
+	j = n - lod->dirty_start;
+	if(j < 0) {
+		j += t->capacity;
+	}
+	if(j <= lod->dirty_count && count < t->capacity) {
+		if(j + count > lod->dirty_count) {
+			lod->dirty_count = j + count;
+		}
+		if(lod->dirty_count > t->capacity) {
+			lod->dirty_count = t->capacity;
 		}
+		return;
 	}
-	else {
-		a->max_val = max;		
-		if(!a->do_manual_tics) {
-			a->num_actual_major_tics = i;		
+	/* out-of-order write; just recompute everything */
+	lod->dirty_start = 0;
+	lod->dirty_count = t->capacity;
+}
+
+/* records that ring-buffer slot n has been written */
+static void lod_mark_dirty(trace_t *t, int n) {
+	lod_mark_dirty_range(t, n, 1);
+}
+
+/* recomputes all buckets covering physical slots [a, b) */
+static void lod_update_slots(trace_t *t, int a, int b) {
+	lod_t *lod = &(t->lod);
+	int l, k, n;
+	int k0 = a / lod->bucket_size[0];
+	int k1 = (b - 1) / lod->bucket_size[0];
+
+	for(k = k0; k <= k1; k++) {
+		lod_bucket_t *bk = &(lod->buckets[0][k]);
+		int n_end = (k + 1) * LOD_BASE;
+		if(n_end > t->capacity) {
+			n_end = t->capacity;
+		}
+		lod_bucket_clear(bk);
+		for(n = k * LOD_BASE; n < n_end; n++) {
+			if(trace_slot_is_filled(t, n)) {
+				lod_bucket_add_sample(bk, trace_x(t, n), trace_y(t, n));
+			}
 		}
 	}
-	a->major_tic_delta = actual_tic_delta;
+	for(l = 1; l < lod->num_levels; l++) {
+		int c_end;
+		k0 /= LOD_FANOUT;
+		k1 /= LOD_FANOUT;
+		for(k = k0; k <= k1; k++) {
+			lod_bucket_t *bk = &(lod->buckets[l][k]);
+			lod_bucket_clear(bk);
+			c_end = (k + 1) * LOD_FANOUT;
+			if(c_end > lod->num_buckets[l-1]) {
+				c_end = lod->num_buckets[l-1];
+			}
+			for(n = k * LOD_FANOUT; n < c_end; n++) {
+				lod_bucket_merge(bk, &(lod->buckets[l-1][n]));
+			}
+		}
+	}
+}
 
+/* folds all writes since the last call into the pyramid */
+static void lod_sync(trace_t *t) {
+	lod_t *lod = &(t->lod);
+	int a, b;
+	if(lod->num_levels == 0 || lod->dirty_count == 0) {
+		return;
+	}
+	a = lod->dirty_start;
+	b = a + lod->dirty_count;
+	if(b > t->capacity) {
+		lod_update_slots(t, a, t->capacity);
+		lod_update_slots(t, 0, b - t->capacity);
+	}
+	else {
+		lod_update_slots(t, a, b);
+	}
+	lod->dirty_count = 0;
+}
 
-	return 0;
+/* Picks the coarsest pyramid level whose buckets hold no more samples
+ * than fall in one pixel column, or -1 if the raw samples are cheaper. */
+static int lod_pick_level(trace_t *t, int count, double width_px) {
+	lod_t *lod = &(t->lod);
+	int l;
+	int level = -1;
+	double samples_per_px;
+	if(lod->num_levels == 0 || width_px < 1 || !t->x_monotonic) {
+		return -1;
+	}
+	samples_per_px = count / width_px;
+	for(l = 0; l < lod->num_levels; l++) {
+		if(lod->bucket_size[l] <= samples_per_px) {
+			level = l;
+		}
+	}
+	return level;
 }
 
-static int set_log_tic_values(axis_t *a, double min, double max) {
-	// all values must be positive!!!
-	if(min < 0) {
+/* The pyramid level pass tp draws the trace from, or -1 for the raw
+ * samples.  Drafts go DRAFT_LOD_COARSEN times coarser than a pixel. */
+static int pass_pick_level(trace_t *t, trace_pass_t *tp, int span, double width_px) {
+	if(t->decimate_divisor != 1 || tp->raw) {
 		return -1;
 	}
-	return set_linear_tic_values(a, log10(min), log10(max));
+	return lod_pick_level(t, span, tp->draft ? width_px / DRAFT_LOD_COARSEN : width_px);
 }
 
-static int set_major_tic_values(axis_t *a, double min, double max) {
-	if(a->log_scale) {
-		// try doing log scale. If it succeeds, great.  Otherwise, do linear scale
-		a->log_scale_ok = 0;
-		if(!set_log_tic_values(a, min, max)) {
-			a->log_scale_ok = 1;
-			return 0;
+/* How far apart the raw samples pass tp draws are: the trace's decimate
+ * divisor, or for a draft whatever multiple of it keeps the span within
+ * the draft's share of samples */
+static int pass_stride(trace_t *t, trace_pass_t *tp, int span) {
+	int dd = t->decimate_divisor;
+	if(tp->draft && tp->draft_samples > 0 && span / dd > tp->draft_samples) {
+		dd *= (int)ceil((double)span / dd / tp->draft_samples);
+	}
+	return dd;
+}
+
+/* Finds the range of logical indices [j0, j1] that has to be drawn to
+ * cover x in [x_min, x_max], including one sample on either side so the
+ * lines leaving the plot area are drawn too.  Only x-monotonic traces
+ * can be narrowed; for the others the whole trace is returned.
+ * Returns the number of samples in the span. */
+static int trace_get_visible_span(trace_t *t, double x_min, double x_max, int *j0, int *j1) {
+	int lo, hi, mid;
+	if(t->length <= 0) {
+		*j0 = 0;
+		*j1 = -1;
+		return 0;
+	}
+	if(!t->x_monotonic) {
+		*j0 = 0;
+		*j1 = t->length - 1;
+		return t->length;
+	}
+	if(t->x_uniform) {
+		lo = uniform_index_at(t, x_min, 0);
+		hi = uniform_index_at(t, x_max, 1);
+		*j0 = (lo > 0) ? lo - 1 : 0;
+		*j1 = (hi < t->length) ? hi : t->length - 1;
+		if(*j1 < *j0) {
+			*j1 = *j0;
+		}
+		return *j1 - *j0 + 1;
+	}
+	/* first sample with x >= x_min */
+	lo = 0;
+	hi = t->length;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(trace_x(t, trace_slot(t, mid)) < x_min) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
 		}
 	}
-	return set_linear_tic_values(a, min, max);
+	*j0 = (lo > 0) ? lo - 1 : 0;
+	/* first sample with x > x_max */
+	hi = t->length;
+	while(lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if(trace_x(t, trace_slot(t, mid)) <= x_max) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	*j1 = (lo < t->length) ? lo : t->length - 1;
+	return *j1 - *j0 + 1;
 }
 
-static int set_major_tic_labels(axis_t *a) {
-	int i, ret;
-	int err = 0;
-	if(a->do_auto_tic_format) { // do automagic formatting...
-		double dd = log10( fabs(a->major_tic_delta) );
-		double d1 = log10(fabs(a->major_tic_values[0]));
-		double d2 = log10(fabs(a->major_tic_values[a->num_actual_major_tics-1]));
-		double d = (d2>d1) ? d2 : d1;
-		int sigs = ceil(d) - floor(dd) + 1.5;
-		if(sigs < 4) 
-			sigs = 4;
-		sprintf(a->tic_label_format_string, "%%.%dg", sigs);
-		sprintf(a->coord_label_format_string, "%%.%dg", sigs+2);
-		for(i=0; i<a->num_actual_major_tics; i++) { 
-			if(a->log_scale && a->log_scale_ok) {
-				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, "%g", pow(10,a->major_tic_values[i]));
-			}
-			else {
-				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, a->tic_label_format_string, a->major_tic_values[i]);
-			}
+typedef struct env_ctx_t {
+	trace_t *t;
+	double x_m, x_b, y_m, y_b;
+	render_scratch_t *rs;
+} env_ctx_t;
+
+static env_pt_t *env_push(render_scratch_t *rs) {
+	if(rs->env_length >= rs->env_size) {
+		int new_size = (rs->env_size > 0) ? 2 * rs->env_size : 4096;
+		env_pt_t *e = realloc(rs->env, new_size * sizeof(env_pt_t));
+		if(e == NULL) {
+			return NULL;
 		}
+		rs->env = e;
+		rs->env_size = new_size;
 	}
-	else { // otherwise, use standard fprintf type of format string
-		for(i=0; i<a->num_actual_major_tics; i++) { 
-			if(a->log_scale && a->log_scale_ok) {
-				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, "%g", pow(10,a->major_tic_values[i]));
+	return &(rs->env[rs->env_length++]);
+}
+
+static int env_push_bucket(env_ctx_t *c, lod_bucket_t *b) {
+	env_pt_t *e = env_push(c->rs);
+	if(e == NULL) {
+		return -1;
+	}
+	if(lod_bucket_is_empty(b)) {
+		e->gap = 1;
+		return 0;
+	}
+	e->gap = 0;
+	e->x_first = c->x_m * b->x_min + c->x_b;
+	e->x_last = c->x_m * b->x_max + c->x_b;
+	e->y_first = c->y_m * b->y_first + c->y_b;
+	e->y_last = c->y_m * b->y_last + c->y_b;
+	e->y_lo = c->y_m * b->y_min + c->y_b;
+	e->y_hi = c->y_m * b->y_max + c->y_b;
+	return 0;
+}
+
+/* emits the envelope of physical slots [a, b) using buckets of the given
+ * level where they fit, and finer ones (down to raw samples) at the edges */
+static int env_walk(env_ctx_t *c, int level, int a, int b) {
+	trace_t *t = c->t;
+	int s, first, last, k, n;
+	if(a >= b) {
+		return 0;
+	}
+	if(level < 0) {
+		for(n = a; n < b; n++) {
+			env_pt_t *e = env_push(c->rs);
+			if(e == NULL) {
+				return -1;
 			}
-			else {
-				ret = snprintf(a->major_tic_labels[i], MAJOR_TIC_LABEL_SIZE, a->tic_label_format_string, a->major_tic_values[i]);
+			if(isnan(trace_y(t, n))) {
+				e->gap = 1;
+				continue;
 			}
+			e->gap = 0;
+			e->x_first = e->x_last = c->x_m * trace_x(t, n) + c->x_b;
+			e->y_first = e->y_last = e->y_lo = e->y_hi = c->y_m * trace_y(t, n) + c->y_b;
 		}
+		return 0;
 	}
-	return err;
+	s = t->lod.bucket_size[level];
+	first = (a + s - 1) / s;
+	last = b / s;
+	if(first >= last) {
+		return env_walk(c, level - 1, a, b);
+	}
+	if(env_walk(c, level - 1, a, first * s)) {
+		return -1;
+	}
+	for(k = first; k < last; k++) {
+		if(env_push_bucket(c, &(t->lod.buckets[level][k]))) {
+			return -1;
+		}
+	}
+	return env_walk(c, level - 1, last * s, b);
 }
 
-#if DRAW_WITH_XLIB
-static int get_text_dims_x(Display *display, GC gc, char *text, int *width_out, int *height_out) {
-
-	int direction;
-	int font_ascent;
-	int font_descent;
-	XCharStruct overall;
-
-	XFontStruct *fp = XQueryFont(display, XGContextFromGC(gc));
-	XTextExtents(fp, text, strlen(text), &direction, &font_ascent, &font_descent, &overall);
+/* Builds the pixel-space envelope of logical samples [j0, j1] into the
+ * scratch buffer.  Returns the number of envelope points, or -1. */
+static int lod_build_envelope(trace_t *t, int j0, int j1, int level, double x_m, double x_b, double y_m, double y_b, render_scratch_t *rs) {
+	env_ctx_t c;
+	int a, b;
+	c.t = t;
+	c.x_m = x_m;
+	c.x_b = x_b;
+	c.y_m = y_m;
+	c.y_b = y_b;
+	c.rs = rs;
+	rs->env_length = 0;
+	if(j1 < j0) {
+		return 0;
+	}
+	lod_sync(t);
+	/* a logical range maps onto at most two contiguous runs of slots */
+	a = trace_slot(t, j0);
+	b = trace_slot(t, j1) + 1;
+	if(b <= a) {
+		if(env_walk(&c, level, a, t->capacity) || env_walk(&c, level, 0, b)) {
+			return -1;
+		}
+	}
+	else if(env_walk(&c, level, a, b)) {
+		return -1;
+	}
+	return rs->env_length;
+}
 
-	XFreeFontInfo(NULL, fp, 1);
+static double extrema_value(trace_t *t, int which, int n) {
+	if(which == EXT_X_MIN || which == EXT_X_MAX) {
+		return trace_x(t, n);
+	}
+	return trace_y(t, n);
+}
 
-	*height_out = overall.ascent + overall.descent;
-	*width_out = overall.width;
+static int mono_deque_grow(mono_deque_t *q) {
+	int new_size = (q->size > 0) ? 2 * q->size : 64;
+	int *s = malloc(new_size * sizeof(int));
+	int k;
+	if(s == NULL) {
+		return -1;
+	}
+	for(k = 0; k < q->count; k++) {
+		s[k] = q->slots[(q->head + k) % q->size];
+	}
+	free(q->slots);
+	q->slots = s;
+	q->size = new_size;
+	q->head = 0;
 	return 0;
 }
-#endif
-
-#if DRAW_WITH_XLIB
-static double get_text_height_x(Display *display, GC gc, char *text) {
-
-	int direction;
-	int font_ascent;
-	int font_descent;
-	XCharStruct overall;
-
-	XFontStruct *fp = XQueryFont(display, XGContextFromGC(gc));
-	XTextExtents(fp, text, strlen(text), &direction, &font_ascent, &font_descent, &overall);
-
-	XFreeFontInfo(NULL, fp, 1);
 
-	return (overall.ascent + overall.descent);
+/* appends slot n, dropping every slot it dominates from the back */
+static int mono_deque_push(trace_t *t, int which, int n) {
+	mono_deque_t *q = &(t->ext.dq[which]);
+	int is_max = (which == EXT_X_MAX || which == EXT_Y_MAX);
+	double v = extrema_value(t, which, n);
+	if(isnan(v)) {
+		return 0;
+	}
+	while(q->count > 0) {
+		double bv = extrema_value(t, which, q->slots[(q->head + q->count - 1) % q->size]);
+		if(is_max ? (bv <= v) : (bv >= v)) {
+			q->count--;
+		}
+		else {
+			break;
+		}
+	}
+	if(q->count >= q->size && mono_deque_grow(q)) {
+		return -1;
+	}
+	q->slots[(q->head + q->count) % q->size] = n;
+	q->count++;
+	return 0;
 }
-#endif
-	
-#if DRAW_WITH_XLIB
-static double get_text_width_x(Display *display, GC gc, char *text) {
-
-	int direction;
-	int font_ascent;
-	int font_descent;
-	XCharStruct overall;
-
-	XFontStruct *fp = XQueryFont(display, XGContextFromGC(gc));
-	XTextExtents(fp, text, strlen(text), &direction, &font_ascent, &font_descent, &overall);
 
-	XFreeFontInfo(NULL, fp, 1);
+static void extrema_init(extrema_t *e) {
+	int k;
+	e->mode = EXTREMA_SCAN;
+	for(k = 0; k < EXT_NUM_DEQUES; k++) {
+		e->dq[k].slots = NULL;
+		e->dq[k].size = 0;
+		e->dq[k].head = 0;
+		e->dq[k].count = 0;
+	}
+	e->x_min = e->y_min = DBL_MAX;
+	e->x_max = e->y_max = -DBL_MAX;
+}
 
-	return (overall.width);
+static void extrema_free(extrema_t *e) {
+	int k;
+	for(k = 0; k < EXT_NUM_DEQUES; k++) {
+		free(e->dq[k].slots);
+	}
+	extrema_init(e);
 }
-#endif
-	
 
-static double get_text_height(cairo_t *cr, char *text, double font_size) {
-	cairo_text_extents_t te;
-	cairo_save(cr);
-	cairo_set_font_size(cr, font_size);
-	cairo_text_extents(cr, text, &te);
-	cairo_restore(cr);
-	return te.height;
+/* full scan of the current window, used where no running extrema exist */
+static void extrema_scan(trace_t *t, data_range *xr, data_range *yr) {
+	int j;
+	xr->min = yr->min = DBL_MAX;
+	xr->max = yr->max = -DBL_MAX;
+	for(j = 0; j < t->length; j++) {
+		int n = trace_slot(t, j);
+		if(trace_x(t, n) > xr->max) xr->max = trace_x(t, n);
+		if(trace_x(t, n) < xr->min) xr->min = trace_x(t, n);
+		if(trace_y(t, n) > yr->max) yr->max = trace_y(t, n);
+		if(trace_y(t, n) < yr->min) yr->min = trace_y(t, n);
+	}
 }
-	
-static double get_text_width(cairo_t *cr, char *text, double font_size) {
-	cairo_text_extents_t te;
-	cairo_save(cr);
-	cairo_set_font_size(cr, font_size);
-	cairo_text_extents(cr, text, &te);
-	cairo_restore(cr);
-	return te.width;
+
+/* remembers the extremes of external data handed to the trace */
+static void extrema_snapshot(trace_t *t) {
+	data_range xr, yr;
+	extrema_free(&(t->ext));
+	extrema_scan(t, &xr, &yr);
+	t->ext.x_min = xr.min;
+	t->ext.x_max = xr.max;
+	t->ext.y_min = yr.min;
+	t->ext.y_max = yr.max;
+	t->ext.mode = EXTREMA_SNAPSHOT;
 }
-	
 
-#if DRAW_WITH_XLIB
-static double get_widest_label_width_x(axis_t *a, Display *display, GC gc) {
-	double max = 0.0;
-	double w;
-	int i;
-	for(i=0; i<a->num_actual_major_tics; i++) {
-		w = get_text_width_x(display, gc, a->major_tic_labels[i]);
-		if(w > max) {
-			max = w;
+/* records that slot n is about to be overwritten */
+static void extrema_evict(trace_t *t, int n) {
+	int k;
+	if(t->ext.mode != EXTREMA_DEQUE) {
+		return;
+	}
+	for(k = 0; k < EXT_NUM_DEQUES; k++) {
+		mono_deque_t *q = &(t->ext.dq[k]);
+		if(q->count > 0 && q->slots[q->head] == n) {
+			q->head = (q->head + 1) % q->size;
+			q->count--;
 		}
 	}
-	return max;
 }
-#endif
 
-static double get_widest_label_width(axis_t *a, cairo_t *cr) {
-  double max = 0.0;
-  double w;
-	cairo_text_extents_t te;
-  int i;
-  for(i=0; i<a->num_actual_major_tics; i++) {
-		cairo_text_extents(cr, a->major_tic_labels[i], &te);
-    w = te.width;
-    if(w > max) {
-      max = w;
-    }
-  }
-  return max;
+/* records that slot n now holds the newest sample.  The x extremes of an
+ * x-monotonic trace are its oldest and newest samples, so those deques
+ * are only fed once the trace stops being monotonic. */
+static void extrema_push(trace_t *t, int n) {
+	int err = 0;
+	if(t->ext.mode != EXTREMA_DEQUE) {
+		return;
+	}
+	err |= mono_deque_push(t, EXT_Y_MIN, n);
+	err |= mono_deque_push(t, EXT_Y_MAX, n);
+	if(!t->x_monotonic) {
+		err |= mono_deque_push(t, EXT_X_MIN, n);
+		err |= mono_deque_push(t, EXT_X_MAX, n);
+	}
+	if(err) {
+		/* out of memory; fall back to scanning */
+		extrema_free(&(t->ext));
+	}
 }
-      
 
-static void get_double_parts(double f, double *mantissa, int *exponent) {
-  int neg = 0;
-  if(f == 0.0) {  
-    *mantissa = 0.0;
-    *exponent = 0;
-    return;
-  }
-  if(f < 0) neg = 1;
-  *exponent = floor(log10(fabs(f)));
-  *mantissa = f / pow(10, *exponent);
-  return;
+/* rebuilds the running extrema from the samples currently held */
+static void extrema_rebuild(trace_t *t) {
+	int j, k;
+	if(!t->is_data_owner) {
+		extrema_snapshot(t);
+		return;
+	}
+	for(k = 0; k < EXT_NUM_DEQUES; k++) {
+		t->ext.dq[k].head = 0;
+		t->ext.dq[k].count = 0;
+	}
+	t->ext.mode = EXTREMA_DEQUE;
+	for(j = 0; j < t->length && t->ext.mode == EXTREMA_DEQUE; j++) {
+		extrema_push(t, trace_slot(t, j));
+	}
 }
 
-
-static double round_to_nearest(double num, double nearest) {
-  double a = num / nearest;
-  return (floor(a + 0.5) * nearest);
+static double mono_deque_front(trace_t *t, int which, double empty) {
+	mono_deque_t *q = &(t->ext.dq[which]);
+	if(q->count < 1) {
+		return empty;
+	}
+	return extrema_value(t, which, q->slots[q->head]);
 }
 
-static double round_up_to_nearest(double num, double nearest) {
-  double a = num / nearest;
-  return (ceil(a) * nearest);
+/* Gets the x and y extremes of a trace without touching the samples
+ * whenever possible.  Empty traces give min = DBL_MAX, max = -DBL_MAX. */
+static void trace_get_extrema(trace_t *t, data_range *xr, data_range *yr) {
+	switch(t->ext.mode) {
+		case EXTREMA_DEQUE:
+			yr->min = mono_deque_front(t, EXT_Y_MIN, DBL_MAX);
+			yr->max = mono_deque_front(t, EXT_Y_MAX, -DBL_MAX);
+			if(!t->x_monotonic) {
+				xr->min = mono_deque_front(t, EXT_X_MIN, DBL_MAX);
+				xr->max = mono_deque_front(t, EXT_X_MAX, -DBL_MAX);
+			}
+			else if(t->length > 0) {
+				xr->min = trace_x(t, trace_slot(t, 0));
+				xr->max = trace_x(t, trace_slot(t, t->length - 1));
+			}
+			else {
+				xr->min = DBL_MAX;
+				xr->max = -DBL_MAX;
+			}
+			break;
+		case EXTREMA_SNAPSHOT:
+			xr->min = t->ext.x_min;
+			xr->max = t->ext.x_max;
+			yr->min = t->ext.y_min;
+			yr->max = t->ext.y_max;
+			break;
+		default:
+			extrema_scan(t, xr, yr);
+	}
 }
 
-static double round_down_to_nearest(double num, double nearest) {
-  double a = num / nearest;
-  return (floor(a) * nearest);
+typedef struct range_query_t {
+	int by_x;
+	double lo, hi;
+	double min, max;
+} range_query_t;
+
+static void range_query_sample(trace_t *t, range_query_t *q, int n) {
+	double k = q->by_x ? trace_x(t, n) : trace_y(t, n);
+	double v = q->by_x ? trace_y(t, n) : trace_x(t, n);
+	if(k >= q->lo && k <= q->hi) {
+		if(v > q->max) q->max = v;
+		if(v < q->min) q->min = v;
+	}
 }
 
+/* Descends from bucket k of the given pyramid level.  Buckets whose key
+ * range misses the query are skipped, buckets inside it are taken whole,
+ * and buckets that cannot widen the result so far are skipped too.  For
+ * x-monotonic traces only the buckets straddling the query edges are
+ * opened, so a query costs O(log n). */
+static void range_query_walk(trace_t *t, range_query_t *q, int level, int k) {
+	lod_t *lod = &(t->lod);
+	lod_bucket_t *b = &(lod->buckets[level][k]);
+	double k_min, k_max, v_min, v_max;
+	int n, n_end;
+
+	if(lod_bucket_is_empty(b)) {
+		return;
+	}
+	k_min = q->by_x ? b->x_min : b->y_min;
+	k_max = q->by_x ? b->x_max : b->y_max;
+	v_min = q->by_x ? b->y_min : b->x_min;
+	v_max = q->by_x ? b->y_max : b->x_max;
+	if(k_max < q->lo || k_min > q->hi || (v_min >= q->min && v_max <= q->max)) {
+		return;
+	}
+	if(k_min >= q->lo && k_max <= q->hi) {
+		if(v_max > q->max) q->max = v_max;
+		if(v_min < q->min) q->min = v_min;
+		return;
+	}
+	if(level == 0) {
+		n_end = (k + 1) * LOD_BASE;
+		if(n_end > t->capacity) {
+			n_end = t->capacity;
+		}
+		for(n = k * LOD_BASE; n < n_end; n++) {
+			if(trace_slot_is_filled(t, n)) {
+				range_query_sample(t, q, n);
+			}
+		}
+		return;
+	}
+	n_end = (k + 1) * LOD_FANOUT;
+	if(n_end > lod->num_buckets[level-1]) {
+		n_end = lod->num_buckets[level-1];
+	}
+	for(n = k * LOD_FANOUT; n < n_end; n++) {
+		range_query_walk(t, q, level - 1, n);
+	}
+}
 
-static data_range get_y_range(trace_t **traces, int num_traces) {
-  data_range r;
-  int i, j;
-  double min = DBL_MAX, max = -DBL_MAX;
-  for(i = 0; i < num_traces; i++) {
-    trace_t *t = traces[i];
-    for(j = 0; j< t->length; j++) {
-      if(t->y_data[j] > max) {
-        max = t->y_data[j];
-      }
-      if(t->y_data[j] < min) {
-        min = t->y_data[j];
-      }
-    }
-  }
-	if(min == max) {
-		if(min == 0) {
-			min = -1.0;
-			max = +1.0;
+/* Gets the range of y over the samples whose x lies within key (by_x
+ * set), or the range of x over the samples whose y lies within key.
+ * Traces without a pyramid (small or external ones) are scanned. */
+static void trace_get_range_within(trace_t *t, int by_x, data_range key, data_range *r) {
+	range_query_t q;
+	int j, k;
+	q.by_x = by_x;
+	q.lo = key.min;
+	q.hi = key.max;
+	q.min = DBL_MAX;
+	q.max = -DBL_MAX;
+	if(t->lod.num_levels > 0) {
+		lod_sync(t);
+		k = t->lod.num_levels - 1;
+		for(j = 0; j < t->lod.num_buckets[k]; j++) {
+			range_query_walk(t, &q, k, j);
 		}
-		else {
-			min = min - 0.1 * fabs(min);
-			max = max + 0.1 * fabs(max);
+	}
+	else {
+		for(j = 0; j < t->length; j++) {
+			range_query_sample(t, &q, trace_slot(t, j));
 		}
 	}
-  r.min = min;
-  r.max = max;
-  return r;
+	r->min = q.min;
+	r->max = q.max;
 }
 
-static data_range get_y_range_within_x_range(trace_t **traces, int num_traces, data_range xr) {
-  data_range r;
-  int i, j;
-  double min = DBL_MAX, max = -DBL_MAX;
-  for(i = 0; i < num_traces; i++) {
-    trace_t *t = traces[i];
-    for(j = 0; j< t->length; j++) {
-			if(t->x_data[j] >= xr.min && t->x_data[j] <= xr.max) {
-				if(t->y_data[j] > max) {
-					max = t->y_data[j];
-				}
-				if(t->y_data[j] < min) {
-					min = t->y_data[j];
+/******************* Snap-to-data Functions **************************/
+
+typedef struct snap_query_t {
+	double x_m, x_b, y_m, y_b;
+	double px, py;      // pointer position
+	double left, top, right, bottom;
+	double best;        // squared pixel distance to the nearest sample so far
+	trace_t *t;
+	int slot;
+} snap_query_t;
+
+static void snap_try(snap_query_t *q, trace_t *t, int n) {
+	double dx = q->x_m * trace_x(t, n) + q->x_b - q->px;
+	double dy = q->y_m * trace_y(t, n) + q->y_b - q->py;
+	double d = dx * dx + dy * dy;
+	if(d < q->best) {
+		q->best = d;
+		q->t = t;
+		q->slot = n;
+	}
+}
+
+/* squared pixel distance from the pointer to a bucket's bounding box */
+static double snap_bucket_dist(snap_query_t *q, lod_bucket_t *b) {
+	double x0 = q->x_m * b->x_min + q->x_b, x1 = q->x_m * b->x_max + q->x_b;
+	double y0 = q->y_m * b->y_min + q->y_b, y1 = q->y_m * b->y_max + q->y_b;
+	double dx = 0, dy = 0;
+	if(x0 > x1) { double s = x0; x0 = x1; x1 = s; }
+	if(y0 > y1) { double s = y0; y0 = y1; y1 = s; }
+	if(q->px < x0) dx = x0 - q->px;
+	else if(q->px > x1) dx = q->px - x1;
+	if(q->py < y0) dy = y0 - q->py;
+	else if(q->py > y1) dy = q->py - y1;
+	return dx * dx + dy * dy;
+}
+
+/* Branch and bound over pyramid buckets [k0, k1) of a level, nearest
+ * first.  Buckets of an x-monotonic trace are narrow in x, so only the
+ * few around the pointer get opened. */
+static void snap_walk(snap_query_t *q, trace_t *t, int level, int k0, int k1) {
+	lod_t *lod = &(t->lod);
+	int order[LOD_FANOUT];
+	double dist[LOD_FANOUT];
+	int i, m = 0, k;
+	for(k = k0; k < k1; k++) {
+		lod_bucket_t *b = &(lod->buckets[level][k]);
+		double d;
+		if(lod_bucket_is_empty(b)) {
+			continue;
+		}
+		d = snap_bucket_dist(q, b);
+		for(i = m; i > 0 && dist[i-1] > d; i--) {
+			dist[i] = dist[i-1];
+			order[i] = order[i-1];
+		}
+		dist[i] = d;
+		order[i] = k;
+		m++;
+	}
+	for(i = 0; i < m && dist[i] < q->best; i++) {
+		k = order[i];
+		if(level == 0) {
+			int n, n_end = (k + 1) * LOD_BASE;
+			if(n_end > t->capacity) {
+				n_end = t->capacity;
+			}
+			for(n = k * LOD_BASE; n < n_end; n++) {
+				if(trace_slot_is_filled(t, n)) {
+					snap_try(q, t, n);
 				}
 			}
-    }
-  }
-	if(min == max) {
-		if(min == 0) {
-			min = -1.0;
-			max = +1.0;
 		}
 		else {
-			min = min - 0.1 * fabs(min);
-			max = max + 0.1 * fabs(max);
+			int c_end = (k + 1) * LOD_FANOUT;
+			if(c_end > lod->num_buckets[level-1]) {
+				c_end = lod->num_buckets[level-1];
+			}
+			snap_walk(q, t, level - 1, k * LOD_FANOUT, c_end);
 		}
 	}
-  r.min = min;
-  r.max = max;
-  return r;
 }
 
-static data_range get_x_range(trace_t **traces, int num_traces) {
-  data_range r;
-  int i, j;
-  double min = DBL_MAX, max = -DBL_MAX;
-  for(i = 0; i < num_traces; i++) {
-    trace_t *t = traces[i];
-    for(j = 0; j< t->length; j++) {
-      if(t->x_data[j] > max) {
-        max = t->x_data[j];
-      }
-      if(t->x_data[j] < min) {
-        min = t->x_data[j];
-      }
-    }
-  }
-	if(min == max) {
-		if(min == 0) {
-			min = -1.0;
-			max = +1.0;
+static void snap_grid_free(trace_t *t) {
+	if(t->snap != NULL) {
+		free(t->snap->cell_start);
+		free(t->snap->slots);
+		free(t->snap);
+		t->snap = NULL;
+	}
+}
+
+/* grid cell of a pixel position; positions off the grid go to its edge */
+static int snap_cell(snap_grid_t *g, double x_px, double y_px) {
+	double c = floor((x_px - g->left) / SNAP_CELL_PX);
+	double r = floor((y_px - g->top) / SNAP_CELL_PX);
+	int ci = (c < 0) ? 0 : (c >= g->cols) ? g->cols - 1 : (int)c;
+	int ri = (r < 0) ? 0 : (r >= g->rows) ? g->rows - 1 : (int)r;
+	return ri * g->cols + ci;
+}
+
+/* (re)builds the grid if the samples or the transform have changed */
+static int snap_grid_update(snap_query_t *q, trace_t *t, render_scratch_t *rs) {
+	snap_grid_t *g = t->snap;
+	int j, k, c, cells, count;
+	if(g != NULL && g->data_gen == t->data_gen &&
+	   g->x_m == q->x_m && g->x_b == q->x_b && g->y_m == q->y_m && g->y_b == q->y_b &&
+	   g->left == q->left && g->top == q->top &&
+	   g->cols == (int)((q->right - q->left) / SNAP_CELL_PX) + 1 &&
+	   g->rows == (int)((q->bottom - q->top) / SNAP_CELL_PX) + 1) {
+		return 0;
+	}
+	snap_grid_free(t);
+	g = malloc(sizeof(snap_grid_t));
+	if(g == NULL) {
+		return -1;
+	}
+	g->data_gen = t->data_gen;
+	g->x_m = q->x_m;
+	g->x_b = q->x_b;
+	g->y_m = q->y_m;
+	g->y_b = q->y_b;
+	g->left = q->left;
+	g->top = q->top;
+	g->cols = (int)((q->right - q->left) / SNAP_CELL_PX) + 1;
+	g->rows = (int)((q->bottom - q->top) / SNAP_CELL_PX) + 1;
+	cells = g->cols * g->rows;
+	g->cell_start = calloc(cells + 1, sizeof(int));
+	g->slots = malloc(t->length * sizeof(int));
+	t->snap = g;
+	if(g->cell_start == NULL || g->slots == NULL) {
+		snap_grid_free(t);
+		return -1;
+	}
+	/* counting sort of the slots by cell, converting a chunk at a time */
+	rs->bounds[0] = rs->bounds[2] = -INFINITY;
+	rs->bounds[1] = rs->bounds[3] = INFINITY;
+	for(j = 0; j < t->length; j += count) {
+		count = trace_to_px(t, j, t->length - 1, 1, q->x_m, q->x_b, q->y_m, q->y_b, rs);
+		for(k = 0; k < count; k++) {
+			if(rs->cls[k] == PX_NAN) {
+				continue;
+			}
+			g->cell_start[snap_cell(g, rs->x_px[k], rs->y_px[k]) + 1]++;
 		}
-		else {
-			min = min - 0.1 * fabs(min);
-			max = max + 0.1 * fabs(max);
+	}
+	for(c = 0; c < cells; c++) {
+		g->cell_start[c+1] += g->cell_start[c];
+	}
+	for(j = 0; j < t->length; j += count) {
+		count = trace_to_px(t, j, t->length - 1, 1, q->x_m, q->x_b, q->y_m, q->y_b, rs);
+		for(k = 0; k < count; k++) {
+			if(rs->cls[k] == PX_NAN) {
+				continue;
+			}
+			c = snap_cell(g, rs->x_px[k], rs->y_px[k]);
+			g->slots[g->cell_start[c]++] = trace_slot(t, j + k);
 		}
 	}
-  r.min = min;
-  r.max = max;
-  return r;
+	for(c = cells; c > 0; c--) {
+		g->cell_start[c] = g->cell_start[c-1];
+	}
+	g->cell_start[0] = 0;
+	return 0;
 }
 
-static data_range get_x_range_within_y_range(trace_t **traces, int num_traces, data_range yr) {
-  data_range r;
-  int i, j;
-  double min = DBL_MAX, max = -DBL_MAX;
-  for(i = 0; i < num_traces; i++) {
-    trace_t *t = traces[i];
-    for(j = 0; j< t->length; j++) {
-			if(t->y_data[j] >= yr.min && t->y_data[j] <= yr.max) {
-				if(t->x_data[j] > max) {
-					max = t->x_data[j];
+/* Visits grid cells in rings around the pointer's cell.  Samples off the
+ * grid were filed under edge cells, which only brings them closer, so
+ * no sample in ring r can be nearer than (r - 1) cells. */
+static void snap_grid_search(snap_query_t *q, trace_t *t) {
+	snap_grid_t *g = t->snap;
+	int home = snap_cell(g, q->px, q->py);
+	int hc = home % g->cols, hr = home / g->cols;
+	int r, c, rr, s;
+	int r_max = (g->cols > g->rows) ? g->cols : g->rows;
+	for(r = 0; r <= r_max; r++) {
+		double reach = (r - 1) * (double)SNAP_CELL_PX;
+		if(r > 0 && reach * reach >= q->best) {
+			break;
+		}
+		for(rr = hr - r; rr <= hr + r; rr++) {
+			if(rr < 0 || rr >= g->rows) {
+				continue;
+			}
+			for(c = hc - r; c <= hc + r; c++) {
+				int cell;
+				if(c < 0 || c >= g->cols) {
+					continue;
+				}
+				if(rr != hr - r && rr != hr + r && c != hc - r && c != hc + r) {
+					/* interior cell, visited on an earlier ring */
+					c = hc + r - 1;
+					continue;
 				}
-				if(t->x_data[j] < min) {
-					min = t->x_data[j];
+				cell = rr * g->cols + c;
+				for(s = g->cell_start[cell]; s < g->cell_start[cell+1]; s++) {
+					snap_try(q, t, g->slots[s]);
 				}
 			}
-    }
-  }
-	if(min == max) {
-		if(min == 0) {
-			min = -1.0;
-			max = +1.0;
+		}
+	}
+}
+
+/* Finds the sample nearest pixel (x, y) over all traces.  Returns its
+ * trace and sets *slot, or returns NULL if there is nothing to snap to. */
+static trace_t *find_closest_point(jbplotPrivate *priv, double x, double y, int *slot) {
+	plot_t *p = &(priv->plot);
+	snap_query_t q;
+	int i, j;
+	q.x_m = priv->x_m;
+	q.x_b = priv->x_b;
+	q.y_m = priv->y_m;
+	q.y_b = priv->y_b;
+	q.px = x;
+	q.py = y;
+	q.left = p->plot_area.left_edge;
+	q.top = p->plot_area.top_edge;
+	q.right = p->plot_area.right_edge;
+	q.bottom = p->plot_area.bottom_edge;
+	q.best = DBL_MAX;
+	q.t = NULL;
+	q.slot = 0;
+	for(i = 0; i < p->num_traces; i++) {
+		trace_t *t = p->traces[i];
+		if(t->length < SNAP_MIN_SAMPLES) {
+			for(j = 0; j < t->length; j++) {
+				snap_try(&q, t, trace_slot(t, j));
+			}
+		}
+		else if(t->x_monotonic && t->lod.num_levels > 0) {
+			lod_sync(t);
+			snap_walk(&q, t, t->lod.num_levels - 1, 0, t->lod.num_buckets[t->lod.num_levels - 1]);
+		}
+		else if(snap_grid_update(&q, t, &(priv->scratch)) == 0) {
+			snap_grid_search(&q, t);
 		}
 		else {
-			min = min - 0.1 * fabs(min);
-			max = max + 0.1 * fabs(max);
+			for(j = 0; j < t->length; j++) {
+				snap_try(&q, t, trace_slot(t, j));
+			}
 		}
 	}
-  r.min = min;
-  r.max = max;
-  return r;
+	*slot = q.slot;
+	return q.t;
 }
 
 static void jbplot_get_range_state(jbplot *plot, range_state_t *rs) {
@@ -3878,9 +10089,20 @@ char *jbplot_trace_get_name(trace_handle th) {
 	return th->name;
 }
 
+/* true when the column is a contiguous run of doubles read back as stored,
+ * so that its data pointer can be handed out as a double array */
+static int col_is_plain_double(sample_col_t *c) {
+	return c->type == SAMPLE_DOUBLE && c->stride == sizeof(double) && c->gain == 1.0 && c->offset == 0.0;
+}
+
 int jbplot_trace_get_data(trace_handle th, double **x, double **y, int *length) {
-	*x = th->x_data;
-	*y = th->y_data;
+	if((!th->x_uniform && !col_is_plain_double(&(th->x_col))) || !col_is_plain_double(&(th->y_col))) {
+		*x = *y = NULL;
+		*length = 0;
+		return -1;
+	}
+	*x = th->x_col.data;
+	*y = th->y_col.data;
 	*length = th->length;
 	return 0;
 }
@@ -4080,12 +10302,68 @@ int jbplot_set_antialias(jbplot *plot, gboolean state) {
 	return 0;
 }
 
+int jbplot_set_scroll_mode(jbplot *plot, gboolean state) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	priv->scroll_mode = state ? TRUE : FALSE;
+	priv->scroll.valid = 0;
+	priv->needs_redraw = TRUE;
+	return 0;
+}
+
+int jbplot_set_render_threads(jbplot *plot, int num_threads) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	if(num_threads < 0 || num_threads > MAX_RENDER_THREADS + 1) {
+		printf("Error: render threads must be between 0 and %d\n", MAX_RENDER_THREADS + 1);
+		return -1;
+	}
+	if(num_threads != priv->render_threads) {
+		render_pool_destroy(priv->render_pool);
+		priv->render_pool = NULL;
+		render_layers_free(priv);
+		density_parts_free(priv);
+	}
+	priv->render_threads = num_threads;
+	priv->needs_redraw = TRUE;
+	return 0;
+}
+
 
 GtkWidget *jbplot_new (void) {
 	return g_object_new (JBPLOT_TYPE, NULL);
 }
 
 
+/* Removes the timeouts and idle callbacks pending for the widget; they
+ * hold a bare pointer to it */
+static void remove_callbacks(jbplotPrivate *priv) {
+	if(priv->sched.timer != 0) {
+		g_source_remove(priv->sched.timer);
+		priv->sched.timer = 0;
+	}
+	if(priv->settle_timer != 0) {
+		g_source_remove(priv->settle_timer);
+		priv->settle_timer = 0;
+	}
+	progress_cancel(priv);
+	if(priv->tiles.idle != 0) {
+		g_source_remove(priv->tiles.idle);
+		priv->tiles.idle = 0;
+	}
+	if(priv->wheel.timer != 0) {
+		g_source_remove(priv->wheel.timer);
+		priv->wheel.timer = 0;
+	}
+	// the threads are joined too; the pool's are idle between frames,
+	// the worker may still be drawing for the widget
+	render_pool_destroy(priv->render_pool);
+	priv->render_pool = NULL;
+#if !DRAW_WITH_XLIB
+	async_worker_destroy(priv->async);
+	priv->async = NULL;
+#endif
+	return;
+}
+
 void jbplot_destroy(jbplot *plot) {
 	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
 	
@@ -4102,6 +10380,64 @@ void jbplot_destroy(jbplot *plot) {
 	if(priv->plot_buffer != NULL) {
 		cairo_surface_destroy(priv->plot_buffer);
 	}
+	if(priv->chrome_context != NULL) {
+		cairo_destroy(priv->chrome_context);
+	}
+	if(priv->chrome_buffer != NULL) {
+		cairo_surface_destroy(priv->chrome_buffer);
+	}
+	if(priv->data_context != NULL) {
+		cairo_destroy(priv->data_context);
+	}
+	if(priv->data_buffer != NULL) {
+		cairo_surface_destroy(priv->data_buffer);
+	}
+
+	remove_callbacks(priv);
+	render_layers_free(priv);
+	density_parts_free(priv);
+	frame_cache_flush(priv);
+	tile_cache_reset(priv);
+	wheel_preview_reset(priv);
+	if(priv->progress_context != NULL) {
+		cairo_destroy(priv->progress_context);
+		priv->progress_context = NULL;
+	}
+	if(priv->progress_buffer != NULL) {
+		cairo_surface_destroy(priv->progress_buffer);
+		priv->progress_buffer = NULL;
+	}
+#if DRAW_WITH_XLIB
+	if(priv->progress_pixmap) {
+		XFreePixmap(priv->xdisp, priv->progress_pixmap);
+		priv->progress_pixmap = 0;
+	}
+	if(priv->chrome_pixmap) {
+		XFreePixmap(priv->xdisp, priv->chrome_pixmap);
+		priv->chrome_pixmap = 0;
+	}
+	if(priv->data_pixmap) {
+		XFreePixmap(priv->xdisp, priv->data_pixmap);
+		XFreePixmap(priv->xdisp, priv->data_mask);
+		priv->data_pixmap = 0;
+		priv->data_mask = 0;
+	}
+	/* tile_render() creates this too, so it may exist without a scroll layer */
+	if(priv->mask_gc) {
+		XFreeGC(priv->xdisp, priv->mask_gc);
+		priv->mask_gc = 0;
+	}
+#endif
+
+	free(priv->scratch.env);
+	priv->scratch.env = NULL;
+	priv->scratch.env_size = 0;
+	free(priv->scratch.occupied);
+	priv->scratch.occupied = NULL;
+	priv->scratch.occupied_size = 0;
+#if DRAW_WITH_XLIB
+	xbatch_free(&(priv->scratch.xb));
+#endif
 }
 
 
@@ -4157,6 +10493,7 @@ int jbplot_trace_set_decimation(trace_handle th, int divisor) {
 		th->decimate_divisor = divisor;
 		th->lossless_decimation = 0;
 	}
+	th->edit_gen++;
 	return 0;
 }
 
@@ -4164,16 +10501,22 @@ int jbplot_trace_set_decimation(trace_handle th, int divisor) {
 
 int jbplot_trace_set_data(trace_handle th, double *x_start, double *y_start, int length) {
 	if(th->is_data_owner) {
-		free(th->x_data);
-		free(th->y_data);
+		free(th->x_col.data);
+		free(th->y_col.data);
 		th->is_data_owner = 0;
 	}
-	th->x_data = x_start;
-	th->y_data = y_start;
+	lod_free(&(th->lod));
+	th->x_monotonic = 0;
+	th->x_uniform = 0;
+	col_init(&(th->x_col), SAMPLE_DOUBLE, x_start);
+	col_init(&(th->y_col), SAMPLE_DOUBLE, y_start);
 	th->length = length;
 	th->capacity = length;
 	th->start_index = 0;
 	th->end_index = length-1;
+	extrema_snapshot(th);
+	th->data_gen++;
+	th->edit_gen++;
 	return 0;
 }
 
@@ -4183,15 +10526,26 @@ int jbplot_trace_resize(trace_handle th, int new_size) {
 	}
 	else {
 		if(new_size >= th->capacity) {
-			double *px, *py;
-			px = realloc(th->x_data, new_size * sizeof(double));
-			py = realloc(th->y_data, new_size * sizeof(double));
-			if(px==NULL || py==NULL) {
+			void *px, *py;
+			if(!th->x_uniform) {
+				px = realloc(th->x_col.data, new_size * sample_size(th->x_col.type));
+				if(px==NULL) {
+					return -1;
+				}
+				th->x_col.data = px;
+			}
+			py = realloc(th->y_col.data, new_size * sample_size(th->y_col.type));
+			if(py==NULL) {
 				return -1;
 			} 
-			th->x_data = px;
-			th->y_data = py;
+			th->y_col.data = py;
 			th->capacity = new_size;
+			if(lod_alloc(th)) {
+				return -1;
+			}
+			extrema_rebuild(th);
+			th->data_gen++;
+			th->edit_gen++;
 		}
 	}	
 	return 0;
@@ -4218,12 +10572,20 @@ int jbplot_trace_clear_data(trace_t *t) {
 	t->length = 0;
 	t->start_index = 0;
 	t->end_index = 0;
+	t->x_monotonic = t->is_data_owner;
+	t->first_seq = 0;
+	lod_reset(&(t->lod));
+	extrema_rebuild(t);
+	t->data_gen++;
+	t->edit_gen++;
 	return 0;
 }
 
 
 int jbplot_legend_refresh(jbplot *plot) {
 	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	// trace names aren't in the frame keys
+	frame_cache_flush(priv);
 	priv->plot.legend.needs_redraw = 1;
 	priv->needs_redraw = TRUE;
 	gtk_widget_queue_draw((GtkWidget *)plot);
@@ -4507,7 +10869,124 @@ int jbplot_set_y_axis_range(jbplot *plot, double min, double max, int history) {
 void jbplot_refresh(jbplot *plot) {
 	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
 	priv->needs_redraw = TRUE;
-	gtk_widget_queue_draw((GtkWidget *)plot);
+	frame_request((GtkWidget *)plot);
+	return;
+}
+
+int jbplot_set_max_fps(jbplot *plot, double max_fps, double budget_ms) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	if(max_fps < 0 || budget_ms < 0) {
+		printf("Error: bad frame rate or budget\n");
+		return -1;
+	}
+	priv->sched.max_fps = max_fps;
+	priv->sched.budget_ms = budget_ms;
+	// whatever is waiting goes out now rather than on the old schedule
+	if(priv->sched.timer != 0) {
+		g_source_remove(priv->sched.timer);
+		priv->sched.timer = 0;
+		gtk_widget_queue_draw((GtkWidget *)plot);
+	}
+	priv->sched.next_due.tv_sec = 0;
+	priv->sched.next_due.tv_usec = 0;
+	return 0;
+}
+
+int jbplot_set_progressive(jbplot *plot, gboolean state, int slice_ms) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	if(slice_ms < 1) {
+		printf("Error: bad time slice\n");
+		return -1;
+	}
+	priv->progressive = state ? TRUE : FALSE;
+	priv->progress.slice_ms = slice_ms;
+	if(!priv->progressive && priv->progress.idle != 0) {
+		progress_cancel(priv);
+		priv->needs_redraw = TRUE;
+		gtk_widget_queue_draw((GtkWidget *)plot);
+	}
+	return 0;
+}
+
+int jbplot_set_render_worker(jbplot *plot, gboolean state) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+#if DRAW_WITH_XLIB
+	if(state) {
+		printf("Error: the render worker needs the cairo renderer\n");
+		return -1;
+	}
+	priv->render_worker = FALSE;
+#else
+	priv->render_worker = state ? TRUE : FALSE;
+	if(!priv->render_worker && priv->async != NULL) {
+		// the frame it was drawing is redrawn and refined on the GTK thread
+		if(priv->progress.idle != 0) {
+			progress_cancel(priv);
+			priv->needs_redraw = TRUE;
+			gtk_widget_queue_draw((GtkWidget *)plot);
+		}
+		async_worker_destroy(priv->async);
+		priv->async = NULL;
+	}
+#endif
+	return 0;
+}
+
+int jbplot_set_frame_cache(jbplot *plot, size_t max_bytes) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	priv->frames.max_bytes = max_bytes;
+	while(priv->frames.bytes > max_bytes) {
+		frame_cache_evict_lru(priv);
+	}
+	return 0;
+}
+
+int jbplot_set_pan_tiles(jbplot *plot, gboolean state) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	priv->pan_tiles = state ? TRUE : FALSE;
+	if(!priv->pan_tiles) {
+		tile_cache_reset(priv);
+	}
+	return 0;
+}
+
+int jbplot_set_wheel_preview(jbplot *plot, gboolean state) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	priv->wheel_preview = state ? TRUE : FALSE;
+	if(!priv->wheel_preview && priv->wheel.active) {
+		wheel_preview_reset(priv);
+		priv->needs_redraw = TRUE;
+		gtk_widget_queue_draw((GtkWidget *)plot);
+	}
+	return 0;
+}
+
+int jbplot_set_interactive_quality(jbplot *plot, gboolean state, int settle_ms) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	if(settle_ms < 0) {
+		printf("Error: bad settle time\n");
+		return -1;
+	}
+	priv->draft_quality = state ? TRUE : FALSE;
+	priv->settle_ms = settle_ms;
+	if(!priv->draft_quality && priv->interacting) {
+		if(priv->settle_timer != 0) {
+			g_source_remove(priv->settle_timer);
+		}
+		interaction_settled(plot);
+	}
+	return 0;
+}
+
+void jbplot_get_frame_stats(jbplot *plot, jbplot_frame_stats_t *stats) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	*stats = priv->sched.stats;
+	return;
+}
+
+void jbplot_reset_frame_stats(jbplot *plot) {
+	jbplotPrivate *priv = JBPLOT_GET_PRIVATE(plot);
+	memset(&(priv->sched.stats), 0, sizeof(jbplot_frame_stats_t));
 	return;
 }
 
@@ -4517,6 +10996,7 @@ int jbplot_trace_set_line_props(trace_t *t, line_type_t type, double width, rgb_
 	if(color != NULL) {
 		t->line_color = *color;
 	}
+	t->edit_gen++;
 	return 0;
 }
 
@@ -4526,6 +11006,23 @@ int jbplot_trace_set_marker_props(trace_t *t, marker_type_t type, double size, r
 	if(color != NULL) {
 		t->marker_color = *color;
 	}
+	sprite_invalidate(t);
+	t->edit_gen++;
+	return 0;
+}
+
+int jbplot_trace_set_density_mode(trace_t *t, density_mode_t mode) {
+	if(mode != DENSITY_NONE && t->density == NULL) {
+		t->density = calloc(1, sizeof(density_t));
+		if(t->density == NULL) {
+			printf("Error allocating density counts\n");
+			return -1;
+		}
+	}
+	if(t->density != NULL) {
+		t->density->mode = mode;
+	}
+	t->edit_gen++;
 	return 0;
 }
 
@@ -4536,65 +11033,366 @@ trace_t *jbplot_create_trace_with_external_data(double *x, double *y, int length
 		printf("Error allocating trace_t structure\n");
 		return NULL;
 	}
-	t->x_data = x;
-	t->y_data = y;
+	col_init(&(t->x_col), SAMPLE_DOUBLE, x);
+	col_init(&(t->y_col), SAMPLE_DOUBLE, y);
 	t->capacity = capacity;
 	t->length = length;
 	t->start_index = 0;
 	t->end_index = length - 1;
 	t->is_data_owner = 0;
+	t->x_monotonic = 0;
+	t->x_uniform = 0;
+	t->first_seq = 0;
+	t->data_gen = 0;
+	t->edit_gen = 0;
+	t->feed = NULL;
+	t->snap = NULL;
+	t->density = NULL;
+	t->sprite = NULL;
+	lod_init(&(t->lod));
+	extrema_init(&(t->ext));
+	extrema_snapshot(t);
 	t->decimate_divisor = 1;
 	t->lossless_decimation = 0;
 	strcpy(t->name, "trace");
 	return t;
 }
 
+/* Views two fields of an interleaved record buffer without copying:
+ * sample n of x is at base + x_offset + n * stride, and likewise for y. */
+trace_t *jbplot_create_trace_with_strided_data(void *base, int stride, sample_type_t x_type, int x_offset, sample_type_t y_type, int y_offset, int length, int capacity) {
+	trace_t *t;
+	if(base == NULL || stride <= 0 || x_offset < 0 || y_offset < 0 || length < 0 || capacity < length) {
+		printf("Invalid strided data layout\n");
+		return NULL;
+	}
+	t = create_trace(0, x_type, y_type, 0, 0.0, 0.0);
+	if(t == NULL) {
+		printf("Error allocating trace_t structure\n");
+		return NULL;
+	}
+	t->x_col.data = (char *)base + x_offset;
+	t->x_col.stride = stride;
+	t->y_col.data = (char *)base + y_offset;
+	t->y_col.stride = stride;
+	t->capacity = capacity;
+	t->length = length;
+	t->end_index = length - 1;
+	extrema_snapshot(t);
+	return t;
+}
+
+/* Tells the trace that samples first..last (0 = oldest) were changed in
+ * place.  For external data, changes past the current length grow the
+ * trace up to its capacity. */
+int jbplot_trace_data_changed(trace_t *t, int first, int last) {
+	int j, old_length = t->length;
+	if(first < 0 || last < first || last >= t->capacity) {
+		return -1;
+	}
+	if(last >= t->length) {
+		if(t->is_data_owner || first > t->length) {
+			return -1;
+		}
+		t->length = last + 1;
+		t->end_index = last;
+	}
+	if(t->is_data_owner) {
+		if(t->x_monotonic && !t->x_uniform) {
+			for(j = (first > 0) ? first : 1; j <= last + 1 && j < t->length; j++) {
+				double x = trace_x(t, trace_slot(t, j));
+				if(isnan(x) || x < trace_x(t, trace_slot(t, j - 1))) {
+					t->x_monotonic = 0;
+					break;
+				}
+			}
+			if(first == 0 && isnan(trace_x(t, trace_slot(t, 0)))) {
+				t->x_monotonic = 0;
+			}
+		}
+		lod_mark_dirty_range(t, trace_slot(t, first), last - first + 1);
+		extrema_rebuild(t);
+	}
+	else if(first >= old_length && t->ext.mode == EXTREMA_SNAPSHOT) {
+		/* appended in place; fold the new samples into the snapshot */
+		for(j = first; j <= last; j++) {
+			double x = trace_x(t, j);
+			double y = trace_y(t, j);
+			if(x > t->ext.x_max) t->ext.x_max = x;
+			if(x < t->ext.x_min) t->ext.x_min = x;
+			if(y > t->ext.y_max) t->ext.y_max = y;
+			if(y < t->ext.y_min) t->ext.y_min = y;
+		}
+	}
+	else {
+		extrema_snapshot(t);
+	}
+	t->data_gen++;
+	t->edit_gen++;
+	return 0;
+}
+
 int jbplot_trace_add_point(trace_t *t, double x, double y) {
+	int index;
+	char was_monotonic = t->x_monotonic;
 	if(!t->is_data_owner) {
 		return -1;
 	}
+	if(!t->x_uniform && (isnan(x) || (t->length > 0 && x < trace_x(t, trace_slot(t, t->length - 1))))) {
+		t->x_monotonic = 0;
+	}
 	if(t->length >= t->capacity) {
-		t->x_data[t->start_index] = x;
-		t->y_data[t->start_index] = y;
+		index = t->start_index;
+		extrema_evict(t, index);
+		if(!t->x_uniform) {
+			col_set(&(t->x_col), index, x);
+		}
+		col_set(&(t->y_col), index, y);
+		t->first_seq++;
 		t->start_index++;
 		if(t->start_index >= t->capacity) {
 			t->start_index = 0;
 		}
 	}
 	else {
-		int index;
 		index = t->start_index + t->length;
 		if(index >= t->capacity) {
-			index = 0;
+			index -= t->capacity;
 		}
-		t->x_data[index] = x;
-		t->y_data[index] = y;
+		if(!t->x_uniform) {
+			col_set(&(t->x_col), index, x);
+		}
+		col_set(&(t->y_col), index, y);
 		t->length++;
 	}
+	lod_mark_dirty(t, index);
+	if(was_monotonic && !t->x_monotonic) {
+		extrema_rebuild(t);
+	}
+	else {
+		extrema_push(t, index);
+	}
 	t->end_index = t->start_index + t->length - 1;
 	if(t->end_index >= t->capacity) {
-		t->end_index = 0;
+		t->end_index -= t->capacity;
 	}
+	t->data_gen++;
 	return 0;
 }
 
+/* Appends n samples at once.  The block is copied into the ring in at
+ * most two runs per axis and the indexes are updated in one pass.
+ * If n exceeds the capacity only the newest samples are kept.  x is
+ * ignored (and may be NULL) for uniform traces. */
+int jbplot_trace_add_points(trace_t *t, double *x, double *y, int n) {
+	int i, index, first, drop, seg, skip = 0;
+	char was_monotonic = t->x_monotonic;
+	if(!t->is_data_owner || n < 0 || (x == NULL && !t->x_uniform)) {
+		return -1;
+	}
+	if(n == 0) {
+		return 0;
+	}
+	if(t->x_monotonic && !t->x_uniform) {
+		if(isnan(x[0]) || (t->length > 0 && x[0] < trace_x(t, trace_slot(t, t->length - 1)))) {
+			t->x_monotonic = 0;
+		}
+		for(i = 1; i < n && t->x_monotonic; i++) {
+			if(isnan(x[i]) || x[i] < x[i-1]) {
+				t->x_monotonic = 0;
+			}
+		}
+	}
+	if(n > t->capacity) {
+		skip = n - t->capacity;
+		x += skip;
+		y += skip;
+		n = t->capacity;
+	}
+
+	/* let go of the samples about to be overwritten */
+	drop = t->length + n - t->capacity;
+	if(drop < 0) {
+		drop = 0;
+	}
+	for(i = 0; i < drop && n < t->capacity; i++) {
+		extrema_evict(t, trace_slot(t, i));
+	}
 
-trace_t *jbplot_create_trace(int capacity) {
+	first = t->start_index + t->length;
+	if(first >= t->capacity) {
+		first -= t->capacity;
+	}
+	seg = t->capacity - first;
+	if(seg > n) {
+		seg = n;
+	}
+	if(!t->x_uniform) {
+		col_store(&(t->x_col), first, x, seg);
+		if(seg < n) {
+			col_store(&(t->x_col), 0, x + seg, n - seg);
+		}
+	}
+	col_store(&(t->y_col), first, y, seg);
+	if(seg < n) {
+		col_store(&(t->y_col), 0, y + seg, n - seg);
+	}
+
+	t->length += n - drop;
+	t->first_seq += drop + skip;
+	t->start_index += drop;
+	if(t->start_index >= t->capacity) {
+		t->start_index -= t->capacity;
+	}
+	t->end_index = t->start_index + t->length - 1;
+	if(t->end_index >= t->capacity) {
+		t->end_index -= t->capacity;
+	}
+
+	lod_mark_dirty_range(t, first, n);
+	if((was_monotonic && !t->x_monotonic) || n >= t->capacity) {
+		extrema_rebuild(t);
+	}
+	else {
+		for(i = 0; i < n; i++) {
+			index = first + i;
+			if(index >= t->capacity) {
+				index -= t->capacity;
+			}
+			extrema_push(t, index);
+		}
+	}
+	t->data_gen++;
+	return 0;
+}
+
+static void trace_feed_free(trace_t *t) {
+	if(t->feed != NULL) {
+		free(t->feed->x);
+		free(t->feed->y);
+		free(t->feed);
+		t->feed = NULL;
+	}
+}
+
+/* Sets up the staging ring for jbplot_trace_feed_points(), with room
+ * for size samples rounded up to a power of two.  Call it from the GTK
+ * thread before the producer thread starts. */
+int jbplot_trace_enable_feed(trace_t *t, int size) {
+	trace_feed_t *f;
+	if(!t->is_data_owner || size <= 0 || size > (1 << 30) || t->feed != NULL) {
+		return -1;
+	}
+	while(size & (size - 1)) {
+		size += size & -size;
+	}
+	f = malloc(sizeof(trace_feed_t));
+	if(f == NULL) {
+		return -1;
+	}
+	f->x = t->x_uniform ? NULL : malloc(size * sizeof(double));
+	f->y = malloc(size * sizeof(double));
+	if(f->y == NULL || (f->x == NULL && !t->x_uniform)) {
+		free(f->x);
+		free(f->y);
+		free(f);
+		return -1;
+	}
+	f->size = size;
+	f->head = 0;
+	f->tail = 0;
+	t->feed = f;
+	return 0;
+}
+
+/* Producer side; may be called from one thread other than the GTK
+ * thread.  Never blocks: returns how many of the n samples fitted,
+ * the rest are dropped.  x is ignored for uniform traces. */
+int jbplot_trace_feed_points(trace_t *t, double *x, double *y, int n) {
+	trace_feed_t *f = t->feed;
+	unsigned int head, tail, first, seg;
+	if(f == NULL || n < 0) {
+		return -1;
+	}
+	head = f->head;
+	tail = __atomic_load_n(&(f->tail), __ATOMIC_ACQUIRE);
+	if((unsigned int)n > f->size - (head - tail)) {
+		n = f->size - (head - tail);
+	}
+	first = head & (f->size - 1);
+	seg = f->size - first;
+	if(seg > (unsigned int)n) {
+		seg = n;
+	}
+	if(f->x != NULL) {
+		memcpy(f->x + first, x, seg * sizeof(double));
+		memcpy(f->x, x + seg, (n - seg) * sizeof(double));
+	}
+	memcpy(f->y + first, y, seg * sizeof(double));
+	memcpy(f->y, y + seg, (n - seg) * sizeof(double));
+	__atomic_store_n(&(f->head), head + n, __ATOMIC_RELEASE);
+	return n;
+}
+
+/* Consumer side, GTK thread only.  Moves everything published so far
+ * into the trace; the plot does this at the start of every frame.
+ * Publishing doesn't wake the GTK thread, so something there has to ask
+ * for the frames, jbplot_refresh() from a timeout say. */
+int jbplot_trace_drain_feed(trace_t *t) {
+	trace_feed_t *f = t->feed;
+	unsigned int head, tail, first, seg, n;
+	if(f == NULL) {
+		return 0;
+	}
+	tail = f->tail;
+	head = __atomic_load_n(&(f->head), __ATOMIC_ACQUIRE);
+	n = head - tail;
+	if(n == 0) {
+		return 0;
+	}
+	first = tail & (f->size - 1);
+	seg = f->size - first;
+	if(seg > n) {
+		seg = n;
+	}
+	jbplot_trace_add_points(t, f->x ? f->x + first : NULL, f->y + first, seg);
+	if(seg < n) {
+		jbplot_trace_add_points(t, f->x, f->y, n - seg);
+	}
+	__atomic_store_n(&(f->tail), head, __ATOMIC_RELEASE);
+	return n;
+}
+
+static trace_t *create_trace(int capacity, sample_type_t x_type, sample_type_t y_type, int x_uniform, double x0, double dx) {
 	trace_t *t;
 	t = malloc(sizeof(trace_t));
 	if(t==NULL) {
 		return NULL;
 	}	
+	col_init(&(t->x_col), x_type, NULL);
+	col_init(&(t->y_col), y_type, NULL);
+	t->x_uniform = x_uniform;
+	t->x0 = x0;
+	t->dx = dx;
+	t->first_seq = 0;
+	t->data_gen = 0;
+	t->edit_gen = 0;
+	t->feed = NULL;
+	t->snap = NULL;
+	t->density = NULL;
+	t->sprite = NULL;
 	if(capacity > 0) {
-		t->x_data = malloc(sizeof(double)*capacity);
-		if(t->x_data==NULL) {
-			free(t);
-			return NULL;
+		if(!x_uniform) {
+			t->x_col.data = malloc(sample_size(x_type)*capacity);
+			if(t->x_col.data==NULL) {
+				free(t);
+				return NULL;
+			}
 		}
-		t->y_data = malloc(sizeof(double)*capacity);
-		if(t->y_data==NULL) {
+		t->y_col.data = malloc(sample_size(y_type)*capacity);
+		if(t->y_col.data==NULL) {
+			free(t->x_col.data);
 			free(t);
-			free(t->x_data);
 			return NULL;
 		}
 		t->is_data_owner = 1;
@@ -4606,6 +11404,14 @@ trace_t *jbplot_create_trace(int capacity) {
 	t->end_index = 0;
 	t->length = 0;
 	t->capacity = capacity;
+	t->x_monotonic = t->is_data_owner;
+	lod_init(&(t->lod));
+	extrema_init(&(t->ext));
+	if(lod_alloc(t)) {
+		jbplot_destroy_trace(t);
+		return NULL;
+	}
+	extrema_rebuild(t);
 	t->line_width = 2.0;
 	t->line_type = LINETYPE_SOLID;
 	t->marker_type = MARKER_NONE;
@@ -4622,11 +11428,64 @@ trace_t *jbplot_create_trace(int capacity) {
 	return t;
 }
 
+trace_t *jbplot_create_trace(int capacity) {
+	return create_trace(capacity, SAMPLE_DOUBLE, SAMPLE_DOUBLE, 0, 0.0, 0.0);
+}
+
+trace_t *jbplot_create_trace_with_types(int capacity, sample_type_t x_type, sample_type_t y_type) {
+	return create_trace(capacity, x_type, y_type, 0, 0.0, 0.0);
+}
+
+trace_t *jbplot_create_uniform_trace(double x0, double dx, int capacity) {
+	return jbplot_create_uniform_trace_with_type(x0, dx, capacity, SAMPLE_DOUBLE);
+}
+
+trace_t *jbplot_create_uniform_trace_with_type(double x0, double dx, int capacity, sample_type_t y_type) {
+	if(capacity <= 0 || !(dx > 0)) {
+		printf("Uniform traces need a positive capacity and dx\n");
+		return NULL;
+	}
+	return create_trace(capacity, SAMPLE_DOUBLE, y_type, 1, x0, dx);
+}
+
+static int col_set_scaling(trace_t *t, sample_col_t *c, double gain, double offset) {
+	if(c->type == SAMPLE_DOUBLE || gain == 0 || isnan(gain) || isnan(offset)) {
+		return -1;
+	}
+	c->gain = gain;
+	c->offset = offset;
+	/* the stored samples now mean something else */
+	lod_mark_dirty_range(t, 0, t->capacity);
+	extrema_rebuild(t);
+	t->data_gen++;
+	t->edit_gen++;
+	return 0;
+}
+
+int jbplot_trace_set_x_scaling(trace_t *t, double gain, double offset) {
+	/* a negative gain would reverse the order of x, and the visible span
+	 * search, the extrema and the LOD all rely on x_monotonic */
+	if(t->x_uniform || gain < 0) {
+		return -1;
+	}
+	return col_set_scaling(t, &(t->x_col), gain, offset);
+}
+
+int jbplot_trace_set_y_scaling(trace_t *t, double gain, double offset) {
+	return col_set_scaling(t, &(t->y_col), gain, offset);
+}
+
 void jbplot_destroy_trace(trace_t *trace) {
 	if(trace->is_data_owner) {
-		free(trace->x_data);
-		free(trace->y_data);
-	}
+		free(trace->x_col.data);
+		free(trace->y_col.data);
+	}
+	lod_free(&(trace->lod));
+	extrema_free(&(trace->ext));
+	trace_feed_free(trace);
+	snap_grid_free(trace);
+	density_free(trace);
+	sprite_free(trace);
 	free(trace);
 	return;
 }
@@ -4654,6 +11513,8 @@ int jbplot_remove_trace(jbplot *plot, trace_handle th) {
 	if(trace_index < 0) {
 		return -1;
 	}
+	// it may be freed and its memory reused for a new trace
+	frame_cache_flush(priv);
 
 	/* if it's the last trace, this is easy */
 	if(trace_index == p->num_traces - 1) {
@@ -65,6 +65,16 @@ typedef enum {
 	MARKER_POINT
 } marker_type_t;
 
+/**
+ * Density modes: instead of its markers, the trace is drawn as the
+ * number of samples falling in each pixel, shaded in the marker color
+ */
+typedef enum {
+	DENSITY_NONE,
+	DENSITY_LINEAR,
+	DENSITY_LOG
+} density_mode_t;
+
 /**
  * Supported cursor types
  */
@@ -95,6 +105,33 @@ typedef enum {
 	LEGEND_POS_TOP
 } legend_pos_t;
 
+/**
+ * Storage types for trace samples
+ */
+typedef enum {
+	SAMPLE_DOUBLE,
+	SAMPLE_FLOAT,
+	SAMPLE_INT16,
+	SAMPLE_INT32
+} sample_type_t;
+
+/**
+ * Counters kept by the frame scheduler, see jbplot_set_max_fps()
+ */
+typedef struct jbplot_frame_stats_t {
+	unsigned long frames;    // frames drawn
+	unsigned long refreshes; // calls to jbplot_refresh()
+	unsigned long coalesced; // refreshes merged into a frame already due
+	unsigned long dropped;   // frame slots skipped because a frame overran its budget
+	unsigned long drafts;    // frames drawn as drafts
+	unsigned long refined;   // progressive frames brought up to full quality
+	unsigned long abandoned; // progressive frames given up for a newer one
+	unsigned long cached;    // frames copied from the frame cache
+	unsigned long tiled;     // pan frames laid out from tiles
+	unsigned long previewed; // wheel-zoom frames scaled from the one before
+	double last_frame_ms;    // how long the last frame took to draw
+} jbplot_frame_stats_t;
+
 typedef struct _jbplot		jbplot;
 typedef struct _jbplotClass	jbplotClass;
 
@@ -173,15 +210,51 @@ int jbplot_trace_resize(trace_handle th, int new_size);
 int jbplot_add_trace(jbplot *plot, trace_handle th);
 int jbplot_remove_trace(jbplot *plot, trace_handle th);
 trace_handle jbplot_create_trace(int capacity);
+/* The k-th sample added to a uniform trace sits at x = x0 + k * dx; no x
+ * values are stored, the x passed to jbplot_trace_add_point() is ignored
+ * and jbplot_trace_get_data() gives a NULL x. */
+trace_handle jbplot_create_uniform_trace(double x0, double dx, int capacity);
+/* Compact storage: float, int16 or int32 samples read back as
+ * gain * stored + offset (see the scaling functions below).  Integer
+ * samples saturate, and NaN is kept as the most negative value.
+ * jbplot_trace_get_data() fails unless both columns are contiguous,
+ * unscaled doubles, so it also fails for strided traces. */
+trace_handle jbplot_create_trace_with_types(int capacity, sample_type_t x_type, sample_type_t y_type);
+trace_handle jbplot_create_uniform_trace_with_type(double x0, double dx, int capacity, sample_type_t y_type);
+/* The x gain must be positive, so that increasing samples stay increasing. */
+int jbplot_trace_set_x_scaling(trace_handle th, double gain, double offset);
+int jbplot_trace_set_y_scaling(trace_handle th, double gain, double offset);
 void jbplot_destroy_trace(trace_handle th);
 int jbplot_trace_set_data(trace_handle th, double *x_start, double *y_start, int length);
 int jbplot_trace_get_data(trace_handle th, double **x, double **y, int *length);
 int jbplot_trace_set_decimation(trace_handle th, int divisor);
 
+/* The extremes of external data are taken when the data is handed over;
+ * call jbplot_trace_data_changed() after modifying it in place. */
 trace_handle jbplot_create_trace_with_external_data(double *x, double *y, int length, int capacity);
+/* Zero-copy view of two fields of an interleaved record buffer; fields
+ * must be naturally aligned.  Call jbplot_trace_data_changed() after the
+ * buffer is written. */
+trace_handle jbplot_create_trace_with_strided_data(void *base, int stride, sample_type_t x_type, int x_offset, sample_type_t y_type, int y_offset, int length, int capacity);
+int jbplot_trace_data_changed(trace_handle th, int first, int last);
 int jbplot_trace_add_point(trace_handle th, double x, double y);
+int jbplot_trace_add_points(trace_handle th, double *x, double *y, int n);
+/* Lock-free producer path: after jbplot_trace_enable_feed(), a single
+ * acquisition thread may call jbplot_trace_feed_points() while the GTK
+ * thread draws; samples reach the trace at the start of the next frame
+ * (or on jbplot_trace_drain_feed()).  Feeding doesn't queue that frame:
+ * the GTK thread still has to call jbplot_refresh(), from a timeout for
+ * instance.  The ring holds size samples rounded up to a power of two.
+ * Stop the producer before destroying the trace. */
+int jbplot_trace_enable_feed(trace_handle th, int size);
+int jbplot_trace_feed_points(trace_handle th, double *x, double *y, int n);
+int jbplot_trace_drain_feed(trace_handle th);
 int jbplot_trace_set_line_props(trace_handle th, line_type_t type, double width, rgb_color_t *color);
 int jbplot_trace_set_marker_props(trace_handle th, marker_type_t type, double size, rgb_color_t *color);
+/* In density mode every sample is counted, whatever the decimation, and
+ * the counts are kept between frames while the axes and plot area stay
+ * put.  The Xlib renderer shades against the plot area color. */
+int jbplot_trace_set_density_mode(trace_handle th, density_mode_t mode);
 int jbplot_trace_set_name(trace_handle th, char *name);
 char *jbplot_trace_get_name(trace_handle th);
 int jbplot_trace_clear_data(trace_handle th);
@@ -204,6 +277,91 @@ int jbplot_capture_svg(jbplot *plot, char *filename);
 void jbplot_refresh(jbplot *plot);
 int jbplot_set_antialias(jbplot *plot, gboolean state);
 
+/* Scroll mode, for strip charts: when the x range only moves right by a
+ * few pixels and the traces were only appended to, the data already on
+ * screen is shifted over and only the newly exposed columns are drawn.
+ * Trace positions may be off by up to half a pixel until the next full
+ * redraw (any zoom, y rescale, or trace edit). */
+int jbplot_set_scroll_mode(jbplot *plot, gboolean state);
+
+/* Draws the traces on num_threads threads (the calling one included)
+ * rather than one; 0 or 1 turns this off.  Runs of traces, or column
+ * bands of a single large trace, are drawn into separate layers that are
+ * then laid over the plot in order, so with antialiasing off the result
+ * is the same pixel for pixel.
+ *
+ * Only the cairo renderer is threaded.  In the default build
+ * (DRAW_WITH_XLIB) the widget's own frames are drawn by the X server and
+ * this speeds up just jbplot_capture_png() and the binning of large
+ * density traces; it is for builds without DRAW_WITH_XLIB that it
+ * threads every frame. */
+int jbplot_set_render_threads(jbplot *plot, int num_threads);
+
+/* Paces the redraws jbplot_refresh() asks for.  Any number of refreshes
+ * between two frames are merged into one, drawn no sooner than 1/max_fps
+ * after the last frame started.  A frame that takes longer than
+ * budget_ms pushes the next one back by the frame slots it ran into,
+ * which are counted as dropped.  Frames are started from the main loop
+ * below the priority of input events, so input is always handled in
+ * between.  A max_fps of 0 redraws on every refresh.  The default is
+ * 60 fps with a 16 ms budget. */
+int jbplot_set_max_fps(jbplot *plot, double max_fps, double budget_ms);
+void jbplot_get_frame_stats(jbplot *plot, jbplot_frame_stats_t *stats);
+void jbplot_reset_frame_stats(jbplot *plot);
+
+/* While the view is being panned or wheel-zoomed, draws drafts: pyramid
+ * levels a few times coarser than a pixel, no antialiasing, markers only
+ * on traces without lines, and the raw samples thinned out to what fits
+ * the frame budget.  A full quality frame follows once the view has been
+ * still for settle_ms.  On by default, settling after 200 ms. */
+int jbplot_set_interactive_quality(jbplot *plot, gboolean state, int settle_ms);
+
+/* Frames with more samples than several drafts' worth are drawn
+ * progressively: a draft goes on screen at once, and the full quality
+ * frame is drawn from idle callbacks, at most slice_ms (or one piece of
+ * it) at a time, and shown once done.  A new frame, or any change to the
+ * traces, abandons it.  While samples are only being appended, though (a
+ * streaming plot whose axes hold still), the frames asked for wait until
+ * it's shown, and the next one is then refined with the full quality
+ * frame left up meanwhile, not a draft.  Such a plot stays at full
+ * quality and updates at the pace of the refinement rather than that of
+ * jbplot_refresh().  Captures are always drawn in full.  On by default
+ * with 8 ms slices. */
+int jbplot_set_progressive(jbplot *plot, gboolean state, int slice_ms);
+
+/* Draws the full quality frames of jbplot_set_progressive() on a thread of
+ * its own instead of from idle callbacks.  It works from a copy of the
+ * samples in view, so the traces can be changed meanwhile; a change, or a
+ * newer frame, makes it drop the one it's drawing.  Frames whose copy
+ * would be too big are refined on the GTK thread as before.  Cairo
+ * renderer only; off by default. */
+int jbplot_set_render_worker(jbplot *plot, gboolean state);
+
+/* Keeps full quality frames of views shown before, so undoing a zoom,
+ * zooming all or going back and forth between views is a copy rather than
+ * a redraw.  Frames are kept while the traces and everything else they
+ * were drawn from are unchanged, at most max_bytes of them (0 turns the
+ * cache off), dropping the least recently used first.  32 MB by default. */
+int jbplot_set_frame_cache(jbplot *plot, size_t max_bytes);
+
+/* Draws middle-button pans from tiles of the data, 256 pixels square,
+ * drawn at the scale the pan started at and kept until the scale or any
+ * trace changes.  Tiles next to the view are drawn ahead from idle
+ * callbacks, those the pan is heading for first, so most pan frames only
+ * copy tiles over the chrome.  The frame after the pan is drawn as usual.
+ * Plots with density traces pan as before.  On by default. */
+int jbplot_set_pan_tiles(jbplot *plot, gboolean state);
+
+/* Previews wheel zooms by scaling the data of the frame shown when the
+ * wheel started turning over the new axes; the point under the pointer
+ * stays put.  Meanwhile the exact frame is drawn as a progressive
+ * refinement (from idle callbacks, or on the render worker if that's on)
+ * and replaces the preview once it's done.  Each notch starts it over, so
+ * a burst of notches costs about one redraw.  With progressive rendering
+ * off, the exact frame is drawn once the wheel has been still for the
+ * settle time of jbplot_set_interactive_quality().  On by default. */
+int jbplot_set_wheel_preview(jbplot *plot, gboolean state);
+
 G_END_DECLS
 
 #endif
@@ -140,6 +140,7 @@ int main (int argc, char **argv) {
 	color.red = 1.0; color.green = 0.0;	color.blue = 0.0;
 	//jbplot_trace_set_marker_props(t1, MARKER_CIRCLE, 2.0, &color);
 	jbplot_trace_set_marker_props(t1, MARKER_POINT, 2.0, &color);
+	jbplot_trace_set_density_mode(t1, DENSITY_LOG);
 	init_trace_with_data(t1);
 	jbplot_add_trace((jbplot *)plot, t1);
 